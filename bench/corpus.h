@@ -0,0 +1,68 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace NBench {
+    // ranks in [0, n) with P(k) ~ 1 / (k + 1)^s, the word frequencies of a natural text
+    class TZipf {
+    public:
+        TZipf(std::size_t n, double s = 1.0) {
+            Cdf.reserve(n);
+            double sum = 0;
+            for (std::size_t k = 0; k < n; ++k) {
+                sum += 1.0 / std::pow(k + 1, s);
+                Cdf.push_back(sum);
+            }
+            for (auto& value: Cdf) {
+                value /= sum;
+            }
+        }
+
+        template <typename TGenerator>
+        std::size_t operator()(TGenerator& g) {
+            double u = std::uniform_real_distribution<double>(0, 1)(g);
+            return std::lower_bound(Cdf.begin(), Cdf.end(), u) - Cdf.begin();
+        }
+
+    private:
+        std::vector<double> Cdf;
+    };
+
+    // the word of the rank, letters only so the text processor keeps it as one token
+    inline std::string MakeWord(std::size_t rank) {
+        std::string word;
+        do {
+            word.push_back('a' + rank % 26);
+            rank /= 26;
+        } while (rank > 0);
+        return "w" + word;
+    }
+
+    // documents of Zipf distributed words over the vocabulary, the same for the same seed
+    inline std::vector<std::string> MakeCorpus(std::size_t docCount, std::size_t wordsPerDoc, std::size_t vocabularySize, uint64_t seed = 42) {
+        std::mt19937_64 g(seed);
+        TZipf zipf(vocabularySize);
+        std::vector<std::string> docs(docCount);
+        for (auto& doc: docs) {
+            for (std::size_t i = 0; i < wordsPerDoc; ++i) {
+                if (i > 0) doc += ' ';
+                doc += MakeWord(zipf(g));
+            }
+        }
+        return docs;
+    }
+
+    // empty directory of the benchmark under the temporary directory
+    inline std::filesystem::path MakeStorage(const std::string& name) {
+        auto path = std::filesystem::temp_directory_path() / "search_bench" / name;
+        std::filesystem::remove_all(path);
+        std::filesystem::create_directories(path);
+        return path;
+    }
+}
@@ -0,0 +1,103 @@
+#include <benchmark/benchmark.h>
+
+#include <random>
+
+#include "../inverted_index/inverted_index.h"
+#include "../inverted_index/text_processor.h"
+#include "corpus.h"
+
+namespace {
+    const std::size_t VOCABULARY_SIZE = 5'000;
+    const std::size_t WORDS_PER_DOC = 200;
+}
+
+static void BM_TextProcessorProcess(benchmark::State& state) {
+    auto corpus = NBench::MakeCorpus(64, WORDS_PER_DOC, VOCABULARY_SIZE);
+    TTextProcessor processor;
+    TTextProcessor::TOpts opts(state.range(0), true, true);
+
+    std::size_t bytes = 0;
+    for (auto _: state) {
+        for (const auto& doc: corpus) {
+            benchmark::DoNotOptimize(processor.Process(doc, opts));
+            bytes += doc.size();
+        }
+    }
+    state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_TextProcessorProcess)->Arg(0)->Arg(1)->ArgName("ngrams");
+
+static void BM_InvertedIndexBulkLoad(benchmark::State& state) {
+    auto corpus = NBench::MakeCorpus(128, WORDS_PER_DOC, VOCABULARY_SIZE);
+    std::vector<TDocument> docs;
+    for (std::size_t i = 0; i < corpus.size(); ++i) {
+        docs.push_back(TDocument{.ID = i, .Text = corpus[i]});
+    }
+
+    for (auto _: state) {
+        state.PauseTiming();
+        auto path = NBench::MakeStorage("inverted_index_bulk_load");
+        state.ResumeTiming();
+
+        TInvertedIndex<128> index(path);
+        index.AddDocuments(docs);
+    }
+    state.SetItemsProcessed(state.iterations() * docs.size());
+}
+BENCHMARK(BM_InvertedIndexBulkLoad)->Unit(benchmark::kMillisecond);
+
+// the words of the ranks: frequent, middle and rare ones
+static void BM_BooleanQuery(benchmark::State& state) {
+    auto corpus = NBench::MakeCorpus(128, WORDS_PER_DOC, VOCABULARY_SIZE);
+    TInvertedIndex<128> index(NBench::MakeStorage("boolean_query"));
+    for (std::size_t i = 0; i < corpus.size(); ++i) {
+        index.AddDocument(TDocument{.ID = i, .Text = corpus[i]});
+    }
+
+    std::vector<std::string> queries = {
+        NBench::MakeWord(0) + " " + NBench::MakeWord(1),
+        NBench::MakeWord(0) + " OR " + NBench::MakeWord(50) + " OR " + NBench::MakeWord(1'000),
+        "(" + NBench::MakeWord(2) + " OR " + NBench::MakeWord(3) + ") AND NOT " + NBench::MakeWord(10),
+        "\"" + NBench::MakeWord(0) + " " + NBench::MakeWord(1) + "\"~3",
+    };
+    const auto& query = queries[state.range(0)];
+    state.SetLabel(query);
+
+    for (auto _: state) {
+        benchmark::DoNotOptimize(index.FindDocsByQuery(query));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_BooleanQuery)->DenseRange(0, 3);
+
+// range(0) == 0 for TInvertedDateIntervalIndex, 1 for TSortedEndpointIntervalIndex,
+// range(1) is the width of the queried interval
+static void BM_IntervalQuery(benchmark::State& state) {
+    const std::size_t docCount = 100'000;
+    const uint64_t timeRange = 10'000'000;
+
+    std::unique_ptr<IIntervalIndex> index;
+    if (state.range(0) == 0) {
+        index = std::make_unique<TInvertedDateIntervalIndex>();
+    } else {
+        index = std::make_unique<TSortedEndpointIntervalIndex>(NBench::MakeStorage("interval_query"));
+    }
+
+    std::mt19937_64 g(19);
+    for (uint32_t docID = 0; docID < docCount; ++docID) {
+        uint64_t begin = g() % timeRange;
+        // mostly short intervals with a few long ones
+        uint64_t length = docID % 100 == 0 ? g() % (timeRange / 10) : g() % 1'000;
+        index->AddInterval(docID, begin, begin + length);
+    }
+
+    uint64_t width = state.range(1);
+    std::size_t found = 0;
+    for (auto _: state) {
+        uint64_t begin = g() % timeRange;
+        found += index->FindDocsByInterval(begin, begin + width).Cardinality();
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["docs_per_query"] = static_cast<double>(found) / state.iterations();
+}
+BENCHMARK(BM_IntervalQuery)->ArgsProduct({{0, 1}, {1, 10'000, 1'000'000}})->ArgNames({"sorted", "width"});
@@ -0,0 +1,198 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <memory>
+#include <random>
+
+#include "../lsm/lsm.h"
+#include "corpus.h"
+
+namespace {
+    using TTree = TLSMTree<uint64_t, uint64_t>;
+
+    // even keys in [0, 2 * count), so the odd ones miss
+    void Fill(TTree& tree, std::size_t count) {
+        std::mt19937_64 g(7);
+        std::vector<uint64_t> keys(count);
+        for (std::size_t i = 0; i < count; ++i) {
+            keys[i] = 2 * i;
+        }
+        std::shuffle(keys.begin(), keys.end(), g);
+        for (auto key: keys) {
+            tree.Insert(key, key);
+        }
+        tree.Flush();
+    }
+}
+
+static void BM_LSMInsert(benchmark::State& state) {
+    std::size_t count = state.range(0);
+    for (auto _: state) {
+        state.PauseTiming();
+        auto path = NBench::MakeStorage("lsm_insert");
+        state.ResumeTiming();
+
+        TTree tree(path);
+        for (uint64_t key = 0; key < count; ++key) {
+            tree.Insert(key * 0x9E3779B97F4A7C15ull, key);
+        }
+        tree.Flush();
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_LSMInsert)->Arg(10'240)->Arg(102'400)->Unit(benchmark::kMillisecond);
+
+static void BM_LSMBulkInsert(benchmark::State& state) {
+    std::size_t count = state.range(0);
+    std::vector<TTree::TEntry> entries;
+    for (uint64_t key = 0; key < count; ++key) {
+        entries.emplace_back(key * 0x9E3779B97F4A7C15ull, key);
+    }
+
+    for (auto _: state) {
+        state.PauseTiming();
+        auto path = NBench::MakeStorage("lsm_bulk_insert");
+        state.ResumeTiming();
+
+        TTree tree(path);
+        tree.BulkInsert(entries);
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_LSMBulkInsert)->Arg(102'400)->Unit(benchmark::kMillisecond);
+
+// range(1) == 1 for the present keys, 0 for the absent ones
+static void BM_LSMReadPoint(benchmark::State& state) {
+    std::size_t count = state.range(0);
+    bool hit = state.range(1);
+    TTree tree(NBench::MakeStorage("lsm_read_point"));
+    Fill(tree, count);
+
+    std::mt19937_64 g(11);
+    for (auto _: state) {
+        uint64_t key = 2 * (g() % count) + (hit ? 0 : 1);
+        benchmark::DoNotOptimize(tree.ReadPoint(key));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LSMReadPoint)->ArgsProduct({{100'000}, {0, 1}})->ArgNames({"keys", "hit"});
+
+// range(0) keys per batch, range(1) == 1 for io_uring, 0 for pread
+static void BM_LSMMultiGet(benchmark::State& state) {
+    std::size_t count = 100'000;
+    std::size_t batch = state.range(0);
+    auto backend = state.range(1) ? NAsyncIO::EBackend::EIOURing : NAsyncIO::EBackend::EPRead;
+    TTree tree(NBench::MakeStorage("lsm_multi_get"));
+    Fill(tree, count);
+
+    std::unique_ptr<NAsyncIO::IReader> ioReader;
+    try {
+        ioReader = NAsyncIO::MakeReader(NAsyncIO::THREAD_READER_CAPACITY, backend);
+    } catch (const std::exception& e) {
+        state.SkipWithError(e.what());
+        return;
+    }
+
+    std::mt19937_64 g(17);
+    std::vector<uint64_t> keys(batch);
+    for (auto _: state) {
+        for (auto& key: keys) {
+            key = 2 * (g() % count);
+        }
+        TTree::TAsyncReader reader(tree, *ioReader);
+        for (auto key: keys) {
+            reader.ReadPointAsync(key, [](std::optional<std::pair<uint64_t, uint64_t>> entry) { benchmark::DoNotOptimize(entry); });
+        }
+        reader.Drain();
+    }
+    state.SetItemsProcessed(state.iterations() * batch);
+}
+BENCHMARK(BM_LSMMultiGet)->ArgsProduct({{1, 64}, {0, 1}})->ArgNames({"batch", "io_uring"});
+
+static void BM_LSMReadRange(benchmark::State& state) {
+    std::size_t count = 100'000;
+    uint64_t width = state.range(0);
+    TTree tree(NBench::MakeStorage("lsm_read_range"));
+    Fill(tree, count);
+
+    std::mt19937_64 g(13);
+    std::size_t entries = 0;
+    for (auto _: state) {
+        uint64_t from = g() % (2 * count);
+        auto range = tree.ReadRanges(from, from + width);
+        entries += range.size();
+        benchmark::DoNotOptimize(range);
+    }
+    state.SetItemsProcessed(entries);
+}
+BENCHMARK(BM_LSMReadRange)->Arg(16)->Arg(1'024)->Arg(65'536);
+
+// the flush of a full memtable into a tree of range(0) entries, including the compaction it triggers
+static void BM_LSMCompaction(benchmark::State& state) {
+    std::size_t count = state.range(0);
+    std::size_t memTableSize = TMemTable<uint64_t, uint64_t>::MAX_SIZE;
+    for (auto _: state) {
+        state.PauseTiming();
+        auto path = NBench::MakeStorage("lsm_compaction");
+        auto tree = std::make_unique<TTree>(path);
+        Fill(*tree, count);
+        for (uint64_t key = 0; key + 1 < memTableSize; ++key) {
+            tree->Insert(2 * key + 1, key);
+        }
+        state.ResumeTiming();
+
+        tree->Insert(2 * memTableSize + 1, 0);
+
+        state.PauseTiming();
+        tree.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * (count + memTableSize));
+}
+BENCHMARK(BM_LSMCompaction)->Arg(30'720)->Arg(102'400)->Unit(benchmark::kMillisecond);
+
+// a bulk insert of range(0) / 2 entries merged into a table of range(0) in range(1) parallel subcompactions
+static void BM_LSMSubcompaction(benchmark::State& state) {
+    std::size_t count = state.range(0);
+    std::vector<TTree::TEntry> even, odd;
+    for (uint64_t key = 0; key < count; ++key) {
+        even.emplace_back(2 * key, key);
+    }
+    for (uint64_t key = 0; key < count / 2; ++key) {
+        odd.emplace_back(4 * key + 1, key);
+    }
+
+    for (auto _: state) {
+        state.PauseTiming();
+        auto tree = std::make_unique<TTree>(NBench::MakeStorage("lsm_subcompaction"));
+        tree->SetMaxSubcompactions(state.range(1));
+        tree->BulkInsert(even);
+        state.ResumeTiming();
+
+        tree->BulkInsert(odd);
+
+        state.PauseTiming();
+        tree.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * (count + count / 2));
+}
+BENCHMARK(BM_LSMSubcompaction)->ArgsProduct({{2'097'152}, {1, 2, 4, 8}})->ArgNames({"entries", "subcompactions"})->Unit(benchmark::kMillisecond)->UseRealTime();
+
+static void BM_BloomFilterProbe(benchmark::State& state) {
+    std::size_t count = state.range(0);
+    NSSTable::TBloomFilter<uint64_t> filter(count * 5);
+    for (uint64_t key = 0; key < count; ++key) {
+        filter.Count(2 * key);
+    }
+
+    std::mt19937_64 g(17);
+    std::size_t positives = 0;
+    for (auto _: state) {
+        positives += filter.Probe(g() % (2 * count));
+    }
+    state.SetItemsProcessed(state.iterations());
+    // half of the probes are absent keys, the rest above a half are the false positives
+    state.counters["positive_rate"] = static_cast<double>(positives) / state.iterations();
+}
+BENCHMARK(BM_BloomFilterProbe)->Arg(10'240)->Arg(1'000'000);
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <algorithm>
+#include <bitset>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Automata walked along the term trie. Each of them provides
+//   TState Start() const
+//   void Step(const TState& from, char c, TState& to) const
+//   bool IsMatch(const TState&) const
+//   bool CanMatch(const TState&) const - false if no continuation can match, the trie subtree is skipped
+namespace NAutomata {
+    // Thompson NFA of the pattern, which has to match the whole term. Supports
+    // literals, '.', [a-z] / [^a-z] classes, '\' escapes, groups, '|', '*', '+' and '?'.
+    class TRegex {
+    public:
+        // sorted NFA state indices, closed by the epsilon transitions
+        using TState = std::vector<uint32_t>;
+
+    public:
+        explicit TRegex(std::string_view pattern)
+            : Pattern(pattern)
+        {
+            auto fragment = ParseAlternation();
+            if (Pos != Pattern.size()) {
+                Fail("unexpected symbol");
+            }
+            Start_ = fragment.Start;
+            Accept = fragment.End;
+        }
+
+        TState Start() const {
+            TState state{Start_};
+            Close(state);
+            return state;
+        }
+
+        void Step(const TState& from, char c, TState& to) const {
+            to.clear();
+            for (auto idx: from) {
+                const auto& state = States[idx];
+                if (state.Next != NONE && state.Chars.test(static_cast<unsigned char>(c))) {
+                    to.push_back(state.Next);
+                }
+            }
+            Close(to);
+        }
+
+        bool IsMatch(const TState& state) const {
+            return std::binary_search(state.begin(), state.end(), Accept);
+        }
+
+        bool CanMatch(const TState& state) const {
+            return !state.empty();
+        }
+
+    private:
+        static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+        struct TNFAState {
+            // the symbol transition goes to Next on the Chars
+            std::bitset<256> Chars;
+            uint32_t Next = NONE;
+            std::vector<uint32_t> Epsilon;
+        };
+
+        struct TFragment {
+            uint32_t Start;
+            uint32_t End;
+        };
+
+        uint32_t NewState() {
+            States.emplace_back();
+            return States.size() - 1;
+        }
+
+        TFragment ParseAlternation() {
+            auto fragment = ParseConcatenation();
+            while (Pos < Pattern.size() && Pattern[Pos] == '|') {
+                ++Pos;
+                auto other = ParseConcatenation();
+                uint32_t start = NewState();
+                uint32_t end = NewState();
+                States[start].Epsilon = {fragment.Start, other.Start};
+                States[fragment.End].Epsilon.push_back(end);
+                States[other.End].Epsilon.push_back(end);
+                fragment = {start, end};
+            }
+            return fragment;
+        }
+
+        TFragment ParseConcatenation() {
+            uint32_t start = NewState();
+            TFragment fragment{start, start};
+            while (Pos < Pattern.size() && Pattern[Pos] != '|' && Pattern[Pos] != ')') {
+                auto next = ParseRepetition();
+                States[fragment.End].Epsilon.push_back(next.Start);
+                fragment.End = next.End;
+            }
+            return fragment;
+        }
+
+        TFragment ParseRepetition() {
+            auto fragment = ParseAtom();
+            while (Pos < Pattern.size() && (Pattern[Pos] == '*' || Pattern[Pos] == '+' || Pattern[Pos] == '?')) {
+                char op = Pattern[Pos++];
+                uint32_t start = NewState();
+                uint32_t end = NewState();
+                States[start].Epsilon.push_back(fragment.Start);
+                if (op != '+') {
+                    States[start].Epsilon.push_back(end);
+                }
+                if (op != '?') {
+                    States[fragment.End].Epsilon.push_back(fragment.Start);
+                }
+                States[fragment.End].Epsilon.push_back(end);
+                fragment = {start, end};
+            }
+            return fragment;
+        }
+
+        TFragment ParseAtom() {
+            if (Pos == Pattern.size()) {
+                Fail("operand expected");
+            }
+
+            char c = Pattern[Pos++];
+            if (c == '(') {
+                auto fragment = ParseAlternation();
+                if (Pos == Pattern.size() || Pattern[Pos] != ')') {
+                    Fail("')' expected");
+                }
+                ++Pos;
+                return fragment;
+            }
+
+            std::bitset<256> chars;
+            if (c == '.') {
+                chars.set();
+            } else if (c == '[') {
+                chars = ParseClass();
+            } else if (c == '\\') {
+                if (Pos == Pattern.size()) {
+                    Fail("escaped symbol expected");
+                }
+                chars.set(static_cast<unsigned char>(Pattern[Pos++]));
+            } else if (c == '*' || c == '+' || c == '?') {
+                --Pos;
+                Fail("nothing to repeat");
+            } else {
+                chars.set(static_cast<unsigned char>(c));
+            }
+
+            uint32_t start = NewState();
+            uint32_t end = NewState();
+            States[start].Chars = chars;
+            States[start].Next = end;
+            return {start, end};
+        }
+
+        std::bitset<256> ParseClass() {
+            std::bitset<256> chars;
+            bool negated = Pos < Pattern.size() && Pattern[Pos] == '^';
+            if (negated) {
+                ++Pos;
+            }
+
+            bool first = true;
+            while (Pos < Pattern.size() && (Pattern[Pos] != ']' || first)) {
+                unsigned char from = Pattern[Pos++];
+                unsigned char to = from;
+                if (Pos + 1 < Pattern.size() && Pattern[Pos] == '-' && Pattern[Pos + 1] != ']') {
+                    to = Pattern[Pos + 1];
+                    Pos += 2;
+                }
+                for (unsigned c = from; c <= to; ++c) {
+                    chars.set(c);
+                }
+                first = false;
+            }
+            if (Pos == Pattern.size()) {
+                Fail("']' expected");
+            }
+            ++Pos;
+
+            return negated ? ~chars : chars;
+        }
+
+        void Close(TState& state) const {
+            std::vector<bool> visited(States.size(), false);
+            std::vector<uint32_t> stack(state.begin(), state.end());
+            state.clear();
+            while (!stack.empty()) {
+                auto idx = stack.back();
+                stack.pop_back();
+                if (visited[idx]) {
+                    continue;
+                }
+                visited[idx] = true;
+                state.push_back(idx);
+                for (auto next: States[idx].Epsilon) {
+                    stack.push_back(next);
+                }
+            }
+            std::sort(state.begin(), state.end());
+        }
+
+        [[noreturn]] void Fail(const std::string& message) const {
+            throw std::runtime_error("regex parse error at " + std::to_string(Pos) + ": " + message + ".");
+        }
+
+    private:
+        std::string Pattern;
+        std::size_t Pos = 0;
+        std::vector<TNFAState> States;
+        uint32_t Start_ = 0;
+        uint32_t Accept = 0;
+    };
+
+    // Terms within the edit distance of the word: the state is the row of the
+    // Levenshtein matrix for the term prefix walked so far.
+    class TLevenshtein {
+    public:
+        using TState = std::vector<uint32_t>;
+
+    public:
+        TLevenshtein(std::string_view word, uint32_t maxDistance)
+            : Word(word)
+            , MaxDistance(maxDistance)
+        {}
+
+        TState Start() const {
+            TState row(Word.size() + 1);
+            for (std::size_t i = 0; i < row.size(); ++i) {
+                row[i] = i;
+            }
+            return row;
+        }
+
+        void Step(const TState& from, char c, TState& to) const {
+            to.resize(from.size());
+            to[0] = from[0] + 1;
+            for (std::size_t i = 1; i < from.size(); ++i) {
+                uint32_t replace = from[i - 1] + (Word[i - 1] == c ? 0 : 1);
+                to[i] = std::min({to[i - 1] + 1, from[i] + 1, replace});
+            }
+        }
+
+        bool IsMatch(const TState& state) const {
+            return state.back() <= MaxDistance;
+        }
+
+        bool CanMatch(const TState& state) const {
+            return *std::min_element(state.begin(), state.end()) <= MaxDistance;
+        }
+
+    private:
+        std::string Word;
+        uint32_t MaxDistance;
+    };
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <vector>
+
+#include "bitmap.h"
+
+// Bit-sliced index of a 64 bit attribute: Slices[i] holds the documents with the
+// bit i set. The comparisons follow O'Neil & Quass "Improved query performance
+// with variant indexes": one pass from the highest slice keeps the documents
+// equal to the constant so far and moves the rest to "less" or "greater".
+class TBitSlicedIndex {
+public:
+    // replaces the value of the document, if it was set before
+    void Set(uint32_t docID, uint64_t value) {
+        if (Existence.Contains(docID)) {
+            Remove(docID);
+        }
+
+        Existence.Add(docID);
+        std::size_t width = std::bit_width(value);
+        if (Slices.size() < width) {
+            Slices.resize(width);
+        }
+        for (std::size_t i = 0; i < width; ++i) {
+            if ((value >> i) & 1) {
+                Slices[i].Add(docID);
+            }
+        }
+    }
+
+    void Remove(uint32_t docID) {
+        Existence.Remove(docID);
+        for (auto& slice: Slices) {
+            slice.Remove(docID);
+        }
+    }
+
+    std::optional<uint64_t> Get(uint32_t docID) const {
+        if (!Existence.Contains(docID)) {
+            return std::nullopt;
+        }
+        uint64_t value = 0;
+        for (std::size_t i = 0; i < Slices.size(); ++i) {
+            if (Slices[i].Contains(docID)) {
+                value |= 1ull << i;
+            }
+        }
+        return value;
+    }
+
+    // documents with the value in [from, to]
+    TBitmap Between(uint64_t from, uint64_t to) const {
+        if (from > to) {
+            return TBitmap();
+        }
+        if (static_cast<std::size_t>(std::bit_width(from)) > Slices.size()) {
+            return TBitmap();
+        }
+        if (static_cast<std::size_t>(std::bit_width(to)) > Slices.size()) {
+            return GreaterOrEqual(from);
+        }
+
+        // both bounds are compared in the same pass over the slices
+        TComparison lower{.Equal = Existence};
+        TComparison upper{.Equal = Existence};
+        for (std::size_t i = Slices.size(); i-- > 0;) {
+            if (!lower.Equal.Empty()) {
+                Step(lower, (from >> i) & 1, Slices[i]);
+            }
+            if (!upper.Equal.Empty()) {
+                Step(upper, (to >> i) & 1, Slices[i]);
+            }
+        }
+        return lower.Greater.Or(lower.Equal).And(upper.Less.Or(upper.Equal));
+    }
+
+    TBitmap LessOrEqual(uint64_t value) const {
+        auto comparison = Compare(value);
+        return comparison.Less.Or(comparison.Equal);
+    }
+
+    TBitmap GreaterOrEqual(uint64_t value) const {
+        auto comparison = Compare(value);
+        return comparison.Greater.Or(comparison.Equal);
+    }
+
+    TBitmap Equal(uint64_t value) const {
+        return Compare(value).Equal;
+    }
+
+    const TBitmap& GetExistence() const {
+        return Existence;
+    }
+
+    std::size_t GetSliceCount() const {
+        return Slices.size();
+    }
+
+private:
+    struct TComparison {
+        TBitmap Less;
+        TBitmap Equal;
+        TBitmap Greater;
+    };
+
+    TComparison Compare(uint64_t value) const {
+        TComparison comparison{.Equal = Existence};
+        // the documents have no bits above the slices, so a wider constant is greater than all of them
+        if (static_cast<std::size_t>(std::bit_width(value)) > Slices.size()) {
+            comparison.Less = std::move(comparison.Equal);
+            comparison.Equal = TBitmap();
+            return comparison;
+        }
+
+        for (std::size_t i = Slices.size(); i-- > 0 && !comparison.Equal.Empty();) {
+            Step(comparison, (value >> i) & 1, Slices[i]);
+        }
+        return comparison;
+    }
+
+    // the documents equal so far split by the slice of the next bit
+    static void Step(TComparison& comparison, bool bit, const TBitmap& slice) {
+        TBitmap split = comparison.Equal;
+        if (bit) {
+            comparison.Less.Or(split.AndNot(slice));
+            comparison.Equal.And(slice);
+        } else {
+            comparison.Greater.Or(split.And(slice));
+            comparison.Equal.AndNot(slice);
+        }
+    }
+
+private:
+    TBitmap Existence;
+    std::vector<TBitmap> Slices;
+};
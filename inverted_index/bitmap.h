@@ -0,0 +1,340 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+// Compressed set of 32 bit document IDs in the roaring layout: the IDs are grouped
+// by the high 16 bits, a sparse group keeps the sorted low bits, a dense one keeps
+// the 65536 bit bitmap. The memory is proportional to the documents, not to the
+// largest ID, so the bitmap works for any collection size.
+class TBitmap {
+public:
+    // groups with more IDs are stored as bitmaps
+    const static std::size_t ARRAY_MAX_SIZE = 4'096ull;
+
+public:
+    TBitmap() = default;
+
+    void Add(uint32_t id) {
+        auto& container = GetOrCreate(id >> 16);
+        uint16_t low = id & 0xFFFF;
+
+        if (container.IsBitmap()) {
+            uint64_t& word = container.Bits[low >> 6];
+            uint64_t mask = 1ull << (low & 63);
+            container.Cardinality += (word & mask) ? 0 : 1;
+            word |= mask;
+            return;
+        }
+
+        auto it = std::lower_bound(container.Array.begin(), container.Array.end(), low);
+        if (it != container.Array.end() && *it == low) {
+            return;
+        }
+        container.Array.insert(it, low);
+        ++container.Cardinality;
+        if (container.Cardinality > ARRAY_MAX_SIZE) {
+            container.ToBitmap();
+        }
+    }
+
+    void Remove(uint32_t id) {
+        auto it = Find(id >> 16);
+        if (it == Containers.end()) {
+            return;
+        }
+
+        uint16_t low = id & 0xFFFF;
+        if (it->IsBitmap()) {
+            uint64_t& word = it->Bits[low >> 6];
+            uint64_t mask = 1ull << (low & 63);
+            it->Cardinality -= (word & mask) ? 1 : 0;
+            word &= ~mask;
+        } else {
+            auto pos = std::lower_bound(it->Array.begin(), it->Array.end(), low);
+            if (pos == it->Array.end() || *pos != low) {
+                return;
+            }
+            it->Array.erase(pos);
+            --it->Cardinality;
+        }
+
+        if (it->Cardinality == 0) {
+            Containers.erase(it);
+        } else {
+            it->Normalize();
+        }
+    }
+
+    bool Contains(uint32_t id) const {
+        auto it = std::lower_bound(Containers.begin(), Containers.end(), id >> 16, [](const TContainer& container, uint32_t key) { return container.Key < key; });
+        if (it == Containers.end() || it->Key != (id >> 16)) {
+            return false;
+        }
+        return it->Contains(id & 0xFFFF);
+    }
+
+    bool HasDoc(std::size_t id) const {
+        return Contains(id);
+    }
+
+    std::size_t Cardinality() const {
+        std::size_t cardinality = 0;
+        for (const auto& container: Containers) {
+            cardinality += container.Cardinality;
+        }
+        return cardinality;
+    }
+
+    bool Empty() const {
+        return Containers.empty();
+    }
+
+    // onID(id) in the increasing order
+    template <typename TOnID>
+    void ForEach(TOnID&& onID) const {
+        for (const auto& container: Containers) {
+            uint32_t high = static_cast<uint32_t>(container.Key) << 16;
+            if (!container.IsBitmap()) {
+                for (auto low: container.Array) {
+                    onID(high | low);
+                }
+                continue;
+            }
+            for (std::size_t i = 0; i < container.Bits.size(); ++i) {
+                for (uint64_t word = container.Bits[i]; word != 0; word &= word - 1) {
+                    onID(high | (i << 6) | std::countr_zero(word));
+                }
+            }
+        }
+    }
+
+    std::vector<std::size_t> GetIDs() const {
+        std::vector<std::size_t> ids;
+        ids.reserve(Cardinality());
+        ForEach([&ids](uint32_t id) { ids.push_back(id); });
+        return ids;
+    }
+
+    TBitmap& And(const TBitmap& other) {
+        std::vector<TContainer> result;
+        auto lhs = Containers.begin();
+        auto rhs = other.Containers.begin();
+        while (lhs != Containers.end() && rhs != other.Containers.end()) {
+            if (lhs->Key < rhs->Key) {
+                ++lhs;
+            } else if (rhs->Key < lhs->Key) {
+                ++rhs;
+            } else {
+                auto container = TContainer::And(*lhs++, *rhs++);
+                if (container.Cardinality != 0) {
+                    result.push_back(std::move(container));
+                }
+            }
+        }
+        Containers = std::move(result);
+        return *this;
+    }
+
+    TBitmap& Or(const TBitmap& other) {
+        std::vector<TContainer> result;
+        result.reserve(Containers.size() + other.Containers.size());
+        auto lhs = Containers.begin();
+        auto rhs = other.Containers.begin();
+        while (lhs != Containers.end() || rhs != other.Containers.end()) {
+            if (rhs == other.Containers.end() || (lhs != Containers.end() && lhs->Key < rhs->Key)) {
+                result.push_back(std::move(*lhs++));
+            } else if (lhs == Containers.end() || rhs->Key < lhs->Key) {
+                result.push_back(*rhs++);
+            } else {
+                result.push_back(TContainer::Or(*lhs++, *rhs++));
+            }
+        }
+        Containers = std::move(result);
+        return *this;
+    }
+
+    // set difference
+    TBitmap& AndNot(const TBitmap& other) {
+        std::vector<TContainer> result;
+        auto rhs = other.Containers.begin();
+        for (auto& container: Containers) {
+            while (rhs != other.Containers.end() && rhs->Key < container.Key) {
+                ++rhs;
+            }
+            if (rhs == other.Containers.end() || rhs->Key != container.Key) {
+                result.push_back(std::move(container));
+                continue;
+            }
+            auto difference = TContainer::AndNot(container, *rhs);
+            if (difference.Cardinality != 0) {
+                result.push_back(std::move(difference));
+            }
+        }
+        Containers = std::move(result);
+        return *this;
+    }
+
+    bool operator==(const TBitmap& other) const {
+        return GetIDs() == other.GetIDs();
+    }
+
+    // memory used by the containers
+    std::size_t GetByteSize() const {
+        std::size_t size = 0;
+        for (const auto& container: Containers) {
+            size += sizeof(container) + container.Array.size() * sizeof(uint16_t) + container.Bits.size() * sizeof(uint64_t);
+        }
+        return size;
+    }
+
+private:
+    struct TContainer {
+        static constexpr std::size_t WORD_COUNT = 65'536 / 64;
+
+        uint16_t Key = 0;
+        uint32_t Cardinality = 0;
+        // sorted low bits, used while Bits is empty
+        std::vector<uint16_t> Array;
+        std::vector<uint64_t> Bits;
+
+        bool IsBitmap() const {
+            return !Bits.empty();
+        }
+
+        bool Contains(uint16_t low) const {
+            if (IsBitmap()) {
+                return (Bits[low >> 6] >> (low & 63)) & 1;
+            }
+            return std::binary_search(Array.begin(), Array.end(), low);
+        }
+
+        void ToBitmap() {
+            Bits.assign(WORD_COUNT, 0);
+            for (auto low: Array) {
+                Bits[low >> 6] |= 1ull << (low & 63);
+            }
+            Array.clear();
+            Array.shrink_to_fit();
+        }
+
+        void ToArray() {
+            Array.clear();
+            Array.reserve(Cardinality);
+            for (std::size_t i = 0; i < Bits.size(); ++i) {
+                for (uint64_t word = Bits[i]; word != 0; word &= word - 1) {
+                    Array.push_back((i << 6) | std::countr_zero(word));
+                }
+            }
+            Bits.clear();
+            Bits.shrink_to_fit();
+        }
+
+        // picks the smaller representation for the cardinality
+        void Normalize() {
+            if (IsBitmap() && Cardinality <= ARRAY_MAX_SIZE) {
+                ToArray();
+            } else if (!IsBitmap() && Cardinality > ARRAY_MAX_SIZE) {
+                ToBitmap();
+            }
+        }
+
+        static TContainer And(const TContainer& lhs, const TContainer& rhs) {
+            TContainer result{.Key = lhs.Key};
+            if (!lhs.IsBitmap() || !rhs.IsBitmap()) {
+                const auto& array = lhs.IsBitmap() ? rhs : lhs;
+                const auto& other = lhs.IsBitmap() ? lhs : rhs;
+                if (other.IsBitmap()) {
+                    std::copy_if(array.Array.begin(), array.Array.end(), std::back_inserter(result.Array), [&other](uint16_t low) { return other.Contains(low); });
+                } else {
+                    std::set_intersection(array.Array.begin(), array.Array.end(), other.Array.begin(), other.Array.end(), std::back_inserter(result.Array));
+                }
+                result.Cardinality = result.Array.size();
+                return result;
+            }
+
+            result.Bits.resize(WORD_COUNT);
+            for (std::size_t i = 0; i < WORD_COUNT; ++i) {
+                result.Bits[i] = lhs.Bits[i] & rhs.Bits[i];
+                result.Cardinality += std::popcount(result.Bits[i]);
+            }
+            result.Normalize();
+            return result;
+        }
+
+        static TContainer Or(const TContainer& lhs, const TContainer& rhs) {
+            TContainer result{.Key = lhs.Key};
+            if (!lhs.IsBitmap() && !rhs.IsBitmap()) {
+                std::set_union(lhs.Array.begin(), lhs.Array.end(), rhs.Array.begin(), rhs.Array.end(), std::back_inserter(result.Array));
+                result.Cardinality = result.Array.size();
+                result.Normalize();
+                return result;
+            }
+
+            result.Bits = lhs.IsBitmap() ? lhs.Bits : rhs.Bits;
+            const auto& other = lhs.IsBitmap() ? rhs : lhs;
+            if (other.IsBitmap()) {
+                for (std::size_t i = 0; i < WORD_COUNT; ++i) {
+                    result.Bits[i] |= other.Bits[i];
+                }
+            } else {
+                for (auto low: other.Array) {
+                    result.Bits[low >> 6] |= 1ull << (low & 63);
+                }
+            }
+            for (auto word: result.Bits) {
+                result.Cardinality += std::popcount(word);
+            }
+            return result;
+        }
+
+        static TContainer AndNot(const TContainer& lhs, const TContainer& rhs) {
+            TContainer result{.Key = lhs.Key};
+            if (!lhs.IsBitmap()) {
+                if (rhs.IsBitmap()) {
+                    std::copy_if(lhs.Array.begin(), lhs.Array.end(), std::back_inserter(result.Array), [&rhs](uint16_t low) { return !rhs.Contains(low); });
+                } else {
+                    std::set_difference(lhs.Array.begin(), lhs.Array.end(), rhs.Array.begin(), rhs.Array.end(), std::back_inserter(result.Array));
+                }
+                result.Cardinality = result.Array.size();
+                return result;
+            }
+
+            result.Bits = lhs.Bits;
+            if (rhs.IsBitmap()) {
+                for (std::size_t i = 0; i < WORD_COUNT; ++i) {
+                    result.Bits[i] &= ~rhs.Bits[i];
+                }
+            } else {
+                for (auto low: rhs.Array) {
+                    result.Bits[low >> 6] &= ~(1ull << (low & 63));
+                }
+            }
+            for (auto word: result.Bits) {
+                result.Cardinality += std::popcount(word);
+            }
+            result.Normalize();
+            return result;
+        }
+    };
+
+    std::vector<TContainer>::iterator Find(uint16_t key) {
+        auto it = std::lower_bound(Containers.begin(), Containers.end(), key, [](const TContainer& container, uint16_t key) { return container.Key < key; });
+        return it != Containers.end() && it->Key == key ? it : Containers.end();
+    }
+
+    TContainer& GetOrCreate(uint16_t key) {
+        auto it = std::lower_bound(Containers.begin(), Containers.end(), key, [](const TContainer& container, uint16_t key) { return container.Key < key; });
+        if (it == Containers.end() || it->Key != key) {
+            it = Containers.insert(it, TContainer{.Key = key});
+        }
+        return *it;
+    }
+
+private:
+    // sorted by the key
+    std::vector<TContainer> Containers;
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cassert>
+#include <list>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+
+#include "../lsm/memory.h"
+
+struct TCacheStatistics {
+    std::size_t Hits = 0;
+    std::size_t Misses = 0;
+};
+
+template <typename TKey, typename TValue, typename THash = std::hash<TKey>>
+class TLRUCache {
+public:
+    explicit TLRUCache(std::size_t capacity)
+        : Capacity(capacity)
+    {
+        assert(Capacity > 0);
+    }
+
+    std::optional<TValue> Find(const TKey& key) {
+        auto it = Index.find(key);
+        if (it == Index.end()) {
+            ++Stats.Misses;
+            return std::nullopt;
+        }
+
+        ++Stats.Hits;
+        Entries.splice(Entries.begin(), Entries, it->second);
+        return it->second->second;
+    }
+
+    void Insert(TKey key, TValue value) {
+        if (auto it = Index.find(key); it != Index.end()) {
+            it->second->second = std::move(value);
+            Entries.splice(Entries.begin(), Entries, it->second);
+            return;
+        }
+
+        if (Entries.size() == Capacity) {
+            Index.erase(Entries.back().first);
+            Entries.pop_back();
+        }
+
+        Entries.emplace_front(std::move(key), std::move(value));
+        Index.emplace(Entries.front().first, Entries.begin());
+    }
+
+    void Clear() {
+        Entries.clear();
+        Index.clear();
+    }
+
+    std::size_t Size() const {
+        return Entries.size();
+    }
+
+    const TCacheStatistics& GetStatistics() const {
+        return Stats;
+    }
+
+private:
+    using TEntries = std::list<std::pair<TKey, TValue>, NMemory::TTrackingAllocator<std::pair<TKey, TValue>, NMemory::ECategory::ECache>>;
+    using TIndex = std::unordered_map<
+        TKey,
+        typename TEntries::iterator,
+        THash,
+        std::equal_to<TKey>,
+        NMemory::TTrackingAllocator<std::pair<const TKey, typename TEntries::iterator>, NMemory::ECategory::ECache>
+    >;
+
+    std::size_t Capacity;
+    // the most recently used entry goes first
+    TEntries Entries;
+    TIndex Index;
+    TCacheStatistics Stats;
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// Byte oriented LZ77 for the stored texts. The stream is a sequence of
+//   varint literals count, literals, varint match length, varint match offset
+// and ends right after the literals of the last sequence.
+namespace NCompression {
+    namespace NPrivate {
+        constexpr std::size_t MIN_MATCH = 4;
+        constexpr std::size_t MAX_OFFSET = 65'535;
+        constexpr std::size_t HASH_BITS = 12;
+
+        inline void WriteVarint(std::string& out, uint64_t value) {
+            while (value > 0x7F) {
+                out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+                value >>= 7;
+            }
+            out.push_back(static_cast<char>(value));
+        }
+
+        inline uint64_t ReadVarint(std::string_view in, std::size_t& pos) {
+            uint64_t value = 0;
+            for (std::size_t shift = 0;; shift += 7) {
+                if (pos == in.size() || shift > 63) {
+                    throw std::runtime_error("corrupted compressed data.");
+                }
+                uint8_t byte = in[pos++];
+                value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+                if (!(byte & 0x80)) {
+                    return value;
+                }
+            }
+        }
+
+        inline uint32_t Hash(const char* data) {
+            uint32_t word;
+            std::memcpy(&word, data, sizeof(word));
+            return (word * 2654435761u) >> (32 - HASH_BITS);
+        }
+    }
+
+    inline std::string Compress(std::string_view in) {
+        using namespace NPrivate;
+
+        std::string out;
+        out.reserve(in.size() / 2 + 16);
+        std::array<int64_t, 1 << HASH_BITS> lastPos;
+        lastPos.fill(-1);
+
+        std::size_t anchor = 0;
+        std::size_t pos = 0;
+        while (pos + MIN_MATCH <= in.size()) {
+            uint32_t hash = Hash(in.data() + pos);
+            int64_t candidate = lastPos[hash];
+            lastPos[hash] = pos;
+
+            if (candidate < 0 || pos - candidate > MAX_OFFSET || std::memcmp(in.data() + candidate, in.data() + pos, MIN_MATCH) != 0) {
+                ++pos;
+                continue;
+            }
+
+            std::size_t length = MIN_MATCH;
+            while (pos + length < in.size() && in[candidate + length] == in[pos + length]) {
+                ++length;
+            }
+
+            WriteVarint(out, pos - anchor);
+            out.append(in.substr(anchor, pos - anchor));
+            WriteVarint(out, length);
+            WriteVarint(out, pos - candidate);
+
+            // a couple of positions inside the match keep the table fresh without hashing every byte
+            for (std::size_t i = pos + 1; i < pos + length && i + MIN_MATCH <= in.size(); i += length / 4 + 1) {
+                lastPos[Hash(in.data() + i)] = i;
+            }
+            pos += length;
+            anchor = pos;
+        }
+
+        WriteVarint(out, in.size() - anchor);
+        out.append(in.substr(anchor));
+        return out;
+    }
+
+    inline std::string Decompress(std::string_view in, std::size_t rawSize) {
+        using namespace NPrivate;
+
+        std::string out;
+        out.reserve(rawSize);
+        std::size_t pos = 0;
+        while (true) {
+            auto literals = ReadVarint(in, pos);
+            if (literals > in.size() - pos) {
+                throw std::runtime_error("corrupted compressed data.");
+            }
+            out.append(in.substr(pos, literals));
+            pos += literals;
+            if (pos == in.size()) {
+                break;
+            }
+
+            auto length = ReadVarint(in, pos);
+            auto offset = ReadVarint(in, pos);
+            if (offset == 0 || offset > out.size()) {
+                throw std::runtime_error("corrupted compressed data.");
+            }
+            // the match may overlap the bytes it produces
+            std::size_t from = out.size() - offset;
+            for (std::size_t i = 0; i < length; ++i) {
+                out.push_back(out[from + i]);
+            }
+        }
+
+        if (out.size() != rawSize) {
+            throw std::runtime_error("corrupted compressed data.");
+        }
+        return out;
+    }
+}
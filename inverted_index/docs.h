@@ -23,6 +23,14 @@ public:
         return ID < MaxDocCount && Docs[ID];
     }
 
+    bool Empty() const {
+        return Docs.none();
+    }
+
+    std::size_t Count() const {
+        return Docs.count();
+    }
+
     std::vector<size_t> GetIDs() const {
         std::vector<std::size_t> docs;
 
@@ -53,6 +61,12 @@ public:
         return *this;
     }
 
+    // set difference, the complement of other is never built
+    TDocs<MaxDocCount>& AndNot(const TDocs<MaxDocCount>& other) {
+        Docs ^= Docs & other.Docs;
+        return *this;
+    }
+
     TDocs<MaxDocCount> Not() const {
         return ~Docs;
     }
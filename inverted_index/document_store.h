@@ -0,0 +1,271 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "compression.h"
+
+// Read only mapping of a file, which can be remapped after the file grew.
+class TMappedFile {
+public:
+    TMappedFile() = default;
+
+    ~TMappedFile() {
+        Unmap();
+    }
+
+    TMappedFile(const TMappedFile&) = delete;
+    TMappedFile& operator=(const TMappedFile&) = delete;
+
+    void Map(const std::filesystem::path& path) {
+        Unmap();
+
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("can't open " + path.string() + ".");
+        }
+        struct stat st{};
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("can't stat " + path.string() + ".");
+        }
+
+        if (st.st_size > 0) {
+            void* data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("can't mmap " + path.string() + ".");
+            }
+            Data = static_cast<const char*>(data);
+            Size = st.st_size;
+        }
+        ::close(fd);
+    }
+
+    std::string_view View(std::size_t offset, std::size_t size) const {
+        return std::string_view(Data + offset, size);
+    }
+
+    std::size_t GetSize() const {
+        return Size;
+    }
+
+private:
+    void Unmap() {
+        if (Data) {
+            ::munmap(const_cast<char*>(Data), Size);
+        }
+        Data = nullptr;
+        Size = 0;
+    }
+
+private:
+    const char* Data = nullptr;
+    std::size_t Size = 0;
+};
+
+// On disk store of the document texts. The texts are appended to a block, a full
+// block is compressed and appended to the data file, and the index file maps the
+// document ID to the block and the text inside it. The data file is read through
+// mmap, the recently used decompressed blocks are cached.
+class TDocumentStore {
+public:
+    const static std::size_t BLOCK_SIZE = 16'384ull;
+    const static std::size_t BLOCK_CACHE_SIZE = 32ull;
+
+public:
+    TDocumentStore(std::filesystem::path path, std::size_t blockSize = BLOCK_SIZE)
+        : DataPath(path / "data")
+        , IndexPath(path / "index")
+        , BlockSize(blockSize)
+    {
+        std::filesystem::create_directories(path);
+        LoadIndex();
+        DataFile.open(DataPath, std::ios::out | std::ios::binary | std::ios::app);
+        IndexFile.open(IndexPath, std::ios::out | std::ios::binary | std::ios::app);
+    }
+
+    ~TDocumentStore() {
+        try {
+            Flush();
+        } catch (...) {
+        }
+    }
+
+    TDocumentStore(const TDocumentStore&) = delete;
+    TDocumentStore& operator=(const TDocumentStore&) = delete;
+
+    // replaces the text of the document, if it was stored before
+    void Put(std::size_t docID, std::string_view text) {
+        PendingRecords.push_back(TRecord{.DocID = docID, .Offset = static_cast<uint32_t>(PendingBlock.size()), .Size = static_cast<uint32_t>(text.size())});
+        PendingBlock.append(text);
+        Locations[docID] = TLocation{.Block = PENDING_BLOCK, .Offset = PendingRecords.back().Offset, .Size = PendingRecords.back().Size};
+
+        if (PendingBlock.size() >= BlockSize) {
+            Flush();
+        }
+    }
+
+    std::optional<std::string> Get(std::size_t docID) {
+        auto it = Locations.find(docID);
+        if (it == Locations.end()) {
+            return std::nullopt;
+        }
+
+        const auto& location = it->second;
+        if (location.Block == PENDING_BLOCK) {
+            return PendingBlock.substr(location.Offset, location.Size);
+        }
+        return GetBlock(location.Block)->substr(location.Offset, location.Size);
+    }
+
+    bool Contains(std::size_t docID) const {
+        return Locations.contains(docID);
+    }
+
+    std::size_t Size() const {
+        return Locations.size();
+    }
+
+    // onDoc(docID) in the increasing order
+    template <typename TOnDoc>
+    void ForEachID(TOnDoc&& onDoc) const {
+        for (const auto& [docID, _]: Locations) {
+            onDoc(docID);
+        }
+    }
+
+    // seals the pending block, the stored documents survive the restart after it
+    void Flush() {
+        if (PendingRecords.empty()) {
+            return;
+        }
+
+        auto compressed = NCompression::Compress(PendingBlock);
+        TBlock block{.Offset = DataSize, .Size = compressed.size(), .RawSize = PendingBlock.size()};
+        DataFile.write(compressed.data(), compressed.size());
+        DataFile.flush();
+        DataSize += compressed.size();
+
+        // the data goes before the index, so the index never points past the data
+        for (auto& record: PendingRecords) {
+            record.Block = block;
+            IndexFile.write(reinterpret_cast<const char*>(&record), sizeof(record));
+            Locations[record.DocID] = TLocation{.Block = Blocks.size(), .Offset = record.Offset, .Size = record.Size};
+        }
+        IndexFile.flush();
+        if (!DataFile || !IndexFile) {
+            throw std::runtime_error("can't write the document store " + DataPath.string() + ".");
+        }
+
+        Blocks.push_back(block);
+        PendingRecords.clear();
+        PendingBlock.clear();
+    }
+
+    // decompressed size of the stored texts to their size on the disk
+    double GetCompressionRatio() const {
+        std::size_t raw = 0;
+        for (const auto& block: Blocks) {
+            raw += block.RawSize;
+        }
+        return DataSize == 0 ? 1.0 : static_cast<double>(raw) / DataSize;
+    }
+
+private:
+    static constexpr uint64_t PENDING_BLOCK = ~0ull;
+
+    struct TBlock {
+        uint64_t Offset = 0;
+        uint64_t Size = 0;
+        uint64_t RawSize = 0;
+    };
+
+    // the index file consists of the raw records
+    struct TRecord {
+        uint64_t DocID = 0;
+        TBlock Block;
+        uint32_t Offset = 0;
+        uint32_t Size = 0;
+    };
+
+    struct TLocation {
+        uint64_t Block = 0;
+        uint32_t Offset = 0;
+        uint32_t Size = 0;
+    };
+
+    void LoadIndex() {
+        DataSize = std::filesystem::exists(DataPath) ? std::filesystem::file_size(DataPath) : 0;
+
+        std::ifstream fIn(IndexPath, std::ios::binary);
+        TRecord record;
+        std::size_t validSize = 0;
+        while (fIn.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+            // the tail of an interrupted write is dropped
+            if (record.Block.Offset + record.Block.Size > DataSize) {
+                break;
+            }
+            if (Blocks.empty() || Blocks.back().Offset != record.Block.Offset) {
+                Blocks.push_back(record.Block);
+            }
+            Locations[record.DocID] = TLocation{.Block = Blocks.size() - 1, .Offset = record.Offset, .Size = record.Size};
+            validSize += sizeof(record);
+        }
+        fIn.close();
+
+        if (std::filesystem::exists(IndexPath) && std::filesystem::file_size(IndexPath) != validSize) {
+            std::filesystem::resize_file(IndexPath, validSize);
+        }
+        if (DataSize != (Blocks.empty() ? 0 : Blocks.back().Offset + Blocks.back().Size)) {
+            DataSize = Blocks.empty() ? 0 : Blocks.back().Offset + Blocks.back().Size;
+            std::filesystem::resize_file(DataPath, DataSize);
+        }
+    }
+
+    std::shared_ptr<const std::string> GetBlock(uint64_t blockIdx) {
+        if (auto cached = BlockCache.Find(blockIdx)) {
+            return cached.value();
+        }
+
+        const auto& block = Blocks[blockIdx];
+        if (block.Offset + block.Size > Mapped.GetSize()) {
+            Mapped.Map(DataPath);
+        }
+        auto text = std::make_shared<const std::string>(NCompression::Decompress(Mapped.View(block.Offset, block.Size), block.RawSize));
+        BlockCache.Insert(blockIdx, text);
+        return text;
+    }
+
+private:
+    std::filesystem::path DataPath;
+    std::filesystem::path IndexPath;
+    std::size_t BlockSize;
+
+    std::ofstream DataFile;
+    std::ofstream IndexFile;
+    uint64_t DataSize = 0;
+    TMappedFile Mapped;
+
+    std::vector<TBlock> Blocks;
+    std::map<std::size_t, TLocation> Locations;
+
+    std::string PendingBlock;
+    std::vector<TRecord> PendingRecords;
+
+    TLRUCache<uint64_t, std::shared_ptr<const std::string>> BlockCache{BLOCK_CACHE_SIZE};
+};
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <tuple>
+
+#include "../lsm/lsm.h"
+#include "bitmap.h"
+#include "utils.h"
+
+class IIntervalIndex {
+public:
+    virtual ~IIntervalIndex() = default;
+
+    // replaces the interval of the document, if it was set before
+    virtual void AddInterval(uint32_t docID, uint64_t intervalBegin, uint64_t intervalEnd) = 0;
+
+    // documents with the interval intersecting [intervalBegin, intervalEnd]
+    virtual TBitmap FindDocsByInterval(uint64_t intervalBegin, uint64_t intervalEnd) const = 0;
+
+    // the candidates with the interval intersecting [intervalBegin, intervalEnd],
+    // the engines check the candidates one by one instead of the whole field
+    virtual TBitmap FilterDocsByInterval(const TBitmap& candidates, uint64_t intervalBegin, uint64_t intervalEnd) const {
+        return FindDocsByInterval(intervalBegin, intervalEnd).And(candidates);
+    }
+
+    // the expected number of the documents FindDocsByInterval returns, for the query planner
+    virtual std::size_t EstimateDocsByInterval(uint64_t intervalBegin, uint64_t intervalEnd) const = 0;
+
+    // documents with the interval containing the timestamp
+    TBitmap FindDocsByTimePoint(uint64_t timestamp) const {
+        return FindDocsByInterval(timestamp, timestamp);
+    }
+};
+
+namespace NIntervals {
+    // intervals are partitioned by the length class, the class k keeps the lengths
+    // below 2^k, so only the begins in [from - 2^k + 1, to] can overlap [from, to]
+    struct TKey {
+        uint32_t LengthClass = 0;
+        uint32_t DocID = 0;
+        uint64_t Begin = 0;
+
+        bool operator<(const TKey& other) const {
+            return std::tie(LengthClass, Begin, DocID) < std::tie(other.LengthClass, other.Begin, other.DocID);
+        }
+
+        bool operator<=(const TKey& other) const {
+            return !(other < *this);
+        }
+
+        bool operator>(const TKey& other) const {
+            return other < *this;
+        }
+
+        bool operator==(const TKey& other) const {
+            return LengthClass == other.LengthClass && DocID == other.DocID && Begin == other.Begin;
+        }
+    };
+
+    struct TValue {
+        uint64_t Begin = 0;
+        uint64_t End = 0;
+        // the LSM tree has no deletions, the replaced entries are overwritten by the removed ones
+        uint64_t Removed = 0;
+
+        bool operator<(const TValue& other) const {
+            return false;
+        }
+    };
+
+    inline uint32_t GetLengthClass(uint64_t begin, uint64_t end) {
+        return std::bit_width(end - begin);
+    }
+
+    // The intervals of a field as a whole, the estimates assume the begins spread evenly
+    // over [MinBegin, MaxBegin]: a query overlaps the intervals beginning in its range
+    // widened to the left by the mean length. The bounds are not shrunk by the removals.
+    struct TStatistics {
+        uint64_t Count = 0;
+        uint64_t MinBegin = std::numeric_limits<uint64_t>::max();
+        uint64_t MaxBegin = 0;
+        double TotalLength = 0;
+
+        void Add(uint64_t begin, uint64_t end) {
+            ++Count;
+            MinBegin = std::min(MinBegin, begin);
+            MaxBegin = std::max(MaxBegin, begin);
+            TotalLength += static_cast<double>(end - begin);
+        }
+
+        void Remove(uint64_t begin, uint64_t end) {
+            assert(Count > 0);
+            --Count;
+            TotalLength = std::max(0.0, TotalLength - static_cast<double>(end - begin));
+        }
+
+        std::size_t Estimate(uint64_t begin, uint64_t end) const {
+            if (Count == 0) {
+                return 0;
+            }
+            double from = std::max(static_cast<double>(begin) - TotalLength / Count, static_cast<double>(MinBegin));
+            double to = std::min(static_cast<double>(end), static_cast<double>(MaxBegin));
+            if (from > to) {
+                return 0;
+            }
+            double span = static_cast<double>(MaxBegin - MinBegin) + 1;
+            return static_cast<std::size_t>(std::ceil(Count * std::min(1.0, (to - from + 1) / span)));
+        }
+    };
+}
+
+// Persistent interval index over the sorted begins: the intervals are stored in
+// the LSM tree ordered by (length class, begin), an overlap query is one range
+// scan per present length class, which filters out the intervals ending before
+// the query. The length classes bound the filtered out part of the scan.
+class TSortedEndpointIntervalIndex: public IIntervalIndex {
+public:
+    static constexpr uint32_t LENGTH_CLASS_COUNT = 65;
+    // a point lookup per candidate costs more than a scan of a few entries per candidate
+    const static std::size_t FILTER_MAX_CANDIDATES = 256ull;
+
+public:
+    // both trees keep their memtables within the limit of writeBufferManager if it is set
+    TSortedEndpointIntervalIndex(std::filesystem::path indexStoragePath, std::shared_ptr<NMemory::TWriteBufferManager> writeBufferManager = nullptr)
+        : Intervals(NUtils::EnsureDirectory(indexStoragePath / "intervals"), NDirectIO::EMode::EBuffered, writeBufferManager)
+        , IntervalsByDoc(NUtils::EnsureDirectory(indexStoragePath / "docs"), NDirectIO::EMode::EBuffered, std::move(writeBufferManager))
+        , LengthClassesPath(indexStoragePath / "length_classes")
+        , StatisticsPath(indexStoragePath / "statistics")
+    {
+        if (std::ifstream fIn(LengthClassesPath, std::ios::binary); fIn.is_open()) {
+            fIn.read(reinterpret_cast<char*>(LengthClasses.data()), sizeof(LengthClasses));
+        }
+        LoadStatistics();
+    }
+
+    ~TSortedEndpointIntervalIndex() {
+        if (std::ofstream fOut(StatisticsPath, std::ios::binary | std::ios::trunc); fOut.is_open()) {
+            fOut.write(reinterpret_cast<const char*>(&Statistics), sizeof(Statistics));
+        }
+    }
+
+    void AddInterval(uint32_t docID, uint64_t intervalBegin, uint64_t intervalEnd) override {
+        assert(intervalBegin <= intervalEnd);
+
+        if (auto previous = IntervalsByDoc.ReadPoint(docID); previous && !previous->second.Removed) {
+            const auto& [begin, end, _] = previous->second;
+            Intervals.Insert(NIntervals::TKey{.LengthClass = NIntervals::GetLengthClass(begin, end), .DocID = docID, .Begin = begin}, {begin, end, 1});
+            Statistics.Remove(begin, end);
+        }
+        Statistics.Add(intervalBegin, intervalEnd);
+
+        NIntervals::TValue value{.Begin = intervalBegin, .End = intervalEnd};
+        uint32_t lengthClass = NIntervals::GetLengthClass(intervalBegin, intervalEnd);
+        Intervals.Insert(NIntervals::TKey{.LengthClass = lengthClass, .DocID = docID, .Begin = intervalBegin}, value);
+        IntervalsByDoc.Insert(docID, value);
+        AddLengthClass(lengthClass);
+    }
+
+    TBitmap FindDocsByInterval(uint64_t intervalBegin, uint64_t intervalEnd) const override {
+        TBitmap docs;
+        for (uint32_t lengthClass = 0; lengthClass < LENGTH_CLASS_COUNT; ++lengthClass) {
+            if (!HasLengthClass(lengthClass)) {
+                continue;
+            }
+
+            uint64_t maxLength = lengthClass == 64 ? std::numeric_limits<uint64_t>::max() : (1ull << lengthClass) - 1;
+            uint64_t from = intervalBegin > maxLength ? intervalBegin - maxLength : 0;
+            NIntervals::TKey lhs{.LengthClass = lengthClass, .DocID = 0, .Begin = from};
+            NIntervals::TKey rhs{.LengthClass = lengthClass, .DocID = std::numeric_limits<uint32_t>::max(), .Begin = intervalEnd};
+            for (const auto& [key, value]: Intervals.ReadRanges(lhs, rhs)) {
+                if (!value.Removed && value.End >= intervalBegin) {
+                    docs.Add(key.DocID);
+                }
+            }
+        }
+        return docs;
+    }
+
+    // the candidates are looked up one by one unless there are more of them than the documents in the range
+    TBitmap FilterDocsByInterval(const TBitmap& candidates, uint64_t intervalBegin, uint64_t intervalEnd) const override {
+        std::size_t candidateCount = candidates.Cardinality();
+        if (candidateCount > FILTER_MAX_CANDIDATES || candidateCount > EstimateDocsByInterval(intervalBegin, intervalEnd)) {
+            return IIntervalIndex::FilterDocsByInterval(candidates, intervalBegin, intervalEnd);
+        }
+
+        TBitmap docs;
+        candidates.ForEach([&](uint32_t docID) {
+            auto interval = IntervalsByDoc.ReadPoint(docID);
+            if (interval && !interval->second.Removed && interval->second.Begin <= intervalEnd && interval->second.End >= intervalBegin) {
+                docs.Add(docID);
+            }
+        });
+        return docs;
+    }
+
+    void RemoveInterval(uint32_t docID) {
+        auto previous = IntervalsByDoc.ReadPoint(docID);
+        if (!previous || previous->second.Removed) {
+            return;
+        }
+        auto value = previous->second;
+        value.Removed = 1;
+        Intervals.Insert(NIntervals::TKey{.LengthClass = NIntervals::GetLengthClass(value.Begin, value.End), .DocID = docID, .Begin = value.Begin}, value);
+        IntervalsByDoc.Insert(docID, value);
+        Statistics.Remove(value.Begin, value.End);
+    }
+
+    std::size_t EstimateDocsByInterval(uint64_t intervalBegin, uint64_t intervalEnd) const override {
+        return Statistics.Estimate(intervalBegin, intervalEnd);
+    }
+
+private:
+    // saved by the destructor and removed once loaded, so after a crash they are rebuilt from the intervals
+    void LoadStatistics() {
+        if (std::ifstream fIn(StatisticsPath, std::ios::binary); fIn.is_open()) {
+            fIn.read(reinterpret_cast<char*>(&Statistics), sizeof(Statistics));
+            if (fIn) {
+                fIn.close();
+                std::filesystem::remove(StatisticsPath);
+                return;
+            }
+            Statistics = NIntervals::TStatistics();
+        }
+        for (const auto& [_, value]: IntervalsByDoc.ReadRanges(0, std::numeric_limits<uint32_t>::max())) {
+            if (!value.Removed) {
+                Statistics.Add(value.Begin, value.End);
+            }
+        }
+    }
+
+    bool HasLengthClass(uint32_t lengthClass) const {
+        return (LengthClasses[lengthClass / 64] >> (lengthClass % 64)) & 1;
+    }
+
+    void AddLengthClass(uint32_t lengthClass) {
+        if (HasLengthClass(lengthClass)) {
+            return;
+        }
+        LengthClasses[lengthClass / 64] |= 1ull << (lengthClass % 64);
+        std::ofstream fOut(LengthClassesPath, std::ios::binary | std::ios::trunc);
+        fOut.write(reinterpret_cast<const char*>(LengthClasses.data()), sizeof(LengthClasses));
+    }
+
+private:
+    TLSMTree<NIntervals::TKey, NIntervals::TValue> Intervals;
+    TLSMTree<uint32_t, NIntervals::TValue> IntervalsByDoc;
+    std::filesystem::path LengthClassesPath;
+    std::array<uint64_t, 2> LengthClasses{};
+    std::filesystem::path StatisticsPath;
+    NIntervals::TStatistics Statistics;
+};
@@ -1,284 +1,1178 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <type_traits>
 #include <cstdio>
+#include <map>
 #include <string>
+#include <thread>
 #include "../lsm/lsm.h"
+#include "../lsm/thread_pool.h"
 #include "../lsm/types.h"
 #include "text_processor.h"
 #include "utils.h"
 #include "logic_algebra.h"
 #include "docs.h"
+#include "postings.h"
+#include "query.h"
+#include "cache.h"
+#include "term_dictionary.h"
+#include "ngram_index.h"
+#include "document_store.h"
+#include "bit_sliced_index.h"
+#include "interval_index.h"
 
 struct TDocument {
     std::size_t ID;
     std::string Text;
 };
 
+// The chunks of a bulk load indexed on a pool into the states of the workers.
+namespace NBulk {
+    // a state per worker and one for a calling thread from outside the pool
+    template <typename TState>
+    struct TJob {
+        std::size_t ChunkCount = 0;
+        std::atomic<std::size_t> NextChunk = 0;
+        std::size_t DoneChunks = 0;
+        std::vector<TState> States;
+        std::function<void(TState&, std::size_t)> IndexChunk;
+        std::exception_ptr Error;
+        std::mutex Mutex;
+        std::condition_variable Done;
+    };
+
+    // the tasks started after all the chunks are taken touch nothing but the job
+    template <typename TState>
+    void IndexChunks(TJob<TState>& job, TState& state) {
+        for (std::size_t chunk = job.NextChunk++; chunk < job.ChunkCount; chunk = job.NextChunk++) {
+            std::exception_ptr error;
+            try {
+                job.IndexChunk(state, chunk);
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            std::lock_guard lock(job.Mutex);
+            if (error && !job.Error) {
+                job.Error = error;
+            }
+            if (++job.DoneChunks == job.ChunkCount) {
+                job.Done.notify_all();
+            }
+        }
+    }
+
+    // Calls indexChunk(state, chunk) for every chunk. The calling thread takes the chunks too
+    // and waits only for the ones being indexed, so a call from a worker of a shared pool
+    // doesn't wait for the tasks queued behind it. The first error is rethrown.
+    template <typename TState>
+    std::shared_ptr<TJob<TState>> Run(TThreadPool& pool, std::size_t chunkCount, std::function<void(TState&, std::size_t)> indexChunk) {
+        auto job = std::make_shared<TJob<TState>>();
+        job->ChunkCount = chunkCount;
+        job->States.resize(pool.Size() + 1);
+        job->IndexChunk = std::move(indexChunk);
+        for (std::size_t i = 1; i < std::min(chunkCount, pool.Size()); ++i) {
+            pool.Submit([job, &pool]() {
+                IndexChunks(*job, job->States[pool.WorkerIndex().value()]);
+            });
+        }
+        IndexChunks(*job, job->States[pool.WorkerIndex().value_or(pool.Size())]);
+
+        std::unique_lock lock(job->Mutex);
+        job->Done.wait(lock, [&job]() { return job->DoneChunks == job->ChunkCount; });
+        if (job->Error) {
+            std::rethrow_exception(job->Error);
+        }
+        return job;
+    }
+}
+
+// The Find* methods may run concurrently, the updates need exclusive access: a search
+// takes a reader state of its own, the caches are shared under CacheMutex.
 template <std::size_t MaxDocCount>
 class TInvertedIndex {
 public:
-    TInvertedIndex(std::filesystem::path indexStoragePath)
-        : LSMTree(std::move(indexStoragePath))
-    {}
+    const static std::size_t RESULT_CACHE_SIZE = 1'024ull;
+    const static std::size_t TERM_CACHE_SIZE = 4'096ull;
+    const static std::size_t BULK_CHUNK_SIZE = 64ull;
+    // the key of the live documents in the docs tree, never a term ID
+    static constexpr TTermID LIVE_DOCS_KEY = TTermDictionary::UNKNOWN_TERM - 1;
+
+public:
+    // the indexes sharing writeBufferManager keep their memtables within its limit, see lsm/memory.h,
+    // the bulk loads run on pool if it is set, on an own pool created by the first one otherwise
+    TInvertedIndex(
+            std::filesystem::path indexStoragePath,
+            TStopWords stopWords = TStopWords::Default(),
+            std::shared_ptr<NMemory::TWriteBufferManager> writeBufferManager = nullptr,
+            std::shared_ptr<TThreadPool> pool = nullptr
+    )
+        : Dictionary(indexStoragePath / "terms")
+        , LSMTree(indexStoragePath, NDirectIO::EMode::EBuffered, writeBufferManager)
+        , PositionsLSMTree(NUtils::EnsureDirectory(indexStoragePath / "positions"), NDirectIO::EMode::EBuffered, writeBufferManager)
+        , Processor(std::move(stopWords))
+        , Pool(std::move(pool))
+    {
+        LSMTree.SetBeforeFlush([this]() { Dictionary.Sync(); });
+        PositionsLSMTree.SetBeforeFlush([this]() { Dictionary.Sync(); });
+        if (auto maybeEntry = LSMTree.ReadPoint(LIVE_DOCS_KEY)) {
+            LiveDocs = maybeEntry.value().second;
+        }
+    }
 
     void AddDocument(const TDocument& doc) {
         assert(doc.ID < MaxDocCount);
 
-        for (const auto& processedWord: Processor.Process(doc.Text)) {
-            if (auto maybeEntry = LSMTree.ReadPoint(processedWord)) {
-                auto& [word, docs] = maybeEntry.value();
-                docs.Add(doc.ID);
-                LSMTree.Insert(word, docs);
-                continue;
-            }
+        ++Generation;
+        LiveDocs.Add(doc.ID);
+        // written with the postings, so Not and AndNot see the same documents after a reopen
+        LSMTree.Insert(LIVE_DOCS_KEY, LiveDocs);
 
+        for (const auto& [termID, positions]: CollectPositions(Processor, doc.Text)) {
             TDocs<MaxDocCount> docs;
+            if (auto maybeEntry = LSMTree.ReadPoint(termID)) {
+                docs = maybeEntry.value().second;
+            }
             docs.Add(doc.ID);
-            LSMTree.Insert(processedWord, docs);
+            LSMTree.Insert(termID, docs);
+
+            uint32_t block = 0;
+            for (auto& positionsBlock: NPostings::EncodePositions(positions)) {
+                PositionsLSMTree.Insert({termID, static_cast<uint32_t>(doc.ID), block++}, std::move(positionsBlock));
+            }
         }
     }
 
+    // Bulk load: the documents are tokenized and stemmed on the work stealing pool
+    // into per-worker segments, which are merged and written to each LSM tree as
+    // a single sorted run. Every term costs one LSM read per batch instead of one
+    // read and write per occurrence.
+    void AddDocuments(const std::vector<TDocument>& docs) {
+        if (docs.empty()) {
+            return;
+        }
+
+        auto job = NBulk::Run<TWorkerState>(GetPool(), (docs.size() + BULK_CHUNK_SIZE - 1) / BULK_CHUNK_SIZE, [this, &docs](TWorkerState& state, std::size_t chunk) {
+            if (!state.Processor) {
+                state.Processor.emplace(Processor.GetStopWords());
+            }
+            std::size_t from = chunk * BULK_CHUNK_SIZE;
+            for (std::size_t docIdx = from; docIdx < std::min(from + BULK_CHUNK_SIZE, docs.size()); ++docIdx) {
+                const auto& doc = docs[docIdx];
+                for (auto& [termID, positions]: CollectPositions(state.Processor.value(), doc.Text)) {
+                    state.Segment[termID].emplace_back(doc.ID, std::move(positions));
+                }
+            }
+        });
+
+        // the chunks are taken in any order, so the postings are sorted by the document ID after the merge
+        TSegment segment;
+        for (auto& state: job->States) {
+            for (auto& [termID, postings]: state.Segment) {
+                auto& merged = segment[termID];
+                merged.insert(merged.end(), std::make_move_iterator(postings.begin()), std::make_move_iterator(postings.end()));
+            }
+        }
+        for (auto& [_, postings]: segment) {
+            std::sort(postings.begin(), postings.end(), [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+        }
+
+        ++Generation;
+        for (const auto& doc: docs) {
+            assert(doc.ID < MaxDocCount);
+            LiveDocs.Add(doc.ID);
+        }
+
+        std::vector<std::pair<TTermID, TDocs<MaxDocCount>>> docsEntries;
+        std::vector<std::pair<TPositionsKey, NPostings::TPositionsBlock>> positionsEntries;
+        docsEntries.reserve(segment.size() + 1);
+        for (const auto& [termID, postings]: segment) {
+            TDocs<MaxDocCount> docs;
+            if (auto maybeEntry = LSMTree.ReadPoint(termID)) {
+                docs = maybeEntry.value().second;
+            }
+
+            for (const auto& [docID, positions]: postings) {
+                docs.Add(docID);
+
+                uint32_t block = 0;
+                for (auto& positionsBlock: NPostings::EncodePositions(positions)) {
+                    positionsEntries.emplace_back(TPositionsKey{termID, static_cast<uint32_t>(docID), block++}, std::move(positionsBlock));
+                }
+            }
+            docsEntries.emplace_back(termID, docs);
+        }
+        docsEntries.emplace_back(LIVE_DOCS_KEY, LiveDocs);
+
+        LSMTree.BulkInsert(std::move(docsEntries));
+        PositionsLSMTree.BulkInsert(std::move(positionsEntries));
+    }
+
     TDocs<MaxDocCount> FindDocsByWord(const std::string& word) {
-        auto searchingWord = Processor.Process(word)[0];
-        if (auto maybeEntry = LSMTree.ReadPoint(searchingWord)) {
-            const auto& [_, docs] = maybeEntry.value();
-            return docs;
+        auto termID = FindTermID(word);
+        if (!termID) {
+            return TDocs<MaxDocCount>();
+        }
+
+        if (auto cached = FindCached(TermDocsCache, termID.value())) {
+            return cached.value();
+        }
+
+        TDocs<MaxDocCount> docs;
+        if (auto maybeEntry = LSMTree.ReadPoint(termID.value())) {
+            docs = maybeEntry.value().second;
+        }
+        InsertCached(TermDocsCache, termID.value(), docs);
+        return docs;
+    }
+
+    // the prefix is neither stemmed nor checked against the stop words
+    TDocs<MaxDocCount> FindDocsByPrefix(const std::string& prefix) {
+        auto processedPrefix = TReaderLease(*this)->Processor.Process(prefix, TTextProcessor::TOpts(false, false, false));
+        if (processedPrefix.empty()) {
+            return TDocs<MaxDocCount>();
         }
 
-        return TDocs<MaxDocCount>();
+        std::vector<TTermID> termIDs;
+        Dictionary.ForEachWithPrefix(processedPrefix[0], [&termIDs](std::string_view, TTermID termID) {
+            termIDs.push_back(termID);
+        });
+        return FindDocsByTermIDs(termIDs);
+    }
+
+    TDocs<MaxDocCount> GetLiveDocs() const {
+        return LiveDocs;
+    }
+
+    // the word is stemmed as the indexed terms, the distance is between the stems
+    TDocs<MaxDocCount> FindDocsByFuzzy(const std::string& word, uint32_t maxDistance) {
+        auto processedWord = TReaderLease(*this)->Processor.Process(word, TTextProcessor::TOpts(false, true, false));
+        if (processedWord.empty()) {
+            return TDocs<MaxDocCount>();
+        }
+
+        std::vector<TTermID> termIDs;
+        Dictionary.ForEachSimilar(processedWord[0], maxDistance, [&termIDs](std::string_view, TTermID termID) {
+            termIDs.push_back(termID);
+        });
+        return FindDocsByTermIDs(termIDs);
+    }
+
+    // the regex is matched against the stemmed terms as is
+    TDocs<MaxDocCount> FindDocsByRegex(const std::string& regex) {
+        std::vector<TTermID> termIDs;
+        Dictionary.ForEachMatching(regex, [&termIDs](std::string_view, TTermID termID) {
+            termIDs.push_back(termID);
+        });
+        return FindDocsByTermIDs(termIDs);
+    }
+
+    // documents with a stemmed term in [from, to)
+    TDocs<MaxDocCount> FindDocsByTermRange(const std::string& from, const std::string& to) {
+        std::vector<TTermID> termIDs;
+        Dictionary.ForEachInRange(from, to, [&termIDs](std::string_view, TTermID termID) {
+            termIDs.push_back(termID);
+        });
+        return FindDocsByTermIDs(termIDs);
+    }
+
+    std::optional<TPostings> FindPostingsByWord(const std::string& word) {
+        auto termID = FindTermID(word);
+        if (!termID) {
+            return std::nullopt;
+        }
+
+        if (auto cached = FindCached(TermPostingsCache, termID.value())) {
+            return cached;
+        }
+
+        auto postings = NPostings::DecodePostings(PositionsLSMTree.ReadRanges(TPositionsKey::Min(termID.value()), TPositionsKey::Max(termID.value())));
+        InsertCached(TermPostingsCache, termID.value(), postings);
+        return postings;
+    }
+
+    TDocs<MaxDocCount> FindDocsByPhrase(const std::string& phrase) {
+        return FindDocsByExpr(std::make_shared<NLogicAlgebra::TPhrase>(NUtils::Split(phrase, ' ')));
     }
 
     TDocs<MaxDocCount> FindDocsByExpr(const std::shared_ptr<NLogicAlgebra::IASTNode>& astTree) {
-        auto ctx = NLogicAlgebra::IASTNode::TContext([this](const std::string& word){ return FindDocsByWord(word); });
-        return astTree->Evaluate(ctx);
+        auto cacheKey = astTree->Canonical([this](const std::string& word) {
+            auto termID = FindTermID(word);
+            return termID ? std::to_string(termID.value()) : std::string();
+        });
+
+        if (auto cached = FindCached(ResultCache, cacheKey)) {
+            return cached.value();
+        }
+
+        auto ctx = MakeContext();
+        auto docs = astTree->Evaluate(ctx);
+        InsertCached(ResultCache, std::move(cacheKey), docs);
+        return docs;
+    }
+
+    // the text part of the expression evaluation, the other sources are added by the owners
+    NLogicAlgebra::IASTNode::TContext MakeContext() {
+        NLogicAlgebra::IASTNode::TContext ctx(
+            [this](const std::string& word){ return FindDocsByWord(word); },
+            [this](const std::string& word){ return FindPostingsByWord(word); },
+            [this](){ return LiveDocs; }
+        );
+        // the documents of the word stay in the term cache for the evaluation
+        ctx.EstimateDocsByWord = [this](const std::string& word) {
+            return FindDocsByWord(word).Count();
+        };
+        return ctx;
+    }
+
+    // see query.h for the syntax, the results share the cache of FindDocsByExpr keyed by the query text
+    TDocs<MaxDocCount> FindDocsByQuery(std::string_view query) {
+        std::string cacheKey = "query:";
+        cacheKey.append(query);
+
+        if (auto cached = FindCached(ResultCache, cacheKey)) {
+            return cached.value();
+        }
+
+        TReaderLease reader(*this);
+        reader->QueryCompiler.Compile(query, reader->CompiledQuery);
+        auto docs = reader->QueryEvaluator.Evaluate(reader->CompiledQuery, *this);
+        InsertCached(ResultCache, std::move(cacheKey), docs);
+        return docs;
+    }
+
+    // see TLSMTree::SetFlushRequestHandler, the handler is shared by the trees of the index
+    void SetFlushRequestHandler(std::function<void()> handler) {
+        LSMTree.SetFlushRequestHandler(handler);
+        PositionsLSMTree.SetFlushRequestHandler(std::move(handler));
+    }
+
+    // an update, flushes the trees the write buffer manager asked for
+    void FlushIfRequested() {
+        LSMTree.FlushIfRequested();
+        PositionsLSMTree.FlushIfRequested();
+    }
+
+    // bumped by every index update, the caches are dropped when it changes
+    uint64_t GetGeneration() const {
+        return Generation;
+    }
+
+    TCacheStatistics GetResultCacheStatistics() const {
+        std::lock_guard lock(CacheMutex);
+        return ResultCache.GetStatistics();
+    }
+
+    TCacheStatistics GetTermCacheStatistics() const {
+        std::lock_guard lock(CacheMutex);
+        return TermDocsCache.GetStatistics();
+    }
+
+    const TTermDictionary& GetDictionary() const {
+        return Dictionary;
+    }
+
+private:
+    // term -> (document ID, positions of the term in the document)
+    using TSegment = std::map<TTermID, std::vector<std::pair<std::size_t, std::vector<uint32_t>>>>;
+
+    // the pool workers keep their text processor and term buffer between the chunks
+    struct TWorkerState {
+        std::optional<TTextProcessor> Processor;
+        TSegment Segment;
+    };
+
+    TThreadPool& GetPool() {
+        if (!Pool) {
+            Pool = std::make_shared<TThreadPool>();
+        }
+        return *Pool;
+    }
+
+    std::map<TTermID, std::vector<uint32_t>> CollectPositions(TTextProcessor& processor, const std::string& text) {
+        std::map<TTermID, std::vector<uint32_t>> positionsByTerm;
+        uint32_t position = 0;
+        processor.ForEachToken(text, TTextProcessor::TOpts(false, false, true), [&](std::string_view surface) {
+            auto termID = Dictionary.Resolve(surface, [&processor](std::string& term) { processor.Stem(term); });
+            positionsByTerm[termID].push_back(position++);
+        });
+        return positionsByTerm;
+    }
+
+    TDocs<MaxDocCount> FindDocsByTermIDs(const std::vector<TTermID>& termIDs) {
+        TDocs<MaxDocCount> docs;
+        for (const auto& [_, termDocs]: LSMTree.ReadPoints(termIDs)) {
+            docs.Or(termDocs);
+        }
+        return docs;
+    }
+
+    // std::nullopt if the word is dropped by the text processing,
+    // TTermDictionary::UNKNOWN_TERM if the word was never indexed
+    std::optional<TTermID> FindTermID(const std::string& word) {
+        TReaderLease reader(*this);
+        auto& processor = reader->Processor;
+        std::optional<TTermID> termID;
+        processor.ForEachToken(word, TTextProcessor::TOpts(false, false, true), [&](std::string_view surface) {
+            if (!termID) {
+                termID = Dictionary.Lookup(surface, [&processor](std::string& term) { processor.Stem(term); });
+            }
+        });
+        return termID;
+    }
+
+    // the text processing and the query buffers of one search
+    struct TReader {
+        explicit TReader(TStopWords stopWords)
+            : Processor(std::move(stopWords))
+        {}
+
+        TTextProcessor Processor;
+        NQuery::TCompiler QueryCompiler;
+        NQuery::TCompiledQuery CompiledQuery;
+        NQuery::TEvaluator QueryEvaluator;
+    };
+
+    // a reader state taken from the free ones for the scope, a nested search takes another one
+    class TReaderLease {
+    public:
+        explicit TReaderLease(TInvertedIndex& index)
+            : Index(index)
+        {
+            {
+                std::lock_guard lock(Index.ReadersMutex);
+                if (!Index.Readers.empty()) {
+                    Reader = std::move(Index.Readers.back());
+                    Index.Readers.pop_back();
+                }
+            }
+            if (!Reader) {
+                Reader = std::make_unique<TReader>(Index.Processor.GetStopWords());
+            }
+        }
+
+        ~TReaderLease() {
+            std::lock_guard lock(Index.ReadersMutex);
+            Index.Readers.push_back(std::move(Reader));
+        }
+
+        TReaderLease(const TReaderLease&) = delete;
+        TReaderLease& operator=(const TReaderLease&) = delete;
+
+        TReader* operator->() const {
+            return Reader.get();
+        }
+
+    private:
+        TInvertedIndex& Index;
+        std::unique_ptr<TReader> Reader;
+    };
+
+    template <typename TKey, typename TValue>
+    std::optional<TValue> FindCached(TLRUCache<TKey, TValue>& cache, const TKey& key) {
+        std::lock_guard lock(CacheMutex);
+        SyncCaches();
+        return cache.Find(key);
+    }
+
+    template <typename TKey, typename TValue>
+    void InsertCached(TLRUCache<TKey, TValue>& cache, TKey key, TValue value) {
+        std::lock_guard lock(CacheMutex);
+        SyncCaches();
+        cache.Insert(std::move(key), std::move(value));
+    }
+
+    // under CacheMutex
+    void SyncCaches() {
+        if (CachesGeneration == Generation) {
+            return;
+        }
+
+        ResultCache.Clear();
+        TermDocsCache.Clear();
+        TermPostingsCache.Clear();
+        CachesGeneration = Generation;
     }
 
 private:
-    using TWord = TString<128>;
-    TLSMTree<TWord, TDocs<MaxDocCount>> LSMTree;
+    using TPositionsKey = NPostings::TPositionsKey<TTermID>;
+    // outlives the trees, their last flushes sync it
+    TTermDictionary Dictionary;
+    TLSMTree<TTermID, TDocs<MaxDocCount>> LSMTree;
+    TLSMTree<TPositionsKey, NPostings::TPositionsBlock> PositionsLSMTree;
+    TDocs<MaxDocCount> LiveDocs;
+    // of the updates, the searches lease the Readers
     TTextProcessor Processor;
+    std::mutex ReadersMutex;
+    std::vector<std::unique_ptr<TReader>> Readers;
+
+    uint64_t Generation = 0;
+    uint64_t CachesGeneration = 0;
+    mutable std::mutex CacheMutex;
+    TLRUCache<std::string, TDocs<MaxDocCount>> ResultCache{RESULT_CACHE_SIZE};
+    TLRUCache<TTermID, TDocs<MaxDocCount>> TermDocsCache{TERM_CACHE_SIZE};
+    TLRUCache<TTermID, TPostings> TermPostingsCache{TERM_CACHE_SIZE};
+
+    std::shared_ptr<TThreadPool> Pool;
 };
 
+// Wildcard search without the document texts: the pattern is split by '*' and spaces
+// into pieces, every piece is resolved to the terms containing it through the n-gram
+// index over the term dictionary, and the order of the pieces is checked by the term
+// positions. The first piece has to start a term unless the pattern starts with '*',
+// the last piece has to end a term unless the pattern ends with '*'. The pieces split
+// by spaces only are consecutive terms as in the text, so `brown fox` matches
+// "a brown fox" but neither "brownie and fox" nor "brown foxes".
 template <std::size_t MaxDocCount>
 class TInvertedPatternIndex {
 public:
-    TInvertedPatternIndex(std::filesystem::path indexStoragePath)
-        : LSMTree(std::move(indexStoragePath))
-    {}
+    const static std::size_t SNIPPET_RADIUS = 64ull;
+    const static std::size_t BULK_CHUNK_SIZE = 64ull;
+
+public:
+    // the trees keep their memtables within the limit of writeBufferManager if it is set,
+    // the bulk loads run on pool as in TInvertedIndex
+    TInvertedPatternIndex(
+            std::filesystem::path indexStoragePath,
+            std::size_t nGramSize = 3,
+            std::shared_ptr<NMemory::TWriteBufferManager> writeBufferManager = nullptr,
+            std::shared_ptr<TThreadPool> pool = nullptr
+    )
+        : Dictionary(indexStoragePath / "terms")
+        , LSMTree(indexStoragePath, NDirectIO::EMode::EBuffered, writeBufferManager)
+        , PositionsLSMTree(NUtils::EnsureDirectory(indexStoragePath / "positions"), NDirectIO::EMode::EBuffered, writeBufferManager)
+        , NGrams(nGramSize)
+        , DocumentStore(indexStoragePath / "documents")
+        , Pool(std::move(pool))
+    {
+        LSMTree.SetBeforeFlush([this]() { Dictionary.Sync(); });
+        PositionsLSMTree.SetBeforeFlush([this]() { Dictionary.Sync(); });
+        for (TTermID termID = 0; termID < Dictionary.Size(); ++termID) {
+            NGrams.Add(Dictionary.GetTerm(termID), termID);
+        }
+        DocumentStore.ForEachID([this](std::size_t docID) { LiveDocs.Add(docID); });
+    }
 
     void AddDocument(const TDocument& doc) {
         assert(doc.ID < MaxDocCount);
 
-        for (const auto& processedWord: Processor.Process(doc.Text, TTextProcessor::TOpts(true, false, true))) {
-            if (auto maybeEntry = LSMTree.ReadPoint(processedWord)) {
-                auto& [word, docs] = maybeEntry.value();
-                docs.Add(doc.ID);
-                LSMTree.Insert(word, docs);
-                continue;
+        LiveDocs.Add(doc.ID);
+        DocumentStore.Put(doc.ID, doc.Text);
+
+        std::map<TTermID, std::vector<uint32_t>> positionsByTerm;
+        uint32_t position = 0;
+        Processor.ForEachToken(doc.Text, TTextProcessor::TOpts(false, false, true), [&](std::string_view term) {
+            std::size_t termCount = Dictionary.Size();
+            auto termID = Dictionary.Intern(term);
+            if (termID == termCount) {
+                NGrams.Add(term, termID);
             }
+            positionsByTerm[termID].push_back(position++);
+        });
 
+        for (const auto& [termID, positions]: positionsByTerm) {
             TDocs<MaxDocCount> docs;
+            if (auto maybeEntry = LSMTree.ReadPoint(termID)) {
+                docs = maybeEntry.value().second;
+            }
             docs.Add(doc.ID);
-            LSMTree.Insert(processedWord, docs);
+            LSMTree.Insert(termID, docs);
+
+            uint32_t block = 0;
+            for (auto& positionsBlock: NPostings::EncodePositions(positions)) {
+                PositionsLSMTree.Insert({termID, static_cast<uint32_t>(doc.ID), block++}, std::move(positionsBlock));
+            }
+        }
+    }
+
+    // Bulk load: the documents are tokenized on the pool into per-worker buffers keyed by the
+    // term text. The calling thread interns the terms, the n-gram index needs them in the order
+    // of their IDs, and writes each LSM tree as a single sorted run.
+    void AddDocuments(const std::vector<TDocument>& docs) {
+        if (docs.empty()) {
+            return;
         }
 
-        docsStorage.push_back(doc);
+        auto job = NBulk::Run<TWorkerState>(GetPool(), (docs.size() + BULK_CHUNK_SIZE - 1) / BULK_CHUNK_SIZE, [this, &docs](TWorkerState& state, std::size_t chunk) {
+            if (!state.Processor) {
+                state.Processor.emplace(Processor.GetStopWords());
+            }
+            std::size_t from = chunk * BULK_CHUNK_SIZE;
+            for (std::size_t docIdx = from; docIdx < std::min(from + BULK_CHUNK_SIZE, docs.size()); ++docIdx) {
+                const auto& doc = docs[docIdx];
+                std::map<std::string, std::vector<uint32_t>, std::less<>> positionsByTerm;
+                uint32_t position = 0;
+                state.Processor->ForEachToken(doc.Text, TTextProcessor::TOpts(false, false, true), [&](std::string_view term) {
+                    auto it = positionsByTerm.find(term);
+                    if (it == positionsByTerm.end()) {
+                        it = positionsByTerm.emplace(std::string(term), std::vector<uint32_t>()).first;
+                    }
+                    it->second.push_back(position++);
+                });
+                for (auto& [term, positions]: positionsByTerm) {
+                    state.Terms[term].emplace_back(doc.ID, std::move(positions));
+                }
+            }
+        });
+
+        std::map<TTermID, std::vector<std::pair<std::size_t, std::vector<uint32_t>>>> segment;
+        for (auto& state: job->States) {
+            for (auto& [term, postings]: state.Terms) {
+                std::size_t termCount = Dictionary.Size();
+                auto termID = Dictionary.Intern(term);
+                if (termID == termCount) {
+                    NGrams.Add(term, termID);
+                }
+                auto& merged = segment[termID];
+                merged.insert(merged.end(), std::make_move_iterator(postings.begin()), std::make_move_iterator(postings.end()));
+            }
+        }
+
+        for (const auto& doc: docs) {
+            assert(doc.ID < MaxDocCount);
+            LiveDocs.Add(doc.ID);
+            DocumentStore.Put(doc.ID, doc.Text);
+        }
+
+        std::vector<std::pair<TTermID, TDocs<MaxDocCount>>> docsEntries;
+        std::vector<std::pair<TPositionsKey, NPostings::TPositionsBlock>> positionsEntries;
+        docsEntries.reserve(segment.size());
+        for (auto& [termID, postings]: segment) {
+            // the chunks are taken in any order
+            std::sort(postings.begin(), postings.end(), [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+            TDocs<MaxDocCount> termDocs;
+            if (auto maybeEntry = LSMTree.ReadPoint(termID)) {
+                termDocs = maybeEntry.value().second;
+            }
+
+            for (const auto& [docID, positions]: postings) {
+                termDocs.Add(docID);
+
+                uint32_t block = 0;
+                for (auto& positionsBlock: NPostings::EncodePositions(positions)) {
+                    positionsEntries.emplace_back(TPositionsKey{termID, static_cast<uint32_t>(docID), block++}, std::move(positionsBlock));
+                }
+            }
+            docsEntries.emplace_back(termID, termDocs);
+        }
+
+        LSMTree.BulkInsert(std::move(docsEntries));
+        PositionsLSMTree.BulkInsert(std::move(positionsEntries));
     }
 
     TDocs<MaxDocCount> FindDocsByPattern(const std::string& pattern) {
-        std::shared_ptr<NLogicAlgebra::IASTNode> dummy;
+        if (pattern.empty()) {
+            return TDocs<MaxDocCount>();
+        }
 
-        for (const auto& toSearch: NUtils::Split(pattern, '*')) {
-            dummy = NLogicAlgebra::And(dummy, toSearch);
+        auto pieces = SplitPattern(pattern);
+        if (pieces.empty()) {
+            return LiveDocs;
         }
 
-        auto ctx = NLogicAlgebra::IASTNode::TContext([this](const std::string& word){ return FindDocsByWord(word); });
-        return MatchPattern(dummy->Evaluate(ctx), pattern);
+        std::vector<std::map<TTermID, std::vector<uint32_t>>> matches;
+        std::optional<TDocs<MaxDocCount>> docs;
+        for (const auto& piece: pieces) {
+            matches.push_back(MatchTerms(piece));
+
+            std::vector<TTermID> termIDs;
+            for (const auto& [termID, _]: matches.back()) {
+                termIDs.push_back(termID);
+            }
+            TDocs<MaxDocCount> pieceDocs;
+            for (const auto& [_, termDocs]: LSMTree.ReadPoints(termIDs)) {
+                pieceDocs.Or(termDocs);
+            }
+            docs = docs ? docs->And(pieceDocs) : pieceDocs;
+        }
+
+        // a single piece can't be out of order
+        if (pieces.size() == 1 || docs->GetIDs().empty()) {
+            return docs.value();
+        }
+        return MatchOrder(docs.value(), pieces, matches);
     }
 
     TDocs<MaxDocCount> FindDocsByPrefix(const std::string& prefix) {
         return FindDocsByPattern(prefix + "*");
     }
 
+    std::optional<TDocument> GetDocument(std::size_t docID) {
+        auto text = DocumentStore.Get(docID);
+        if (!text) {
+            return std::nullopt;
+        }
+        return TDocument{.ID = docID, .Text = std::move(text.value())};
+    }
+
+    // text around the first occurrence of the first pattern piece, the whole text if there is no such piece
+    std::optional<std::string> GetSnippet(std::size_t docID, const std::string& pattern, std::size_t radius = SNIPPET_RADIUS) {
+        auto text = DocumentStore.Get(docID);
+        if (!text) {
+            return std::nullopt;
+        }
+
+        auto pieces = SplitPattern(pattern);
+        if (pieces.empty() || text->size() <= 2 * radius) {
+            return text;
+        }
+
+        std::string lowered = text.value();
+        std::transform(lowered.begin(), lowered.end(), lowered.begin(), [](unsigned char c) { return NText::CHAR_TABLE.Lower[c]; });
+        auto found = lowered.find(pieces.front().Text);
+        std::size_t center = found == std::string::npos ? 0 : found;
+        std::size_t from = center > radius ? center - radius : 0;
+        return text->substr(from, 2 * radius);
+    }
+
+    const TDocumentStore& GetDocumentStore() const {
+        return DocumentStore;
+    }
+
 private:
-    TDocs<MaxDocCount> MatchPattern(const TDocs<MaxDocCount>& docs, const std::string& pattern) {
-        TDocs<MaxDocCount> res;
-        if (pattern.empty()) {
-            return res;
+    struct TPiece {
+        std::string Text;
+        bool AtStart = false;
+        bool AtEnd = false;
+        // the term right after the one of the previous piece
+        bool Adjacent = false;
+    };
+
+    // a match of a piece: the term position in the document and the offset inside the term
+    struct TOccurrence {
+        uint32_t Position = 0;
+        uint32_t Offset = 0;
+
+        bool operator<(const TOccurrence& other) const {
+            return std::tie(Position, Offset) < std::tie(other.Position, other.Offset);
         }
+    };
 
-        auto order = NUtils::Split(pattern, '*');
-        for (const auto& docID: docs.GetIDs()) {
-            auto& doc = docsStorage[docID];
+    // a run of the delimiters with '*' lets anything between its pieces, a run of spaces joins them
+    std::vector<TPiece> SplitPattern(const std::string& pattern) {
+        std::vector<TPiece> pieces;
+        std::string text;
+        // the run since the last piece, the pattern start is a run of spaces
+        bool wildcard = false;
+        auto addPiece = [&]() {
+            // the pieces are normalized as the indexed terms, but never dropped as stop words
+            auto processed = Processor.Process(text, TTextProcessor::TOpts(false, false, false));
+            text.clear();
+            if (processed.empty()) {
+                return;
+            }
+            if (!pieces.empty() && !wildcard) {
+                pieces.back().AtEnd = true;
+            }
+            pieces.push_back(TPiece{.Text = std::move(processed[0]), .AtStart = !wildcard, .Adjacent = !pieces.empty() && !wildcard});
+            wildcard = false;
+        };
 
-            size_t prevPos = 0;
-            for (size_t idx = 0; idx < order.size(); ++idx) {
-                if (idx > 0 && order[idx - 1] == order[idx]) {
-                    ++prevPos;
-                }
-                size_t curPos = doc.Text.find(order[idx], prevPos);
-                if ((prevPos = curPos) == std::string::npos) {
-                    break;
+        for (unsigned char c: pattern) {
+            if (c != '*' && NText::CHAR_TABLE.Class[c] != NText::ECharClass::ESeparator) {
+                text.push_back(c);
+                continue;
+            }
+            if (!text.empty()) {
+                addPiece();
+            }
+            wildcard |= c == '*';
+        }
+        if (!text.empty()) {
+            addPiece();
+        }
+
+        if (!pieces.empty()) {
+            pieces.back().AtEnd = !wildcard;
+        }
+        return pieces;
+    }
+
+    // term ID -> offsets of the piece inside the term
+    std::map<TTermID, std::vector<uint32_t>> MatchTerms(const TPiece& piece) {
+        std::map<TTermID, std::vector<uint32_t>> matches;
+        auto verify = [&](std::string_view term, TTermID termID) {
+            std::vector<uint32_t> offsets;
+            for (auto offset = term.find(piece.Text); offset != std::string_view::npos; offset = term.find(piece.Text, offset + 1)) {
+                if ((!piece.AtStart || offset == 0) && (!piece.AtEnd || offset + piece.Text.size() == term.size())) {
+                    offsets.push_back(offset);
                 }
             }
+            if (!offsets.empty()) {
+                matches.emplace(termID, std::move(offsets));
+            }
+        };
 
-            if (prevPos == std::string::npos) {
-                continue;
+        if (auto candidates = NGrams.FindCandidates(piece.Text, piece.AtStart, piece.AtEnd)) {
+            for (auto termID: candidates.value()) {
+                verify(Dictionary.GetTerm(termID), termID);
             }
+        } else {
+            // too short for a gram, the prefix range of the dictionary is still narrower than all the terms
+            Dictionary.ForEachWithPrefix(piece.AtStart ? piece.Text : std::string(), verify);
+        }
+        return matches;
+    }
 
-            if (pattern.front() != '*') {
-                auto foundID = doc.Text.find(order.front());
-                if (foundID != 0 && doc.Text[foundID - 1] != ' ') {
-                    continue;
+    // The pieces have to occur one after another, the earliest end of every group of the
+    // adjacent pieces is picked greedily. A group is matched from its first piece on, as
+    // the rest of it has to follow in the next terms.
+    TDocs<MaxDocCount> MatchOrder(const TDocs<MaxDocCount>& docs, const std::vector<TPiece>& pieces, const std::vector<std::map<TTermID, std::vector<uint32_t>>>& matches) {
+        std::map<TTermID, TPostings> postingsByTerm;
+        for (const auto& pieceMatches: matches) {
+            for (const auto& [termID, _]: pieceMatches) {
+                if (!postingsByTerm.contains(termID)) {
+                    postingsByTerm.emplace(termID, NPostings::DecodePostings(PositionsLSMTree.ReadRanges(TPositionsKey::Min(termID), TPositionsKey::Max(termID))));
                 }
             }
+        }
 
-            if (pattern.back() != '*') {
-                auto foundID = doc.Text.find(order.back());
+        TDocs<MaxDocCount> res;
+        std::vector<TOccurrence> occurrences;
+        for (auto docID: docs.GetIDs()) {
+            std::optional<TOccurrence> end;
+            bool matched = true;
+            for (std::size_t idx = 0; idx < pieces.size() && matched; ) {
+                std::size_t last = idx;
+                while (last + 1 < pieces.size() && pieces[last + 1].Adjacent) {
+                    ++last;
+                }
 
-                if (foundID + order.back().size() < doc.Text.size() && doc.Text[foundID + order.back().size()] != ' ') {
-                    continue;
+                occurrences.clear();
+                for (const auto& [termID, offsets]: matches[idx]) {
+                    if (const auto* posting = FindPosting(postingsByTerm.at(termID), docID)) {
+                        for (auto position: posting->Positions) {
+                            for (auto offset: offsets) {
+                                occurrences.push_back(TOccurrence{.Position = position, .Offset = offset});
+                            }
+                        }
+                    }
                 }
+                std::sort(occurrences.begin(), occurrences.end());
+
+                std::optional<TOccurrence> next;
+                for (const auto& occurrence: occurrences) {
+                    if (end && occurrence < end.value()) {
+                        continue;
+                    }
+                    bool consecutive = true;
+                    for (std::size_t k = idx + 1; k <= last && consecutive; ++k) {
+                        consecutive = HasTermAt(postingsByTerm, matches[k], docID, occurrence.Position + (k - idx));
+                    }
+                    if (consecutive) {
+                        uint32_t offset = last == idx ? occurrence.Offset : 0;
+                        next = TOccurrence{.Position = static_cast<uint32_t>(occurrence.Position + (last - idx)), .Offset = offset + static_cast<uint32_t>(pieces[last].Text.size())};
+                        break;
+                    }
+                }
+
+                matched = next.has_value();
+                end = next;
+                idx = last + 1;
             }
 
-            res.Add(docID);
+            if (matched) {
+                res.Add(docID);
+            }
         }
-
         return res;
     }
 
-private:
-    TDocs<MaxDocCount> FindDocsByWord(const std::string& word) {
-        auto processedWord = Processor.Process(word, TTextProcessor::TOpts(false, false, false));
-        std::string searchingWord = processedWord[0];
-        if (auto maybeEntry = LSMTree.ReadPoint(searchingWord)) {
-            const auto& [_, docs] = maybeEntry.value();
-            return docs;
+    // the pool workers keep their text processor and term buffer between the chunks
+    struct TWorkerState {
+        std::optional<TTextProcessor> Processor;
+        // term -> (document ID, positions of the term in the document)
+        std::map<std::string, std::vector<std::pair<std::size_t, std::vector<uint32_t>>>> Terms;
+    };
+
+    TThreadPool& GetPool() {
+        if (!Pool) {
+            Pool = std::make_shared<TThreadPool>();
         }
+        return *Pool;
+    }
 
-        return TDocs<MaxDocCount>();
+    static const TPosting* FindPosting(const TPostings& postings, std::size_t docID) {
+        auto it = std::lower_bound(postings.begin(), postings.end(), docID, [](const TPosting& posting, std::size_t id) { return posting.DocID < id; });
+        return it == postings.end() || it->DocID != docID ? nullptr : &*it;
+    }
+
+    // one of the terms matched by a piece is at the position of the document
+    static bool HasTermAt(const std::map<TTermID, TPostings>& postingsByTerm, const std::map<TTermID, std::vector<uint32_t>>& pieceMatches, std::size_t docID, uint32_t position) {
+        for (const auto& [termID, _]: pieceMatches) {
+            const auto* posting = FindPosting(postingsByTerm.at(termID), docID);
+            if (posting && std::binary_search(posting->Positions.begin(), posting->Positions.end(), position)) {
+                return true;
+            }
+        }
+        return false;
     }
 
 private:
-    using TWord = TString<128>;
-    TLSMTree<TWord, TDocs<MaxDocCount>> LSMTree;
-    std::vector<TDocument> docsStorage;
+    using TPositionsKey = NPostings::TPositionsKey<TTermID>;
+    // the terms are neither stemmed nor stop words, outlives the trees as in TInvertedIndex
+    TTermDictionary Dictionary;
+    TLSMTree<TTermID, TDocs<MaxDocCount>> LSMTree;
+    TLSMTree<TPositionsKey, NPostings::TPositionsBlock> PositionsLSMTree;
+    TNGramIndex NGrams;
+    TDocumentStore DocumentStore;
+    TDocs<MaxDocCount> LiveDocs;
     TTextProcessor Processor;
+
+    std::shared_ptr<TThreadPool> Pool;
 };
 
-namespace NBitSliceIndex {
-    class TRangePredicate {
-    public:
-        TRangePredicate(std::size_t maxBitCount = 32)
-            : MaxBitCount(maxBitCount)
-        {}
+// Documents with a time interval, both ends are kept in the bit-sliced indices,
+// so an overlap query is two range comparisons over the slices. In memory only.
+class TInvertedDateIntervalIndex: public IIntervalIndex {
+public:
+    const static std::size_t FILTER_MAX_CANDIDATES = 1'024ull;
+
+public:
+    void AddDocument(const TDocument& doc, uint64_t intervalBegin, uint64_t intervalEnd) {
+        assert(doc.ID <= std::numeric_limits<uint32_t>::max());
+        AddInterval(doc.ID, intervalBegin, intervalEnd);
+    }
+
+    void AddInterval(uint32_t docID, uint64_t intervalBegin, uint64_t intervalEnd) override {
+        assert(intervalBegin <= intervalEnd);
 
-        std::vector<std::vector<bool>> GetPredicates(uint32_t l, uint32_t r) {
-            GetPredicatesImpl(0, std::numeric_limits<std::uint32_t>::max(), l, r);
-            return Predicates;
+        if (auto begin = Begins.Get(docID)) {
+            Statistics.Remove(begin.value(), Ends.Get(docID).value());
         }
+        Statistics.Add(intervalBegin, intervalEnd);
+        Begins.Set(docID, intervalBegin);
+        Ends.Set(docID, intervalEnd);
+    }
 
-    private:
-        void GetPredicatesImpl(
-            uint32_t curLeft,
-            uint32_t curRight,
-            uint32_t requestedLeft,
-            uint32_t requestedRight
-        ) {
-            if (curLeft > curRight || requestedLeft > requestedRight) {
-                return;
+    TBitmap FindDocsByInterval(uint64_t intervalBegin, uint64_t intervalEnd) const override {
+        return Begins.LessOrEqual(intervalEnd).And(Ends.GreaterOrEqual(intervalBegin));
+    }
+
+    // a few candidates are cheaper to look up than to compare all the slices
+    TBitmap FilterDocsByInterval(const TBitmap& candidates, uint64_t intervalBegin, uint64_t intervalEnd) const override {
+        if (candidates.Cardinality() > FILTER_MAX_CANDIDATES) {
+            return IIntervalIndex::FilterDocsByInterval(candidates, intervalBegin, intervalEnd);
+        }
+
+        TBitmap docs;
+        candidates.ForEach([&](uint32_t docID) {
+            auto begin = Begins.Get(docID);
+            if (begin && *begin <= intervalEnd && *Ends.Get(docID) >= intervalBegin) {
+                docs.Add(docID);
             }
+        });
+        return docs;
+    }
 
-            if (curLeft == requestedLeft && curRight == requestedRight) {
-                Predicates.push_back(Path);
-                return;
+    std::size_t EstimateDocsByInterval(uint64_t intervalBegin, uint64_t intervalEnd) const override {
+        return Statistics.Estimate(intervalBegin, intervalEnd);
+    }
+
+private:
+    TBitSlicedIndex Begins;
+    TBitSlicedIndex Ends;
+    NIntervals::TStatistics Statistics;
+};
+
+enum class EIntervalEngine {
+    // TInvertedDateIntervalIndex
+    EBitSliced,
+    // TSortedEndpointIntervalIndex
+    ESortedEndpoints,
+};
+
+// Interval fields of the documents, every field has its own engine.
+class TIntervalFieldsIndex {
+public:
+    // the fields on disk share writeBufferManager if it is set
+    TIntervalFieldsIndex(std::filesystem::path indexStoragePath, std::shared_ptr<NMemory::TWriteBufferManager> writeBufferManager = nullptr)
+        : IndexStoragePath(std::move(indexStoragePath))
+        , WriteBufferManager(std::move(writeBufferManager))
+    {}
+
+    void AddField(const std::string& field, EIntervalEngine engine) {
+        if (Fields.contains(field)) {
+            throw std::runtime_error("interval field " + field + " already exists.");
+        }
+
+        switch (engine) {
+            case EIntervalEngine::EBitSliced: {
+                Fields.emplace(field, std::make_unique<TInvertedDateIntervalIndex>());
+                break;
+            }
+            case EIntervalEngine::ESortedEndpoints: {
+                Fields.emplace(field, std::make_unique<TSortedEndpointIntervalIndex>(NUtils::EnsureDirectory(IndexStoragePath / field), WriteBufferManager));
+                break;
             }
+        }
+    }
 
-            uint32_t mid = (curLeft + curRight) / 2;
+    bool HasField(const std::string& field) const {
+        return Fields.contains(field);
+    }
+
+    void AddDocument(const std::string& field, const TDocument& doc, uint64_t intervalBegin, uint64_t intervalEnd) {
+        assert(doc.ID <= std::numeric_limits<uint32_t>::max());
+        GetField(field).AddInterval(doc.ID, intervalBegin, intervalEnd);
+    }
+
+    TBitmap FindDocsByInterval(const std::string& field, uint64_t intervalBegin, uint64_t intervalEnd) const {
+        return GetField(field).FindDocsByInterval(intervalBegin, intervalEnd);
+    }
+
+    TBitmap FilterDocsByInterval(const std::string& field, const TBitmap& candidates, uint64_t intervalBegin, uint64_t intervalEnd) const {
+        return GetField(field).FilterDocsByInterval(candidates, intervalBegin, intervalEnd);
+    }
+
+    std::size_t EstimateDocsByInterval(const std::string& field, uint64_t intervalBegin, uint64_t intervalEnd) const {
+        return GetField(field).EstimateDocsByInterval(intervalBegin, intervalEnd);
+    }
 
-            Path.push_back(false);
-            GetPredicatesImpl(curLeft, mid, requestedLeft, std::min(requestedRight, mid));
-            Path.pop_back();
+    TBitmap FindDocsByTimePoint(const std::string& field, uint64_t timestamp) const {
+        return GetField(field).FindDocsByTimePoint(timestamp);
+    }
 
-            Path.push_back(true);
-            GetPredicatesImpl(mid + 1, curRight, std::max(requestedLeft, mid + 1), requestedRight);
-            Path.pop_back();
+private:
+    IIntervalIndex& GetField(const std::string& field) const {
+        auto it = Fields.find(field);
+        if (it == Fields.end()) {
+            throw std::runtime_error("unknown interval field: " + field + ".");
         }
+        return *it->second;
+    }
 
-    private:
-        std::vector<bool> Path;
-        std::vector<std::vector<bool>> Predicates;
-        const std::size_t MaxBitCount = 0;
+private:
+    std::filesystem::path IndexStoragePath;
+    std::shared_ptr<NMemory::TWriteBufferManager> WriteBufferManager;
+    std::map<std::string, std::unique_ptr<IIntervalIndex>> Fields;
+};
+
+// Text and interval fields of the same documents behind one query interface, e.g.
+// `russia published:[1700000000 TO *]` or And("russia", Interval("published", from, to)).
+// The interval filters of an intersection only check the documents matched by the text.
+template <std::size_t MaxDocCount>
+class TSearchIndex {
+public:
+    struct TFieldInterval {
+        std::string Field;
+        uint64_t Begin = 0;
+        uint64_t End = 0;
     };
-}
 
-class TInvertedDateIntervalIndex {
 public:
-    TInvertedDateIntervalIndex() {
-        DocIDsByBitStart.resize(32);
-        DocIDsByBitEnd.resize(32);
-    }
+    // the text and the interval fields share writeBufferManager if it is set
+    TSearchIndex(
+            std::filesystem::path indexStoragePath,
+            TStopWords stopWords = TStopWords::Default(),
+            std::shared_ptr<NMemory::TWriteBufferManager> writeBufferManager = nullptr
+    )
+        : Text(NUtils::EnsureDirectory(indexStoragePath / "text"), std::move(stopWords), writeBufferManager)
+        , Intervals(NUtils::EnsureDirectory(indexStoragePath / "intervals"), std::move(writeBufferManager))
+    {}
 
-    void AddDocument(const TDocument& doc, uint32_t intervalBegin, uint32_t intervalEnd) {
-        AddedDocs.Add(doc.ID);
+    void AddField(const std::string& field, EIntervalEngine engine) {
+        Intervals.AddField(field, engine);
+    }
 
-        for (std::size_t i = 0; i < 32; ++i) {
-            if ((intervalBegin >> (32 - 1 - i)) & 1) {
-                DocIDsByBitStart[i].Add(doc.ID);
+    void AddDocument(const TDocument& doc, const std::vector<TFieldInterval>& intervals = {}) {
+        // nothing is indexed for a document with an unknown field
+        for (const auto& interval: intervals) {
+            if (!Intervals.HasField(interval.Field)) {
+                throw std::runtime_error("unknown interval field: " + interval.Field + ".");
             }
+        }
 
-            if ((intervalEnd >> (32 - 1 - i)) & 1) {
-                DocIDsByBitEnd[i].Add(doc.ID);
-            }
+        Text.AddDocument(doc);
+        for (const auto& interval: intervals) {
+            Intervals.AddDocument(interval.Field, doc, interval.Begin, interval.End);
         }
     }
 
-    TDocs<128> FindDocsByInterval(uint32_t intervalBegin, uint32_t intervalEnd) {
-        auto predicates1 = NBitSliceIndex::TRangePredicate().GetPredicates(0, intervalEnd);
-        auto intervalSuitableDocsStarts = EvaluatePredicates(predicates1, DocIDsByBitStart);
-        auto predicates2 = NBitSliceIndex::TRangePredicate().GetPredicates(intervalBegin, std::numeric_limits<uint32_t>::max());
-        auto intervalSuitableDocsEnds = EvaluatePredicates(predicates2, DocIDsByBitEnd);
-        return intervalSuitableDocsStarts.And(intervalSuitableDocsEnds);
+    TDocs<MaxDocCount> FindDocsByWord(const std::string& word) {
+        return Text.FindDocsByWord(word);
     }
 
-    TDocs<128> FindDocsByTimePoint(uint32_t timestamp) {
-        return FindDocsByInterval(timestamp, timestamp);
+    TDocs<MaxDocCount> FindDocsByPrefix(const std::string& prefix) {
+        return Text.FindDocsByPrefix(prefix);
     }
 
-private:
-    TDocs<128> EvaluatePredicates(
-        const std::vector<std::vector<bool>>& predicates,
-        const std::vector<TDocs<128>>& bitSliceIndex
-    ) {
-        TDocs<128> docs;
+    TDocs<MaxDocCount> FindDocsByFuzzy(const std::string& word, uint32_t maxDistance) {
+        return Text.FindDocsByFuzzy(word, maxDistance);
+    }
 
-        for (const auto& predicate: predicates) {
-            docs.Or(EvaluatePredicate(predicate, bitSliceIndex));
-        }
+    std::optional<TPostings> FindPostingsByWord(const std::string& word) {
+        return Text.FindPostingsByWord(word);
+    }
 
-        return docs;
+    TDocs<MaxDocCount> GetLiveDocs() const {
+        return Text.GetLiveDocs();
     }
 
-    TDocs<128> EvaluatePredicate(
-        const std::vector<bool>& predicate,
-        const std::vector<TDocs<128>>& bitSliceIndex
-    ) {
-        TDocs<128> docs = AddedDocs;
+    TDocs<MaxDocCount> FindDocsByInterval(const std::string& field, uint64_t intervalBegin, uint64_t intervalEnd) const {
+        return ToDocs(Intervals.FindDocsByInterval(field, intervalBegin, intervalEnd));
+    }
 
-        for (size_t i = 0; i < predicate.size(); ++i) {
-            if (predicate[i]) {
-                docs.And(bitSliceIndex[i]);
-            } else {
-                docs.And(bitSliceIndex[i].Not());
-            }
+    TDocs<MaxDocCount> FilterDocsByInterval(const std::string& field, uint64_t intervalBegin, uint64_t intervalEnd, const TDocs<MaxDocCount>& candidates) const {
+        TBitmap bitmap;
+        for (auto docID: candidates.GetIDs()) {
+            bitmap.Add(docID);
         }
+        return ToDocs(Intervals.FilterDocsByInterval(field, bitmap, intervalBegin, intervalEnd));
+    }
 
+    std::size_t EstimateDocsByInterval(const std::string& field, uint64_t intervalBegin, uint64_t intervalEnd) const {
+        return Intervals.EstimateDocsByInterval(field, intervalBegin, intervalEnd);
+    }
+
+    TDocs<MaxDocCount> FindDocsByExpr(const std::shared_ptr<NLogicAlgebra::IASTNode>& astTree) {
+        auto ctx = Text.MakeContext();
+        ctx.FindDocsByInterval = [this](const std::string& field, uint64_t intervalBegin, uint64_t intervalEnd) {
+            return FindDocsByInterval(field, intervalBegin, intervalEnd);
+        };
+        ctx.FilterDocsByInterval = [this](const std::string& field, uint64_t intervalBegin, uint64_t intervalEnd, const TDocs<MaxDocCount>& candidates) {
+            return FilterDocsByInterval(field, intervalBegin, intervalEnd, candidates);
+        };
+        ctx.EstimateDocsByInterval = [this](const std::string& field, uint64_t intervalBegin, uint64_t intervalEnd) {
+            return EstimateDocsByInterval(field, intervalBegin, intervalEnd);
+        };
+        return astTree->Evaluate(ctx);
+    }
+
+    // see query.h for the syntax
+    TDocs<MaxDocCount> FindDocsByQuery(std::string_view query) {
+        QueryCompiler.Compile(query, CompiledQuery);
+        return QueryEvaluator.Evaluate(CompiledQuery, *this);
+    }
+
+    TInvertedIndex<MaxDocCount>& GetText() {
+        return Text;
+    }
+
+    const TIntervalFieldsIndex& GetIntervals() const {
+        return Intervals;
+    }
+
+private:
+    static TDocs<MaxDocCount> ToDocs(const TBitmap& bitmap) {
+        TDocs<MaxDocCount> docs;
+        bitmap.ForEach([&docs](uint32_t docID) {
+            docs.Add(docID);
+        });
         return docs;
     }
 
 private:
-    TDocs<128> AddedDocs;
-    std::vector<TDocs<128>> DocIDsByBitStart;
-    std::vector<TDocs<128>> DocIDsByBitEnd;
+    TInvertedIndex<MaxDocCount> Text;
+    TIntervalFieldsIndex Intervals;
+
+    NQuery::TCompiler QueryCompiler;
+    NQuery::TCompiledQuery CompiledQuery;
+    NQuery::TEvaluator QueryEvaluator;
 };
@@ -1,7 +1,13 @@
 #include <gtest/gtest.h>
+#include <map>
+#include <random>
+#include <set>
+#include <thread>
 
 #include "text_processor.h"
 #include "inverted_index.h"
+#include "parallel_indexer.h"
+#include "sharded_index.h"
 
 using namespace NLogicAlgebra;
 
@@ -29,6 +35,164 @@ TEST(TextProcessor, Basic) {
     ASSERT_EQ("give me document have sex plz", Join(processor.Process(s)));
 }
 
+TEST(TextProcessor, Tokenizer) {
+    TTextProcessor processor;
+    std::string s = "Hello,World  don't\tSTOP.the \xD0\x9F\xD1\x83 x\r\n42nd";
+
+    std::vector<std::string> tokens;
+    processor.ForEachToken(s, TTextProcessor::TOpts(false, false, false), [&tokens](std::string_view token) {
+        tokens.emplace_back(token);
+    });
+    std::vector<std::string> expected = {"helloworld", "dont", "stopthe", "x", "42nd"};
+    ASSERT_EQ(tokens, expected);
+    ASSERT_EQ(processor.Process(s, TTextProcessor::TOpts(false, false, false)), expected);
+
+    expected = {"$x$", "$xy", "xy$", "$he", "hel", "ell", "llo", "lo$"};
+    ASSERT_EQ(processor.Process("The x of xy hello", TTextProcessor::TOpts(true, false, true)), expected);
+
+    for (size_t i = 0; i < 3; ++i) {
+        ASSERT_EQ("give me document have sex plz", Join(processor.Process("give me the documentation of the\n\thaving sex plz\n\t\n")));
+    }
+}
+
+TEST(TextProcessor, StopWords) {
+    auto stopWords = TStopWords::FromFile(std::filesystem::current_path() / "static" / "stop_words" / "english");
+    ASSERT_GT(stopWords.Size(), 150);
+    for (const auto* word: {"the", "me", "ourselves", "wouldn", "y"}) {
+        ASSERT_TRUE(stopWords.Contains(word)) << word;
+    }
+    for (const auto* word: {"", "th", "them1", "document", "mee", "yy"}) {
+        ASSERT_FALSE(stopWords.Contains(word)) << word;
+    }
+
+    TTextProcessor processor(std::move(stopWords));
+    ASSERT_EQ("give document sex plz", Join(processor.Process("give me the documentation of the\n\thaving sex plz\n\t\n")));
+
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directory("./test");
+    {
+        std::ofstream fOut("./test/stop_words");
+        fOut << "# custom\n\n  Putin \r\nrussia\n";
+    }
+
+    TInvertedIndex<128> index("./test", TStopWords::FromFile("./test/stop_words"));
+    index.AddDocument(TDocument{.ID = 0, .Text = "putin the russia europe"});
+    std::vector<std::size_t> expected = {0};
+    ASSERT_EQ(index.FindDocsByWord("the").GetIDs(), expected);
+    ASSERT_EQ(index.FindDocsByExpr(Phrase("the", "russia", "europe")).GetIDs(), expected);
+    ASSERT_EQ(index.FindDocsByExpr(Phrase("europe", "the")).GetIDs(), std::vector<std::size_t>{});
+    ASSERT_THROW(TStopWords::FromFile("./test/missing"), std::runtime_error);
+}
+
+TEST(TermDictionary, Basic) {
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directory("./test");
+
+    size_t stemCalls = 0;
+    auto stem = [&stemCalls](std::string& word) {
+        ++stemCalls;
+        if (word.ends_with("s")) word.pop_back();
+    };
+
+    {
+        TTermDictionary dictionary("./test/terms");
+        auto cat = dictionary.Resolve("cats", stem);
+        ASSERT_EQ(dictionary.Resolve("cat", stem), cat);
+        ASSERT_EQ(dictionary.Resolve("cats", stem), cat);
+        ASSERT_EQ(stemCalls, 2);
+        auto dog = dictionary.Resolve("dogs", stem);
+        ASSERT_NE(dog, cat);
+        ASSERT_EQ(dictionary.Lookup("catss", stem), TTermDictionary::UNKNOWN_TERM);
+        ASSERT_EQ(dictionary.Size(), 2);
+        dictionary.Intern("category");
+        dictionary.Intern("ca");
+    }
+
+    TTermDictionary dictionary("./test/terms");
+    ASSERT_EQ(dictionary.Size(), 4);
+    ASSERT_EQ(dictionary.GetTerm(0), "cat");
+    ASSERT_EQ(dictionary.Find("dog"), 1);
+    ASSERT_EQ(dictionary.Intern("new"), 4);
+    // the synced terms are on the disk while the dictionary is open
+    dictionary.Sync();
+    ASSERT_EQ(TTermDictionary("./test/terms").Size(), 5);
+
+    std::vector<std::string> terms;
+    dictionary.ForEachWithPrefix("cat", [&terms](std::string_view term, TTermID) { terms.emplace_back(term); });
+    ASSERT_EQ(terms, std::vector<std::string>({"cat", "category"}));
+
+    std::vector<std::thread> threads;
+    std::vector<std::vector<TTermID>> ids(4);
+    for (size_t i = 0; i < ids.size(); ++i) {
+        threads.emplace_back([&dictionary, &ids, i]() {
+            for (size_t j = 0; j < 1'000; ++j) {
+                ids[i].push_back(dictionary.Resolve("w" + std::to_string(j), [](std::string&) {}));
+            }
+        });
+    }
+    for (auto& thread: threads) {
+        thread.join();
+    }
+    for (size_t i = 1; i < ids.size(); ++i) {
+        ASSERT_EQ(ids[i], ids[0]);
+    }
+    ASSERT_EQ(dictionary.Size(), 1'005);
+}
+
+TEST(TermDictionary, Trie) {
+    TTermDictionary dictionary;
+    for (const auto* term: {"car", "cart", "carbon", "cat", "dog", "do", "door", "a", "zebra"}) {
+        dictionary.Intern(term);
+    }
+
+    auto collect = [&dictionary](auto&& walk) {
+        std::vector<std::string> terms;
+        walk([&terms, &dictionary](std::string_view term, TTermID termID) {
+            EXPECT_EQ(dictionary.GetTerm(termID), term);
+            terms.emplace_back(term);
+        });
+        return terms;
+    };
+    using TTerms = std::vector<std::string>;
+
+    ASSERT_EQ(collect([&](auto f) { dictionary.ForEachWithPrefix("car", f); }), (TTerms{"car", "carbon", "cart"}));
+    ASSERT_EQ(collect([&](auto f) { dictionary.ForEachWithPrefix("", f); }).size(), 9);
+    ASSERT_EQ(collect([&](auto f) { dictionary.ForEachInRange("carb", "do", f); }), (TTerms{"carbon", "cart", "cat"}));
+    ASSERT_EQ(collect([&](auto f) { dictionary.ForEachInRange("", "b", f); }), (TTerms{"a"}));
+    ASSERT_EQ(collect([&](auto f) { dictionary.ForEachInRange("do", "dp", f); }), (TTerms{"do", "dog", "door"}));
+    ASSERT_EQ(collect([&](auto f) { dictionary.ForEachMatching("ca(r|t)", f); }), (TTerms{"car", "cat"}));
+    ASSERT_EQ(collect([&](auto f) { dictionary.ForEachMatching("d[^g]*", f); }), (TTerms{"do", "door"}));
+    ASSERT_EQ(collect([&](auto f) { dictionary.ForEachMatching(".*r.*", f); }), (TTerms{"car", "carbon", "cart", "door", "zebra"}));
+    ASSERT_EQ(collect([&](auto f) { dictionary.ForEachMatching("c.+t?", f); }), (TTerms{"car", "carbon", "cart", "cat"}));
+    ASSERT_THROW(dictionary.ForEachMatching("(ca", [](std::string_view, TTermID) {}), std::runtime_error);
+    ASSERT_EQ(collect([&](auto f) { dictionary.ForEachSimilar("cat", 1, f); }), (TTerms{"car", "cart", "cat"}));
+    ASSERT_EQ(collect([&](auto f) { dictionary.ForEachSimilar("dor", 1, f); }), (TTerms{"do", "dog", "door"}));
+    ASSERT_EQ(collect([&](auto f) { dictionary.ForEachSimilar("zbra", 1, f); }), (TTerms{"zebra"}));
+
+    // the new terms go to the trie as they are added
+    dictionary.Intern("cab");
+    ASSERT_EQ(collect([&](auto f) { dictionary.ForEachSimilar("cat", 1, f); }), (TTerms{"cab", "car", "cart", "cat"}));
+    dictionary.Intern("ca");
+    ASSERT_EQ(collect([&](auto f) { dictionary.ForEachInRange("c", "cb", f); }), (TTerms{"ca", "cab", "car", "carbon", "cart", "cat"}));
+
+    // the inserts in any order keep the walks sorted
+    TTermTrie<TTermID> trie;
+    std::vector<std::string> inserted = {"dog", "car", "do", "cart", "a", "carbon", "door"};
+    for (TTermID termID = 0; termID < inserted.size(); ++termID) {
+        trie.Insert(inserted[termID], termID);
+    }
+    trie.Insert("car", 7);
+    ASSERT_EQ(trie.Size(), 7);
+    TTerms terms;
+    std::vector<TTermID> termIDs;
+    trie.ForEachWithPrefix("", [&](std::string_view term, TTermID termID) {
+        terms.emplace_back(term);
+        termIDs.push_back(termID);
+    });
+    ASSERT_EQ(terms, (TTerms{"a", "car", "carbon", "cart", "do", "dog", "door"}));
+    ASSERT_EQ(termIDs, (std::vector<TTermID>{4, 7, 5, 3, 2, 0, 6}));
+}
+
 TDocument GetDocument(std::size_t docID) {
     std::ifstream file(std::filesystem::current_path() / "static" / "documents" /  std::to_string(docID));
     if (!file.is_open()) {
@@ -67,6 +231,393 @@ TEST(InvertedIndex, Basic) {
     ASSERT_EQ(index.FindDocsByExpr(And("russia", Or("Putin", "Podnebesny"))).GetIDs(), expected);
 }
 
+TEST(InvertedIndex, Negation) {
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directory("./test");
+
+    TInvertedIndex<128> index("./test");
+    for (size_t i = 0; i < 5; ++i) {
+        index.AddDocument(GetDocument(i));
+    }
+
+    std::vector<std::size_t> expected = {0, 2};
+    ASSERT_EQ(index.FindDocsByExpr(And("russia", Not("europe"))).GetIDs(), expected);
+    ASSERT_EQ(index.FindDocsByExpr(And(Not("putin"), Not("europe"))).GetIDs(), expected);
+    expected = {0, 2, 3};
+    ASSERT_EQ(index.FindDocsByExpr(AndNot("russia", "putin")).GetIDs(), expected);
+    expected = {2};
+    ASSERT_EQ(index.FindDocsByExpr(AndNot("russia", "putin", "Podnebesny", "europe")).GetIDs(), expected);
+    expected = {4};
+    ASSERT_EQ(index.FindDocsByExpr(Not("russia")).GetIDs(), expected);
+    expected = {};
+    ASSERT_EQ(index.FindDocsByExpr(Not(Or("russia", "europe"))).GetIDs(), expected);
+}
+
+TEST(InvertedIndex, NegationAfterReopen) {
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directory("./test");
+
+    {
+        TInvertedIndex<128> index("./test");
+        for (size_t i = 0; i < 3; ++i) {
+            index.AddDocument(GetDocument(i));
+        }
+    }
+    {
+        TInvertedIndex<128> index("./test");
+        index.AddDocuments({GetDocument(3), GetDocument(4)});
+        // the bulk runs are written after the terms they refer to
+        ASSERT_EQ(TTermDictionary("./test/terms").Size(), index.GetDictionary().Size());
+    }
+
+    TInvertedIndex<128> index("./test");
+    std::vector<std::size_t> expected = {0, 1, 2, 3, 4};
+    ASSERT_EQ(index.GetLiveDocs().GetIDs(), expected);
+    expected = {4};
+    ASSERT_EQ(index.FindDocsByExpr(Not("russia")).GetIDs(), expected);
+    expected = {0, 2, 3};
+    ASSERT_EQ(index.FindDocsByExpr(AndNot("russia", "putin")).GetIDs(), expected);
+    ASSERT_EQ(index.FindDocsByQuery("russia AND NOT putin").GetIDs(), expected);
+}
+
+TEST(InvertedIndex, PhraseAndNear) {
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directory("./test");
+
+    TInvertedIndex<128> index("./test");
+    index.AddDocument(TDocument{.ID = 0, .Text = "Vladimir Putin visited Europe"});
+    index.AddDocument(TDocument{.ID = 1, .Text = "Putin, Vladimir. Europe"});
+    index.AddDocument(TDocument{.ID = 2, .Text = "vladimir and the putin"});
+    index.AddDocument(TDocument{.ID = 3, .Text = "europe is far from russia and putin lives in russia"});
+
+    std::string repeated;
+    for (size_t i = 0; i < 100; ++i) {
+        repeated += "alpha beta ";
+    }
+    index.AddDocument(TDocument{.ID = 4, .Text = repeated + "vladimir putin"});
+
+    std::vector<std::size_t> expected = {0, 2, 4};
+    ASSERT_EQ(index.FindDocsByExpr(Phrase("vladimir", "putin")).GetIDs(), expected);
+    ASSERT_EQ(index.FindDocsByPhrase("Vladimir the Putin").GetIDs(), expected);
+    expected = {1};
+    ASSERT_EQ(index.FindDocsByExpr(Phrase("putin", "vladimir", "europe")).GetIDs(), expected);
+    expected = {0, 1, 2, 4};
+    ASSERT_EQ(index.FindDocsByExpr(Near(1, "putin", "vladimir")).GetIDs(), expected);
+    expected = {0, 1};
+    ASSERT_EQ(index.FindDocsByExpr(Near(2, "europe", "putin")).GetIDs(), expected);
+    expected = {0, 1, 3};
+    ASSERT_EQ(index.FindDocsByExpr(Near(4, "europe", "putin")).GetIDs(), expected);
+    expected = {0};
+    ASSERT_EQ(index.FindDocsByExpr(And("visited", Phrase("vladimir", "putin"))).GetIDs(), expected);
+    expected = {4};
+    ASSERT_EQ(index.FindDocsByExpr(Phrase("beta", "alpha", "beta", "vladimir")).GetIDs(), expected);
+    expected = {};
+    ASSERT_EQ(index.FindDocsByExpr(Phrase("alpha", "alpha")).GetIDs(), expected);
+
+    // a repeated word needs as many occurrences inside the window
+    expected = {3};
+    ASSERT_EQ(index.FindDocsByExpr(Near(10, "russia", "russia")).GetIDs(), expected);
+    ASSERT_EQ(index.FindDocsByQuery("\"russia russia putin\"~10").GetIDs(), expected);
+    expected = {};
+    ASSERT_EQ(index.FindDocsByExpr(Near(10, "putin", "putin")).GetIDs(), expected);
+    ASSERT_EQ(index.FindDocsByExpr(Near(1, "russia", "russia")).GetIDs(), expected);
+    ASSERT_EQ(index.FindDocsByQuery("\"putin putin\"~3").GetIDs(), expected);
+}
+
+TEST(Query, Compiler) {
+    NQuery::TCompiler compiler;
+
+    auto query = compiler.Compile("a b c OR d");
+    ASSERT_EQ(query.Nodes.size(), 6);
+    ASSERT_EQ(query.Nodes[3].Type, NQuery::ENodeType::EAnd);
+    ASSERT_EQ(query.Nodes[3].Count, 3);
+    ASSERT_EQ(query.Nodes[5].Type, NQuery::ENodeType::EOr);
+    ASSERT_EQ(query.Nodes[5].Count, 2);
+
+    query = compiler.Compile("title:\"european union\"~2 AND NOT eur*");
+    ASSERT_EQ(query.Nodes.size(), 4);
+    ASSERT_EQ(query.Nodes[0].Type, NQuery::ENodeType::ENear);
+    ASSERT_EQ(query.Nodes[0].Distance, 2);
+    ASSERT_EQ(query.View(query.Nodes[0].Field), "title");
+    ASSERT_EQ(query.View(query.Words[1]), "union");
+    ASSERT_EQ(query.Nodes[1].Type, NQuery::ENodeType::EPrefix);
+    ASSERT_EQ(query.View(query.Words[query.Nodes[1].FirstWord]), "eur");
+    ASSERT_EQ(query.Nodes[2].Type, NQuery::ENodeType::ENot);
+
+    query = compiler.Compile("russia published:[10 TO *]");
+    ASSERT_EQ(query.Nodes.size(), 3);
+    ASSERT_EQ(query.Nodes[1].Type, NQuery::ENodeType::EInterval);
+    ASSERT_EQ(query.View(query.Nodes[1].Field), "published");
+    ASSERT_EQ(query.Nodes[1].Begin, 10);
+    ASSERT_EQ(query.Nodes[1].End, std::numeric_limits<uint64_t>::max());
+
+    for (const auto* bad: {"", "(a", "a)", "a AND", "OR a", "\"a b", "\"\"", "a ~2", ":a", "NOT", "t:[1 2]", "t:[2 TO 1]", "t:[1 TO", "a~4294967296"}) {
+        ASSERT_THROW(compiler.Compile(bad), std::runtime_error) << bad;
+    }
+}
+
+TEST(InvertedIndex, Query) {
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directory("./test");
+
+    TInvertedIndex<128> index("./test");
+    for (size_t i = 0; i < 5; ++i) {
+        index.AddDocument(GetDocument(i));
+    }
+
+    std::vector<std::size_t> expected = {0, 1, 3, 4};
+    ASSERT_EQ(index.FindDocsByQuery("Podnebesny OR eUroPe").GetIDs(), expected);
+    expected = {0, 1};
+    ASSERT_EQ(index.FindDocsByQuery("russia (Putin OR Podnebesny)").GetIDs(), expected);
+    ASSERT_EQ(index.FindDocsByQuery("russia AND (Putin OR Podnebesny)").GetIDs(), expected);
+    expected = {0, 2};
+    ASSERT_EQ(index.FindDocsByQuery("russia AND NOT europe").GetIDs(), expected);
+    ASSERT_EQ(index.FindDocsByQuery("NOT putin NOT europe").GetIDs(), expected);
+    expected = {4};
+    ASSERT_EQ(index.FindDocsByQuery("NOT russia").GetIDs(), expected);
+    ASSERT_EQ(index.FindDocsByQuery("NOT NOT NOT russia").GetIDs(), expected);
+    expected = {1, 4};
+    ASSERT_EQ(index.FindDocsByQuery("Putin OR NOT russia").GetIDs(), expected);
+    ASSERT_THROW(index.FindDocsByQuery("title:russia"), std::runtime_error);
+
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directory("./test");
+
+    TInvertedIndex<128> small("./test");
+    small.AddDocument(TDocument{.ID = 0, .Text = "hello world"});
+    small.AddDocument(TDocument{.ID = 1, .Text = "help me"});
+    small.AddDocument(TDocument{.ID = 2, .Text = "world peace, hello"});
+
+    expected = {0, 1, 2};
+    ASSERT_EQ(small.FindDocsByQuery("hel*").GetIDs(), expected);
+    expected = {1};
+    ASSERT_EQ(small.FindDocsByQuery("hel* NOT world").GetIDs(), expected);
+    expected = {0};
+    ASSERT_EQ(small.FindDocsByQuery("\"hello world\"").GetIDs(), expected);
+    expected = {0, 2};
+    ASSERT_EQ(small.FindDocsByQuery("\"world hello\"~2").GetIDs(), expected);
+    ASSERT_EQ(small.FindDocsByQuery("wrold~2").GetIDs(), expected);
+    ASSERT_EQ(small.FindDocsByRegex("he(l+)o").GetIDs(), expected);
+    ASSERT_EQ(small.FindDocsByRegex("[wp].*").GetIDs(), expected);
+    ASSERT_EQ(small.FindDocsByTermRange("hello", "help").GetIDs(), expected);
+    expected = {0, 1, 2};
+    ASSERT_EQ(small.FindDocsByQuery("helo~1").GetIDs(), expected);
+    ASSERT_EQ(small.FindDocsByTermRange("h", "i").GetIDs(), expected);
+    expected = {1};
+    ASSERT_EQ(small.FindDocsByQuery("hekp~1 NOT world~0").GetIDs(), expected);
+}
+
+TEST(LogicAlgebra, Canonical) {
+    auto normalize = [](const std::string& word) {
+        std::string lowered = word;
+        std::transform(lowered.begin(), lowered.end(), lowered.begin(), ::tolower);
+        return lowered == "the" ? std::string() : lowered;
+    };
+
+    ASSERT_EQ(And("a", Or("b", "C"))->Canonical(normalize), And(Or("c", "b"), "A")->Canonical(normalize));
+    ASSERT_EQ(And("a", "a", Not("b"))->Canonical(normalize), And(Not("B"), "a")->Canonical(normalize));
+    ASSERT_EQ(Phrase("the", "a", "b")->Canonical(normalize), Phrase("a", "b")->Canonical(normalize));
+    ASSERT_EQ(Near(2, "a", "b")->Canonical(normalize), Near(2, "b", "a")->Canonical(normalize));
+    ASSERT_NE(Phrase("a", "b")->Canonical(normalize), Phrase("b", "a")->Canonical(normalize));
+    ASSERT_NE(Near(2, "a", "b")->Canonical(normalize), Near(3, "a", "b")->Canonical(normalize));
+    ASSERT_NE(AndNot("a", "b")->Canonical(normalize), AndNot("b", "a")->Canonical(normalize));
+    ASSERT_NE(And("a", "b")->Canonical(normalize), Or("a", "b")->Canonical(normalize));
+}
+
+TEST(InvertedIndex, ResultCache) {
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directory("./test");
+
+    TInvertedIndex<128> index("./test");
+    for (size_t i = 0; i < 4; ++i) {
+        index.AddDocument(GetDocument(i));
+    }
+
+    std::vector<std::size_t> expected = {0, 1, 3};
+    ASSERT_EQ(index.FindDocsByExpr(Or("Podnebesny", "eUroPe")).GetIDs(), expected);
+    ASSERT_EQ(index.FindDocsByExpr(Or("europe", "podnebesny")).GetIDs(), expected);
+    ASSERT_EQ(index.GetResultCacheStatistics().Hits, 1);
+    ASSERT_EQ(index.GetTermCacheStatistics().Misses, 2);
+
+    expected = {0, 1, 3};
+    ASSERT_EQ(index.FindDocsByExpr(And("russia", Or("europe", "Podnebesny"))).GetIDs(), expected);
+    // the planner looks every term up before the evaluation
+    ASSERT_EQ(index.GetTermCacheStatistics().Hits, 5);
+
+    auto generation = index.GetGeneration();
+    index.AddDocument(GetDocument(4));
+    ASSERT_GT(index.GetGeneration(), generation);
+
+    expected = {0, 1, 3, 4};
+    ASSERT_EQ(index.FindDocsByExpr(Or("europe", "podnebesny")).GetIDs(), expected);
+    ASSERT_EQ(index.GetResultCacheStatistics().Hits, 1);
+
+    expected = {0, 2};
+    ASSERT_EQ(index.FindDocsByQuery("russia AND NOT europe").GetIDs(), expected);
+    ASSERT_EQ(index.FindDocsByQuery("russia AND NOT europe").GetIDs(), expected);
+    ASSERT_EQ(index.GetResultCacheStatistics().Hits, 2);
+}
+
+TEST(InvertedIndex, BulkLoad) {
+    std::mt19937 g(42);
+    std::vector<std::string> vocabulary;
+    for (size_t i = 0; i < 500; ++i) {
+        vocabulary.push_back("w" + std::to_string(i));
+    }
+
+    std::vector<TDocument> docs;
+    for (size_t i = 0; i < 5; ++i) {
+        docs.push_back(GetDocument(i));
+    }
+    for (size_t i = 5; i < 128; ++i) {
+        std::string text;
+        for (size_t j = 0; j < 200; ++j) {
+            text += vocabulary[std::min(g() % vocabulary.size(), g() % vocabulary.size())] + " ";
+        }
+        docs.push_back(TDocument{.ID = i, .Text = std::move(text)});
+    }
+
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directories("./test/one");
+    std::filesystem::create_directories("./test/bulk");
+
+    TInvertedIndex<128> oneByOne("./test/one");
+    for (const auto& doc: docs) {
+        oneByOne.AddDocument(doc);
+    }
+
+    TInvertedIndex<128> bulk("./test/bulk");
+    bulk.AddDocuments({docs.begin(), docs.begin() + 60});
+    bulk.AddDocuments({docs.begin() + 60, docs.end()});
+
+    for (const auto& word: {"russia", "europe", "putin", "Podnebesny"}) {
+        ASSERT_EQ(bulk.FindDocsByWord(word).GetIDs(), oneByOne.FindDocsByWord(word).GetIDs()) << word;
+    }
+    for (size_t i = 0; i < vocabulary.size(); i += 7) {
+        ASSERT_EQ(bulk.FindDocsByWord(vocabulary[i]).GetIDs(), oneByOne.FindDocsByWord(vocabulary[i]).GetIDs()) << vocabulary[i];
+        auto phrase = Phrase(vocabulary[i], vocabulary[i / 2]);
+        ASSERT_EQ(bulk.FindDocsByExpr(phrase).GetIDs(), oneByOne.FindDocsByExpr(phrase).GetIDs()) << vocabulary[i];
+    }
+    ASSERT_EQ(bulk.FindDocsByQuery("NOT w0").GetIDs(), oneByOne.FindDocsByQuery("NOT w0").GetIDs());
+}
+
+TEST(InvertedIndex, BulkLoadOnSharedPool) {
+    std::vector<TDocument> docs;
+    for (size_t i = 0; i < 128; ++i) {
+        docs.push_back(TDocument{.ID = i, .Text = "w" + std::to_string(i % 10) + " x" + std::to_string(i % 3)});
+    }
+
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directories("./test");
+
+    // the loads run on the only worker of the pool they submit to
+    auto pool = std::make_shared<TThreadPool>(1);
+    TInvertedIndex<128> index("./test", TStopWords::Default(), nullptr, pool);
+    pool->Submit([&index, &docs]() { index.AddDocuments({docs.begin(), docs.begin() + 100}); }).get();
+    index.AddDocuments({docs.begin() + 100, docs.end()});
+
+    std::vector<std::size_t> expected;
+    for (size_t i = 0; i < 128; i += 10) {
+        expected.push_back(i);
+    }
+    ASSERT_EQ(index.FindDocsByWord("w0").GetIDs(), expected);
+    ASSERT_EQ(index.GetLiveDocs().Count(), 128);
+}
+
+TEST(InvertedIndex, ParallelIndexer) {
+    std::mt19937 g(7);
+    std::vector<TDocument> docs;
+    for (size_t i = 0; i < 128; ++i) {
+        std::string text;
+        for (size_t j = 0; j < 50; ++j) {
+            text += "w" + std::to_string(g() % 300) + " ";
+        }
+        docs.push_back(TDocument{.ID = i, .Text = std::move(text)});
+    }
+
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directories("./test/one");
+    std::filesystem::create_directories("./test/parallel");
+
+    TInvertedIndex<128> oneByOne("./test/one");
+    for (const auto& doc: docs) {
+        oneByOne.AddDocument(doc);
+    }
+
+    TInvertedIndex<128> parallel("./test/parallel");
+    {
+        TParallelIndexer indexer(parallel, 16, 32);
+        std::thread producer([&]() {
+            for (size_t i = 0; i < docs.size(); i += 2) {
+                indexer.Add(docs[i]);
+            }
+        });
+        for (size_t i = 1; i < docs.size(); i += 2) {
+            indexer.Add(docs[i]);
+        }
+        producer.join();
+        indexer.Finish();
+    }
+
+    ASSERT_EQ(parallel.GetLiveDocs().GetIDs(), oneByOne.GetLiveDocs().GetIDs());
+    for (size_t i = 0; i < 300; i += 3) {
+        auto word = "w" + std::to_string(i);
+        ASSERT_EQ(parallel.FindDocsByWord(word).GetIDs(), oneByOne.FindDocsByWord(word).GetIDs()) << word;
+        auto phrase = Phrase(word, "w" + std::to_string(i + 1));
+        ASSERT_EQ(parallel.FindDocsByExpr(phrase).GetIDs(), oneByOne.FindDocsByExpr(phrase).GetIDs()) << word;
+    }
+}
+
+TEST(TShardedIndex, ScatterGather) {
+    std::mt19937 g(11);
+    std::vector<TDocument> docs;
+    for (size_t i = 0; i < 128; ++i) {
+        std::string text;
+        for (size_t j = 0; j < 40; ++j) {
+            text += "w" + std::to_string(std::min(g() % 200, g() % 200)) + " ";
+        }
+        docs.push_back(TDocument{.ID = i, .Text = std::move(text)});
+    }
+
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directories("./test/one");
+    TInvertedIndex<128> one("./test/one");
+    one.AddDocuments(docs);
+
+    for (auto partition: {EShardPartition::EHash, EShardPartition::ERange}) {
+        auto root = std::filesystem::path("./test") / (partition == EShardPartition::EHash ? "hash" : "range");
+        TShardedIndex<128> sharded({root / "0", root / "1", root / "2"}, partition);
+        sharded.AddDocuments({docs.begin(), docs.begin() + 100});
+        for (size_t i = 100; i < docs.size(); ++i) {
+            sharded.AddDocument(docs[i]);
+        }
+
+        ASSERT_EQ(sharded.GetLiveDocs().GetIDs(), one.GetLiveDocs().GetIDs());
+        for (size_t i = 0; i < 200; i += 5) {
+            auto word = "w" + std::to_string(i);
+            ASSERT_EQ(sharded.FindDocsByWord(word).GetIDs(), one.FindDocsByWord(word).GetIDs()) << word;
+            auto query = word + " AND NOT w" + std::to_string(i + 1);
+            ASSERT_EQ(sharded.FindDocsByQuery(query).GetIDs(), one.FindDocsByQuery(query).GetIDs()) << query;
+            auto phrase = Phrase(word, "w" + std::to_string(i / 2));
+            ASSERT_EQ(sharded.FindDocsByExpr(phrase).GetIDs(), one.FindDocsByExpr(phrase).GetIDs()) << word;
+        }
+
+        // the shard scores agree with the scores over the single index
+        TShardedIndex<128> single({root / "single"});
+        single.AddDocuments(docs);
+        std::vector<std::string> words = {"w3", "w50", "w120"};
+        auto top = sharded.FindTopK(words, 10);
+        auto expected = single.FindTopK(words, 10);
+        ASSERT_EQ(top.size(), 10);
+        for (size_t i = 0; i < top.size(); ++i) {
+            ASSERT_EQ(top[i].DocID, expected[i].DocID);
+            ASSERT_DOUBLE_EQ(top[i].Score, expected[i].Score);
+            ASSERT_TRUE(i == 0 || top[i - 1].Score >= top[i].Score);
+        }
+        ASSERT_TRUE(sharded.FindTopK({"nothing"}, 10).empty());
+    }
+}
+
 TDocument CreateDocument(const std::string& text) {
     static std::size_t COUNTER = 0;
     return TDocument{.ID = COUNTER++, .Text = text};
@@ -91,14 +642,193 @@ TEST(TInvertedPatternIndex, Basic) {
     ASSERT_EQ(index.FindDocsByPrefix("ell").GetIDs(), expected);
 }
 
+TEST(TInvertedPatternIndex, Wildcards) {
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directory("./test");
+
+    TInvertedPatternIndex<128> index("./test");
+    index.AddDocument(TDocument{.ID = 0, .Text = "the quick brown fox"});
+    index.AddDocument(TDocument{.ID = 1, .Text = "brown foxes are quick"});
+    index.AddDocument(TDocument{.ID = 2, .Text = "Mississippi"});
+    index.AddDocument(TDocument{.ID = 3, .Text = "a quicker brownie"});
+
+    auto find = [&index](const std::string& pattern) {
+        return index.FindDocsByPattern(pattern).GetIDs();
+    };
+    using TIDs = std::vector<std::size_t>;
+
+    ASSERT_EQ(find("*ick*"), (TIDs{0, 1, 3}));
+    ASSERT_EQ(find("*ick"), (TIDs{0, 1}));
+    ASSERT_EQ(find("qu*k"), (TIDs{0, 1}));
+    ASSERT_EQ(find("*own*fox*"), (TIDs{0, 1}));
+    ASSERT_EQ(find("quick*brown*"), (TIDs{0, 3}));
+    ASSERT_EQ(find("brown*quick"), (TIDs{1}));
+    ASSERT_EQ(find("*fox"), (TIDs{0}));
+    ASSERT_EQ(find("m*ss*ss*pi"), (TIDs{2}));
+    ASSERT_EQ(find("m*ss*ss*ss*"), (TIDs{}));
+    ASSERT_EQ(find("*s*"), (TIDs{1, 2}));
+    ASSERT_EQ(find("brown fox"), (TIDs{0}));
+    ASSERT_EQ(find("*zz*"), (TIDs{}));
+}
+
+// the pieces split by spaces are consecutive terms as in the text
+TEST(TInvertedPatternIndex, Spaces) {
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directory("./test");
+
+    TInvertedPatternIndex<128> index("./test");
+    index.AddDocument(TDocument{.ID = 0, .Text = "the quick brown fox"});
+    index.AddDocument(TDocument{.ID = 1, .Text = "brown foxes are quick"});
+    index.AddDocument(TDocument{.ID = 2, .Text = "a quicker brownie"});
+    index.AddDocument(TDocument{.ID = 3, .Text = "brownie and a quick fox, brown, then fox"});
+    index.AddDocument(TDocument{.ID = 4, .Text = "fox one fox two"});
+
+    auto find = [&index](const std::string& pattern) {
+        return index.FindDocsByPattern(pattern).GetIDs();
+    };
+    using TIDs = std::vector<std::size_t>;
+
+    ASSERT_EQ(find("brown fox"), (TIDs{0}));
+    ASSERT_EQ(find("quick brown"), (TIDs{0}));
+    ASSERT_EQ(find("quick brown fox"), (TIDs{0}));
+    ASSERT_EQ(find("quick fo*"), (TIDs{3}));
+    ASSERT_EQ(find("*icker brown*"), (TIDs{2}));
+    ASSERT_EQ(find("brown then"), (TIDs{3}));
+    ASSERT_EQ(find("brown*fox"), (TIDs{0, 3}));
+    ASSERT_EQ(find("quick*brown then fox"), (TIDs{3}));
+    // the first occurrence of a piece isn't always followed by the rest of its group
+    ASSERT_EQ(find("fox two"), (TIDs{4}));
+    ASSERT_EQ(find("*ox t*"), (TIDs{4}));
+}
+
+TEST(TInvertedPatternIndex, Reopen) {
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directory("./test");
+
+    std::string longText;
+    for (size_t i = 0; i < 100; ++i) {
+        longText += "filler" + std::to_string(i) + " ";
+    }
+    longText += "needle";
+
+    {
+        TInvertedPatternIndex<128> index("./test");
+        index.AddDocument(TDocument{.ID = 0, .Text = "the quick brown fox"});
+        index.AddDocument(TDocument{.ID = 1, .Text = "brown foxes are quick"});
+        index.AddDocument(TDocument{.ID = 2, .Text = longText});
+    }
+
+    TInvertedPatternIndex<128> index("./test");
+    index.AddDocument(TDocument{.ID = 3, .Text = "a quicker brownie"});
+
+    using TIDs = std::vector<std::size_t>;
+    ASSERT_EQ(index.FindDocsByPattern("*ick*").GetIDs(), (TIDs{0, 1, 3}));
+    ASSERT_EQ(index.FindDocsByPattern("quick*brown*").GetIDs(), (TIDs{0, 3}));
+    ASSERT_EQ(index.FindDocsByPattern("*").GetIDs(), (TIDs{0, 1, 2, 3}));
+    ASSERT_EQ(index.GetDocument(1).value().Text, "brown foxes are quick");
+    ASSERT_EQ(index.GetDocument(3).value().Text, "a quicker brownie");
+    ASSERT_FALSE(index.GetDocument(4).has_value());
+
+    auto snippet = index.GetSnippet(2, "*eedl*", 16).value();
+    ASSERT_EQ(snippet.size(), 21);
+    ASSERT_TRUE(snippet.ends_with("needle")) << snippet;
+}
+
+TEST(TInvertedPatternIndex, BulkLoad) {
+    std::mt19937 g(7);
+    std::vector<std::string> vocabulary;
+    for (size_t i = 0; i < 300; ++i) {
+        vocabulary.push_back("term" + std::to_string(i));
+    }
+
+    std::vector<TDocument> docs;
+    for (size_t i = 0; i < 128; ++i) {
+        std::string text;
+        for (size_t j = 0; j < 100; ++j) {
+            text += vocabulary[std::min(g() % vocabulary.size(), g() % vocabulary.size())] + " ";
+        }
+        docs.push_back(TDocument{.ID = i, .Text = std::move(text)});
+    }
+
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directories("./test/one");
+    std::filesystem::create_directories("./test/bulk");
+
+    TInvertedPatternIndex<128> oneByOne("./test/one");
+    for (const auto& doc: docs) {
+        oneByOne.AddDocument(doc);
+    }
+
+    auto check = [&](TInvertedPatternIndex<128>& bulk) {
+        for (const auto& pattern: {"*", "term1*", "*rm29*", "term5 term*", "*7 term1*", "term42"}) {
+            ASSERT_EQ(bulk.FindDocsByPattern(pattern).GetIDs(), oneByOne.FindDocsByPattern(pattern).GetIDs()) << pattern;
+        }
+        for (size_t i = 0; i < vocabulary.size(); i += 11) {
+            auto phrase = vocabulary[i] + " " + vocabulary[i / 2];
+            ASSERT_EQ(bulk.FindDocsByPattern(phrase).GetIDs(), oneByOne.FindDocsByPattern(phrase).GetIDs()) << phrase;
+        }
+        ASSERT_EQ(bulk.GetDocument(77).value().Text, docs[77].Text);
+    };
+
+    {
+        TInvertedPatternIndex<128> bulk("./test/bulk", 3, nullptr, std::make_shared<TThreadPool>(4));
+        bulk.AddDocuments({docs.begin(), docs.begin() + 50});
+        bulk.AddDocuments({docs.begin() + 50, docs.end()});
+        check(bulk);
+    }
+
+    TInvertedPatternIndex<128> bulk("./test/bulk");
+    check(bulk);
+}
+
+TEST(DocumentStore, Basic) {
+    std::filesystem::remove_all("./test");
+
+    std::mt19937 g(3);
+    std::vector<std::string> texts;
+    for (size_t i = 0; i < 500; ++i) {
+        std::string text;
+        for (size_t j = g() % 200; j > 0; --j) {
+            text += "word" + std::to_string(g() % 50) + " ";
+        }
+        texts.push_back(std::move(text));
+    }
+
+    {
+        TDocumentStore store("./test", 4'096);
+        for (size_t i = 0; i < texts.size(); ++i) {
+            store.Put(i, texts[i]);
+        }
+        store.Put(7, "replaced");
+        ASSERT_EQ(store.Get(7).value(), "replaced");
+        ASSERT_EQ(store.Get(texts.size() - 1).value(), texts.back());
+        ASSERT_GT(store.GetCompressionRatio(), 1.5);
+    }
+    texts[7] = "replaced";
+
+    TDocumentStore store("./test", 4'096);
+    ASSERT_EQ(store.Size(), texts.size());
+    for (size_t i = 0; i < texts.size(); i += 3) {
+        ASSERT_EQ(store.Get(i).value(), texts[i]) << i;
+    }
+    for (size_t i = 1; i < texts.size(); i += 3) {
+        ASSERT_EQ(store.Get(i).value(), texts[i]) << i;
+    }
+    ASSERT_FALSE(store.Get(texts.size()).has_value());
+
+    for (const auto* raw: {"", "a", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", "abcabcabcabcabcxyzabcabc"}) {
+        ASSERT_EQ(NCompression::Decompress(NCompression::Compress(raw), std::strlen(raw)), raw);
+    }
+}
+
 TEST(TInvertedDateIntervalIndex, Basic) {
     TInvertedDateIntervalIndex index;
 
-    index.AddDocument(CreateDocument("doc1"), 0, 1);
-    index.AddDocument(CreateDocument("doc2"), 2, 3);
-    index.AddDocument(CreateDocument("doc3"), 2, 3);
-    index.AddDocument(CreateDocument("doc4"), 2, 3);
-    index.AddDocument(CreateDocument("doc5"), 5, 6);
+    index.AddDocument(TDocument{.ID = 0, .Text = "doc1"}, 0, 1);
+    index.AddDocument(TDocument{.ID = 1, .Text = "doc2"}, 2, 3);
+    index.AddDocument(TDocument{.ID = 2, .Text = "doc3"}, 2, 3);
+    index.AddDocument(TDocument{.ID = 3, .Text = "doc4"}, 2, 3);
+    index.AddDocument(TDocument{.ID = 4, .Text = "doc5"}, 5, 6);
 
     std::vector<std::size_t> expected = {0};
     ASSERT_EQ(index.FindDocsByInterval(0, 1).GetIDs(), expected);
@@ -113,3 +843,253 @@ TEST(TInvertedDateIntervalIndex, Basic) {
     ASSERT_EQ(index.FindDocsByInterval(5, 6).GetIDs(), expected);
 }
 
+TEST(TInvertedDateIntervalIndex, Large) {
+    std::mt19937_64 g(11);
+    TInvertedDateIntervalIndex index;
+    std::vector<std::tuple<uint32_t, uint64_t, uint64_t>> docs;
+    for (uint32_t i = 0; i < 20'000; ++i) {
+        uint32_t docID = i * 97 + g() % 97;
+        uint64_t begin = (g() >> 1) % (1ull << 62);
+        uint64_t end = begin + g() % (1ull << 40);
+        docs.emplace_back(docID, begin, end);
+        index.AddDocument(TDocument{.ID = docID, .Text = ""}, begin, end);
+    }
+
+    for (size_t query = 0; query < 20; ++query) {
+        uint64_t begin = (g() >> 1) % (1ull << 62);
+        uint64_t end = begin + g() % (1ull << 58);
+        std::vector<std::size_t> expected;
+        for (const auto& [docID, docBegin, docEnd]: docs) {
+            if (docBegin <= end && begin <= docEnd) {
+                expected.push_back(docID);
+            }
+        }
+        ASSERT_EQ(index.FindDocsByInterval(begin, end).GetIDs(), expected);
+    }
+
+    const auto& [docID, begin, end] = docs[123];
+    ASSERT_TRUE(index.FindDocsByTimePoint(begin).Contains(docID));
+    ASSERT_TRUE(index.FindDocsByTimePoint(end).Contains(docID));
+}
+
+TEST(TIntervalFieldsIndex, Engines) {
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directory("./test");
+
+    std::mt19937_64 g(17);
+    std::map<uint32_t, std::pair<uint64_t, uint64_t>> intervals;
+    std::size_t estimate = 0;
+    auto check = [&intervals, &g](const TIntervalFieldsIndex& index) {
+        for (size_t query = 0; query < 50; ++query) {
+            uint64_t begin = g() % 1'000'000;
+            uint64_t end = begin + g() % (query % 2 ? 10 : 100'000);
+            std::vector<std::size_t> expected;
+            for (const auto& [docID, interval]: intervals) {
+                if (interval.first <= end && begin <= interval.second) {
+                    expected.push_back(docID);
+                }
+            }
+            ASSERT_EQ(index.FindDocsByInterval("bsi", begin, end).GetIDs(), expected);
+            ASSERT_EQ(index.FindDocsByInterval("sorted", begin, end).GetIDs(), expected);
+
+            TBitmap candidates;
+            std::vector<std::size_t> filtered;
+            // both the lookups of a few candidates and the scan for many
+            for (uint32_t docID = query; docID < 30'000; docID += query % 3 ? 97 : 1'009) {
+                candidates.Add(docID);
+            }
+            std::copy_if(expected.begin(), expected.end(), std::back_inserter(filtered), [&candidates](std::size_t docID) { return candidates.Contains(docID); });
+            ASSERT_EQ(index.FilterDocsByInterval("bsi", candidates, begin, end).GetIDs(), filtered);
+            ASSERT_EQ(index.FilterDocsByInterval("sorted", candidates, begin, end).GetIDs(), filtered);
+        }
+    };
+
+    {
+        TIntervalFieldsIndex index("./test");
+        index.AddField("bsi", EIntervalEngine::EBitSliced);
+        index.AddField("sorted", EIntervalEngine::ESortedEndpoints);
+        ASSERT_THROW(index.AddField("bsi", EIntervalEngine::ESortedEndpoints), std::runtime_error);
+        ASSERT_THROW(index.FindDocsByTimePoint("unknown", 0), std::runtime_error);
+
+        for (uint32_t docID = 0; docID < 30'000; ++docID) {
+            uint64_t begin = g() % 1'000'000;
+            // mostly short intervals with a few long ones
+            uint64_t end = begin + (docID % 100 == 0 ? g() % 500'000 : g() % 1'000);
+            // some documents are updated
+            if (docID % 7 == 0) {
+                index.AddDocument("sorted", TDocument{.ID = docID, .Text = ""}, end, end + 1);
+            }
+            intervals[docID] = {begin, end};
+            index.AddDocument("bsi", TDocument{.ID = docID, .Text = ""}, begin, end);
+            index.AddDocument("sorted", TDocument{.ID = docID, .Text = ""}, begin, end);
+        }
+        check(index);
+
+        // the begins are uniform, a tenth of the range holds about a tenth of the intervals,
+        // the bounds of the sorted one are widened by the replaced intervals
+        ASSERT_NEAR(index.EstimateDocsByInterval("bsi", 0, 99'999), 3'000, 300);
+        ASSERT_NEAR(index.EstimateDocsByInterval("sorted", 0, 99'999), 3'000, 1'000);
+        ASSERT_EQ(index.EstimateDocsByInterval("bsi", 2'000'000, 3'000'000), 0);
+        estimate = index.EstimateDocsByInterval("sorted", 0, 99'999);
+    }
+
+    // only the sorted endpoints engine is persistent
+    TIntervalFieldsIndex index("./test");
+    index.AddField("bsi", EIntervalEngine::EBitSliced);
+    index.AddField("sorted", EIntervalEngine::ESortedEndpoints);
+    for (const auto& [docID, interval]: intervals) {
+        index.AddDocument("bsi", TDocument{.ID = docID, .Text = ""}, interval.first, interval.second);
+    }
+    check(index);
+    ASSERT_EQ(index.EstimateDocsByInterval("sorted", 0, 99'999), estimate);
+}
+
+TEST(LogicAlgebra, Planner) {
+    using namespace NLogicAlgebra;
+
+    std::vector<std::string> calls;
+    IASTNode::TContext ctx([&calls](std::string word) {
+        calls.push_back(word);
+        return TDocs<128>();
+    });
+    ctx.FindDocsByInterval = [&calls](const std::string& field, uint64_t, uint64_t) {
+        calls.push_back(field);
+        TDocs<128> docs;
+        docs.Add(1);
+        return docs;
+    };
+    ctx.FilterDocsByInterval = [&calls](const std::string& field, uint64_t, uint64_t, const TDocs<128>& candidates) {
+        calls.push_back("filter " + field);
+        return candidates;
+    };
+
+    // without the estimates the intervals go last
+    auto expr = And("common", Interval("narrow", 0, 1), "rare");
+    expr->Evaluate(ctx);
+    ASSERT_EQ(calls, (std::vector<std::string>{"common"}));
+
+    std::map<std::string, std::size_t> estimates = {{"common", 100}, {"rare", 10}, {"narrow", 1}};
+    ctx.EstimateDocsByWord = [&estimates](const std::string& word) {
+        return estimates.at(word);
+    };
+    ctx.EstimateDocsByInterval = [&estimates](const std::string& field, uint64_t, uint64_t) {
+        return estimates.at(field);
+    };
+    calls.clear();
+    expr->Evaluate(ctx);
+    ASSERT_EQ(calls, (std::vector<std::string>{"narrow", "rare"}));
+
+    // an interval after a smaller child checks its documents
+    estimates["narrow"] = 50;
+    calls.clear();
+    And("rare", Interval("narrow", 0, 1))->Evaluate(ctx);
+    ASSERT_EQ(calls, (std::vector<std::string>{"rare"}));
+    ctx.FindDocsByWord = [&calls](std::string word) {
+        calls.push_back(word);
+        TDocs<128> docs;
+        docs.Add(1);
+        return docs;
+    };
+    calls.clear();
+    And("rare", Interval("narrow", 0, 1))->Evaluate(ctx);
+    ASSERT_EQ(calls, (std::vector<std::string>{"rare", "filter narrow"}));
+    ASSERT_EQ(And("rare", Or("common", "narrow"))->EstimateCardinality(ctx), 10);
+}
+
+TEST(TSearchIndex, TextAndIntervals) {
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directory("./test");
+
+    // the text, the interval fields on disk and the patterns share one budget
+    const std::size_t LIMIT = 256ull << 10;
+    auto manager = std::make_shared<NMemory::TWriteBufferManager>(LIMIT);
+    TSearchIndex<128> index("./test", TStopWords::Default(), manager);
+    std::size_t textUsage = manager->GetUsage();
+    ASSERT_GT(textUsage, 0);
+    index.AddField("published", EIntervalEngine::EBitSliced);
+    ASSERT_EQ(manager->GetUsage(), textUsage);
+    index.AddField("valid", EIntervalEngine::ESortedEndpoints);
+    ASSERT_GT(manager->GetUsage(), textUsage);
+    for (size_t i = 0; i < 100; ++i) {
+        std::string text = i % 2 ? "russia news" : "europe news";
+        uint64_t published = i * 3'600;
+        index.AddDocument(TDocument{.ID = i, .Text = text}, {{"published", published, published}, {"valid", published, published + 10 * 3'600}});
+    }
+    std::size_t searchUsage = manager->GetUsage();
+    TInvertedPatternIndex<128> patterns(NUtils::EnsureDirectory("./test/patterns"), 3, manager);
+    patterns.AddDocument(CreateDocument("russia news"));
+    ASSERT_GT(manager->GetUsage(), searchUsage);
+    ASSERT_LE(manager->GetUsage(), LIMIT);
+    ASSERT_THROW(index.AddDocument(TDocument{.ID = 100, .Text = "russia"}, {{"unknown", 0, 0}}), std::runtime_error);
+    ASSERT_TRUE(index.FindDocsByWord("russia").GetIDs().size() == 50);
+
+    using namespace NLogicAlgebra;
+    // russia in the last day
+    std::vector<std::size_t> expected = {77, 79, 81, 83, 85, 87, 89, 91, 93, 95, 97, 99};
+    ASSERT_EQ(index.FindDocsByExpr(And("russia", Interval("published", 76 * 3'600, 99 * 3'600))).GetIDs(), expected);
+    ASSERT_EQ(index.FindDocsByQuery("russia published:[273600 TO *]").GetIDs(), expected);
+    ASSERT_EQ(index.FindDocsByQuery("published:[273600 TO *] AND russia").GetIDs(), expected);
+    ASSERT_EQ(index.FindDocsByQuery("russia NOT published:[* TO 273599]").GetIDs(), expected);
+
+    expected = {0, 2, 4, 6, 8, 10};
+    ASSERT_EQ(index.FindDocsByQuery("europe valid:[* TO 36000]").GetIDs(), expected);
+    ASSERT_EQ(index.FindDocsByExpr(And(Interval("valid", 0, 36'000), Not("russia"))).GetIDs(), expected);
+    ASSERT_EQ(index.FindDocsByQuery("published:[0 TO 3600] OR valid:[356400 TO 356400]").GetIDs(), (std::vector<std::size_t>{0, 1, 89, 90, 91, 92, 93, 94, 95, 96, 97, 98, 99}));
+    ASSERT_TRUE(index.FindDocsByQuery("missing published:[0 TO *]").GetIDs().empty());
+    ASSERT_THROW(index.FindDocsByQuery("russia unknown:[0 TO 1]"), std::runtime_error);
+
+    TInvertedIndex<128> text(NUtils::EnsureDirectory("./test/plain"));
+    ASSERT_THROW(text.FindDocsByQuery("published:[0 TO 1]"), std::runtime_error);
+}
+
+TEST(Bitmap, Basic) {
+    std::mt19937 g(5);
+    std::set<uint32_t> lhsIDs, rhsIDs;
+    TBitmap lhs, rhs;
+    for (size_t i = 0; i < 30'000; ++i) {
+        // dense and sparse groups
+        uint32_t id = i % 2 ? g() % 70'000 : g();
+        lhsIDs.insert(id);
+        lhs.Add(id);
+        id = i % 3 ? g() % 70'000 : g();
+        rhsIDs.insert(id);
+        rhs.Add(id);
+    }
+    for (size_t i = 0; i < 5'000; ++i) {
+        uint32_t id = g() % 70'000;
+        lhsIDs.erase(id);
+        lhs.Remove(id);
+    }
+
+    auto toVector = [](const std::set<uint32_t>& ids) { return std::vector<std::size_t>(ids.begin(), ids.end()); };
+    ASSERT_EQ(lhs.GetIDs(), toVector(lhsIDs));
+    ASSERT_EQ(lhs.Cardinality(), lhsIDs.size());
+
+    TBitmap dense;
+    for (uint32_t id = 0; id < 1'000'000; ++id) {
+        dense.Add(id);
+    }
+    ASSERT_EQ(dense.Cardinality(), 1'000'000);
+    // 16 full bitmap groups of 8 KiB
+    ASSERT_LT(dense.GetByteSize(), 140'000);
+
+    std::set<uint32_t> expected;
+    std::set_intersection(lhsIDs.begin(), lhsIDs.end(), rhsIDs.begin(), rhsIDs.end(), std::inserter(expected, expected.end()));
+    ASSERT_EQ(TBitmap(lhs).And(rhs).GetIDs(), toVector(expected));
+    expected.clear();
+    std::set_union(lhsIDs.begin(), lhsIDs.end(), rhsIDs.begin(), rhsIDs.end(), std::inserter(expected, expected.end()));
+    ASSERT_EQ(TBitmap(lhs).Or(rhs).GetIDs(), toVector(expected));
+    expected.clear();
+    std::set_difference(lhsIDs.begin(), lhsIDs.end(), rhsIDs.begin(), rhsIDs.end(), std::inserter(expected, expected.end()));
+    ASSERT_EQ(TBitmap(lhs).AndNot(rhs).GetIDs(), toVector(expected));
+
+    TBitSlicedIndex bsi;
+    bsi.Set(7, 100);
+    bsi.Set(8, 5);
+    bsi.Set(7, 3);
+    ASSERT_EQ(bsi.Get(7), 3);
+    ASSERT_EQ(bsi.Between(0, 4).GetIDs(), std::vector<std::size_t>{7});
+    ASSERT_EQ(bsi.Between(4, 1ull << 63).GetIDs(), std::vector<std::size_t>{8});
+    ASSERT_TRUE(bsi.Between(6, 1'000).Empty());
+    ASSERT_EQ(bsi.Equal(5).GetIDs(), std::vector<std::size_t>{8});
+}
@@ -1,7 +1,16 @@
 #pragma once
 
 #include "docs.h"
+#include "postings.h"
+#include "../lsm/trace.h"
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <limits>
 #include <memory>
+#include <optional>
+#include <stdexcept>
+#include <tuple>
 
 namespace NLogicAlgebra {
     class IASTNode {
@@ -16,15 +25,66 @@ namespace NLogicAlgebra {
 
     public:
         struct TContext {
-            TContext(const std::function<TDocs<128>(std::string)> & findDocsByWord)
+            TContext(
+                const std::function<TDocs<128>(std::string)>& findDocsByWord,
+                const std::function<std::optional<TPostings>(std::string)>& findPostingsByWord = {},
+                const std::function<TDocs<128>()>& liveDocs = {}
+            )
                 : FindDocsByWord(findDocsByWord)
+                , FindPostingsByWord(findPostingsByWord)
+                , LiveDocs(liveDocs)
             {}
 
+            TDocs<128> GetLiveDocs() const {
+                if (LiveDocs) {
+                    return LiveDocs();
+                }
+
+                TDocs<128> docs;
+                docs.SetAll();
+                return docs;
+            }
+
             std::function<TDocs<128>(std::string)> FindDocsByWord;
+            // std::nullopt if the word is dropped by the text processing (e.g. a stop word)
+            std::function<std::optional<TPostings>(std::string)> FindPostingsByWord;
+            // documents the negation is relative to, every possible ID if not set
+            std::function<TDocs<128>()> LiveDocs;
+            // documents with the interval of the field intersecting [begin, end]
+            std::function<TDocs<128>(const std::string& field, uint64_t begin, uint64_t end)> FindDocsByInterval;
+            // the same restricted to the candidates, for the filters pushed down below a selective AND
+            std::function<TDocs<128>(const std::string& field, uint64_t begin, uint64_t end, const TDocs<128>& candidates)> FilterDocsByInterval;
+            // the expected result sizes for the planner, unknown if not set
+            std::function<std::size_t(const std::string& word)> EstimateDocsByWord;
+            std::function<std::size_t(const std::string& field, uint64_t begin, uint64_t end)> EstimateDocsByInterval;
         };
 
+        const static std::size_t UNKNOWN_CARDINALITY = std::numeric_limits<std::size_t>::max();
+
         virtual TDocs<128> Evaluate(TContext& ctx) = 0;
 
+        // maps a query word to its indexed form, empty if the word is not indexed
+        using TNormalizer = std::function<std::string(const std::string&)>;
+
+        // equal for the expressions that differ only in the order of commutative
+        // children and in the word forms, so it can be used as a cache key
+        virtual std::string Canonical(const TNormalizer& normalize) const = 0;
+
+        // relative evaluation cost, the cheaper children of an intersection go first
+        virtual std::size_t GetCost() const {
+            std::size_t cost = 1;
+            for (const auto& child: Children) {
+                if (child == nullptr) continue;
+                cost += child->GetCost();
+            }
+            return cost;
+        }
+
+        // the expected number of the documents, the smaller children of an intersection go first
+        virtual std::size_t EstimateCardinality(const TContext& ctx) const {
+            return UNKNOWN_CARDINALITY;
+        }
+
         const std::vector<std::shared_ptr<IASTNode>>& ChildrenView() const {
             return Children;
         }
@@ -34,6 +94,28 @@ namespace NLogicAlgebra {
             return Children[idx];
         }
 
+    protected:
+        static std::string JoinCanonical(const std::string& name, const std::vector<std::string>& parts) {
+            std::string result = name + "(";
+            for (size_t i = 0; i < parts.size(); ++i) {
+                if (i > 0) result += ",";
+                result += parts[i];
+            }
+            return result + ")";
+        }
+
+        // sorted and deduplicated, for the commutative and idempotent operations
+        std::vector<std::string> CanonicalChildren(const TNormalizer& normalize, size_t from = 0) const {
+            std::vector<std::string> parts;
+            for (size_t i = from; i < Children.size(); ++i) {
+                if (Children[i] == nullptr) continue;
+                parts.push_back(Children[i]->Canonical(normalize));
+            }
+            std::sort(parts.begin(), parts.end());
+            parts.erase(std::unique(parts.begin(), parts.end()), parts.end());
+            return parts;
+        }
+
     protected:
         std::vector<std::shared_ptr<IASTNode>> Children;
     };
@@ -45,14 +127,91 @@ namespace NLogicAlgebra {
         {}
 
         TDocs<128> Evaluate(TContext& ctx) override {
+            NTRACE_SPAN("query", "Literal");
             auto res = ctx.FindDocsByWord(Word);
             return res;
         }
 
+        std::string Canonical(const TNormalizer& normalize) const override {
+            return JoinCanonical("w", {normalize(Word)});
+        }
+
+        std::size_t EstimateCardinality(const TContext& ctx) const override {
+            return ctx.EstimateDocsByWord ? ctx.EstimateDocsByWord(Word) : UNKNOWN_CARDINALITY;
+        }
+
     private:
         std::string Word;
     };
 
+    class TNot : public IASTNode {
+    public:
+        TNot(std::shared_ptr<IASTNode> child)
+                : IASTNode({std::move(child)})
+        {}
+
+        TDocs<128> Evaluate(TContext& ctx) override {
+            NTRACE_SPAN("query", "Not");
+            return ctx.GetLiveDocs().AndNot(this->Children[0]->Evaluate(ctx));
+        }
+
+        std::string Canonical(const TNormalizer& normalize) const override {
+            return JoinCanonical("not", {this->Children[0]->Canonical(normalize)});
+        }
+    };
+
+    // documents with the interval of the field intersecting [Begin, End]
+    class TInterval : public IASTNode {
+    public:
+        const static std::size_t INTERVAL_COST = 64ull;
+
+    public:
+        TInterval(std::string field, uint64_t begin, uint64_t end)
+                : Field(std::move(field))
+                , Begin(begin)
+                , End(end)
+        {}
+
+        TDocs<128> Evaluate(TContext& ctx) override {
+            NTRACE_SPAN("query", "Interval");
+            if (!ctx.FindDocsByInterval) {
+                throw std::runtime_error("intervals are not available in the context.");
+            }
+            return ctx.FindDocsByInterval(Field, Begin, End);
+        }
+
+        // the candidates which satisfy the interval
+        TDocs<128> Filter(TContext& ctx, const TDocs<128>& candidates) {
+            if (!ctx.FilterDocsByInterval) {
+                return Evaluate(ctx).And(candidates);
+            }
+            return ctx.FilterDocsByInterval(Field, Begin, End, candidates);
+        }
+
+        // a scan over the field instead of a posting lookup
+        std::size_t GetCost() const override {
+            return INTERVAL_COST;
+        }
+
+        std::size_t EstimateCardinality(const TContext& ctx) const override {
+            return ctx.EstimateDocsByInterval ? ctx.EstimateDocsByInterval(Field, Begin, End) : UNKNOWN_CARDINALITY;
+        }
+
+        std::string Canonical(const TNormalizer& normalize) const override {
+            return JoinCanonical("interval", {Field, std::to_string(Begin), std::to_string(End)});
+        }
+
+    private:
+        std::string Field;
+        uint64_t Begin;
+        uint64_t End;
+    };
+
+    // Children of TNot type are subtracted from the intersection of the rest
+    // instead of intersecting with their complement. The rest are evaluated from
+    // the smallest estimated result, the cheapest among the unknown ones, an interval
+    // after the first child only checks the documents left so far, the evaluation
+    // stops as soon as nothing is left.
     class TAnd : public IASTNode {
     public:
         TAnd(std::vector<std::shared_ptr<IASTNode>> children)
@@ -60,15 +219,96 @@ namespace NLogicAlgebra {
         {}
 
         TDocs<128> Evaluate(TContext& ctx) override {
-            TDocs<128> result;
-            result.SetAll();
+            NTRACE_SPAN("query", "And");
+            std::optional<TDocs<128>> result;
+            std::vector<std::shared_ptr<IASTNode>> excluded;
+
+            struct TPlanned {
+                std::shared_ptr<IASTNode> Node;
+                std::size_t Cardinality;
+                std::size_t Cost;
+            };
+            std::vector<TPlanned> included;
 
             for (auto& child: this->Children) {
                 if (child == nullptr) continue;
-                result.And(child->Evaluate(ctx));
+                if (std::dynamic_pointer_cast<TNot>(child)) {
+                    excluded.push_back(child->Child(0));
+                } else {
+                    included.push_back(TPlanned{child, child->EstimateCardinality(ctx), child->GetCost()});
+                }
+            }
+            std::stable_sort(included.begin(), included.end(), [](const auto& lhs, const auto& rhs) {
+                return std::tie(lhs.Cardinality, lhs.Cost) < std::tie(rhs.Cardinality, rhs.Cost);
+            });
+
+            for (auto& [child, _, __]: included) {
+                auto filter = std::dynamic_pointer_cast<TInterval>(child);
+                if (!result) {
+                    result = child->Evaluate(ctx);
+                } else if (filter) {
+                    result = filter->Filter(ctx, result.value());
+                } else {
+                    result->And(child->Evaluate(ctx));
+                }
+                if (result->Empty()) {
+                    return result.value();
+                }
+            }
+
+            if (!result) {
+                result = ctx.GetLiveDocs();
+            }
+
+            for (auto& child: excluded) {
+                result->AndNot(child->Evaluate(ctx));
+            }
+            return result.value();
+        }
+
+        std::string Canonical(const TNormalizer& normalize) const override {
+            return JoinCanonical("and", CanonicalChildren(normalize));
+        }
+
+        // at most the smallest child
+        std::size_t EstimateCardinality(const TContext& ctx) const override {
+            std::size_t cardinality = UNKNOWN_CARDINALITY;
+            for (const auto& child: this->Children) {
+                if (child == nullptr || std::dynamic_pointer_cast<TNot>(child)) continue;
+                cardinality = std::min(cardinality, child->EstimateCardinality(ctx));
+            }
+            return cardinality;
+        }
+    };
+
+    // the first child without the rest
+    class TAndNot : public IASTNode {
+    public:
+        TAndNot(std::vector<std::shared_ptr<IASTNode>> children)
+                : IASTNode(std::move(children))
+        {}
+
+        TDocs<128> Evaluate(TContext& ctx) override {
+            NTRACE_SPAN("query", "AndNot");
+            assert(!this->Children.empty());
+
+            TDocs<128> result = this->Children[0]->Evaluate(ctx);
+            for (size_t i = 1; i < this->Children.size(); ++i) {
+                if (this->Children[i] == nullptr) continue;
+                result.AndNot(this->Children[i]->Evaluate(ctx));
             }
             return result;
         }
+
+        std::string Canonical(const TNormalizer& normalize) const override {
+            auto parts = CanonicalChildren(normalize, 1);
+            parts.insert(parts.begin(), this->Children[0]->Canonical(normalize));
+            return JoinCanonical("andnot", parts);
+        }
+
+        std::size_t EstimateCardinality(const TContext& ctx) const override {
+            return this->Children[0]->EstimateCardinality(ctx);
+        }
     };
 
     class TOr : public IASTNode {
@@ -78,6 +318,7 @@ namespace NLogicAlgebra {
         {}
 
         TDocs<128> Evaluate(TContext& ctx) override {
+            NTRACE_SPAN("query", "Or");
             TDocs<128> result;
             for (auto& child: this->Children) {
                 if (child == nullptr) continue;
@@ -85,15 +326,144 @@ namespace NLogicAlgebra {
             }
             return result;
         }
+
+        std::string Canonical(const TNormalizer& normalize) const override {
+            return JoinCanonical("or", CanonicalChildren(normalize));
+        }
+
+        // at most the sum of the children
+        std::size_t EstimateCardinality(const TContext& ctx) const override {
+            std::size_t cardinality = 0;
+            for (const auto& child: this->Children) {
+                if (child == nullptr) continue;
+                auto childCardinality = child->EstimateCardinality(ctx);
+                if (childCardinality > UNKNOWN_CARDINALITY - cardinality) {
+                    return UNKNOWN_CARDINALITY;
+                }
+                cardinality += childCardinality;
+            }
+            return cardinality;
+        }
+    };
+
+    class TPositional : public IASTNode {
+    public:
+        TPositional(std::vector<std::string> words)
+                : Words(std::move(words))
+        {}
+
+        // the positions of every word are decoded
+        std::size_t GetCost() const override {
+            return 2 * Words.size() + 1;
+        }
+
+        // at most the rarest word
+        std::size_t EstimateCardinality(const TContext& ctx) const override {
+            if (!ctx.EstimateDocsByWord) {
+                return UNKNOWN_CARDINALITY;
+            }
+            std::size_t cardinality = UNKNOWN_CARDINALITY;
+            for (const auto& word: Words) {
+                cardinality = std::min(cardinality, ctx.EstimateDocsByWord(word));
+            }
+            return cardinality;
+        }
+
+    protected:
+        template <typename TMatch>
+        TDocs<128> EvaluatePositional(TContext& ctx, TMatch&& match) const {
+            if (!ctx.FindPostingsByWord) {
+                throw std::runtime_error("positions are not available in the context.");
+            }
+
+            std::vector<TPostings> postings;
+            postings.reserve(Words.size());
+            for (const auto& word: Words) {
+                if (auto maybePostings = ctx.FindPostingsByWord(word)) {
+                    postings.push_back(std::move(maybePostings.value()));
+                }
+            }
+
+            std::vector<const TPostings*> lists;
+            for (const auto& list: postings) {
+                lists.push_back(&list);
+            }
+
+            TDocs<128> result;
+            NPostings::IntersectDocs(lists, [&](std::size_t docID, const std::vector<const TPosting*>& docPostings) {
+                if (match(docPostings)) {
+                    result.Add(docID);
+                }
+            });
+            return result;
+        }
+
+        // words dropped by the normalization do not take part in the evaluation either
+        std::vector<std::string> CanonicalWords(const TNormalizer& normalize) const {
+            std::vector<std::string> words;
+            for (const auto& word: Words) {
+                if (auto normalized = normalize(word); !normalized.empty()) {
+                    words.push_back(std::move(normalized));
+                }
+            }
+            return words;
+        }
+
+    protected:
+        std::vector<std::string> Words;
+    };
+
+    class TPhrase : public TPositional {
+    public:
+        TPhrase(std::vector<std::string> words)
+                : TPositional(std::move(words))
+        {}
+
+        TDocs<128> Evaluate(TContext& ctx) override {
+            NTRACE_SPAN("query", "Phrase");
+            return EvaluatePositional(ctx, [](const std::vector<const TPosting*>& postings) {
+                return NPostings::HasPhrase(postings);
+            });
+        }
+
+        std::string Canonical(const TNormalizer& normalize) const override {
+            return JoinCanonical("phrase", CanonicalWords(normalize));
+        }
+    };
+
+    class TNear : public TPositional {
+    public:
+        TNear(std::size_t distance, std::vector<std::string> words)
+                : TPositional(std::move(words))
+                , Distance(distance)
+        {}
+
+        TDocs<128> Evaluate(TContext& ctx) override {
+            NTRACE_SPAN("query", "Near");
+            return EvaluatePositional(ctx, [this](const std::vector<const TPosting*>& postings) {
+                return NPostings::HasNear(postings, Distance);
+            });
+        }
+
+        std::string Canonical(const TNormalizer& normalize) const override {
+            auto words = CanonicalWords(normalize);
+            std::sort(words.begin(), words.end());
+            return JoinCanonical("near" + std::to_string(Distance), words);
+        }
+
+    private:
+        std::size_t Distance;
     };
 
     // user expressions
     enum EOperation : uint64_t {
         EAnd = 0,
-        EOr = 1
+        EOr = 1,
+        ENot = 2,
+        EAndNot = 3
     };
 
-    void processArguments(std::vector<std::shared_ptr<IASTNode>>& nodeCollection) {
+    inline void processArguments(std::vector<std::shared_ptr<IASTNode>>& nodeCollection) {
     }
 
     template <typename T, typename... Args>
@@ -116,6 +486,18 @@ namespace NLogicAlgebra {
         switch (operation) {
             case EOperation::EAnd: { return std::make_shared<TAnd>(std::move(nodeCollection)); }
             case EOperation::EOr: { return std::make_shared<TOr>(std::move(nodeCollection)); }
+            case EOperation::ENot: {
+                if (nodeCollection.size() != 1) {
+                    throw std::runtime_error("not takes exactly one argument.");
+                }
+                return std::make_shared<TNot>(std::move(nodeCollection[0]));
+            }
+            case EOperation::EAndNot: {
+                if (nodeCollection.empty()) {
+                    throw std::runtime_error("and not takes at least one argument.");
+                }
+                return std::make_shared<TAndNot>(std::move(nodeCollection));
+            }
             default: throw std::runtime_error("no such operation.");
         }
 
@@ -131,4 +513,28 @@ namespace NLogicAlgebra {
     std::shared_ptr<IASTNode> Or(Args... args) {
         return Operation(EOperation::EOr, args...);
     }
+
+    template <typename Arg>
+    std::shared_ptr<IASTNode> Not(Arg arg) {
+        return Operation(EOperation::ENot, arg);
+    } // And("russia", Not("europe"))
+
+    template <typename... Args>
+    std::shared_ptr<IASTNode> AndNot(Args... args) {
+        return Operation(EOperation::EAndNot, args...);
+    } // AndNot("russia", "putin", "europe") == russia without putin and europe
+
+    template <typename... Args>
+    std::shared_ptr<IASTNode> Phrase(Args... words) {
+        return std::make_shared<TPhrase>(std::vector<std::string>{std::string(std::move(words))...});
+    } // Phrase("vladimir", "putin")
+
+    template <typename... Args>
+    std::shared_ptr<IASTNode> Near(std::size_t distance, Args... words) {
+        return std::make_shared<TNear>(distance, std::vector<std::string>{std::string(std::move(words))...});
+    } // Near(3, "russia", "europe")
+
+    inline std::shared_ptr<IASTNode> Interval(std::string field, uint64_t begin, uint64_t end) {
+        return std::make_shared<TInterval>(std::move(field), begin, end);
+    } // And("russia", Interval("published", now - day, now))
 }
\ No newline at end of file
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <algorithm>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "term_dictionary.h"
+#include "text_processor.h"
+
+// n-gram -> IDs of the terms containing it, the terms are padded with the
+// boundary marker, so anchored pieces of the patterns use the boundary grams too
+class TNGramIndex {
+public:
+    explicit TNGramIndex(std::size_t n = 3)
+        : N(n)
+    {}
+
+    // the terms have to be added in the increasing order of the IDs, it keeps the lists sorted
+    void Add(std::string_view term, TTermID termID) {
+        Padded.assign(1, TTextProcessor::NGRAM_BOUNDARY);
+        Padded.append(term);
+        Padded.push_back(TTextProcessor::NGRAM_BOUNDARY);
+
+        TTextProcessor::ForEachNGram(Padded, N, [this, termID](std::string_view gram) {
+            auto& termIDs = Grams[std::string(gram)];
+            // a gram can repeat inside the term
+            if (termIDs.empty() || termIDs.back() != termID) {
+                termIDs.push_back(termID);
+            }
+        });
+    }
+
+    // Terms which may contain the piece, they have to be verified against the piece.
+    // std::nullopt if the piece is too short to have a gram, i.e. any term may contain it.
+    std::optional<std::vector<TTermID>> FindCandidates(std::string_view piece, bool atStart, bool atEnd) const {
+        std::string padded;
+        if (atStart) {
+            padded.push_back(TTextProcessor::NGRAM_BOUNDARY);
+        }
+        padded.append(piece);
+        if (atEnd) {
+            padded.push_back(TTextProcessor::NGRAM_BOUNDARY);
+        }
+        if (padded.size() < N) {
+            return std::nullopt;
+        }
+
+        std::vector<const std::vector<TTermID>*> lists;
+        bool missing = false;
+        TTextProcessor::ForEachNGram(padded, N, [this, &lists, &missing](std::string_view gram) {
+            auto it = Grams.find(std::string(gram));
+            if (it == Grams.end()) {
+                missing = true;
+                return;
+            }
+            lists.push_back(&it->second);
+        });
+        if (missing) {
+            return std::vector<TTermID>();
+        }
+
+        // the rarest gram goes first, so the intersection shrinks fast
+        std::sort(lists.begin(), lists.end(), [](const auto* lhs, const auto* rhs) { return lhs->size() < rhs->size(); });
+        std::vector<TTermID> candidates = *lists.front();
+        for (std::size_t i = 1; i < lists.size() && !candidates.empty(); ++i) {
+            std::vector<TTermID> intersection;
+            std::set_intersection(candidates.begin(), candidates.end(), lists[i]->begin(), lists[i]->end(), std::back_inserter(intersection));
+            candidates = std::move(intersection);
+        }
+        return candidates;
+    }
+
+    std::size_t GetN() const {
+        return N;
+    }
+
+    std::size_t Size() const {
+        return Grams.size();
+    }
+
+private:
+    std::size_t N;
+    std::unordered_map<std::string, std::vector<TTermID>> Grams;
+    std::string Padded;
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../lsm/thread_pool.h"
+#include "inverted_index.h"
+
+// Streams the documents into the index: the producer is throttled by the bounded
+// queue, the consumer thread gathers the documents into batches for AddDocuments.
+template <typename TIndex>
+class TParallelIndexer {
+public:
+    const static std::size_t QUEUE_SIZE = 4'096ull;
+    const static std::size_t BATCH_SIZE = 1'024ull;
+
+public:
+    explicit TParallelIndexer(TIndex& index, std::size_t queueSize = QUEUE_SIZE, std::size_t batchSize = BATCH_SIZE)
+        : Index(index)
+        , Queue(queueSize)
+        , BatchSize(std::max<std::size_t>(batchSize, 1))
+        , Consumer([this]() { Consume(); })
+    {}
+
+    ~TParallelIndexer() {
+        try {
+            Finish();
+        } catch (...) {
+        }
+    }
+
+    // blocks while the queue is full
+    void Add(TDocument doc) {
+        if (!Queue.Push(std::move(doc))) {
+            throw std::runtime_error("parallel indexer is finished.");
+        }
+    }
+
+    // waits until all the added documents are indexed, rethrows the indexing error
+    void Finish() {
+        Queue.Close();
+        if (Consumer.joinable()) {
+            Consumer.join();
+        }
+
+        std::lock_guard lock(ErrorMutex);
+        if (Error) {
+            std::rethrow_exception(std::exchange(Error, nullptr));
+        }
+    }
+
+private:
+    void Consume() {
+        std::vector<TDocument> batch;
+        while (auto doc = Queue.Pop()) {
+            batch.push_back(std::move(doc.value()));
+            // take what is already queued without waiting, so a slow producer doesn't delay the batch
+            while (batch.size() < BatchSize) {
+                auto next = Queue.TryPop();
+                if (!next) {
+                    break;
+                }
+                batch.push_back(std::move(next.value()));
+            }
+
+            try {
+                Index.AddDocuments(batch);
+            } catch (...) {
+                std::lock_guard lock(ErrorMutex);
+                if (!Error) {
+                    Error = std::current_exception();
+                }
+            }
+            batch.clear();
+        }
+    }
+
+private:
+    TIndex& Index;
+    TBoundedQueue<TDocument> Queue;
+    std::size_t BatchSize;
+
+    std::mutex ErrorMutex;
+    std::exception_ptr Error;
+
+    std::thread Consumer;
+};
@@ -0,0 +1,246 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <tuple>
+#include <vector>
+
+#include "docs.h"
+
+struct TPosting {
+    std::size_t DocID;
+    std::vector<uint32_t> Positions;
+};
+
+// sorted by DocID, positions are sorted within a posting
+using TPostings = std::vector<TPosting>;
+
+namespace NPostings {
+    // LSM key of one block of the term positions inside the document
+    template <typename TTerm>
+    struct TPositionsKey {
+        TTerm Term;
+        uint32_t DocID = 0;
+        uint32_t Block = 0;
+
+        static TPositionsKey Min(TTerm term) {
+            return {std::move(term), 0, 0};
+        }
+
+        static TPositionsKey Max(TTerm term) {
+            return {std::move(term), std::numeric_limits<uint32_t>::max(), std::numeric_limits<uint32_t>::max()};
+        }
+
+        bool operator<(const TPositionsKey& other) const {
+            return std::tie(Term, DocID, Block) < std::tie(other.Term, other.DocID, other.Block);
+        }
+
+        bool operator<=(const TPositionsKey& other) const {
+            return !(other < *this);
+        }
+
+        bool operator>(const TPositionsKey& other) const {
+            return other < *this;
+        }
+
+        bool operator==(const TPositionsKey& other) const {
+            return Term == other.Term && DocID == other.DocID && Block == other.Block;
+        }
+    };
+
+    // fixed size block of delta + varint encoded positions, so it can be stored as a raw LSM value
+    class TPositionsBlock {
+    public:
+        static constexpr std::size_t CAPACITY = 60;
+
+    public:
+        bool TryAppend(uint32_t position) {
+            assert(Count == 0 || Last <= position);
+
+            uint32_t delta = Count == 0 ? position : position - Last;
+            std::array<uint8_t, 5> encoded{};
+            std::size_t encodedSize = 0;
+            do {
+                encoded[encodedSize++] = (delta & 0x7F) | (delta > 0x7F ? 0x80 : 0);
+                delta >>= 7;
+            } while (delta != 0);
+
+            if (Used + encodedSize > CAPACITY) {
+                return false;
+            }
+
+            std::copy_n(encoded.begin(), encodedSize, Bytes.begin() + Used);
+            Used += encodedSize;
+            Last = position;
+            ++Count;
+            return true;
+        }
+
+        void Decode(std::vector<uint32_t>& positions) const {
+            uint32_t position = 0;
+            std::size_t offset = 0;
+            for (std::size_t i = 0; i < Count; ++i) {
+                uint32_t delta = 0;
+                for (std::size_t shift = 0;; shift += 7) {
+                    uint8_t byte = Bytes[offset++];
+                    delta |= static_cast<uint32_t>(byte & 0x7F) << shift;
+                    if (!(byte & 0x80)) {
+                        break;
+                    }
+                }
+                position = i == 0 ? delta : position + delta;
+                positions.push_back(position);
+            }
+        }
+
+        bool operator==(const TPositionsBlock& other) const {
+            return Count == other.Count && Used == other.Used && Bytes == other.Bytes;
+        }
+
+        bool operator<(const TPositionsBlock& other) const {
+            return false;
+        }
+
+    private:
+        std::array<uint8_t, CAPACITY> Bytes{};
+        uint16_t Count = 0;
+        uint16_t Used = 0;
+        uint32_t Last = 0;
+    };
+
+    inline std::vector<TPositionsBlock> EncodePositions(const std::vector<uint32_t>& positions) {
+        std::vector<TPositionsBlock> blocks(1);
+        for (auto position: positions) {
+            if (!blocks.back().TryAppend(position)) {
+                blocks.emplace_back().TryAppend(position);
+            }
+        }
+        return blocks;
+    }
+
+    // entries have to be sorted by key, as LSM range reads return them
+    template <typename TTerm>
+    TPostings DecodePostings(const std::vector<std::pair<TPositionsKey<TTerm>, TPositionsBlock>>& entries) {
+        TPostings postings;
+        for (const auto& [key, block]: entries) {
+            if (postings.empty() || postings.back().DocID != key.DocID) {
+                postings.push_back(TPosting{.DocID = key.DocID, .Positions = {}});
+            }
+            block.Decode(postings.back().Positions);
+        }
+        return postings;
+    }
+
+    // calls onDoc(docID, postings) for each document present in every list
+    template <typename TOnDoc>
+    void IntersectDocs(const std::vector<const TPostings*>& lists, TOnDoc&& onDoc) {
+        if (lists.empty()) {
+            return;
+        }
+
+        std::vector<std::size_t> cursors(lists.size(), 0);
+        while (cursors[0] < lists[0]->size()) {
+            std::size_t docID = (*lists[0])[cursors[0]].DocID;
+            bool inAll = true;
+
+            for (std::size_t i = 1; i < lists.size(); ++i) {
+                const auto& list = *lists[i];
+                auto it = std::lower_bound(
+                    list.begin() + cursors[i], list.end(), docID,
+                    [](const TPosting& posting, std::size_t id) { return posting.DocID < id; }
+                );
+                cursors[i] = it - list.begin();
+                if (it == list.end()) {
+                    return;
+                }
+                if (it->DocID != docID) {
+                    inAll = false;
+                    docID = it->DocID;
+                    break;
+                }
+            }
+
+            if (inAll) {
+                std::vector<const TPosting*> postings;
+                postings.reserve(lists.size());
+                for (std::size_t i = 0; i < lists.size(); ++i) {
+                    postings.push_back(&(*lists[i])[cursors[i]]);
+                }
+                onDoc(docID, postings);
+                ++cursors[0];
+                continue;
+            }
+
+            auto it = std::lower_bound(
+                lists[0]->begin() + cursors[0], lists[0]->end(), docID,
+                [](const TPosting& posting, std::size_t id) { return posting.DocID < id; }
+            );
+            cursors[0] = it - lists[0]->begin();
+        }
+    }
+
+    // terms occur at consecutive positions in the given order
+    inline bool HasPhrase(const std::vector<const TPosting*>& postings) {
+        for (auto start: postings[0]->Positions) {
+            bool matched = true;
+            for (std::size_t i = 1; i < postings.size() && matched; ++i) {
+                const auto& positions = postings[i]->Positions;
+                matched = std::binary_search(positions.begin(), positions.end(), start + i);
+            }
+            if (matched) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // every term occurs inside a window of at most distance + 1 positions, in any order,
+    // a word repeated in the query needs as many distinct positions of its term
+    inline bool HasNear(const std::vector<const TPosting*>& postings, std::size_t distance) {
+        // the repeated words have the same postings, a position holds one term only
+        std::vector<std::size_t> needed;
+        std::vector<const TPosting*> terms;
+        for (const auto* posting: postings) {
+            auto it = std::find_if(terms.begin(), terms.end(), [posting](const TPosting* term) {
+                return term == posting || term->Positions == posting->Positions;
+            });
+            if (it == terms.end()) {
+                terms.push_back(posting);
+                needed.push_back(1);
+            } else {
+                ++needed[it - terms.begin()];
+            }
+        }
+
+        std::vector<std::pair<uint32_t, std::size_t>> merged;
+        for (std::size_t i = 0; i < terms.size(); ++i) {
+            for (auto position: terms[i]->Positions) {
+                merged.emplace_back(position, i);
+            }
+        }
+        std::sort(merged.begin(), merged.end());
+
+        std::vector<std::size_t> inWindow(terms.size(), 0);
+        std::size_t covered = 0;
+        for (std::size_t l = 0, r = 0; r < merged.size(); ++r) {
+            auto term = merged[r].second;
+            if (++inWindow[term] == needed[term]) {
+                ++covered;
+            }
+            while (merged[r].first - merged[l].first > distance) {
+                auto left = merged[l].second;
+                if (inWindow[left]-- == needed[left]) {
+                    --covered;
+                }
+                ++l;
+            }
+            if (covered == terms.size()) {
+                return true;
+            }
+        }
+        return false;
+    }
+}
@@ -0,0 +1,595 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "docs.h"
+#include "postings.h"
+#include "../lsm/trace.h"
+
+// Textual query language:
+//   query  := or
+//   or     := and ("OR" and)*
+//   and    := unary (["AND"] unary)*
+//   unary  := "NOT" unary | primary
+//   primary:= "(" or ")" | [field ":"] ( word | word "*" | word "~" distance | '"' word+ '"' ["~" distance] )
+//           | field ":" "[" bound "TO" bound "]"
+//   bound  := number | "*"
+// e.g. `russia AND NOT europe`, `(putin OR podnebesny) "european union"~2 eur* rusia~1`,
+// `russia published:[1700000000 TO *]`
+namespace NQuery {
+    enum class ENodeType : uint8_t {
+        EWord,
+        EPrefix,
+        // Distance is the maximal edit distance
+        EFuzzy,
+        EPhrase,
+        ENear,
+        // documents with the interval of Field intersecting [Begin, End]
+        EInterval,
+        EAnd,
+        EOr,
+        ENot,
+    };
+
+    // [Offset, Offset + Size) of TCompiledQuery::Text
+    struct TSpan {
+        uint32_t Offset = 0;
+        uint32_t Size = 0;
+    };
+
+    struct TNode {
+        ENodeType Type;
+        // children count for EAnd / EOr, words count for the rest
+        uint32_t Count = 0;
+        // index of the first word in TCompiledQuery::Words
+        uint32_t FirstWord = 0;
+        uint32_t Distance = 0;
+        TSpan Field{};
+        uint64_t Begin = 0;
+        uint64_t End = 0;
+    };
+
+    // nodes are stored in postfix order, children go before the parent
+    struct TCompiledQuery {
+        std::string Text;
+        std::vector<TSpan> Words;
+        std::vector<TNode> Nodes;
+
+        std::string_view View(TSpan span) const {
+            return std::string_view(Text).substr(span.Offset, span.Size);
+        }
+
+        void Clear() {
+            Text.clear();
+            Words.clear();
+            Nodes.clear();
+        }
+    };
+
+    // buffers of the compiled query are reused, so compiling a query of a
+    // familiar shape does not allocate
+    class TCompiler {
+    public:
+        void Compile(std::string_view text, TCompiledQuery& query) {
+            NTRACE_SPAN("query", "Compile");
+            query.Clear();
+            query.Text.assign(text);
+            Query = &query;
+            Pos = 0;
+
+            if (!ParseOr()) {
+                throw std::runtime_error("empty query.");
+            }
+            SkipSpaces();
+            if (Pos != Query->Text.size()) {
+                Fail("unexpected symbol");
+            }
+        }
+
+        TCompiledQuery Compile(std::string_view text) {
+            TCompiledQuery query;
+            Compile(text, query);
+            return query;
+        }
+
+    private:
+        bool ParseOr() {
+            uint32_t count = 0;
+            do {
+                if (!ParseAnd()) {
+                    if (count == 0) {
+                        return false;
+                    }
+                    Fail("operand expected");
+                }
+                ++count;
+            } while (ConsumeKeyword("OR"));
+
+            if (count > 1) {
+                Query->Nodes.push_back(TNode{.Type = ENodeType::EOr, .Count = count});
+            }
+            return true;
+        }
+
+        bool ParseAnd() {
+            uint32_t count = 0;
+            while (true) {
+                bool explicitAnd = count > 0 && ConsumeKeyword("AND");
+                if (!ParseUnary()) {
+                    if (explicitAnd) {
+                        Fail("operand expected");
+                    }
+                    break;
+                }
+                ++count;
+            }
+
+            if (count > 1) {
+                Query->Nodes.push_back(TNode{.Type = ENodeType::EAnd, .Count = count});
+            }
+            return count > 0;
+        }
+
+        bool ParseUnary() {
+            if (ConsumeKeyword("NOT")) {
+                if (!ParseUnary()) {
+                    Fail("operand expected");
+                }
+                Query->Nodes.push_back(TNode{.Type = ENodeType::ENot, .Count = 1});
+                return true;
+            }
+            return ParsePrimary();
+        }
+
+        bool ParsePrimary() {
+            SkipSpaces();
+            if (Pos == Query->Text.size() || Peek() == ')' || IsKeyword("OR") || IsKeyword("AND")) {
+                return false;
+            }
+
+            if (Peek() == '(') {
+                ++Pos;
+                if (!ParseOr()) {
+                    Fail("empty parentheses");
+                }
+                SkipSpaces();
+                if (Pos == Query->Text.size() || Peek() != ')') {
+                    Fail("')' expected");
+                }
+                ++Pos;
+                return true;
+            }
+
+            TSpan field{};
+            std::size_t wordStart = Pos;
+            TSpan word = ParseWord();
+            if (Pos < Query->Text.size() && Peek() == ':') {
+                if (word.Size == 0) {
+                    Fail("field name expected");
+                }
+                ++Pos;
+                field = word;
+                if (Pos < Query->Text.size() && Peek() == '[') {
+                    ParseInterval(field);
+                    return true;
+                }
+                wordStart = Pos;
+                word = ParseWord();
+            }
+
+            if (Pos < Query->Text.size() && Peek() == '"') {
+                if (word.Size != 0) {
+                    Fail("unexpected '\"'");
+                }
+                ParsePhrase(field);
+                return true;
+            }
+
+            if (word.Size == 0) {
+                Pos = wordStart;
+                Fail("word expected");
+            }
+
+            auto type = ENodeType::EWord;
+            uint32_t distance = 0;
+            if (Pos < Query->Text.size() && Peek() == '*') {
+                ++Pos;
+                type = ENodeType::EPrefix;
+            } else if (Pos < Query->Text.size() && Peek() == '~') {
+                ++Pos;
+                distance = ParseDistance();
+                type = ENodeType::EFuzzy;
+            }
+
+            Query->Nodes.push_back(TNode{.Type = type, .Count = 1, .FirstWord = static_cast<uint32_t>(Query->Words.size()), .Distance = distance, .Field = field});
+            Query->Words.push_back(word);
+            return true;
+        }
+
+        void ParsePhrase(TSpan field) {
+            ++Pos;
+            TNode node{.Type = ENodeType::EPhrase, .FirstWord = static_cast<uint32_t>(Query->Words.size()), .Field = field};
+
+            while (true) {
+                SkipSpaces();
+                if (Pos == Query->Text.size()) {
+                    Fail("'\"' expected");
+                }
+                if (Peek() == '"') {
+                    ++Pos;
+                    break;
+                }
+                TSpan word = ParseWord();
+                if (word.Size == 0) {
+                    Fail("word expected");
+                }
+                Query->Words.push_back(word);
+                ++node.Count;
+            }
+
+            if (node.Count == 0) {
+                Fail("empty phrase");
+            }
+
+            if (Pos < Query->Text.size() && Peek() == '~') {
+                ++Pos;
+                node.Distance = ParseDistance();
+                node.Type = ENodeType::ENear;
+            }
+
+            Query->Nodes.push_back(node);
+        }
+
+        void ParseInterval(TSpan field) {
+            ++Pos;
+            TNode node{.Type = ENodeType::EInterval, .Field = field};
+            node.Begin = ParseBound(0);
+            if (!ConsumeKeyword("TO")) {
+                Fail("'TO' expected");
+            }
+            node.End = ParseBound(std::numeric_limits<uint64_t>::max());
+            SkipSpaces();
+            if (Pos == Query->Text.size() || Peek() != ']') {
+                Fail("']' expected");
+            }
+            ++Pos;
+            if (node.Begin > node.End) {
+                Fail("empty interval");
+            }
+            Query->Nodes.push_back(node);
+        }
+
+        // '*' is the open bound
+        uint64_t ParseBound(uint64_t open) {
+            SkipSpaces();
+            if (Pos < Query->Text.size() && Peek() == '*') {
+                ++Pos;
+                return open;
+            }
+
+            std::size_t start = Pos;
+            uint64_t value = 0;
+            while (Pos < Query->Text.size() && std::isdigit(static_cast<unsigned char>(Peek()))) {
+                uint64_t digit = Peek() - '0';
+                if (value > (std::numeric_limits<uint64_t>::max() - digit) / 10) {
+                    Fail("bound is too large");
+                }
+                value = value * 10 + digit;
+                ++Pos;
+            }
+            if (start == Pos) {
+                Fail("bound expected");
+            }
+            return value;
+        }
+
+        uint32_t ParseDistance() {
+            std::size_t start = Pos;
+            uint32_t distance = 0;
+            while (Pos < Query->Text.size() && std::isdigit(static_cast<unsigned char>(Peek()))) {
+                uint32_t digit = Peek() - '0';
+                if (distance > (std::numeric_limits<uint32_t>::max() - digit) / 10) {
+                    Fail("distance is too large");
+                }
+                distance = distance * 10 + digit;
+                ++Pos;
+            }
+            if (start == Pos) {
+                Fail("distance expected");
+            }
+            return distance;
+        }
+
+        TSpan ParseWord() {
+            std::size_t start = Pos;
+            while (Pos < Query->Text.size() && IsWordChar(Peek())) {
+                ++Pos;
+            }
+            return TSpan{.Offset = static_cast<uint32_t>(start), .Size = static_cast<uint32_t>(Pos - start)};
+        }
+
+        bool IsKeyword(std::string_view keyword) const {
+            std::string_view rest = std::string_view(Query->Text).substr(Pos);
+            return rest.starts_with(keyword) && (rest.size() == keyword.size() || !IsWordChar(rest[keyword.size()]));
+        }
+
+        bool ConsumeKeyword(std::string_view keyword) {
+            SkipSpaces();
+            if (!IsKeyword(keyword)) {
+                return false;
+            }
+            Pos += keyword.size();
+            return true;
+        }
+
+        static bool IsWordChar(char c) {
+            return !std::isspace(static_cast<unsigned char>(c)) && c != '(' && c != ')' && c != '"' && c != ':' && c != '*' && c != '~';
+        }
+
+        void SkipSpaces() {
+            while (Pos < Query->Text.size() && std::isspace(static_cast<unsigned char>(Peek()))) {
+                ++Pos;
+            }
+        }
+
+        char Peek() const {
+            return Query->Text[Pos];
+        }
+
+        [[noreturn]] void Fail(const std::string& message) const {
+            throw std::runtime_error("query parse error at " + std::to_string(Pos) + ": " + message + ".");
+        }
+
+    private:
+        TCompiledQuery* Query = nullptr;
+        std::size_t Pos = 0;
+    };
+
+    // Stack machine over the postfix nodes. TSource has to provide
+    //   TDocs<128> FindDocsByWord(const std::string&)
+    //   TDocs<128> FindDocsByPrefix(const std::string&)
+    //   std::optional<TPostings> FindPostingsByWord(const std::string&)
+    //   TDocs<128> GetLiveDocs()
+    // and may provide TDocs<128> FindDocsByField(const std::string& field, const std::string& word)
+    // for the field:word terms, TDocs<128> FindDocsByFuzzy(const std::string&, uint32_t distance)
+    // for the word~distance terms and
+    //   TDocs<128> FindDocsByInterval(const std::string& field, uint64_t begin, uint64_t end)
+    //   TDocs<128> FilterDocsByInterval(const std::string& field, uint64_t begin, uint64_t end, const TDocs<128>& candidates)
+    // for the field:[begin TO end] terms. The intervals are evaluated lazily: inside AND only the
+    // documents left by the text terms are checked, from the smallest interval if the source
+    // provides std::size_t EstimateDocsByInterval(const std::string& field, uint64_t begin, uint64_t end).
+    class TEvaluator {
+    public:
+        template <typename TSource>
+        TDocs<128> Evaluate(const TCompiledQuery& query, TSource& source) {
+            NTRACE_SPAN("query", "Evaluate");
+            Stack.clear();
+            Query = &query;
+
+            for (const auto& node: query.Nodes) {
+                switch (node.Type) {
+                    case ENodeType::EWord:
+                    case ENodeType::EPrefix:
+                    case ENodeType::EFuzzy: {
+                        Stack.push_back(TItem{.Docs = EvaluateWord(query, node, source)});
+                        break;
+                    }
+                    case ENodeType::EPhrase:
+                    case ENodeType::ENear: {
+                        Stack.push_back(TItem{.Docs = EvaluatePositional(query, node, source)});
+                        break;
+                    }
+                    case ENodeType::EInterval: {
+                        Stack.push_back(TItem{.Interval = &node});
+                        break;
+                    }
+                    case ENodeType::EAnd: {
+                        EvaluateAnd(node.Count, source);
+                        break;
+                    }
+                    case ENodeType::EOr: {
+                        EvaluateOr(node.Count, source);
+                        break;
+                    }
+                    case ENodeType::ENot: {
+                        Stack.back().Negated = !Stack.back().Negated;
+                        break;
+                    }
+                }
+            }
+
+            assert(Stack.size() == 1);
+            return Materialize(Stack.back(), source);
+        }
+
+    private:
+        // negation is kept lazy until the parent needs it, so that AND can subtract it,
+        // and so is the interval, so that AND can check only its candidates
+        struct TItem {
+            TDocs<128> Docs;
+            bool Negated = false;
+            const TNode* Interval = nullptr;
+        };
+
+        template <typename TSource>
+        TDocs<128> EvaluateWord(const TCompiledQuery& query, const TNode& node, TSource& source) {
+            NTRACE_SPAN("query", "Word");
+            Word.assign(query.View(query.Words[node.FirstWord]));
+
+            if (node.Field.Size != 0) {
+                if constexpr (requires { source.FindDocsByField(Word, Word); }) {
+                    if (node.Type != ENodeType::EWord) {
+                        throw std::runtime_error("prefix and fuzzy search are not supported for fields.");
+                    }
+                    Field.assign(query.View(node.Field));
+                    return source.FindDocsByField(Field, Word);
+                } else {
+                    throw std::runtime_error("unknown field: " + std::string(query.View(node.Field)) + ".");
+                }
+            }
+
+            if (node.Type == ENodeType::EPrefix) {
+                return source.FindDocsByPrefix(Word);
+            }
+            if (node.Type == ENodeType::EFuzzy) {
+                if constexpr (requires { source.FindDocsByFuzzy(Word, node.Distance); }) {
+                    return source.FindDocsByFuzzy(Word, node.Distance);
+                } else {
+                    throw std::runtime_error("fuzzy search is not supported.");
+                }
+            }
+            return source.FindDocsByWord(Word);
+        }
+
+        template <typename TSource>
+        TDocs<128> EvaluatePositional(const TCompiledQuery& query, const TNode& node, TSource& source) {
+            NTRACE_SPAN("query", "Positional");
+            if (node.Field.Size != 0) {
+                throw std::runtime_error("phrases are not supported for fields.");
+            }
+
+            Postings.clear();
+            for (uint32_t i = 0; i < node.Count; ++i) {
+                Word.assign(query.View(query.Words[node.FirstWord + i]));
+                if (auto maybePostings = source.FindPostingsByWord(Word)) {
+                    Postings.push_back(std::move(maybePostings.value()));
+                }
+            }
+
+            Lists.clear();
+            for (const auto& list: Postings) {
+                Lists.push_back(&list);
+            }
+
+            TDocs<128> result;
+            NPostings::IntersectDocs(Lists, [&](std::size_t docID, const std::vector<const TPosting*>& postings) {
+                bool matched = node.Type == ENodeType::EPhrase
+                    ? NPostings::HasPhrase(postings)
+                    : NPostings::HasNear(postings, node.Distance);
+                if (matched) {
+                    result.Add(docID);
+                }
+            });
+            return result;
+        }
+
+        template <typename TSource>
+        TDocs<128> EvaluateInterval(const TCompiledQuery& query, const TNode& node, TSource& source, const TDocs<128>* candidates) {
+            NTRACE_SPAN("query", "Interval");
+            if constexpr (requires { source.FindDocsByInterval(Field, node.Begin, node.End); }) {
+                Field.assign(query.View(node.Field));
+                if (candidates == nullptr) {
+                    return source.FindDocsByInterval(Field, node.Begin, node.End);
+                }
+                if constexpr (requires { source.FilterDocsByInterval(Field, node.Begin, node.End, *candidates); }) {
+                    return source.FilterDocsByInterval(Field, node.Begin, node.End, *candidates);
+                } else {
+                    return source.FindDocsByInterval(Field, node.Begin, node.End).And(*candidates);
+                }
+            } else {
+                throw std::runtime_error("interval search is not supported.");
+            }
+        }
+
+        template <typename TSource>
+        std::size_t EstimateInterval(const TCompiledQuery& query, const TNode& node, TSource& source) {
+            if constexpr (requires { source.EstimateDocsByInterval(Field, node.Begin, node.End); }) {
+                Field.assign(query.View(node.Field));
+                return source.EstimateDocsByInterval(Field, node.Begin, node.End);
+            } else {
+                return 0;
+            }
+        }
+
+        template <typename TSource>
+        void EvaluateAnd(uint32_t count, TSource& source) {
+            NTRACE_SPAN("query", "And");
+            auto first = Stack.end() - count;
+
+            std::optional<TDocs<128>> result;
+            for (auto it = first; it != Stack.end() && !(result && result->Empty()); ++it) {
+                if (it->Negated || it->Interval) continue;
+                if (!result) {
+                    result = it->Docs;
+                } else {
+                    result->And(it->Docs);
+                }
+            }
+
+            Intervals.clear();
+            for (auto it = first; it != Stack.end(); ++it) {
+                if (it->Negated || !it->Interval) continue;
+                Intervals.emplace_back(EstimateInterval(*Query, *it->Interval, source), it->Interval);
+            }
+            std::stable_sort(Intervals.begin(), Intervals.end(), [](const auto& lhs, const auto& rhs) {
+                return lhs.first < rhs.first;
+            });
+            for (auto it = Intervals.begin(); it != Intervals.end() && !(result && result->Empty()); ++it) {
+                result = EvaluateInterval(*Query, *it->second, source, result ? &result.value() : nullptr);
+            }
+
+            if (!result) {
+                result = source.GetLiveDocs();
+            }
+
+            for (auto it = first; it != Stack.end() && !result->Empty(); ++it) {
+                if (!it->Negated) continue;
+                result->AndNot(Resolve(*it, source));
+            }
+
+            Stack.erase(first, Stack.end());
+            Stack.push_back(TItem{.Docs = result.value()});
+        }
+
+        template <typename TSource>
+        void EvaluateOr(uint32_t count, TSource& source) {
+            NTRACE_SPAN("query", "Or");
+            auto first = Stack.end() - count;
+
+            TDocs<128> result;
+            for (auto it = first; it != Stack.end(); ++it) {
+                result.Or(Materialize(*it, source));
+            }
+
+            Stack.erase(first, Stack.end());
+            Stack.push_back(TItem{.Docs = result});
+        }
+
+        // the documents of the item ignoring its negation
+        template <typename TSource>
+        TDocs<128> Resolve(const TItem& item, TSource& source) {
+            if (item.Interval) {
+                return EvaluateInterval(*Query, *item.Interval, source, nullptr);
+            }
+            return item.Docs;
+        }
+
+        template <typename TSource>
+        TDocs<128> Materialize(const TItem& item, TSource& source) {
+            if (!item.Negated) {
+                return Resolve(item, source);
+            }
+            return source.GetLiveDocs().AndNot(Resolve(item, source));
+        }
+
+    private:
+        const TCompiledQuery* Query = nullptr;
+        std::vector<TItem> Stack;
+        std::vector<TPostings> Postings;
+        std::vector<const TPostings*> Lists;
+        // the estimated sizes of the intervals of an AND
+        std::vector<std::pair<std::size_t, const TNode*>> Intervals;
+        std::string Word;
+        std::string Field;
+    };
+}
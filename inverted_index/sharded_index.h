@@ -0,0 +1,287 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../lsm/thread_pool.h"
+#include "inverted_index.h"
+
+enum class EShardPartition {
+    // docID % shard count, spreads the ingest of the sequential IDs over all the shards
+    EHash,
+    // contiguous docID ranges, the shard of a range can be dropped or moved as a whole
+    ERange,
+};
+
+struct TScoredDoc {
+    std::size_t DocID;
+    double Score;
+};
+
+// The documents are partitioned over the TInvertedIndex shards, one LSM tree per shard
+// directory, so the shards can live on different disks. A query is executed on all the
+// shards in parallel and the shard results are merged; the document IDs stay global, so
+// the merge of the disjoint shard results is a union. The shard tasks and the bulk loads
+// of the shards share one pool.
+template <std::size_t MaxDocCount>
+class TShardedIndex {
+public:
+    // the shards share writeBufferManager if it is set
+    explicit TShardedIndex(
+            const std::vector<std::filesystem::path>& shardPaths,
+            EShardPartition partition = EShardPartition::EHash,
+            TStopWords stopWords = TStopWords::Default(),
+            std::shared_ptr<NMemory::TWriteBufferManager> writeBufferManager = nullptr
+    )
+        : Partition(partition)
+        , Pool(std::make_shared<TThreadPool>(std::max<std::size_t>(shardPaths.size(), std::thread::hardware_concurrency())))
+    {
+        if (shardPaths.empty()) {
+            throw std::runtime_error("no shards.");
+        }
+        for (const auto& path: shardPaths) {
+            Shards.push_back(std::make_unique<TShard>(NUtils::EnsureDirectory(path), stopWords, writeBufferManager, Pool));
+        }
+        // an idle shard is flushed on the pool when the other writers run out of the budget
+        for (auto& shard: Shards) {
+            shard->Index.SetFlushRequestHandler([this, shard = shard.get()]() { ScheduleFlush(*shard); });
+        }
+    }
+
+    ~TShardedIndex() {
+        for (auto& shard: Shards) {
+            shard->Index.SetFlushRequestHandler(nullptr);
+        }
+        // the scheduled flushes reference the shards
+        std::unique_lock lock(FlushesMutex);
+        FlushesDone.wait(lock, [this]() { return PendingFlushes == 0; });
+    }
+
+    TShardedIndex(const TShardedIndex&) = delete;
+    TShardedIndex& operator=(const TShardedIndex&) = delete;
+
+    void AddDocument(const TDocument& doc) {
+        auto& shard = *Shards[GetShard(doc.ID)];
+        std::lock_guard lock(shard.Mutex);
+        shard.Index.AddDocument(doc);
+    }
+
+    // the shards are loaded in parallel
+    void AddDocuments(const std::vector<TDocument>& docs) {
+        std::vector<std::vector<TDocument>> partitioned(Shards.size());
+        for (const auto& doc: docs) {
+            partitioned[GetShard(doc.ID)].push_back(doc);
+        }
+
+        Scatter([&partitioned](std::size_t shardIdx, TInvertedIndex<MaxDocCount>& index) {
+            if (!partitioned[shardIdx].empty()) {
+                index.AddDocuments(partitioned[shardIdx]);
+            }
+            return 0;
+        });
+    }
+
+    TDocs<MaxDocCount> FindDocsByWord(const std::string& word) {
+        return Gather([&word](TInvertedIndex<MaxDocCount>& index) { return index.FindDocsByWord(word); });
+    }
+
+    TDocs<MaxDocCount> FindDocsByPrefix(const std::string& prefix) {
+        return Gather([&prefix](TInvertedIndex<MaxDocCount>& index) { return index.FindDocsByPrefix(prefix); });
+    }
+
+    TDocs<MaxDocCount> FindDocsByExpr(const std::shared_ptr<NLogicAlgebra::IASTNode>& astTree) {
+        return Gather([&astTree](TInvertedIndex<MaxDocCount>& index) { return index.FindDocsByExpr(astTree); });
+    }
+
+    // see query.h for the syntax, NOT is evaluated against the live documents of every shard
+    TDocs<MaxDocCount> FindDocsByQuery(std::string_view query) {
+        return Gather([query](TInvertedIndex<MaxDocCount>& index) { return index.FindDocsByQuery(query); });
+    }
+
+    TDocs<MaxDocCount> GetLiveDocs() {
+        return Gather([](TInvertedIndex<MaxDocCount>& index) { return index.GetLiveDocs(); });
+    }
+
+    // The documents containing any of the words ranked by tf-idf, the best first. The
+    // document frequencies are summed over all the shards before the scoring, so the
+    // score of a document doesn't depend on its shard; every shard returns its own top k
+    // and the global top k is taken from them.
+    std::vector<TScoredDoc> FindTopK(const std::vector<std::string>& words, std::size_t k) {
+        if (k == 0 || words.empty()) {
+            return {};
+        }
+
+        // the shards count the document frequencies with the postings, only the counts are summed here
+        auto shardPostings = Scatter([&words](std::size_t, TInvertedIndex<MaxDocCount>& index) {
+            TShardPostings postings{.DocCount = index.GetLiveDocs().Count()};
+            for (const auto& word: words) {
+                postings.Words.push_back(index.FindPostingsByWord(word).value_or(TPostings()));
+                postings.DocFrequencies.push_back(postings.Words.back().size());
+            }
+            return postings;
+        });
+
+        std::size_t docCount = 0;
+        std::vector<std::size_t> docFrequencies(words.size());
+        for (const auto& postings: shardPostings) {
+            docCount += postings.DocCount;
+            for (std::size_t i = 0; i < words.size(); ++i) {
+                docFrequencies[i] += postings.DocFrequencies[i];
+            }
+        }
+
+        std::vector<double> idfs(words.size());
+        for (std::size_t i = 0; i < words.size(); ++i) {
+            idfs[i] = docFrequencies[i] == 0 ? 0 : std::log(1.0 + static_cast<double>(docCount) / docFrequencies[i]);
+        }
+
+        auto shardTops = Scatter([&shardPostings, &idfs, k](std::size_t shardIdx, TInvertedIndex<MaxDocCount>&) {
+            std::map<std::size_t, double> scores;
+            const auto& postings = shardPostings[shardIdx];
+            for (std::size_t i = 0; i < postings.Words.size(); ++i) {
+                for (const auto& posting: postings.Words[i]) {
+                    scores[posting.DocID] += (1.0 + std::log(static_cast<double>(posting.Positions.size()))) * idfs[i];
+                }
+            }
+
+            std::vector<TScoredDoc> top;
+            top.reserve(scores.size());
+            for (const auto& [docID, score]: scores) {
+                top.push_back(TScoredDoc{.DocID = docID, .Score = score});
+            }
+            TakeTop(top, k);
+            return top;
+        });
+
+        std::vector<TScoredDoc> top;
+        for (auto& shardTop: shardTops) {
+            top.insert(top.end(), shardTop.begin(), shardTop.end());
+        }
+        TakeTop(top, k);
+        return top;
+    }
+
+    std::size_t GetShardCount() const {
+        return Shards.size();
+    }
+
+    std::size_t GetShard(std::size_t docID) const {
+        assert(docID < MaxDocCount);
+        switch (Partition) {
+            case EShardPartition::EHash:
+                return docID % Shards.size();
+            case EShardPartition::ERange:
+                return docID * Shards.size() / MaxDocCount;
+        }
+        return 0;
+    }
+
+private:
+    // a shard is not thread safe, the concurrent queries are serialized on it
+    struct TShard {
+        TShard(std::filesystem::path path, TStopWords stopWords, std::shared_ptr<NMemory::TWriteBufferManager> writeBufferManager, std::shared_ptr<TThreadPool> pool)
+            : Index(std::move(path), std::move(stopWords), std::move(writeBufferManager), std::move(pool))
+        {}
+
+        std::mutex Mutex;
+        TInvertedIndex<MaxDocCount> Index;
+    };
+
+    struct TShardPostings {
+        std::size_t DocCount = 0;
+        // in the order of the query words
+        std::vector<TPostings> Words;
+        std::vector<std::size_t> DocFrequencies;
+    };
+
+    // the flush requested by the write buffer manager, nobody waits for the task
+    void ScheduleFlush(TShard& shard) {
+        {
+            std::lock_guard lock(FlushesMutex);
+            ++PendingFlushes;
+        }
+        Pool->Submit([this, &shard]() {
+            try {
+                std::lock_guard lock(shard.Mutex);
+                shard.Index.FlushIfRequested();
+            } catch (const std::exception& e) {
+                spdlog::error(std::string("Failed to flush the shard: ") + e.what());
+            }
+            std::lock_guard lock(FlushesMutex);
+            if (--PendingFlushes == 0) {
+                FlushesDone.notify_all();
+            }
+        });
+    }
+
+    // runs the function on every shard in the pool, the results are in the shard order
+    template <typename TFunc>
+    auto Scatter(TFunc&& func) {
+        using TResult = std::invoke_result_t<TFunc&, std::size_t, TInvertedIndex<MaxDocCount>&>;
+
+        std::vector<std::future<TResult>> tasks;
+        tasks.reserve(Shards.size());
+        for (std::size_t i = 0; i < Shards.size(); ++i) {
+            tasks.push_back(Pool->Submit([this, &func, i]() {
+                std::lock_guard lock(Shards[i]->Mutex);
+                return func(i, Shards[i]->Index);
+            }));
+        }
+
+        // every task is waited for before the first error is rethrown, they reference func
+        std::vector<TResult> results;
+        std::exception_ptr error;
+        for (auto& task: tasks) {
+            try {
+                results.push_back(task.get());
+            } catch (...) {
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return results;
+    }
+
+    template <typename TFunc>
+    TDocs<MaxDocCount> Gather(TFunc&& func) {
+        TDocs<MaxDocCount> docs;
+        for (const auto& shardDocs: Scatter([&func](std::size_t, TInvertedIndex<MaxDocCount>& index) { return func(index); })) {
+            docs.Or(shardDocs);
+        }
+        return docs;
+    }
+
+    // the k best by score, the ties are broken by docID to keep the result deterministic
+    static void TakeTop(std::vector<TScoredDoc>& docs, std::size_t k) {
+        auto better = [](const TScoredDoc& lhs, const TScoredDoc& rhs) {
+            return lhs.Score != rhs.Score ? lhs.Score > rhs.Score : lhs.DocID < rhs.DocID;
+        };
+        k = std::min(k, docs.size());
+        std::partial_sort(docs.begin(), docs.begin() + k, docs.end(), better);
+        docs.resize(k);
+    }
+
+private:
+    EShardPartition Partition;
+    // destroyed after the shards, which submit to it
+    std::shared_ptr<TThreadPool> Pool;
+    std::vector<std::unique_ptr<TShard>> Shards;
+
+    std::mutex FlushesMutex;
+    std::condition_variable FlushesDone;
+    std::size_t PendingFlushes = 0;
+};
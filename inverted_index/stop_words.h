@@ -0,0 +1,115 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Open addressing set of the words, probed without allocations: the words
+// live in one buffer and the slots keep only their offsets.
+class TStopWords {
+public:
+    TStopWords() = default;
+
+    TStopWords(const std::vector<std::string>& words) {
+        std::size_t capacity = 16;
+        while (capacity < words.size() * 2) {
+            capacity *= 2;
+        }
+        Slots.assign(capacity, TSlot{});
+
+        for (const auto& word: words) {
+            Insert(word);
+        }
+    }
+
+    static TStopWords Default() {
+        return TStopWords({"the", "and", "is", "in", "at", "of", "a", "on"});
+    }
+
+    // one word per line, empty lines and lines starting with '#' are skipped, the words are lowercased
+    static TStopWords FromFile(const std::filesystem::path& path) {
+        std::ifstream fIn(path);
+        if (!fIn.is_open()) {
+            throw std::runtime_error("can't open stop words file " + path.string() + ".");
+        }
+
+        std::vector<std::string> words;
+        std::string line;
+        while (std::getline(fIn, line)) {
+            auto first = line.find_first_not_of(" \t\r");
+            if (first == std::string::npos || line[first] == '#') {
+                continue;
+            }
+            auto last = line.find_last_not_of(" \t\r");
+            words.push_back(line.substr(first, last - first + 1));
+            std::transform(words.back().begin(), words.back().end(), words.back().begin(), ::tolower);
+        }
+
+        return TStopWords(words);
+    }
+
+    bool Contains(std::string_view word) const {
+        if (Slots.empty() || word.empty()) {
+            return false;
+        }
+
+        for (std::size_t i = Hash(word) & (Slots.size() - 1);; i = (i + 1) & (Slots.size() - 1)) {
+            const auto& slot = Slots[i];
+            if (slot.Size == 0) {
+                return false;
+            }
+            if (slot.Size == word.size() && View(slot) == word) {
+                return true;
+            }
+        }
+    }
+
+    std::size_t Size() const {
+        return Count;
+    }
+
+private:
+    struct TSlot {
+        uint32_t Offset = 0;
+        uint32_t Size = 0;
+    };
+
+    void Insert(std::string_view word) {
+        if (word.empty() || Contains(word)) {
+            return;
+        }
+
+        std::size_t i = Hash(word) & (Slots.size() - 1);
+        while (Slots[i].Size != 0) {
+            i = (i + 1) & (Slots.size() - 1);
+        }
+
+        Slots[i] = TSlot{.Offset = static_cast<uint32_t>(Words.size()), .Size = static_cast<uint32_t>(word.size())};
+        Words.append(word);
+        ++Count;
+    }
+
+    std::string_view View(const TSlot& slot) const {
+        return std::string_view(Words).substr(slot.Offset, slot.Size);
+    }
+
+    // FNV-1a
+    static std::size_t Hash(std::string_view word) {
+        uint64_t hash = 14695981039346656037ull;
+        for (unsigned char c: word) {
+            hash = (hash ^ c) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+private:
+    std::string Words;
+    // the size is a power of two and at least twice the words count
+    std::vector<TSlot> Slots;
+    std::size_t Count = 0;
+};
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "automata.h"
+#include "term_trie.h"
+
+using TTermID = uint32_t;
+
+// Interns the indexed terms into dense IDs and caches surface form -> term ID,
+// so repeated words are neither stemmed nor compared as strings again.
+// Safe to use from several threads, the walks call onTerm under the lock of the terms,
+// so onTerm must not add terms.
+class TTermDictionary {
+public:
+    static constexpr TTermID UNKNOWN_TERM = std::numeric_limits<TTermID>::max();
+    const static std::size_t SURFACE_CACHE_SHARD_SIZE = 65'536ull;
+
+public:
+    // the terms are persisted to the file one per line, the line number is the ID
+    TTermDictionary(std::filesystem::path path = {}) {
+        if (path.empty()) {
+            return;
+        }
+
+        if (std::ifstream fIn(path); fIn.is_open()) {
+            std::string term;
+            while (std::getline(fIn, term)) {
+                Add(std::move(term));
+            }
+        }
+        TermsFile.open(path, std::ios::out | std::ios::app);
+        TermsPath = std::move(path);
+    }
+
+    // The new terms reach the disk. The term IDs are written to the LSM trees, so it
+    // has to be called before their flushes, or a crash leaves IDs without the terms.
+    void Sync() {
+        std::unique_lock lock(TermsMutex);
+        if (!TermsFile.is_open() || !Unsynced) {
+            return;
+        }
+
+        TermsFile.flush();
+        int fd = open(TermsPath.c_str(), O_RDONLY | O_CLOEXEC);
+        bool synced = TermsFile && fd >= 0 && fdatasync(fd) == 0;
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (!synced) {
+            throw std::runtime_error("can't sync terms to " + TermsPath.string() + ".");
+        }
+        Unsynced = false;
+    }
+
+    // ID of the indexed form of the surface word, stem(std::string&) turns
+    // the surface form into the indexed one and is called on cache misses only
+    template <typename TStem>
+    TTermID Resolve(std::string_view surface, TStem&& stem) {
+        if (auto cached = FindSurface(surface)) {
+            return cached.value();
+        }
+
+        std::string term(surface);
+        stem(term);
+        TTermID termID = Intern(term);
+        CacheSurface(surface, termID);
+        return termID;
+    }
+
+    // as Resolve, but never adds a term, UNKNOWN_TERM if there is no such term
+    template <typename TStem>
+    TTermID Lookup(std::string_view surface, TStem&& stem) {
+        if (auto cached = FindSurface(surface)) {
+            return cached.value();
+        }
+
+        std::string term(surface);
+        stem(term);
+        auto termID = Find(term);
+        if (termID) {
+            CacheSurface(surface, termID.value());
+        }
+        return termID.value_or(UNKNOWN_TERM);
+    }
+
+    TTermID Intern(std::string_view term) {
+        {
+            std::shared_lock lock(TermsMutex);
+            if (auto it = IDs.find(term); it != IDs.end()) {
+                return it->second;
+            }
+        }
+
+        std::unique_lock lock(TermsMutex);
+        if (auto it = IDs.find(term); it != IDs.end()) {
+            return it->second;
+        }
+        if (TermsFile.is_open()) {
+            TermsFile << term << '\n';
+            Unsynced = true;
+        }
+        return Add(std::string(term));
+    }
+
+    std::optional<TTermID> Find(std::string_view term) const {
+        std::shared_lock lock(TermsMutex);
+        if (auto it = IDs.find(term); it != IDs.end()) {
+            return it->second;
+        }
+        return std::nullopt;
+    }
+
+    std::string GetTerm(TTermID termID) const {
+        std::shared_lock lock(TermsMutex);
+        return Terms.at(termID)->first;
+    }
+
+    std::size_t Size() const {
+        std::shared_lock lock(TermsMutex);
+        return Terms.size();
+    }
+
+    // calls onTerm(term, termID) in the lexicographical order
+    template <typename TOnTerm>
+    void ForEachWithPrefix(std::string_view prefix, TOnTerm&& onTerm) const {
+        std::shared_lock lock(TermsMutex);
+        for (auto it = IDs.lower_bound(prefix); it != IDs.end() && it->first.starts_with(prefix); ++it) {
+            onTerm(std::string_view(it->first), it->second);
+        }
+    }
+
+    // onTerm(term, termID) for the terms in [from, to), in the lexicographical order
+    template <typename TOnTerm>
+    void ForEachInRange(std::string_view from, std::string_view to, TOnTerm&& onTerm) const {
+        std::shared_lock lock(TermsMutex);
+        Trie.ForEachInRange(from, to, onTerm);
+    }
+
+    // onTerm(term, termID) for the terms fully matching the regex, see NAutomata::TRegex for the syntax
+    template <typename TOnTerm>
+    void ForEachMatching(std::string_view regex, TOnTerm&& onTerm) const {
+        NAutomata::TRegex automaton(regex);
+        std::shared_lock lock(TermsMutex);
+        Trie.ForEachAccepted(automaton, onTerm);
+    }
+
+    // onTerm(term, termID) for the terms within the edit distance of the word
+    template <typename TOnTerm>
+    void ForEachSimilar(std::string_view word, uint32_t maxDistance, TOnTerm&& onTerm) const {
+        NAutomata::TLevenshtein automaton(word, maxDistance);
+        std::shared_lock lock(TermsMutex);
+        Trie.ForEachAccepted(automaton, onTerm);
+    }
+
+private:
+    struct TStringHash {
+        using is_transparent = void;
+
+        std::size_t operator()(std::string_view s) const {
+            return std::hash<std::string_view>()(s);
+        }
+    };
+
+    struct TSurfaceShard {
+        mutable std::shared_mutex Mutex;
+        std::unordered_map<std::string, TTermID, TStringHash, std::equal_to<>> IDs;
+    };
+
+    TTermID Add(std::string term) {
+        TTermID termID = Terms.size();
+        Terms.push_back(IDs.emplace(std::move(term), termID).first);
+        Trie.Insert(Terms.back()->first, termID);
+        return termID;
+    }
+
+    TSurfaceShard& GetShard(std::string_view surface) const {
+        return SurfaceShards[TStringHash()(surface) % SurfaceShards.size()];
+    }
+
+    std::optional<TTermID> FindSurface(std::string_view surface) const {
+        auto& shard = GetShard(surface);
+        std::shared_lock lock(shard.Mutex);
+        if (auto it = shard.IDs.find(surface); it != shard.IDs.end()) {
+            return it->second;
+        }
+        return std::nullopt;
+    }
+
+    void CacheSurface(std::string_view surface, TTermID termID) {
+        auto& shard = GetShard(surface);
+        std::unique_lock lock(shard.Mutex);
+        // the cache is only an optimization, so the overflown shard is simply dropped
+        if (shard.IDs.size() >= SURFACE_CACHE_SHARD_SIZE) {
+            shard.IDs.clear();
+        }
+        shard.IDs.emplace(surface, termID);
+    }
+
+private:
+    mutable std::shared_mutex TermsMutex;
+    std::map<std::string, TTermID, std::less<>> IDs;
+    std::vector<std::map<std::string, TTermID, std::less<>>::const_iterator> Terms;
+    std::ofstream TermsFile;
+    std::filesystem::path TermsPath;
+    // the terms written after the last Sync
+    bool Unsynced = false;
+    // the terms for the range and the automaton walks, updated with IDs
+    TTermTrie<TTermID> Trie;
+
+    mutable std::array<TSurfaceShard, 16> SurfaceShards;
+};
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Trie over the terms: the children of a node are a list of siblings sorted by the
+// label, so every walk reports the terms in the lexicographical order. The terms are
+// inserted one at a time, a new term costs its length times the siblings passed.
+template <typename TValue>
+class TTermTrie {
+public:
+    static constexpr TValue NO_VALUE = std::numeric_limits<TValue>::max();
+
+public:
+    TTermTrie() {
+        Nodes.emplace_back();
+    }
+
+    explicit TTermTrie(const std::vector<std::pair<std::string_view, TValue>>& terms)
+        : TTermTrie()
+    {
+        for (const auto& [term, value]: terms) {
+            Insert(term, value);
+        }
+    }
+
+    // replaces the value of an inserted term
+    void Insert(std::string_view term, TValue value) {
+        uint32_t node = 0;
+        for (char c: term) {
+            node = FindOrAddChild(node, c);
+        }
+        Count += Nodes[node].Value == NO_VALUE;
+        Nodes[node].Value = value;
+    }
+
+    std::size_t Size() const {
+        return Count;
+    }
+
+    // onTerm(term, value) for the terms starting with the prefix
+    template <typename TOnTerm>
+    void ForEachWithPrefix(std::string_view prefix, TOnTerm&& onTerm) const {
+        uint32_t node = 0;
+        for (char c: prefix) {
+            node = FindChild(node, c);
+            if (node == NONE) {
+                return;
+            }
+        }
+        std::string term(prefix);
+        Walk(node, term, onTerm);
+    }
+
+    // onTerm(term, value) for the terms in [from, to)
+    template <typename TOnTerm>
+    void ForEachInRange(std::string_view from, std::string_view to, TOnTerm&& onTerm) const {
+        std::string term;
+        WalkRange(0, term, from, to, true, true, onTerm);
+    }
+
+    // onTerm(term, value) for the terms accepted by the automaton, see automata.h
+    template <typename TAutomaton, typename TOnTerm>
+    void ForEachAccepted(const TAutomaton& automaton, TOnTerm&& onTerm) const {
+        std::string term;
+        std::vector<typename TAutomaton::TState> states(1, automaton.Start());
+        WalkAccepted(0, term, automaton, states, onTerm);
+    }
+
+private:
+    static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+    struct TNode {
+        uint32_t FirstChild = NONE;
+        uint32_t NextSibling = NONE;
+        TValue Value = NO_VALUE;
+        // the label of the edge into the node
+        char Label = '\0';
+    };
+
+    static bool Less(char lhs, char rhs) {
+        return static_cast<unsigned char>(lhs) < static_cast<unsigned char>(rhs);
+    }
+
+    uint32_t FindChild(uint32_t node, char c) const {
+        uint32_t child = Nodes[node].FirstChild;
+        while (child != NONE && Less(Nodes[child].Label, c)) {
+            child = Nodes[child].NextSibling;
+        }
+        return child != NONE && Nodes[child].Label == c ? child : NONE;
+    }
+
+    uint32_t FindOrAddChild(uint32_t node, char c) {
+        uint32_t previous = NONE;
+        uint32_t child = Nodes[node].FirstChild;
+        while (child != NONE && Less(Nodes[child].Label, c)) {
+            previous = child;
+            child = Nodes[child].NextSibling;
+        }
+        if (child != NONE && Nodes[child].Label == c) {
+            return child;
+        }
+
+        uint32_t added = Nodes.size();
+        Nodes.push_back(TNode{.NextSibling = child, .Label = c});
+        (previous == NONE ? Nodes[node].FirstChild : Nodes[previous].NextSibling) = added;
+        return added;
+    }
+
+    template <typename TOnTerm>
+    void Walk(uint32_t node, std::string& term, TOnTerm& onTerm) const {
+        if (Nodes[node].Value != NO_VALUE) {
+            onTerm(std::string_view(term), Nodes[node].Value);
+        }
+        for (uint32_t child = Nodes[node].FirstChild; child != NONE; child = Nodes[child].NextSibling) {
+            term.push_back(Nodes[child].Label);
+            Walk(child, term, onTerm);
+            term.pop_back();
+        }
+    }
+
+    // the bounds are tight while the term is a prefix of them
+    template <typename TOnTerm>
+    void WalkRange(uint32_t node, std::string& term, std::string_view from, std::string_view to, bool lowerTight, bool upperTight, TOnTerm& onTerm) const {
+        std::size_t depth = term.size();
+        if (upperTight && depth == to.size()) {
+            // the term equals the upper bound, the subtree is above it
+            return;
+        }
+        if (lowerTight && depth == from.size()) {
+            lowerTight = false;
+        }
+
+        if (!lowerTight && Nodes[node].Value != NO_VALUE) {
+            onTerm(std::string_view(term), Nodes[node].Value);
+        }
+
+        for (uint32_t child = Nodes[node].FirstChild; child != NONE; child = Nodes[child].NextSibling) {
+            auto label = static_cast<unsigned char>(Nodes[child].Label);
+            if (lowerTight && label < static_cast<unsigned char>(from[depth])) {
+                continue;
+            }
+            if (upperTight && label > static_cast<unsigned char>(to[depth])) {
+                break;
+            }
+            term.push_back(Nodes[child].Label);
+            WalkRange(
+                child, term, from, to,
+                lowerTight && label == static_cast<unsigned char>(from[depth]),
+                upperTight && label == static_cast<unsigned char>(to[depth]),
+                onTerm
+            );
+            term.pop_back();
+        }
+    }
+
+    // states[depth] is the automaton state after the term, the deeper ones are reused
+    template <typename TAutomaton, typename TOnTerm>
+    void WalkAccepted(uint32_t node, std::string& term, const TAutomaton& automaton, std::vector<typename TAutomaton::TState>& states, TOnTerm& onTerm) const {
+        std::size_t depth = term.size();
+        if (Nodes[node].Value != NO_VALUE && automaton.IsMatch(states[depth])) {
+            onTerm(std::string_view(term), Nodes[node].Value);
+        }
+
+        if (states.size() == depth + 1) {
+            states.emplace_back();
+        }
+        for (uint32_t child = Nodes[node].FirstChild; child != NONE; child = Nodes[child].NextSibling) {
+            automaton.Step(states[depth], Nodes[child].Label, states[depth + 1]);
+            if (!automaton.CanMatch(states[depth + 1])) {
+                continue;
+            }
+            term.push_back(Nodes[child].Label);
+            WalkAccepted(child, term, automaton, states, onTerm);
+            term.pop_back();
+        }
+    }
+
+private:
+    std::vector<TNode> Nodes;
+    std::size_t Count = 0;
+};
@@ -1,25 +1,65 @@
 #pragma once
 
 #include "../contrib/OleanderStemmingLibrary/src/english_stem.h"
+#include "stop_words.h"
+#include "../lsm/trace.h"
 
 #include <algorithm>
+#include <array>
+#include <cstdint>
 #include <vector>
 #include <string>
-#include <ostream>
-#include <istream>
-#include <sstream>
+#include <string_view>
 
 
 class TStemmer {
 public:
+    // the stemmer and the buffer are reused between the calls
     void Stem(std::string& text) {
-        std::wstring s(text.begin(), text.end());
-        stemming::english_stem<> stemmer;
-        stemmer(s);
-        text = std::string(s.begin(), s.end());
+        Buffer.assign(text.begin(), text.end());
+        Stemmer(Buffer);
+        text.assign(Buffer.begin(), Buffer.end());
     }
+
+private:
+    stemming::english_stem<> Stemmer;
+    std::wstring Buffer;
 };
 
+namespace NText {
+    enum class ECharClass : uint8_t {
+        EDrop,
+        ESeparator,
+        EToken,
+    };
+
+    struct TCharTable {
+        std::array<ECharClass, 256> Class{};
+        std::array<char, 256> Lower{};
+    };
+
+    // the same classification as std::isalnum / std::isspace / std::tolower in the "C" locale
+    constexpr TCharTable MakeCharTable() {
+        TCharTable table;
+        for (std::size_t c = 0; c < 256; ++c) {
+            table.Lower[c] = static_cast<char>(c);
+            if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')) {
+                table.Class[c] = ECharClass::EToken;
+            } else if (c >= 'A' && c <= 'Z') {
+                table.Class[c] = ECharClass::EToken;
+                table.Lower[c] = static_cast<char>(c - 'A' + 'a');
+            } else if (c == ' ' || (c >= '\t' && c <= '\r')) {
+                table.Class[c] = ECharClass::ESeparator;
+            } else {
+                table.Class[c] = ECharClass::EDrop;
+            }
+        }
+        return table;
+    }
+
+    inline constexpr TCharTable CHAR_TABLE = MakeCharTable();
+}
+
 class TTextProcessor {
 public:
     struct TOpts {
@@ -33,66 +73,99 @@ public:
         bool AddNGrams = false;
         bool AddStemming = true;
         bool RemoveStopWords = true;
+        std::size_t NGramSize = 3;
     };
 
-    std::vector<std::string> Process(std::string text, TOpts opts = {}) {
-        std::transform(text.begin(), text.end(), text.begin(), ::tolower);
-        text.erase(std::remove_if(text.begin(), text.end(), [](unsigned char c) {
-            return !std::isalnum(c) && !std::isspace(c);
-        }), text.end());
-        std::vector<std::string> tokens = Tokenize(text);
-        if (opts.RemoveStopWords) {
-            tokens.erase(std::remove_if(tokens.begin(), tokens.end(), [this](const std::string &token) {
-                return std::find(STOP_WORDS.begin(), STOP_WORDS.end(), token) != STOP_WORDS.end();
-            }), tokens.end());
-        }
+    // the word boundaries are marked, so the grams of "$" + prefix and suffix + "$" find anchored matches
+    static constexpr char NGRAM_BOUNDARY = '$';
+
+    TTextProcessor(TStopWords stopWords = TStopWords::Default())
+        : StopWords(std::move(stopWords))
+    {}
+
+    const TStopWords& GetStopWords() const {
+        return StopWords;
+    }
+
+    void Stem(std::string& word) {
+        stemmer.Stem(word);
+    }
 
+    std::vector<std::string> Process(std::string_view text, TOpts opts = {}) {
+        NTRACE_SPAN("text", "Process");
         std::vector<std::string> processedWords;
-        if (opts.AddStemming) {
-            for (std::string &token: tokens) {
-                processedWords.push_back(token);
-                stemmer.Stem(processedWords.back());
-            }
-        } else {
-            processedWords = tokens;
-        }
+        ForEachToken(text, opts, [&processedWords](std::string_view token) {
+            processedWords.emplace_back(token);
+        });
+        return processedWords;
+    }
 
-        if (opts.AddNGrams) {
-            std::vector<std::string> nGrams;
-            for (const auto& token: tokens) {
-                for (size_t k = 1; k <= token.size(); ++k) {
-                    auto kGram = GenerateKGram(token, k);
-                    nGrams.insert(nGrams.end(), std::make_move_iterator(kGram.begin()), std::make_move_iterator(kGram.end()));
+    // Single pass over the text: lowercases, drops punctuation, splits by spaces and calls
+    // onToken for every processed word. The views point to the internal buffer and are
+    // valid only during the call.
+    template <typename TOnToken>
+    void ForEachToken(std::string_view text, TOpts opts, TOnToken&& onToken) {
+        Token.clear();
+        for (unsigned char c: text) {
+            switch (NText::CHAR_TABLE.Class[c]) {
+                case NText::ECharClass::EToken: {
+                    Token.push_back(NText::CHAR_TABLE.Lower[c]);
+                    break;
+                }
+                case NText::ECharClass::ESeparator: {
+                    if (!Token.empty()) {
+                        ProcessToken(opts, onToken);
+                        Token.clear();
+                    }
+                    break;
+                }
+                case NText::ECharClass::EDrop: {
+                    break;
                 }
             }
-            processedWords = std::move(nGrams);
         }
 
-        return processedWords;
+        if (!Token.empty()) {
+            ProcessToken(opts, onToken);
+            Token.clear();
+        }
     }
 
-private:
-    TStemmer stemmer;
-    std::vector<std::string> STOP_WORDS = {"the", "and", "is", "in", "at", "of", "a", "on"};
-
-    static std::vector<std::string> GenerateKGram(const std::string& token, size_t k) {
-        std::vector<std::string> nGrams;
-        nGrams.reserve(token.size() - k + 1);
+    // every substring of the given size, the whole text if it is shorter
+    template <typename TOnGram>
+    static void ForEachNGram(std::string_view text, std::size_t n, TOnGram&& onGram) {
+        if (text.size() <= n) {
+            onGram(text);
+            return;
+        }
+        for (std::size_t i = 0; i + n <= text.size(); ++i) {
+            onGram(text.substr(i, n));
+        }
+    }
 
-        for (size_t i = 0; i < token.size() - k + 1; ++i) {
-            nGrams.push_back(token.substr(0, k));
+private:
+    template <typename TOnToken>
+    void ProcessToken(TOpts opts, TOnToken& onToken) {
+        if (opts.RemoveStopWords && StopWords.Contains(Token)) {
+            return;
         }
 
-        return nGrams;
-    }
+        if (opts.AddNGrams) {
+            Token.insert(Token.begin(), NGRAM_BOUNDARY);
+            Token.push_back(NGRAM_BOUNDARY);
+            ForEachNGram(Token, opts.NGramSize, onToken);
+            return;
+        }
 
-    static std::vector<std::string> Tokenize(const std::string& text) {
-        std::vector<std::string> tokens;
-        std::istringstream stream(text);
-        std::string token;
-        while (stream >> token) {
-            tokens.push_back(token);
+        if (opts.AddStemming) {
+            stemmer.Stem(Token);
         }
-        return tokens;
+        onToken(std::string_view(Token));
     }
+
+private:
+    TStemmer stemmer;
+    TStopWords StopWords;
+    // the current token, reused between the tokens and the calls
+    std::string Token;
 };
@@ -1,11 +1,12 @@
 #pragma once
 
+#include <filesystem>
 #include <string>
 #include <vector>
 
 namespace NUtils {
 
-    std::vector<std::string> Split(const std::string &str, char delimiter) {
+    inline std::vector<std::string> Split(const std::string &str, char delimiter) {
         std::vector<std::string> result;
         std::string token;
         for (char ch: str) {
@@ -24,4 +25,9 @@ namespace NUtils {
         return result;
     }
 
+    inline std::filesystem::path EnsureDirectory(std::filesystem::path path) {
+        std::filesystem::create_directories(path);
+        return path;
+    }
+
 }
\ No newline at end of file
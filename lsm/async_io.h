@@ -0,0 +1,330 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+// defined by linux/fs.h, clashes with the constants of the users
+#undef BLOCK_SIZE
+#undef BLOCK_SIZE_BITS
+#define LSM_HAS_IO_URING 1
+#endif
+
+#include "spdlog/spdlog.h"
+
+// Positioned reads which are submitted now and completed later, so one thread can keep
+// many of them in flight. io_uring is used through the raw syscalls when the kernel has
+// it (and a seccomp profile doesn't hide it), pread on the submission otherwise.
+namespace NAsyncIO {
+    struct TCompletion {
+        uint64_t Tag;
+        // the bytes read or -errno
+        int64_t Result;
+    };
+
+    class IReader {
+    public:
+        virtual ~IReader() = default;
+
+        // false if Capacity reads are in flight already, the buffer has to live until the completion
+        virtual bool Read(int fd, uint64_t offset, void* buffer, uint32_t size, uint64_t tag) = 0;
+
+        // submits the queued reads and appends the completions, waits for minCompletions of them
+        virtual void Wait(std::vector<TCompletion>& completions, std::size_t minCompletions) = 0;
+
+        virtual std::size_t InFlight() const = 0;
+
+        virtual std::size_t Capacity() const = 0;
+
+        virtual const char* GetName() const = 0;
+    };
+
+    // the reads are executed on the submission, the completions are only delivered later
+    class TPReadReader : public IReader {
+    public:
+        explicit TPReadReader(std::size_t capacity)
+            : MaxInFlight(std::max<std::size_t>(capacity, 1))
+        {}
+
+        bool Read(int fd, uint64_t offset, void* buffer, uint32_t size, uint64_t tag) override {
+            if (Completed.size() >= MaxInFlight) {
+                return false;
+            }
+
+            std::size_t done = 0;
+            while (done < size) {
+                auto count = pread(fd, static_cast<char*>(buffer) + done, size - done, offset + done);
+                if (count < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (count <= 0) {
+                    Completed.push_back(TCompletion{.Tag = tag, .Result = count < 0 ? -errno : static_cast<int64_t>(done)});
+                    return true;
+                }
+                done += count;
+            }
+            Completed.push_back(TCompletion{.Tag = tag, .Result = static_cast<int64_t>(done)});
+            return true;
+        }
+
+        void Wait(std::vector<TCompletion>& completions, std::size_t) override {
+            completions.insert(completions.end(), Completed.begin(), Completed.end());
+            Completed.clear();
+        }
+
+        std::size_t InFlight() const override {
+            return Completed.size();
+        }
+
+        std::size_t Capacity() const override {
+            return MaxInFlight;
+        }
+
+        const char* GetName() const override {
+            return "pread";
+        }
+
+    private:
+        std::size_t MaxInFlight;
+        std::vector<TCompletion> Completed;
+    };
+
+#ifdef LSM_HAS_IO_URING
+    // Single thread io_uring: the submission and the completion rings are mapped from
+    // the kernel, the reads are queued as IORING_OP_READ and submitted by Wait with
+    // one io_uring_enter.
+    class TURingReader : public IReader {
+    public:
+        // throws if io_uring or IORING_OP_READ is not available
+        explicit TURingReader(std::size_t capacity) {
+            io_uring_params params{};
+            Ring = syscall(__NR_io_uring_setup, static_cast<unsigned>(std::max<std::size_t>(capacity, 1)), &params);
+            if (Ring < 0) {
+                throw std::runtime_error(std::string("io_uring_setup: ") + std::strerror(errno));
+            }
+
+            try {
+                Map(params);
+                Probe();
+            } catch (...) {
+                Unmap();
+                close(Ring);
+                throw;
+            }
+        }
+
+        ~TURingReader() override {
+            // the kernel may still write into the buffers of the reads in flight
+            std::vector<TCompletion> completions;
+            while (Pending > 0) {
+                try {
+                    Wait(completions, 1);
+                } catch (...) {
+                    break;
+                }
+            }
+            Unmap();
+            close(Ring);
+        }
+
+        TURingReader(const TURingReader&) = delete;
+        TURingReader& operator=(const TURingReader&) = delete;
+
+        bool Read(int fd, uint64_t offset, void* buffer, uint32_t size, uint64_t tag) override {
+            if (Pending >= SQEntries) {
+                return false;
+            }
+
+            unsigned tail = *SQTail;
+            unsigned index = tail & *SQMask;
+            io_uring_sqe& sqe = SQEs[index];
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_READ;
+            sqe.fd = fd;
+            sqe.off = offset;
+            sqe.addr = reinterpret_cast<uint64_t>(buffer);
+            sqe.len = size;
+            sqe.user_data = tag;
+            SQArray[index] = index;
+            std::atomic_ref<unsigned>(*SQTail).store(tail + 1, std::memory_order_release);
+
+            ++Unsubmitted;
+            ++Pending;
+            return true;
+        }
+
+        void Wait(std::vector<TCompletion>& completions, std::size_t minCompletions) override {
+            minCompletions = std::min(minCompletions, Pending);
+            std::size_t reaped = Reap(completions);
+            while (Unsubmitted > 0 || reaped < minCompletions) {
+                unsigned wait = reaped < minCompletions ? 1 : 0;
+                int submitted = syscall(__NR_io_uring_enter, Ring, Unsubmitted, wait, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+                if (submitted < 0) {
+                    if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                        reaped += Reap(completions);
+                        continue;
+                    }
+                    throw std::runtime_error(std::string("io_uring_enter: ") + std::strerror(errno));
+                }
+                Unsubmitted -= submitted;
+                reaped += Reap(completions);
+            }
+        }
+
+        std::size_t InFlight() const override {
+            return Pending;
+        }
+
+        std::size_t Capacity() const override {
+            return SQEntries;
+        }
+
+        const char* GetName() const override {
+            return "io_uring";
+        }
+
+    private:
+        void Map(const io_uring_params& params) {
+            SQEntries = params.sq_entries;
+            SQRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            CQRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            if (params.features & IORING_FEAT_SINGLE_MMAP) {
+                SQRingSize = CQRingSize = std::max(SQRingSize, CQRingSize);
+            }
+
+            SQRing = MapRegion(SQRingSize, IORING_OFF_SQ_RING);
+            CQRing = params.features & IORING_FEAT_SINGLE_MMAP ? SQRing : MapRegion(CQRingSize, IORING_OFF_CQ_RING);
+            SQEsSize = params.sq_entries * sizeof(io_uring_sqe);
+            SQEs = static_cast<io_uring_sqe*>(MapRegion(SQEsSize, IORING_OFF_SQES));
+
+            auto* sq = static_cast<char*>(SQRing);
+            SQTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+            SQMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+            SQArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+            auto* cq = static_cast<char*>(CQRing);
+            CQHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+            CQTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+            CQMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+            CQEs = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        }
+
+        void* MapRegion(std::size_t size, off_t offset) {
+            void* region = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Ring, offset);
+            if (region == MAP_FAILED) {
+                throw std::runtime_error(std::string("io_uring mmap: ") + std::strerror(errno));
+            }
+            return region;
+        }
+
+        void Unmap() {
+            if (SQEs) {
+                munmap(SQEs, SQEsSize);
+            }
+            if (CQRing && CQRing != SQRing) {
+                munmap(CQRing, CQRingSize);
+            }
+            if (SQRing) {
+                munmap(SQRing, SQRingSize);
+            }
+            SQEs = nullptr;
+            SQRing = CQRing = nullptr;
+        }
+
+        // IORING_OP_READ appeared in 5.6, the older kernels have the readv only
+        void Probe() {
+            constexpr std::size_t OP_COUNT = 256;
+            std::vector<char> buffer(sizeof(io_uring_probe) + OP_COUNT * sizeof(io_uring_probe_op), 0);
+            auto* probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+            if (syscall(__NR_io_uring_register, Ring, IORING_REGISTER_PROBE, probe, OP_COUNT) < 0) {
+                throw std::runtime_error(std::string("io_uring probe: ") + std::strerror(errno));
+            }
+            if (probe->last_op < IORING_OP_READ || !(probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED)) {
+                throw std::runtime_error("io_uring doesn't support IORING_OP_READ.");
+            }
+        }
+
+        std::size_t Reap(std::vector<TCompletion>& completions) {
+            unsigned head = *CQHead;
+            unsigned tail = std::atomic_ref<unsigned>(*CQTail).load(std::memory_order_acquire);
+            std::size_t reaped = 0;
+            for (; head != tail; ++head, ++reaped) {
+                const io_uring_cqe& cqe = CQEs[head & *CQMask];
+                completions.push_back(TCompletion{.Tag = cqe.user_data, .Result = cqe.res});
+            }
+            std::atomic_ref<unsigned>(*CQHead).store(head, std::memory_order_release);
+            Pending -= reaped;
+            return reaped;
+        }
+
+    private:
+        int Ring = -1;
+        std::size_t SQEntries = 0;
+        std::size_t Pending = 0;
+        std::size_t Unsubmitted = 0;
+
+        void* SQRing = nullptr;
+        void* CQRing = nullptr;
+        io_uring_sqe* SQEs = nullptr;
+        std::size_t SQRingSize = 0;
+        std::size_t CQRingSize = 0;
+        std::size_t SQEsSize = 0;
+
+        unsigned* SQTail = nullptr;
+        unsigned* SQMask = nullptr;
+        unsigned* SQArray = nullptr;
+        unsigned* CQHead = nullptr;
+        unsigned* CQTail = nullptr;
+        unsigned* CQMask = nullptr;
+        io_uring_cqe* CQEs = nullptr;
+    };
+#endif
+
+    enum class EBackend {
+        // io_uring if available, pread otherwise
+        EAuto,
+        EIOURing,
+        EPRead,
+    };
+
+    inline std::unique_ptr<IReader> MakeReader(std::size_t capacity, EBackend backend = EBackend::EAuto) {
+#ifdef LSM_HAS_IO_URING
+        if (backend != EBackend::EPRead) {
+            try {
+                return std::make_unique<TURingReader>(capacity);
+            } catch (const std::exception& e) {
+                if (backend == EBackend::EIOURing) {
+                    throw;
+                }
+                spdlog::debug(std::string("falling back to pread: ") + e.what());
+            }
+        }
+#else
+        if (backend == EBackend::EIOURing) {
+            throw std::runtime_error("io_uring is not supported.");
+        }
+#endif
+        return std::make_unique<TPReadReader>(capacity);
+    }
+
+    const static std::size_t THREAD_READER_CAPACITY = 64ull;
+
+    // the io_uring setup costs a few syscalls and mappings, so a thread keeps its reader
+    inline IReader& GetThreadReader() {
+        thread_local std::unique_ptr<IReader> reader = MakeReader(THREAD_READER_CAPACITY);
+        return *reader;
+    }
+}
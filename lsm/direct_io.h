@@ -0,0 +1,318 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "spdlog/spdlog.h"
+
+// Sequential file I/O of the flushes and the compactions. The merges stream whole
+// tables, which would push the hot pages of the foreground reads out of the page cache:
+//   EBuffered  plain reads and writes through the page cache
+//   EFadvise   through the page cache, the passed ranges are written back and dropped
+//   EDirect    O_DIRECT with aligned buffers, the page cache isn't touched at all
+// A file system without O_DIRECT support (tmpfs) falls back to EFadvise.
+namespace NDirectIO {
+    enum class EMode {
+        EBuffered,
+        EFadvise,
+        EDirect,
+    };
+
+    // the logical block size of the common devices, O_DIRECT needs the offsets, the sizes and the buffers aligned to it
+    const static std::size_t ALIGNMENT = 4'096ull;
+    const static std::size_t CHUNK_SIZE = 1ull << 20;
+
+    inline EMode ParseMode(const std::string& name) {
+        if (name == "buffered") {
+            return EMode::EBuffered;
+        }
+        if (name == "fadvise") {
+            return EMode::EFadvise;
+        }
+        if (name == "direct") {
+            return EMode::EDirect;
+        }
+        throw std::runtime_error("unknown io mode: " + name + ".");
+    }
+
+    struct TFree {
+        void operator()(char* data) const {
+            std::free(data);
+        }
+    };
+    using TAlignedBuffer = std::unique_ptr<char[], TFree>;
+
+    // The chunks are reused between the compactions instead of being allocated for every file.
+    class TBufferPool {
+    public:
+        static TBufferPool& Get() {
+            static TBufferPool pool;
+            return pool;
+        }
+
+        TAlignedBuffer Acquire() {
+            {
+                std::lock_guard lock(Mutex);
+                if (!Free.empty()) {
+                    auto buffer = std::move(Free.back());
+                    Free.pop_back();
+                    return buffer;
+                }
+            }
+            auto* data = static_cast<char*>(std::aligned_alloc(ALIGNMENT, CHUNK_SIZE));
+            if (!data) {
+                throw std::bad_alloc();
+            }
+            return TAlignedBuffer(data);
+        }
+
+        void Release(TAlignedBuffer buffer) {
+            std::lock_guard lock(Mutex);
+            if (Free.size() < MAX_FREE_BUFFERS) {
+                Free.push_back(std::move(buffer));
+            }
+        }
+
+    private:
+        // two readers and a writer per merge, a few merges at once
+        const static std::size_t MAX_FREE_BUFFERS = 16ull;
+
+        std::mutex Mutex;
+        std::vector<TAlignedBuffer> Free;
+    };
+
+    inline int OpenFile(const std::filesystem::path& path, int flags, EMode& mode) {
+        int fd = -1;
+        if (mode == EMode::EDirect) {
+            fd = open(path.c_str(), flags | O_DIRECT | O_CLOEXEC, 0644);
+            if (fd < 0 && errno == EINVAL) {
+                spdlog::debug("O_DIRECT is not supported for " + path.string() + ", falling back to fadvise.");
+                mode = EMode::EFadvise;
+            }
+        }
+        if (fd < 0) {
+            fd = open(path.c_str(), flags | O_CLOEXEC, 0644);
+        }
+        if (fd < 0) {
+            throw std::runtime_error("can't open " + path.string() + ": " + std::strerror(errno) + ".");
+        }
+        return fd;
+    }
+
+    // fsync of a file written through a stream or of a directory after a rename in it
+    inline void SyncPath(const std::filesystem::path& path) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::runtime_error("can't open " + path.string() + ": " + std::strerror(errno) + ".");
+        }
+        int result = fsync(fd);
+        close(fd);
+        if (result < 0) {
+            throw std::runtime_error("can't sync " + path.string() + ".");
+        }
+    }
+
+    // reads the file from offset by CHUNK_SIZE chunks, Read copies out of the current chunk
+    class TSequentialReader {
+    public:
+        TSequentialReader(const std::filesystem::path& path, EMode mode, uint64_t offset = 0)
+            : Mode(mode)
+            , Buffer(TBufferPool::Get().Acquire())
+            , Fd(OpenFile(path, O_RDONLY, Mode))
+            // the chunks stay aligned, the head of the first one is skipped
+            , Offset(offset / ALIGNMENT * ALIGNMENT)
+            , Skip(offset % ALIGNMENT)
+        {
+            struct stat st{};
+            if (fstat(Fd, &st) < 0) {
+                close(Fd);
+                TBufferPool::Get().Release(std::move(Buffer));
+                throw std::runtime_error("can't stat " + path.string() + ".");
+            }
+            FileSize = st.st_size;
+            if (Mode != EMode::EBuffered) {
+                posix_fadvise(Fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            }
+        }
+
+        ~TSequentialReader() {
+            close(Fd);
+            TBufferPool::Get().Release(std::move(Buffer));
+        }
+
+        TSequentialReader(const TSequentialReader&) = delete;
+        TSequentialReader& operator=(const TSequentialReader&) = delete;
+
+        // false at the end of the file, a record cut by the end is an error
+        bool Read(void* data, std::size_t size) {
+            auto* out = static_cast<char*>(data);
+            std::size_t done = 0;
+            while (done < size) {
+                if (Position == Filled) {
+                    if (!Fill()) {
+                        if (done != 0) {
+                            throw std::runtime_error("truncated record.");
+                        }
+                        return false;
+                    }
+                }
+                std::size_t count = std::min(size - done, Filled - Position);
+                std::memcpy(out + done, Buffer.get() + Position, count);
+                Position += count;
+                done += count;
+            }
+            return true;
+        }
+
+    private:
+        bool Fill() {
+            if (Mode == EMode::EFadvise && Filled != 0) {
+                posix_fadvise(Fd, Offset - Filled, Filled, POSIX_FADV_DONTNEED);
+            }
+            if (Offset >= FileSize) {
+                return false;
+            }
+
+            // O_DIRECT reads the whole chunk, the read stops short at the end of the file
+            std::size_t filled = 0;
+            while (filled < CHUNK_SIZE && Offset + filled < FileSize) {
+                auto count = pread(Fd, Buffer.get() + filled, CHUNK_SIZE - filled, Offset + filled);
+                if (count < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (count < 0) {
+                    throw std::runtime_error(std::string("pread: ") + std::strerror(errno));
+                }
+                if (count == 0) {
+                    break;
+                }
+                filled += count;
+                if (Mode == EMode::EDirect && filled % ALIGNMENT != 0) {
+                    break;
+                }
+            }
+            Offset += filled;
+            Filled = filled;
+            Position = std::min<std::size_t>(std::exchange(Skip, 0), filled);
+            return Position < Filled;
+        }
+
+    private:
+        EMode Mode;
+        // acquired before the file is opened, a failed allocation leaks no fd
+        TAlignedBuffer Buffer;
+        int Fd;
+        uint64_t FileSize = 0;
+        // the file offset after the current chunk
+        uint64_t Offset = 0;
+        std::size_t Skip = 0;
+        std::size_t Filled = 0;
+        std::size_t Position = 0;
+    };
+
+    // writes the file by CHUNK_SIZE chunks, Finish writes the tail and syncs
+    class TSequentialWriter {
+    public:
+        TSequentialWriter(const std::filesystem::path& path, EMode mode)
+            : Path(path)
+            , Mode(mode)
+            , Buffer(TBufferPool::Get().Acquire())
+            , Fd(OpenFile(path, O_WRONLY | O_CREAT | O_TRUNC, Mode))
+        {}
+
+        ~TSequentialWriter() {
+            close(Fd);
+            TBufferPool::Get().Release(std::move(Buffer));
+        }
+
+        TSequentialWriter(const TSequentialWriter&) = delete;
+        TSequentialWriter& operator=(const TSequentialWriter&) = delete;
+
+        void Write(const void* data, std::size_t size) {
+            auto* in = static_cast<const char*>(data);
+            while (size > 0) {
+                std::size_t count = std::min(size, CHUNK_SIZE - Filled);
+                std::memcpy(Buffer.get() + Filled, in, count);
+                Filled += count;
+                in += count;
+                size -= count;
+                if (Filled == CHUNK_SIZE) {
+                    WriteChunk(CHUNK_SIZE);
+                }
+            }
+        }
+
+        void Finish() {
+            std::size_t size = Filled;
+            if (Mode == EMode::EDirect && size % ALIGNMENT != 0) {
+                // the tail is padded to the block and cut back
+                std::size_t padded = (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+                std::memset(Buffer.get() + size, 0, padded - size);
+                WriteChunk(padded);
+                Offset -= padded - size;
+                if (ftruncate(Fd, Offset) < 0) {
+                    throw std::runtime_error("can't truncate " + Path.string() + ".");
+                }
+            } else if (size != 0) {
+                WriteChunk(size);
+            }
+
+            // in every mode, the meta referring to the file is replaced after it
+            if (fdatasync(Fd) < 0) {
+                throw std::runtime_error("can't sync " + Path.string() + ".");
+            }
+            if (Mode == EMode::EFadvise) {
+                posix_fadvise(Fd, 0, 0, POSIX_FADV_DONTNEED);
+            }
+        }
+
+    private:
+        void WriteChunk(std::size_t size) {
+            std::size_t done = 0;
+            while (done < size) {
+                auto count = pwrite(Fd, Buffer.get() + done, size - done, Offset + done);
+                if (count < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (count < 0) {
+                    throw std::runtime_error("can't write " + Path.string() + ": " + std::strerror(errno) + ".");
+                }
+                done += count;
+            }
+
+            if (Mode == EMode::EFadvise) {
+                // the writeback of this chunk is started, the previous one is waited for and dropped
+                sync_file_range(Fd, Offset, size, SYNC_FILE_RANGE_WRITE);
+                if (Offset >= CHUNK_SIZE) {
+                    sync_file_range(Fd, Offset - CHUNK_SIZE, CHUNK_SIZE, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+                    posix_fadvise(Fd, Offset - CHUNK_SIZE, CHUNK_SIZE, POSIX_FADV_DONTNEED);
+                }
+            }
+            Offset += size;
+            Filled = 0;
+        }
+
+    private:
+        std::filesystem::path Path;
+        EMode Mode;
+        // acquired before the file is opened, a failed allocation leaks no fd
+        TAlignedBuffer Buffer;
+        int Fd;
+        uint64_t Offset = 0;
+        std::size_t Filled = 0;
+    };
+}
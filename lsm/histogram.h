@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <sstream>
+#include <string>
+
+// Latency histogram in the HdrHistogram layout: the values below 2^SUB_BUCKET_BITS
+// have their own buckets, the larger ones are split into 2^(SUB_BUCKET_BITS - 1)
+// buckets per power of two. The relative error of a percentile stays below
+// 2^-(SUB_BUCKET_BITS - 1) over the whole uint64_t range, the memory is fixed.
+class THistogram {
+public:
+    static constexpr std::size_t SUB_BUCKET_BITS = 8;
+    static constexpr std::size_t SUB_BUCKET_COUNT = 1ull << SUB_BUCKET_BITS;
+    static constexpr std::size_t HALF_SUB_BUCKET_COUNT = SUB_BUCKET_COUNT / 2;
+    static constexpr std::size_t BUCKET_COUNT = SUB_BUCKET_COUNT + (64 - SUB_BUCKET_BITS) * HALF_SUB_BUCKET_COUNT;
+
+public:
+    void Record(uint64_t value) {
+        ++Buckets[GetBucket(value)];
+        ++Count;
+        Sum += value;
+        Min = std::min(Min, value);
+        Max = std::max(Max, value);
+    }
+
+    void Merge(const THistogram& other) {
+        for (std::size_t i = 0; i < BUCKET_COUNT; ++i) {
+            Buckets[i] += other.Buckets[i];
+        }
+        Count += other.Count;
+        Sum += other.Sum;
+        Min = std::min(Min, other.Min);
+        Max = std::max(Max, other.Max);
+    }
+
+    void Clear() {
+        *this = THistogram();
+    }
+
+    uint64_t GetCount() const {
+        return Count;
+    }
+
+    uint64_t GetMin() const {
+        return Count == 0 ? 0 : Min;
+    }
+
+    uint64_t GetMax() const {
+        return Max;
+    }
+
+    double GetMean() const {
+        return Count == 0 ? 0 : static_cast<double>(Sum) / Count;
+    }
+
+    // the largest value of the bucket holding the percentile, percentile in [0, 100]
+    uint64_t GetPercentile(double percentile) const {
+        if (Count == 0) {
+            return 0;
+        }
+
+        uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(percentile / 100 * Count + 0.5));
+        uint64_t seen = 0;
+        for (std::size_t i = 0; i < BUCKET_COUNT; ++i) {
+            seen += Buckets[i];
+            if (seen >= rank) {
+                return std::clamp(GetBucketUpperBound(i), GetMin(), Max);
+            }
+        }
+        return Max;
+    }
+
+    // "count: ... mean: ... p50: ... p99: ... p99.9: ... max: ..."
+    std::string ToString() const {
+        std::stringstream ss;
+        ss << "count: " << Count
+           << " min: " << GetMin()
+           << " mean: " << static_cast<uint64_t>(GetMean())
+           << " p50: " << GetPercentile(50)
+           << " p99: " << GetPercentile(99)
+           << " p99.9: " << GetPercentile(99.9)
+           << " max: " << Max;
+        return ss.str();
+    }
+
+private:
+    friend class TAtomicHistogram;
+
+    static std::size_t GetBucket(uint64_t value) {
+        if (value < SUB_BUCKET_COUNT) {
+            return value;
+        }
+        std::size_t shift = std::bit_width(value) - SUB_BUCKET_BITS;
+        // the top SUB_BUCKET_BITS bits, the highest of them is always set
+        uint64_t top = value >> shift;
+        return SUB_BUCKET_COUNT + (shift - 1) * HALF_SUB_BUCKET_COUNT + (top - HALF_SUB_BUCKET_COUNT);
+    }
+
+    static uint64_t GetBucketUpperBound(std::size_t bucket) {
+        if (bucket < SUB_BUCKET_COUNT) {
+            return bucket;
+        }
+        std::size_t shift = (bucket - SUB_BUCKET_COUNT) / HALF_SUB_BUCKET_COUNT + 1;
+        uint64_t top = (bucket - SUB_BUCKET_COUNT) % HALF_SUB_BUCKET_COUNT + HALF_SUB_BUCKET_COUNT;
+        return (top << shift) + ((1ull << shift) - 1);
+    }
+
+private:
+    std::array<uint64_t, BUCKET_COUNT> Buckets{};
+    uint64_t Count = 0;
+    uint64_t Sum = 0;
+    uint64_t Min = std::numeric_limits<uint64_t>::max();
+    uint64_t Max = 0;
+};
+
+// THistogram which can be recorded from many threads at once, read through a snapshot.
+class TAtomicHistogram {
+public:
+    void Record(uint64_t value) {
+        Buckets[THistogram::GetBucket(value)].fetch_add(1, std::memory_order_relaxed);
+        Count.fetch_add(1, std::memory_order_relaxed);
+        Sum.fetch_add(value, std::memory_order_relaxed);
+        for (uint64_t min = Min.load(std::memory_order_relaxed); value < min && !Min.compare_exchange_weak(min, value, std::memory_order_relaxed);) {
+        }
+        for (uint64_t max = Max.load(std::memory_order_relaxed); value > max && !Max.compare_exchange_weak(max, value, std::memory_order_relaxed);) {
+        }
+    }
+
+    // the concurrent records may be seen partially
+    THistogram Snapshot() const {
+        THistogram histogram;
+        for (std::size_t i = 0; i < THistogram::BUCKET_COUNT; ++i) {
+            histogram.Buckets[i] = Buckets[i].load(std::memory_order_relaxed);
+        }
+        histogram.Count = Count.load(std::memory_order_relaxed);
+        histogram.Sum = Sum.load(std::memory_order_relaxed);
+        histogram.Min = Min.load(std::memory_order_relaxed);
+        histogram.Max = Max.load(std::memory_order_relaxed);
+        return histogram;
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, THistogram::BUCKET_COUNT> Buckets{};
+    std::atomic<uint64_t> Count = 0;
+    std::atomic<uint64_t> Sum = 0;
+    std::atomic<uint64_t> Min = std::numeric_limits<uint64_t>::max();
+    std::atomic<uint64_t> Max = 0;
+};
@@ -1,17 +1,35 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
 #include <iostream>
 #include <cstdlib>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <optional>
 #include <sstream>
-#include <set>
+#include <stdexcept>
 #include <string>
 #include <printf.h>
+#include <thread>
 #include <vector>
 
 #include "spdlog/spdlog.h"
+#include "async_io.h"
+#include "direct_io.h"
+#include "loser_tree.h"
+#include "memory.h"
+#include "statistics.h"
+#include "thread_pool.h"
+#include "trace.h"
 
 namespace NSSTable {
     // Helper struct to check if TKey is hashable
@@ -25,19 +43,30 @@ namespace NSSTable {
     class TBloomFilter {
     public:
         TBloomFilter(std::size_t size = 1'024, size_t hashCount = 3)
-            : BitArray(size)
+            : BitCount(size)
+            , Words((size + 63) / 64, 0)
             , HashCount(hashCount)
         {}
 
         void Count(const TKey& item) {
             for (size_t i = 0; i < HashCount; ++i) {
-                BitArray[Hash(item, i) % BitArray.size()] = true;
+                std::size_t bit = Hash(item, i) % BitCount;
+                Words[bit / 64] |= 1ull << (bit % 64);
+            }
+        }
+
+        // Count from several threads at once, e.g. by the subcompactions filling one filter
+        void CountConcurrently(const TKey& item) {
+            for (size_t i = 0; i < HashCount; ++i) {
+                std::size_t bit = Hash(item, i) % BitCount;
+                std::atomic_ref<uint64_t>(Words[bit / 64]).fetch_or(1ull << (bit % 64), std::memory_order_relaxed);
             }
         }
 
         bool Probe(const TKey& item) const {
             for (size_t i = 0; i < HashCount; ++i) {
-                if (!BitArray[Hash(item, i) % BitArray.size()]) {
+                std::size_t bit = Hash(item, i) % BitCount;
+                if (!(Words[bit / 64] >> (bit % 64) & 1)) {
                     return false;
                 }
             }
@@ -46,11 +75,42 @@ namespace NSSTable {
         }
 
         void Reset() {
-            BitArray.assign(BitArray.size(), false);
+            std::fill(Words.begin(), Words.end(), 0);
+        }
+
+        std::size_t MemoryUsage() const {
+            return Words.capacity() * sizeof(uint64_t);
+        }
+
+        // the bits go in the little endian order
+        void Save(std::ostream& out) const {
+            uint64_t header[2] = {BitCount, HashCount};
+            out.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+            std::vector<uint8_t> bytes((BitCount + 7) / 8, 0);
+            for (std::size_t i = 0; i < bytes.size(); ++i) {
+                bytes[i] = Words[i / 8] >> (i % 8 * 8);
+            }
+            out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        }
+
+        void Load(std::istream& in) {
+            uint64_t header[2] = {0, 0};
+            in.read(reinterpret_cast<char*>(header), sizeof(header));
+            BitCount = header[0];
+            HashCount = header[1];
+
+            std::vector<uint8_t> bytes((BitCount + 7) / 8, 0);
+            in.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+            Words.assign((BitCount + 63) / 64, 0);
+            for (std::size_t i = 0; i < bytes.size(); ++i) {
+                Words[i / 8] |= static_cast<uint64_t>(bytes[i]) << (i % 8 * 8);
+            }
         }
 
     private:
-        std::vector<bool> BitArray;
+        std::size_t BitCount;
+        std::vector<uint64_t, NMemory::TTrackingAllocator<uint64_t, NMemory::ECategory::EBloomFilter>> Words;
         std::size_t HashCount;
 
         std::size_t Hash(const TKey& item, size_t seed) const {
@@ -63,11 +123,34 @@ namespace NSSTable {
         }
     };
 
+    template<typename TKey>
+    struct TPart {
+        std::size_t Size{};
+        TKey FirstKey{};
+        // the file is C<FileID>, never reused by the tree
+        uint64_t FileID{};
+    };
+
+    // An SSTable is stored as one or more files with the ascending disjoint key ranges:
+    // a flush writes one, a compaction one per subcompaction.
     template<typename TKey>
     struct TMeta {
         std::size_t Size{};
         TBloomFilter<TKey> BloomFilter{};
+        std::vector<TPart<TKey>> Parts{};
+
+        // the only part which may contain key, the smaller keys go to the first one
+        std::size_t FindPart(const TKey& key) const {
+            auto it = std::upper_bound(Parts.begin() + 1, Parts.end(), key, [](const TKey& key, const TPart<TKey>& part){ return key < part.FirstKey; });
+            return it - Parts.begin() - 1;
+        }
     };
+
+    // shared by the trees, started by the first parallel compaction
+    inline TThreadPool& GetCompactionPool() {
+        static TThreadPool pool;
+        return pool;
+    }
 }
 
 template <typename TKey, typename TValue>
@@ -77,13 +160,17 @@ public:
     const static std::size_t MAX_SIZE = 10'240ull;
 
 public:
+    // the entries grow on demand, so an idle memtable holds its filter only
     explicit TMemTable()
-        : BloomFilter(MAX_SIZE * 4) {
-        Data.reserve(MAX_SIZE);
-    }
+        : BloomFilter(MAX_SIZE * 4)
+    {}
 
     void Insert(TKey key, TValue value) {
         BloomFilter.Count(key);
+        if (Data.size() == Data.capacity()) {
+            // doubles up to MAX_SIZE, the flush threshold, instead of overshooting it
+            Data.reserve(std::min(std::max<std::size_t>(Data.capacity() * 2, 1), MAX_SIZE));
+        }
         Data.push_back({std::move(key), std::move(value)});
     }
 
@@ -99,75 +186,156 @@ public:
         return *it;
     }
 
-    NSSTable::TMeta<TKey> DumpAsSSTable(const std::filesystem::path& path) {
-        std::set<TEntry> uniqueLastOccur(std::make_move_iterator(Data.rbegin()), std::make_move_iterator(Data.rend()));
-        Data = {std::make_move_iterator(uniqueLastOccur.begin()), std::make_move_iterator(uniqueLastOccur.end())};
+    // the newest entry goes first for the repeated keys
+    std::vector<TEntry> ReadRange(const TKey& lhs, const TKey& rhs) const {
+        std::vector<TEntry> result;
+        std::copy_if(Data.rbegin(), Data.rend(), std::back_inserter(result), [&lhs, &rhs](const TEntry& e){ return lhs <= e.first && e.first <= rhs; });
+        return result;
+    }
 
-        NSSTable::TMeta<TKey> metaData = {.Size = Data.size(), .BloomFilter = BloomFilter};
-        std::ofstream fOut(path, std::ios::out | std::ios::binary);
-        fOut.write(reinterpret_cast<const char*>(Data.data()), Data.size() * sizeof(TEntry));
+    NSSTable::TMeta<TKey> DumpAsSSTable(const std::filesystem::path& path, NDirectIO::EMode ioMode = NDirectIO::EMode::EBuffered) {
+        NTRACE_SPAN("lsm", "DumpAsSSTable");
+        // sorted in place, the last inserted version of a key wins
+        std::stable_sort(Data.begin(), Data.end(), [](const TEntry& lhs, const TEntry& rhs){ return lhs.first < rhs.first; });
+        auto last = std::unique(Data.rbegin(), Data.rend(), [](const TEntry& lhs, const TEntry& rhs){ return lhs.first == rhs.first; });
+        Data.erase(Data.begin(), last.base());
+
+        NSSTable::TMeta<TKey> metaData = {.Size = Data.size(), .BloomFilter = BloomFilter, .Parts = {{.Size = Data.size(), .FirstKey = Data.front().first}}};
+        NDirectIO::TSequentialWriter writer(path, ioMode);
+        writer.Write(Data.data(), Data.size() * sizeof(TEntry));
+        writer.Finish();
+        // the buffer is kept for the next entries, see Release
         Data.clear();
         BloomFilter.Reset();
 
         return metaData;
     }
 
+    // frees the buffer of the entries, e.g. of a memtable flushed to free the memory
+    void Release() {
+        Data = TData();
+    }
+
     std::size_t Size() const {
         return Data.size();
     }
 
+    // the allocated entries and the filter
+    std::size_t MemoryUsage() const {
+        return Data.capacity() * sizeof(TEntry) + BloomFilter.MemoryUsage();
+    }
+
 private:
+    using TData = std::vector<TEntry, NMemory::TTrackingAllocator<TEntry, NMemory::ECategory::EMemTable>>;
+
     NSSTable::TBloomFilter<TKey> BloomFilter{};
-    std::vector<TEntry> Data{};
+    TData Data{};
 };
 
+// The writes (Insert, BulkInsert, Flush) need exclusive access. The const reads may run
+// concurrently with each other: they keep their state on the stack, the statistics are
+// atomic and the asynchronous reads go through a reader of the calling thread.
 template <typename TKey, typename TValue>
 class TLSMTree {
 public:
     using TEntry = std::pair<TKey, TValue>;
+    // a smaller compaction is not split
+    const static std::size_t MIN_SUBCOMPACTION_BYTES = 4ull << 20;
 
     struct TMeta {
         std::size_t SSTableDiffCoefficient = 3;
         std::vector<NSSTable::TMeta<TKey>> SSTableMeta{};
     };
 
-    struct TStatistics {
-        std::size_t BloomFilterReadPointFalsePositive = 0;
-        std::size_t BloomFilterReadPointLookupCount = 0;
-        std::size_t LookUpCount = 0;
-        std::size_t MemTableSuccessLookupCount = 0;
-        std::size_t InsertCount = 0;
-
-        ~TStatistics() {
-            std::stringstream ss;
-            ss
-                << "\n"
-                << "LSMTree Statistics: \n\t"
-                << "LookUpCount: " << LookUpCount << "\n\t"
-                << "MemTableSuccessLookupCount: " << MemTableSuccessLookupCount << "\n\t"
-                << "BloomFilterReadPointFalsePositive: " << BloomFilterReadPointFalsePositive << "\n\t"
-                << "BloomFilterReadPointLookupCount: " << BloomFilterReadPointLookupCount << "\n\t"
-                << "InsertCount: " << InsertCount << "\n\t";
-
-            spdlog::debug(ss.str());
-        }
-    };
-
 public:
-    TLSMTree(std::filesystem::path sourcePath)
+    // the flushes and the compactions are done with backgroundIO, see direct_io.h,
+    // the trees sharing writeBufferManager keep their memtables within its limit
+    TLSMTree(
+            std::filesystem::path sourcePath,
+            NDirectIO::EMode backgroundIO = NDirectIO::EMode::EBuffered,
+            std::shared_ptr<NMemory::TWriteBufferManager> writeBufferManager = nullptr
+    )
         : SourcePath(std::move(sourcePath))
+        , BackgroundIO(backgroundIO)
+        , WriteBufferManager(std::move(writeBufferManager))
     {
         LoadFromDisk();
+        if (WriteBufferManager) {
+            WriteBufferManager->Register(WriteBuffer);
+            WriteBufferManager->Update(WriteBuffer, MemTable.MemoryUsage());
+        }
+    }
+
+    // the memtable is dumped, so the tree is loaded back entirely
+    ~TLSMTree() {
+        try {
+            Flush();
+        } catch (const std::exception& e) {
+            spdlog::error(std::string("Failed to flush the LSM Tree: ") + e.what());
+        }
+        if (WriteBufferManager) {
+            WriteBufferManager->Unregister(WriteBuffer);
+        }
+        spdlog::debug(GetStatistics().ToString());
     }
 
+    TLSMTree(const TLSMTree&) = delete;
+    TLSMTree& operator=(const TLSMTree&) = delete;
+
     void Insert(TKey key, TValue value) {
-        ++Stats.InsertCount;
+        auto start = std::chrono::steady_clock::now();
+        Stats->Puts.Add();
+        Stats->UserBytesWritten.Add(sizeof(TEntry));
         MemTable.Insert(std::move(key), std::move(value));
         if (MemTable.Size() == TMemTable<TKey, TValue>::MAX_SIZE) {
-            auto ssTableMeta = MemTable.DumpAsSSTable(GetSSTablePath(MetaData.SSTableMeta.size()));
-            MetaData.SSTableMeta.push_back(std::move(ssTableMeta));
-            CompactSSTables();
+            FlushMemTable(false);
+        } else if (IsOverBudget()) {
+            Stats->BufferFlushes.Add();
+            Flush();
+        }
+        Stats->Record(NStatistics::ELatency::EPut, start);
+    }
+
+    // dumps the memtable as a new SSTable and frees its buffer
+    void Flush() {
+        FlushMemTable(true);
+    }
+
+    // Writes the entries directly as a new SSTable bypassing the memtable, the entries
+    // become newer than everything inserted before. The last one wins for the repeated keys.
+    void BulkInsert(std::vector<TEntry> entries) {
+        if (entries.empty()) {
+            return;
+        }
+
+        Stats->Puts.Add(entries.size());
+        Stats->UserBytesWritten.Add(entries.size() * sizeof(TEntry));
+        Flush();
+
+        std::stable_sort(entries.begin(), entries.end(), [](const TEntry& lhs, const TEntry& rhs){ return lhs.first < rhs.first; });
+        auto last = std::unique(entries.rbegin(), entries.rend(), [](const TEntry& lhs, const TEntry& rhs){ return lhs.first == rhs.first; });
+        entries.erase(entries.begin(), last.base());
+
+        NSSTable::TBloomFilter<TKey> bloomFilter(entries.size() * 5);
+        for (const auto& entry: entries) {
+            bloomFilter.Count(entry.first);
+        }
+
+        if (BeforeFlush) {
+            BeforeFlush();
         }
+        uint64_t fileID = NextFileID++;
+        NDirectIO::TSequentialWriter writer(GetFilePath(fileID), BackgroundIO);
+        writer.Write(entries.data(), entries.size() * sizeof(TEntry));
+        writer.Finish();
+
+        Stats->FlushBytesWritten.Add(entries.size() * sizeof(TEntry));
+        MetaData.SSTableMeta.push_back(NSSTable::TMeta<TKey>{
+            .Size = entries.size(),
+            .BloomFilter = std::move(bloomFilter),
+            .Parts = {{.Size = entries.size(), .FirstKey = entries.front().first, .FileID = fileID}},
+        });
+        CompactSSTables();
     }
 
     template<bool LeftBinSearch = true>
@@ -188,6 +356,7 @@ public:
 
             ssTableFile.seekg(mid * sizeof(TEntry));
             TEntry midEntry; ssTableFile.read(reinterpret_cast<char*>(&midEntry), sizeof(midEntry));
+            NPerf::GetPerfContext().ReadBytes += sizeof(midEntry);
 
             if constexpr (LeftBinSearch) {
                 if (good(midEntry)) {
@@ -211,12 +380,13 @@ public:
         }
     }
 
+    // the found entries in the order of the keys, the SSTable reads of all the keys are in flight at once
     std::vector<TEntry> ReadPoints(const std::vector<TKey>& keys) const {
         std::vector<TEntry> res;
         res.reserve(keys.size());
 
-        for (const auto& key: keys) {
-            if (auto maybeEntry = ReadPoint(key)) {
+        for (auto& maybeEntry: MultiGet(keys)) {
+            if (maybeEntry) {
                 res.push_back(std::move(maybeEntry.value()));
             }
         }
@@ -224,65 +394,482 @@ public:
         return res;
     }
 
+    // one result per key
+    std::vector<std::optional<TEntry>> MultiGet(const std::vector<TKey>& keys) const {
+        std::vector<std::optional<TEntry>> result(keys.size());
+        TAsyncReader reader(*this);
+        for (std::size_t i = 0; i < keys.size(); ++i) {
+            reader.ReadPointAsync(keys[i], [&result, i](std::optional<TEntry> entry) {
+                result[i] = std::move(entry);
+            });
+        }
+        reader.Drain();
+        return result;
+    }
+
+    // Point lookups driven by the completions: every lookup is a binary search over the
+    // SSTables newest first, each step of it is one asynchronous read of an entry, so
+    // a single thread keeps the reads of many lookups in flight. The tree must not be
+    // modified while the reader is alive, one reader uses an IReader at a time.
+    class TAsyncReader {
+    public:
+        using TCallback = std::function<void(std::optional<TEntry>)>;
+
+    public:
+        explicit TAsyncReader(const TLSMTree& tree, NAsyncIO::IReader& reader = NAsyncIO::GetThreadReader())
+            : Tree(tree)
+            , Reader(reader)
+            , Files(tree.MetaData.SSTableMeta.size())
+        {}
+
+        ~TAsyncReader() {
+            try {
+                Drain();
+            } catch (const std::exception& e) {
+                spdlog::error(std::string("Failed to drain the async reads: ") + e.what());
+            }
+            // the reads of a failed drain still write into the lookups and use the fds
+            Blocked.clear();
+            while (Reader.InFlight() > 0) {
+                try {
+                    Completions.clear();
+                    Reader.Wait(Completions, 1);
+                } catch (const std::exception& e) {
+                    spdlog::error(std::string("Failed to wait for the async reads, leaking their buffers: ") + e.what());
+                    for (auto& lookup: Lookups) {
+                        [[maybe_unused]] auto leaked = lookup.release();
+                    }
+                    return;
+                }
+            }
+            for (const auto& parts: Files) {
+                for (int fd: parts) {
+                    if (fd >= 0) {
+                        close(fd);
+                    }
+                }
+            }
+        }
+
+        TAsyncReader(const TAsyncReader&) = delete;
+        TAsyncReader& operator=(const TAsyncReader&) = delete;
+
+        // the callback is called from ReadPointAsync for a memtable hit, from Poll otherwise
+        void ReadPointAsync(const TKey& key, TCallback callback) {
+            auto start = std::chrono::steady_clock::now();
+            if (auto entry = Tree.MemTable.ReadPoint(key)) {
+                Tree.Stats->MemTableHits.Add();
+                Finish(start, std::move(entry), callback);
+                return;
+            }
+
+            std::size_t slot;
+            if (FreeSlots.empty()) {
+                slot = Lookups.size();
+                Lookups.push_back(std::make_unique<TLookup>());
+            } else {
+                slot = FreeSlots.back();
+                FreeSlots.pop_back();
+            }
+
+            auto& lookup = *Lookups[slot];
+            lookup = TLookup{.Key = key, .Callback = std::move(callback), .Start = start, .Level = static_cast<int>(Files.size())};
+            NextLevel(slot);
+        }
+
+        // handles the completions, waits for one if wait and something is in flight
+        void Poll(bool wait = true) {
+            Completions.clear();
+            Reader.Wait(Completions, wait ? 1 : 0);
+            for (const auto& completion: Completions) {
+                OnRead(completion);
+            }
+
+            while (!Blocked.empty() && Reader.InFlight() < Reader.Capacity()) {
+                auto slot = Blocked.back();
+                Blocked.pop_back();
+                Issue(slot);
+            }
+        }
+
+        // until every callback is called, a lookup failed by a read error gets std::nullopt
+        void Drain() {
+            while (Reader.InFlight() > 0 || !Blocked.empty()) {
+                Poll(true);
+            }
+        }
+
+        std::size_t GetActiveCount() const {
+            return Active;
+        }
+
+        // the lookups failed by an unreadable SSTable
+        std::size_t GetFailedCount() const {
+            return Failed;
+        }
+
+    private:
+        struct TLookup {
+            TKey Key{};
+            TCallback Callback;
+            std::chrono::steady_clock::time_point Start;
+            // the SSTable searched now
+            int Level = 0;
+            std::size_t Part = 0;
+            // the binary search state of SSTableExternalMemoryBinSearch
+            int64_t Left = -1;
+            int64_t Right = 0;
+            std::optional<TEntry> Candidate;
+            // the read target, the lookup is not moved while its read is in flight
+            TEntry Buffer{};
+        };
+
+    private:
+        // the next SSTable whose bloom filter may contain the key
+        void NextLevel(std::size_t slot) {
+            auto& lookup = *Lookups[slot];
+            auto& perf = NPerf::GetPerfContext();
+            while (--lookup.Level >= 0) {
+                auto& level = Tree.Stats->GetLevel(lookup.Level);
+                level.Probes.Add();
+                ++perf.BloomProbes;
+                const auto& meta = Tree.MetaData.SSTableMeta[lookup.Level];
+                if (meta.BloomFilter.Probe(lookup.Key)) {
+                    ++perf.SSTableReads;
+                    lookup.Part = meta.FindPart(lookup.Key);
+                    lookup.Left = -1;
+                    lookup.Right = meta.Parts[lookup.Part].Size;
+                    lookup.Candidate.reset();
+                    ++Active;
+                    Issue(slot);
+                    return;
+                }
+                level.BloomUseful.Add();
+                ++perf.BloomUseful;
+            }
+
+            Complete(slot, std::nullopt);
+        }
+
+        void Issue(std::size_t slot) {
+            auto& lookup = *Lookups[slot];
+            if (lookup.Right - lookup.Left <= 1) {
+                FinishLevel(slot);
+                return;
+            }
+
+            int fd = GetFile(lookup.Level, lookup.Part);
+            if (fd < 0) {
+                Fail(slot, "can't open SSTable ");
+                return;
+            }
+            int64_t mid = (lookup.Left + lookup.Right) / 2;
+            if (!Reader.Read(fd, mid * sizeof(TEntry), &lookup.Buffer, sizeof(TEntry), slot)) {
+                Blocked.push_back(slot);
+            }
+        }
+
+        void OnRead(const NAsyncIO::TCompletion& completion) {
+            auto slot = completion.Tag;
+            auto& lookup = *Lookups[slot];
+            if (completion.Result != static_cast<int64_t>(sizeof(TEntry))) {
+                Fail(slot, "failed to read SSTable ");
+                return;
+            }
+
+            NPerf::GetPerfContext().ReadBytes += sizeof(TEntry);
+            Tree.Stats->GetLevel(lookup.Level).ReadBytes.Add(sizeof(TEntry));
+            Tree.Stats->BytesRead.Add(sizeof(TEntry));
+
+            int64_t mid = (lookup.Left + lookup.Right) / 2;
+            if (lookup.Buffer.first <= lookup.Key) {
+                lookup.Left = mid;
+                lookup.Candidate = lookup.Buffer;
+            } else {
+                lookup.Right = mid;
+            }
+            Issue(slot);
+        }
+
+        // the candidate is the last entry with the key not greater than the searched one
+        void FinishLevel(std::size_t slot) {
+            auto& lookup = *Lookups[slot];
+            auto& level = Tree.Stats->GetLevel(lookup.Level);
+            --Active;
+            if (lookup.Candidate && lookup.Candidate->first == lookup.Key) {
+                level.Hits.Add();
+                Complete(slot, std::move(lookup.Candidate));
+                return;
+            }
+            level.BloomFalsePositive.Add();
+            NextLevel(slot);
+        }
+
+        // called from Poll, so the lookup completes without an entry instead of throwing
+        void Fail(std::size_t slot, const char* message) {
+            const auto& lookup = *Lookups[slot];
+            spdlog::error(message + Tree.GetSSTablePath(lookup.Level, lookup.Part).string() + ".");
+            ++Failed;
+            --Active;
+            Complete(slot, std::nullopt);
+        }
+
+        void Complete(std::size_t slot, std::optional<TEntry> entry) {
+            auto& lookup = *Lookups[slot];
+            auto callback = std::move(lookup.Callback);
+            auto start = lookup.Start;
+            FreeSlots.push_back(slot);
+            Finish(start, std::move(entry), callback);
+        }
+
+        void Finish(std::chrono::steady_clock::time_point start, std::optional<TEntry> entry, const TCallback& callback) {
+            Tree.Stats->Gets.Add();
+            Tree.Stats->GetHits.Add(entry.has_value());
+            Tree.Stats->Record(NStatistics::ELatency::EGet, start);
+            callback(std::move(entry));
+        }
+
+        // -1 if the SSTable can't be opened
+        int GetFile(int level, std::size_t part) {
+            auto& parts = Files[level];
+            if (parts.empty()) {
+                parts.assign(Tree.MetaData.SSTableMeta[level].Parts.size(), -1);
+            }
+            if (parts[part] < 0) {
+                parts[part] = open(Tree.GetSSTablePath(level, part).c_str(), O_RDONLY | O_CLOEXEC);
+            }
+            return parts[part];
+        }
+
+    private:
+        const TLSMTree& Tree;
+        NAsyncIO::IReader& Reader;
+        // the fds of the SSTable parts by level, opened on the first read
+        std::vector<std::vector<int>> Files;
+
+        std::vector<std::unique_ptr<TLookup>> Lookups;
+        std::vector<std::size_t> FreeSlots;
+        // the lookups which didn't fit into the reader, issued as the reads complete
+        std::vector<std::size_t> Blocked;
+        // the lookups waiting for the reads
+        std::size_t Active = 0;
+        std::size_t Failed = 0;
+        std::vector<NAsyncIO::TCompletion> Completions;
+    };
+
     std::optional<TEntry> ReadPoint(const TKey& key) const {
-        ++Stats.LookUpCount;
+        NTRACE_SPAN("lsm", "ReadPoint");
+        auto start = std::chrono::steady_clock::now();
+        auto entry = ReadPointImpl(key);
+        Stats->Gets.Add();
+        Stats->GetHits.Add(entry.has_value());
+        Stats->Record(NStatistics::ELatency::EGet, start);
+        return entry;
+    }
 
-        if (auto entry = MemTable.ReadPoint(key)) {
-            ++Stats.MemTableSuccessLookupCount;
-            return entry;
+    // sorted by key, only the latest version of each key is returned
+    std::vector<TEntry> ReadRanges(const TKey& lhs, const TKey& rhs) const {
+        NTRACE_SPAN("lsm", "ReadRanges");
+        auto& perf = NPerf::GetPerfContext();
+        uint64_t readBytes = perf.ReadBytes;
+        // the nodes are the scratch of the request
+        NMemory::TArena arena;
+        using TAllocator = NMemory::TArenaAllocator<std::pair<const TKey, TValue>>;
+        std::map<TKey, TValue, std::less<TKey>, TAllocator> result{TAllocator(arena)};
+
+        // newer entries are visited first, so emplace keeps the latest version
+        {
+            NPerf::TPerfTimer timer(perf.MemTableNanos);
+            for (auto& entry: MemTable.ReadRange(lhs, rhs)) {
+                result.emplace(std::move(entry));
+            }
         }
 
         for (int i = MetaData.SSTableMeta.size() - 1; i >= 0; --i) {
-            ++Stats.BloomFilterReadPointLookupCount;
-            if (!MetaData.SSTableMeta[i].BloomFilter.Probe(key)) {
-                continue;
+            const auto& meta = MetaData.SSTableMeta[i];
+            std::vector<TEntry> entries;
+            {
+                NPerf::TPerfTimer timer(perf.DiskNanos);
+                // the parts overlapping the range
+                for (auto part = meta.FindPart(lhs); part <= meta.FindPart(rhs); ++part) {
+                    ++perf.SSTableReads;
+                    std::ifstream fIn(GetSSTablePath(i, part), std::ios::binary);
+                    auto lRangePos = SSTableExternalMemoryBinSearch<false>(fIn, [&lhs](const TEntry& mid){ return lhs <= mid.first; });
+                    if (lRangePos < 0) {
+                        continue;
+                    }
+                    auto rRangePos = SSTableExternalMemoryBinSearch<true >(fIn, [&rhs](const TEntry& mid){ return mid.first <= rhs; });
+                    if (rRangePos < 0) {
+                        continue;
+                    }
+                    ScanRange(fIn, lRangePos, rRangePos, entries);
+                }
             }
 
-            std::ifstream fIn(GetSSTablePath(i), std::ios::binary);
-            auto maybeEntryPos = SSTableExternalMemoryBinSearch(fIn, [&key](const TEntry& mid){ return mid.first <= key; });
-            fIn.seekg(maybeEntryPos * sizeof(TEntry));
-            TEntry entry; fIn.read(reinterpret_cast<char*>(&entry), sizeof(entry));
-            if (entry.first == key) {
-                return entry;
+            NPerf::TPerfTimer timer(perf.MergeNanos);
+            for (auto& entry: entries) {
+                result.emplace(std::move(entry));
+            }
+        }
+
+        Stats->RangeReads.Add();
+        Stats->RangeEntries.Add(result.size());
+        Stats->BytesRead.Add(perf.ReadBytes - readBytes);
+        return {std::make_move_iterator(result.begin()), std::make_move_iterator(result.end())};
+    }
+
+    // called before a flush or a bulk insert writes an SSTable, e.g. to make durable what the new entries refer to
+    void SetBeforeFlush(std::function<void()> callback) {
+        BeforeFlush = std::move(callback);
+    }
+
+    // the parallelism of a large compaction, 1 merges on the calling thread only
+    void SetMaxSubcompactions(std::size_t count) {
+        MaxSubcompactions = std::max<std::size_t>(count, 1);
+    }
+
+    // Called from the thread of another writer sharing the write buffer manager when the
+    // memtable of this tree has to be flushed, e.g. while the tree is idle. The handler
+    // schedules FlushIfRequested under the lock of the owner, it is not a write itself.
+    void SetFlushRequestHandler(std::function<void()> handler) {
+        if (WriteBufferManager) {
+            WriteBufferManager->SetFlushRequestHandler(WriteBuffer, std::move(handler));
+        }
+    }
+
+    // a write, flushes the memtable if the write buffer manager asked for it
+    void FlushIfRequested() {
+        if (WriteBuffer.FlushRequested.load(std::memory_order_relaxed)) {
+            Stats->BufferFlushes.Add(MemTable.Size() > 0);
+            Flush();
+        }
+    }
+
+    // the latency histograms of the statistics, not concurrently with the other calls
+    void EnableLatencyHistograms() {
+        Stats->EnableLatencies();
+    }
+
+    // consistent if the tree is not modified concurrently
+    NStatistics::TSnapshot GetStatistics() const {
+        auto snapshot = Stats->Snapshot(MetaData.SSTableMeta.size());
+        snapshot.MemTableBytes = MemTable.MemoryUsage();
+        for (const auto& ssTableMeta: MetaData.SSTableMeta) {
+            snapshot.BloomFilterBytes += ssTableMeta.BloomFilter.MemoryUsage();
+        }
+        return snapshot;
+    }
+
+private:
+    // A memtable filled up keeps its buffer for the next entries, one flushed for the
+    // memory budget or by the user frees it, so an idle tree holds its filter only.
+    void FlushMemTable(bool release) {
+        if (MemTable.Size() == 0) {
+            if (release) {
+                MemTable.Release();
             }
+            UpdateWriteBuffer();
+            return;
+        }
+        if (BeforeFlush) {
+            BeforeFlush();
+        }
 
-            ++Stats.BloomFilterReadPointFalsePositive;
+        auto start = std::chrono::steady_clock::now();
+        uint64_t fileID = NextFileID++;
+        auto ssTableMeta = MemTable.DumpAsSSTable(GetFilePath(fileID), BackgroundIO);
+        ssTableMeta.Parts[0].FileID = fileID;
+        Stats->Flushes.Add();
+        Stats->FlushBytesWritten.Add(ssTableMeta.Size * sizeof(TEntry));
+        Stats->Record(NStatistics::ELatency::EFlush, start);
+
+        MetaData.SSTableMeta.push_back(std::move(ssTableMeta));
+        if (release) {
+            MemTable.Release();
         }
+        UpdateWriteBuffer();
+        CompactSSTables();
+    }
 
-        return std::nullopt;
+    void UpdateWriteBuffer() {
+        WriteBuffer.FlushRequested.store(false, std::memory_order_relaxed);
+        if (WriteBufferManager) {
+            WriteBufferManager->Update(WriteBuffer, MemTable.MemoryUsage());
+        }
     }
 
-    std::vector<TEntry> ReadRanges(const TKey& lhs, const TKey& rhs) const {
-        std::vector<TEntry> result;
+    // the manager is updated as the memtable grows, another writer may have asked for a flush
+    bool IsOverBudget() {
+        if (!WriteBufferManager) {
+            return false;
+        }
+        if (WriteBuffer.FlushRequested.load(std::memory_order_relaxed)) {
+            return true;
+        }
+        std::size_t usage = MemTable.MemoryUsage();
+        return usage != WriteBuffer.Usage.load(std::memory_order_relaxed) && WriteBufferManager->Update(WriteBuffer, usage);
+    }
 
-        for (size_t i = 0; i < MetaData.SSTableMeta.size(); ++i) {
-            std::ifstream fIn(GetSSTablePath(i), std::ios::binary);
-            auto lRangePos = SSTableExternalMemoryBinSearch<false>(fIn, [&lhs](const TEntry& mid){ return lhs <= mid.first; });
-            if (lRangePos < 0) {
-                continue;
+    std::optional<TEntry> ReadPointImpl(const TKey& key) const {
+        auto& perf = NPerf::GetPerfContext();
+        {
+            NPerf::TPerfTimer timer(perf.MemTableNanos);
+            if (auto entry = MemTable.ReadPoint(key)) {
+                Stats->MemTableHits.Add();
+                return entry;
+            }
+        }
+
+        for (int i = MetaData.SSTableMeta.size() - 1; i >= 0; --i) {
+            auto& level = Stats->GetLevel(i);
+            level.Probes.Add();
+            ++perf.BloomProbes;
+            bool mayContain;
+            {
+                NPerf::TPerfTimer timer(perf.FilterNanos);
+                mayContain = MetaData.SSTableMeta[i].BloomFilter.Probe(key);
             }
-            auto rRangePos = SSTableExternalMemoryBinSearch<true >(fIn, [&rhs](const TEntry& mid){ return mid.first <= rhs; });
-            if (rRangePos < 0) {
+            if (!mayContain) {
+                level.BloomUseful.Add();
+                ++perf.BloomUseful;
                 continue;
             }
-            auto tmp = ScanRange(fIn, lRangePos, rRangePos);
-            result.insert(result.end(), tmp.begin(), tmp.end());
+
+            NPerf::TPerfTimer timer(perf.DiskNanos);
+            ++perf.SSTableReads;
+            uint64_t readBytes = perf.ReadBytes;
+            std::ifstream fIn(GetSSTablePath(i, MetaData.SSTableMeta[i].FindPart(key)), std::ios::binary);
+            auto maybeEntryPos = SSTableExternalMemoryBinSearch(fIn, [&key](const TEntry& mid){ return mid.first <= key; });
+            // all the keys of the part are greater
+            std::optional<TEntry> entry;
+            if (maybeEntryPos >= 0) {
+                fIn.seekg(maybeEntryPos * sizeof(TEntry));
+                entry.emplace(); fIn.read(reinterpret_cast<char*>(&entry.value()), sizeof(TEntry));
+                perf.ReadBytes += sizeof(TEntry);
+            }
+            level.ReadBytes.Add(perf.ReadBytes - readBytes);
+            Stats->BytesRead.Add(perf.ReadBytes - readBytes);
+            if (entry && entry->first == key) {
+                level.Hits.Add();
+                return entry;
+            }
+
+            level.BloomFalsePositive.Add();
         }
 
-        return result;
+        return std::nullopt;
     }
 
-private:
-    std::vector<TEntry> ScanRange(std::ifstream& fIn, std::streampos lRangePos, std::streampos rRangePos) const {
-        std::vector<TEntry> result;
+    // appends the entries to result
+    void ScanRange(std::ifstream& fIn, std::streampos lRangePos, std::streampos rRangePos, std::vector<TEntry>& result) const {
+        std::size_t size = result.size();
 
         fIn.seekg(lRangePos * sizeof(TEntry));
         while (fIn.tellg() <= rRangePos * sizeof(TEntry)) {
             TEntry entry; fIn.read(reinterpret_cast<char*>(&entry), sizeof(entry));
             result.push_back(std::move(entry));
         }
-
-        return result;
+        NPerf::GetPerfContext().ReadBytes += (result.size() - size) * sizeof(TEntry);
     }
 
     void LoadFromDisk() {
@@ -290,85 +877,442 @@ private:
 
         if (!std::filesystem::exists(MetaDataPath)) {
             spdlog::debug("There is no LSM Tree on the disk.");
+            RemoveOrphans();
             return;
         }
 
         std::ifstream fIn(MetaDataPath, std::ios::in | std::ios::binary);
         spdlog::debug("Loading LSM meta data from the disk.");
-        fIn.read(reinterpret_cast<char*>(&MetaData), sizeof(MetaData));
+
+        // the meta written before the parts starts with the coefficient, the one
+        // written before the file IDs names the parts by the level
+        uint64_t header[2] = {0, 0};
+        fIn.read(reinterpret_cast<char*>(header), sizeof(uint64_t));
+        bool hasFileIDs = header[0] == META_MAGIC;
+        bool hasParts = hasFileIDs || header[0] == PARTS_META_MAGIC;
+        if (hasParts) {
+            fIn.read(reinterpret_cast<char*>(header), sizeof(uint64_t));
+        }
+        fIn.read(reinterpret_cast<char*>(header + 1), sizeof(uint64_t));
+        MetaData.SSTableDiffCoefficient = header[0];
+        MetaData.SSTableMeta.resize(header[1]);
+        // the old part files are linked to the new names, the old ones go with the orphans
+        std::vector<std::pair<std::filesystem::path, uint64_t>> renamed;
+        for (size_t level = 0; level < MetaData.SSTableMeta.size(); ++level) {
+            auto& ssTableMeta = MetaData.SSTableMeta[level];
+            uint64_t size = 0;
+            fIn.read(reinterpret_cast<char*>(&size), sizeof(size));
+            ssTableMeta.Size = size;
+            ssTableMeta.BloomFilter.Load(fIn);
+
+            uint64_t partCount = 1;
+            if (hasParts) {
+                fIn.read(reinterpret_cast<char*>(&partCount), sizeof(partCount));
+            }
+            if (partCount == 0 || partCount > ssTableMeta.Size) {
+                throw std::runtime_error("corrupted LSM meta data " + MetaDataPath.string() + ".");
+            }
+            ssTableMeta.Parts.resize(partCount, NSSTable::TPart<TKey>{.Size = size, .FileID = level});
+            if (hasParts) {
+                for (size_t part = 0; part < partCount; ++part) {
+                    uint64_t partSize = 0;
+                    fIn.read(reinterpret_cast<char*>(&partSize), sizeof(partSize));
+                    ssTableMeta.Parts[part].Size = partSize;
+                    if (hasFileIDs) {
+                        fIn.read(reinterpret_cast<char*>(&ssTableMeta.Parts[part].FileID), sizeof(uint64_t));
+                    } else if (part > 0) {
+                        renamed.emplace_back(SourcePath / ("C" + std::to_string(level) + "." + std::to_string(part)), level);
+                    }
+                    fIn.read(reinterpret_cast<char*>(&ssTableMeta.Parts[part].FirstKey), sizeof(TKey));
+                }
+            }
+        }
+
+        if (!fIn) {
+            throw std::runtime_error("corrupted LSM meta data " + MetaDataPath.string() + ".");
+        }
+
+        for (const auto& ssTableMeta: MetaData.SSTableMeta) {
+            for (const auto& part: ssTableMeta.Parts) {
+                NextFileID = std::max(NextFileID, part.FileID + 1);
+            }
+        }
+        if (!renamed.empty()) {
+            std::vector<size_t> nextPart(MetaData.SSTableMeta.size(), 1);
+            for (const auto& [oldPath, level]: renamed) {
+                auto& part = MetaData.SSTableMeta[level].Parts[nextPart[level]++];
+                part.FileID = NextFileID++;
+                std::filesystem::create_hard_link(oldPath, GetFilePath(part.FileID));
+            }
+            SaveMeta();
+        }
+        RemoveOrphans();
     }
 
+    // The files of the SSTables are never overwritten: the new ones get the new IDs and the
+    // replaced ones are removed after the synced meta, so a crash of the process or a power
+    // loss at any point leaves the previous or the next version of the tree. The files it doesn't refer to are removed here.
+    void RemoveOrphans() const {
+        std::vector<uint64_t> fileIDs;
+        for (const auto& ssTableMeta: MetaData.SSTableMeta) {
+            for (const auto& part: ssTableMeta.Parts) {
+                fileIDs.push_back(part.FileID);
+            }
+        }
+        std::sort(fileIDs.begin(), fileIDs.end());
+
+        std::error_code error;
+        for (const auto& entry: std::filesystem::directory_iterator(SourcePath, error)) {
+            if (!entry.is_regular_file()) {
+                continue;
+            }
+            auto name = entry.path().filename().string();
+            std::optional<uint64_t> fileID;
+            bool orphan = name == "meta.tmp" || name == "tmp" || (name.starts_with("tmp.") && IsNumber(name.substr(4)));
+            if (name.starts_with("C") && IsNumber(name.substr(1))) {
+                fileID = std::stoull(name.substr(1));
+            } else if (auto dot = name.find('.'); name.starts_with("C") && dot != std::string::npos) {
+                // a part named by the level
+                orphan = IsNumber(name.substr(1, dot - 1)) && IsNumber(name.substr(dot + 1));
+            }
+            if (orphan || (fileID && !std::binary_search(fileIDs.begin(), fileIDs.end(), fileID.value()))) {
+                spdlog::info("Removing the orphaned LSM file " + entry.path().string() + ".");
+                std::filesystem::remove(entry.path());
+            }
+        }
+    }
+
+    static bool IsNumber(const std::string& s) {
+        return !s.empty() && s.size() <= 19 && std::all_of(s.begin(), s.end(), [](unsigned char c) { return std::isdigit(c); });
+    }
+
+    // The meta is written aside, synced and renamed, so a crash or a power loss leaves the
+    // previous version. The SSTables it refers to are synced by their writers before.
+    void SaveMeta() const {
+        std::filesystem::path tmpPath = SourcePath / "meta.tmp";
+        {
+            std::ofstream fOut(tmpPath, std::ios::out | std::ios::binary);
+            uint64_t header[3] = {META_MAGIC, MetaData.SSTableDiffCoefficient, MetaData.SSTableMeta.size()};
+            fOut.write(reinterpret_cast<const char*>(header), sizeof(header));
+            for (const auto& ssTableMeta: MetaData.SSTableMeta) {
+                uint64_t size = ssTableMeta.Size;
+                fOut.write(reinterpret_cast<const char*>(&size), sizeof(size));
+                ssTableMeta.BloomFilter.Save(fOut);
+
+                uint64_t partCount = ssTableMeta.Parts.size();
+                fOut.write(reinterpret_cast<const char*>(&partCount), sizeof(partCount));
+                for (const auto& part: ssTableMeta.Parts) {
+                    uint64_t partSize = part.Size;
+                    fOut.write(reinterpret_cast<const char*>(&partSize), sizeof(partSize));
+                    fOut.write(reinterpret_cast<const char*>(&part.FileID), sizeof(part.FileID));
+                    fOut.write(reinterpret_cast<const char*>(&part.FirstKey), sizeof(part.FirstKey));
+                }
+            }
+            if (!fOut.flush()) {
+                throw std::runtime_error("can't write LSM meta data to " + tmpPath.string() + ".");
+            }
+        }
+        NDirectIO::SyncPath(tmpPath);
+        std::filesystem::rename(tmpPath, SourcePath / "meta");
+        // the rename and the names of the new SSTables
+        NDirectIO::SyncPath(SourcePath);
+    }
+
+    // The cascade of the merges from the newest SSTable is done as one N-way merge: the
+    // merged size is estimated as the sum of the inputs, the duplicates can only shrink it.
     void CompactSSTables() {
         spdlog::debug("Compacting SSTables.");
 
         size_t beforeSize = MetaData.SSTableMeta.size();
-        for (size_t i = MetaData.SSTableMeta.size() - 1; i != 0; --i) {
-            if (MetaData.SSTableDiffCoefficient * MetaData.SSTableMeta[i].Size > MetaData.SSTableMeta[i - 1].Size) {
-                auto mergedSSTableMeta = MergeSSTables(i, i - 1);
-                MetaData.SSTableMeta.pop_back();
-                MetaData.SSTableMeta[i - 1] = mergedSSTableMeta;
+        size_t first = MetaData.SSTableMeta.size() - 1;
+        size_t mergedSize = MetaData.SSTableMeta[first].Size;
+        while (first != 0 && MetaData.SSTableDiffCoefficient * mergedSize > MetaData.SSTableMeta[first - 1].Size) {
+            mergedSize += MetaData.SSTableMeta[--first].Size;
+        }
+        // the inputs are removed once the meta refers to the result
+        std::vector<std::filesystem::path> replaced;
+        if (first + 1 < MetaData.SSTableMeta.size()) {
+            auto mergedSSTableMeta = MergeSSTables(first);
+            for (size_t i = first; i < MetaData.SSTableMeta.size(); ++i) {
+                for (const auto& part: MetaData.SSTableMeta[i].Parts) {
+                    replaced.push_back(GetFilePath(part.FileID));
+                }
             }
+            MetaData.SSTableMeta.resize(first + 1);
+            MetaData.SSTableMeta[first] = std::move(mergedSSTableMeta);
         }
 
         spdlog::debug("Before the compaction: " + std::to_string(beforeSize) + ", after the compaction: " + std::to_string(MetaData.SSTableMeta.size()));
+        SaveMeta();
+        for (const auto& path: replaced) {
+            std::filesystem::remove(path);
+        }
     }
 
-    NSSTable::TMeta<TKey> MergeSSTables(size_t lhsInd, size_t rhsInd) {
-        assert(lhsInd > rhsInd);
+    // the entries [begin, end) of an SSTable in the key order, across its parts
+    class TRangeReader {
+    public:
+        TRangeReader(const TLSMTree& tree, size_t level, uint64_t begin, uint64_t end)
+            : Tree(tree)
+            , Level(level)
+            , Remaining(end - begin)
+        {
+            const auto& parts = Tree.MetaData.SSTableMeta[Level].Parts;
+            while (Part < parts.size() && begin >= parts[Part].Size) {
+                begin -= parts[Part].Size;
+                ++Part;
+            }
+            Offset = begin * sizeof(TEntry);
+        }
 
-        auto& lhsMeta = MetaData.SSTableMeta[lhsInd];
-        auto& rhsMeta = MetaData.SSTableMeta[rhsInd];
-        NSSTable::TBloomFilter<TKey> bloomFilter((lhsMeta.Size + rhsMeta.Size) * 5);
+        bool Read(TEntry& entry) {
+            while (Remaining > 0) {
+                if (!Reader) {
+                    if (Part >= Tree.MetaData.SSTableMeta[Level].Parts.size()) {
+                        throw std::runtime_error("truncated SSTable " + Tree.GetSSTablePath(Level).string() + ".");
+                    }
+                    Reader = std::make_unique<NDirectIO::TSequentialReader>(Tree.GetSSTablePath(Level, Part), Tree.BackgroundIO, Offset);
+                }
+                if (Reader->Read(&entry, sizeof(entry))) {
+                    --Remaining;
+                    return true;
+                }
+                Reader.reset();
+                ++Part;
+                Offset = 0;
+            }
+            return false;
+        }
 
-        assert(lhsMeta.Size <= rhsMeta.Size);
+    private:
+        const TLSMTree& Tree;
+        size_t Level;
+        uint64_t Remaining;
+        size_t Part = 0;
+        uint64_t Offset = 0;
+        std::unique_ptr<NDirectIO::TSequentialReader> Reader;
+    };
 
-        std::ifstream fInLhs(GetSSTablePath(lhsInd), std::ios::binary);
-        std::ifstream fInRhs(GetSSTablePath(rhsInd), std::ios::binary);
-        std::ofstream fOut(SourcePath / "tmp", std::ios::binary);
+    // the keys [Lhs, Rhs) of all the inputs, the first and the last ones are open
+    struct TSubcompaction {
+        std::optional<TKey> Lhs;
+        std::optional<TKey> Rhs;
+        size_t Size = 0;
+        TKey FirstKey{};
+        // the output
+        uint64_t FileID = 0;
+    };
 
-        size_t resSize = 0;
+    // Merges the SSTables first..last into one. The key range is split by the keys sampled
+    // from the largest input into the subcompactions of at least MIN_SUBCOMPACTION_BYTES,
+    // which are merged in parallel into their own parts of the result.
+    NSSTable::TMeta<TKey> MergeSSTables(size_t first) {
+        NTRACE_SPAN("lsm", "MergeSSTables");
+        size_t last = MetaData.SSTableMeta.size() - 1;
+        assert(first < last);
+
+        auto start = std::chrono::steady_clock::now();
+        size_t inputSize = 0;
+        for (size_t i = first; i <= last; ++i) {
+            inputSize += MetaData.SSTableMeta[i].Size;
+        }
 
-        TEntry lhs; fInLhs.read(reinterpret_cast<char*>(&lhs), sizeof(lhs));
-        TEntry rhs; fInRhs.read(reinterpret_cast<char*>(&rhs), sizeof(rhs));
-        for (;!fInLhs.eof() && !fInRhs.eof(); ++resSize) {
-            if (lhs.first <= rhs.first) {
-                bloomFilter.Count(lhs.first);
-                fOut.write(reinterpret_cast<const char*>(&lhs), sizeof(lhs));
-                fInLhs.read(reinterpret_cast<char*>(&lhs), sizeof(lhs));
-            } else if (lhs.first > rhs.first) {
-                bloomFilter.Count(rhs.first);
-                fOut.write(reinterpret_cast<const char*>(&rhs), sizeof(rhs));
-                fInRhs.read(reinterpret_cast<char*>(&rhs), sizeof(rhs));
+        auto boundaries = PickBoundaries(first, inputSize);
+        std::vector<TSubcompaction> subcompactions;
+        for (size_t i = 0; i <= boundaries.size(); ++i) {
+            subcompactions.push_back(TSubcompaction{
+                .Lhs = i > 0 ? std::optional<TKey>(boundaries[i - 1]) : std::nullopt,
+                .Rhs = i < boundaries.size() ? std::optional<TKey>(boundaries[i]) : std::nullopt,
+                .FileID = NextFileID++,
+            });
+        }
+        // one filter of the result, the parallel subcompactions set its bits atomically
+        NSSTable::TBloomFilter<TKey> bloomFilter(inputSize * 5);
+        bool concurrent = subcompactions.size() > 1;
+
+        // the calling thread merges the first range
+        std::vector<std::future<void>> tasks;
+        for (size_t i = 1; i < subcompactions.size(); ++i) {
+            tasks.push_back(NSSTable::GetCompactionPool().Submit([this, first, &subcompactions, i, &bloomFilter]() {
+                RunSubcompaction(first, subcompactions[i], bloomFilter, true);
+            }));
+        }
+        std::exception_ptr error;
+        try {
+            RunSubcompaction(first, subcompactions[0], bloomFilter, concurrent);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        for (auto& task: tasks) {
+            try {
+                task.get();
+            } catch (...) {
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+        if (error) {
+            for (const auto& subcompaction: subcompactions) {
+                std::filesystem::remove(GetFilePath(subcompaction.FileID));
             }
+            std::rethrow_exception(error);
         }
 
-        for (;!fInLhs.eof(); ++resSize) {
-            bloomFilter.Count(lhs.first);
-            fOut.write(reinterpret_cast<const char*>(&lhs), sizeof(lhs));
-            fInLhs.read(reinterpret_cast<char*>(&lhs), sizeof(lhs));
+        // the outputs have the new names, the inputs are left to the caller
+        NSSTable::TMeta<TKey> result{.BloomFilter = std::move(bloomFilter)};
+        for (const auto& subcompaction: subcompactions) {
+            if (subcompaction.Size == 0) {
+                std::filesystem::remove(GetFilePath(subcompaction.FileID));
+                continue;
+            }
+            result.Parts.push_back(NSSTable::TPart<TKey>{.Size = subcompaction.Size, .FirstKey = subcompaction.FirstKey, .FileID = subcompaction.FileID});
+            result.Size += subcompaction.Size;
         }
 
-        for (;!fInRhs.eof(); ++resSize) {
-            bloomFilter.Count(rhs.first);
-            fOut.write(reinterpret_cast<const char*>(&rhs), sizeof(rhs));
-            fInRhs.read(reinterpret_cast<char*>(&rhs), sizeof(rhs));
+        Stats->Compactions.Add();
+        if (concurrent) {
+            Stats->Subcompactions.Add(subcompactions.size());
         }
+        Stats->CompactionBytesRead.Add(inputSize * sizeof(TEntry));
+        Stats->CompactionBytesWritten.Add(result.Size * sizeof(TEntry));
+        Stats->Record(NStatistics::ELatency::ECompaction, start);
 
-        std::filesystem::rename(SourcePath / "tmp", GetSSTablePath(rhsInd));
-        std::filesystem::remove(GetSSTablePath(lhsInd));
+        return result;
+    }
+
+    // an N-way merge of the range through a loser tree, the newest version of a key wins
+    void RunSubcompaction(size_t first, TSubcompaction& subcompaction, NSSTable::TBloomFilter<TKey>& bloomFilter, bool concurrent) const {
+        NTRACE_SPAN("lsm", "Subcompaction");
+        size_t last = MetaData.SSTableMeta.size() - 1;
+
+        // the newer inputs go last
+        std::vector<std::unique_ptr<TRangeReader>> inputs;
+        std::vector<std::optional<TEntry>> heads;
+        for (size_t i = first; i <= last; ++i) {
+            uint64_t begin = subcompaction.Lhs ? LowerBound(i, subcompaction.Lhs.value()) : 0;
+            uint64_t end = subcompaction.Rhs ? LowerBound(i, subcompaction.Rhs.value()) : MetaData.SSTableMeta[i].Size;
+            inputs.push_back(std::make_unique<TRangeReader>(*this, i, begin, end));
+
+            TEntry entry;
+            heads.push_back(inputs.back()->Read(entry) ? std::optional<TEntry>(entry) : std::nullopt);
+        }
 
-        return NSSTable::TMeta<TKey>{.Size = resSize, .BloomFilter = std::move(bloomFilter)};
+        NMerge::TLoserTree tree(inputs.size(), [&heads](size_t lhs, size_t rhs) {
+            if (!heads[lhs]) {
+                return false;
+            }
+            if (!heads[rhs]) {
+                return true;
+            }
+            return heads[lhs]->first < heads[rhs]->first || (heads[lhs]->first == heads[rhs]->first && lhs > rhs);
+        });
+
+        NDirectIO::TSequentialWriter fOut(GetFilePath(subcompaction.FileID), BackgroundIO);
+        std::optional<TKey> lastKey;
+        for (size_t top = tree.Top(); heads[top]; top = tree.Top()) {
+            const auto& entry = heads[top].value();
+            // the older versions come after the newest one
+            if (!lastKey || !(lastKey.value() == entry.first)) {
+                if (subcompaction.Size++ == 0) {
+                    subcompaction.FirstKey = entry.first;
+                }
+                if (concurrent) {
+                    bloomFilter.CountConcurrently(entry.first);
+                } else {
+                    bloomFilter.Count(entry.first);
+                }
+                fOut.Write(&entry, sizeof(entry));
+                lastKey = entry.first;
+            }
+
+            TEntry next;
+            heads[top] = inputs[top]->Read(next) ? std::optional<TEntry>(next) : std::nullopt;
+            tree.Replay();
+        }
+        fOut.Finish();
     }
 
-    std::filesystem::path GetSSTablePath(size_t index) const {
-        return SourcePath / ("C" + std::to_string(index));
+    // the keys splitting the inputs, the largest input is sampled evenly
+    std::vector<TKey> PickBoundaries(size_t first, size_t inputSize) const {
+        size_t count = std::min(MaxSubcompactions, inputSize * sizeof(TEntry) / MIN_SUBCOMPACTION_BYTES);
+        std::vector<TKey> boundaries;
+        if (count <= 1) {
+            return boundaries;
+        }
+
+        size_t largest = first;
+        for (size_t i = first + 1; i < MetaData.SSTableMeta.size(); ++i) {
+            if (MetaData.SSTableMeta[i].Size > MetaData.SSTableMeta[largest].Size) {
+                largest = i;
+            }
+        }
+        for (size_t i = 1; i < count; ++i) {
+            auto key = ReadEntry(largest, MetaData.SSTableMeta[largest].Size * i / count).first;
+            // the repeated samples would make the empty ranges
+            if (boundaries.empty() || boundaries.back() < key) {
+                boundaries.push_back(key);
+            }
+        }
+        return boundaries;
+    }
+
+    TEntry ReadEntry(size_t level, uint64_t index) const {
+        const auto& parts = MetaData.SSTableMeta[level].Parts;
+        size_t part = 0;
+        while (index >= parts[part].Size) {
+            index -= parts[part++].Size;
+        }
+
+        std::ifstream fIn(GetSSTablePath(level, part), std::ios::binary);
+        fIn.seekg(index * sizeof(TEntry));
+        TEntry entry; fIn.read(reinterpret_cast<char*>(&entry), sizeof(entry));
+        if (!fIn) {
+            throw std::runtime_error("can't read SSTable " + GetSSTablePath(level, part).string() + ".");
+        }
+        return entry;
+    }
+
+    // the index of the first entry of the SSTable not less than key
+    uint64_t LowerBound(size_t level, const TKey& key) const {
+        const auto& meta = MetaData.SSTableMeta[level];
+        auto part = meta.FindPart(key);
+        uint64_t index = 0;
+        for (size_t i = 0; i < part; ++i) {
+            index += meta.Parts[i].Size;
+        }
+
+        std::ifstream fIn(GetSSTablePath(level, part), std::ios::binary);
+        auto pos = SSTableExternalMemoryBinSearch<false>(fIn, [&key](const TEntry& mid){ return key <= mid.first; });
+        return index + (pos < 0 ? meta.Parts[part].Size : pos);
+    }
+
+    std::filesystem::path GetSSTablePath(size_t index, size_t part = 0) const {
+        return GetFilePath(MetaData.SSTableMeta[index].Parts[part].FileID);
+    }
+
+    std::filesystem::path GetFilePath(uint64_t fileID) const {
+        return SourcePath / ("C" + std::to_string(fileID));
     }
 
 private:
+    // "LSMFILES", the meta is written with the parts of the SSTables and their file IDs
+    const static uint64_t META_MAGIC = 0x53454c49464d534cull;
+    // "LSMPARTS", the parts were named C<level>.<part>
+    const static uint64_t PARTS_META_MAGIC = 0x5354524150534d4cull;
+
     TMemTable<TKey, TValue> MemTable{};
     TMeta MetaData{};
     std::filesystem::path SourcePath{};
-    mutable TStatistics Stats{};
+    NDirectIO::EMode BackgroundIO = NDirectIO::EMode::EBuffered;
+    std::shared_ptr<NMemory::TWriteBufferManager> WriteBufferManager;
+    NMemory::TWriteBuffer WriteBuffer;
+    std::size_t MaxSubcompactions = std::max(1u, std::thread::hardware_concurrency());
+    std::function<void()> BeforeFlush;
+    // the ID of the next SSTable file
+    uint64_t NextFileID = 0;
+    // on the heap, the striped counters and the histograms are large
+    std::unique_ptr<NStatistics::TStatistics> Stats = std::make_unique<NStatistics::TStatistics>();
 };
 
 //
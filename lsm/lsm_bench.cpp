@@ -0,0 +1,505 @@
+// Workload driver in the spirit of db_bench:
+//   lsm_bench --benchmarks=fillrandom,readrandom,ycsba --num=1000000 --threads=4 --value_size=100
+// Every benchmark reports the throughput, the latency percentiles of its operations
+// and the write, read and space amplification measured over the benchmark.
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "histogram.h"
+#include "lsm.h"
+#include "trace.h"
+
+namespace {
+    struct TFlags {
+        std::string Benchmarks = "fillrandom,readrandom";
+        std::filesystem::path Db = std::filesystem::temp_directory_path() / "lsm_bench";
+        bool UseExistingDb = false;
+        // operations of the write benchmarks and the size of the key space
+        uint64_t Num = 100'000;
+        // operations of the read and mixed benchmarks, Num if not set
+        uint64_t Reads = 0;
+        // the benchmarks run for the duration instead of the operation count if set
+        double Duration = 0;
+        std::size_t Threads = 1;
+        std::size_t ValueSize = 100;
+        // the longest scan of seekrandom and ycsbe
+        std::size_t SeekNexts = 100;
+        uint64_t Seed = 301;
+        // the tree statistics after every benchmark: none, text or json
+        std::string Statistics = "none";
+        // the Chrome trace of the run, needs a build with SEARCH_TRACING
+        std::filesystem::path Trace;
+        // the flush and compaction io: buffered, fadvise or direct
+        NDirectIO::EMode BackgroundIO = NDirectIO::EMode::EBuffered;
+        // the parallel key ranges of a large compaction, 0 for the hardware threads
+        std::size_t Subcompactions = 0;
+    };
+
+    const std::string USAGE =
+        "usage: lsm_bench [--benchmarks=a,b,...] [--db=path] [--use_existing_db=0|1] [--num=N] [--reads=N]\n"
+        "                 [--duration=seconds] [--threads=N] [--value_size=16|100|1000|4000] [--seek_nexts=N] [--seed=N]\n"
+        "                 [--statistics=none|text|json] [--trace=path]\n"
+        "                 [--background_io=buffered|fadvise|direct] [--subcompactions=N]\n"
+        "benchmarks: fillseq fillrandom overwrite readrandom readseq seekrandom readwhilewriting ycsba ycsbb ycsbc ycsbd ycsbe ycsbf\n";
+
+    TFlags ParseFlags(int argc, char** argv) {
+        TFlags flags;
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            auto eq = arg.find('=');
+            if (!arg.starts_with("--") || eq == std::string::npos) {
+                throw std::runtime_error("bad flag: " + arg + ".");
+            }
+            auto name = arg.substr(2, eq - 2);
+            auto value = arg.substr(eq + 1);
+
+            if (name == "benchmarks") {
+                flags.Benchmarks = value;
+            } else if (name == "db") {
+                flags.Db = value;
+            } else if (name == "use_existing_db") {
+                flags.UseExistingDb = value == "1" || value == "true";
+            } else if (name == "num") {
+                flags.Num = std::stoull(value);
+            } else if (name == "reads") {
+                flags.Reads = std::stoull(value);
+            } else if (name == "duration") {
+                flags.Duration = std::stod(value);
+            } else if (name == "threads") {
+                flags.Threads = std::max<std::size_t>(1, std::stoull(value));
+            } else if (name == "value_size") {
+                flags.ValueSize = std::stoull(value);
+            } else if (name == "seek_nexts") {
+                flags.SeekNexts = std::max<std::size_t>(1, std::stoull(value));
+            } else if (name == "seed") {
+                flags.Seed = std::stoull(value);
+            } else if (name == "statistics") {
+                if (value != "none" && value != "text" && value != "json") {
+                    throw std::runtime_error("unknown statistics format: " + value + ".");
+                }
+                flags.Statistics = value;
+            } else if (name == "trace") {
+                flags.Trace = value;
+            } else if (name == "background_io") {
+                flags.BackgroundIO = NDirectIO::ParseMode(value);
+            } else if (name == "subcompactions") {
+                flags.Subcompactions = std::stoull(value);
+            } else {
+                throw std::runtime_error("unknown flag: " + name + ".");
+            }
+        }
+        if (flags.Num == 0) {
+            throw std::runtime_error("num must be positive.");
+        }
+        if (flags.Reads == 0) {
+            flags.Reads = flags.Num;
+        }
+        return flags;
+    }
+
+    // the bytes passed to the read and write syscalls, the page cache hits included
+    struct TIOCounters {
+        uint64_t ReadBytes = 0;
+        uint64_t WrittenBytes = 0;
+    };
+
+    TIOCounters ReadIOCounters() {
+        TIOCounters counters;
+        std::ifstream fIn("/proc/self/io");
+        std::string name;
+        uint64_t value = 0;
+        while (fIn >> name >> value) {
+            if (name == "rchar:") {
+                counters.ReadBytes = value;
+            } else if (name == "wchar:") {
+                counters.WrittenBytes = value;
+            }
+        }
+        return counters;
+    }
+
+    uint64_t GetDirectorySize(const std::filesystem::path& path) {
+        uint64_t size = 0;
+        for (const auto& entry: std::filesystem::recursive_directory_iterator(path)) {
+            if (entry.is_regular_file()) {
+                size += entry.file_size();
+            }
+        }
+        return size;
+    }
+
+    // YCSB zipfian generator (Gray et al. "Quickly generating billion-record synthetic
+    // databases"), the ranks are scrambled so the hot keys are spread over the key space
+    class TZipfian {
+    public:
+        static constexpr double THETA = 0.99;
+
+    public:
+        TZipfian(uint64_t n)
+            : N(n)
+            , Alpha(1 / (1 - THETA))
+            , ZetaN(Zeta(n))
+            , Eta((1 - std::pow(2.0 / n, 1 - THETA)) / (1 - Zeta(2) / ZetaN))
+        {}
+
+        template <typename TGenerator>
+        uint64_t Next(TGenerator& g) {
+            double u = std::uniform_real_distribution<double>(0, 1)(g);
+            double uz = u * ZetaN;
+            uint64_t rank = 0;
+            if (uz < 1) {
+                rank = 0;
+            } else if (uz < 1 + std::pow(0.5, THETA)) {
+                rank = 1;
+            } else {
+                rank = static_cast<uint64_t>(N * std::pow(Eta * u - Eta + 1, Alpha));
+            }
+            return std::min(rank, N - 1);
+        }
+
+        template <typename TGenerator>
+        uint64_t NextScrambled(TGenerator& g) {
+            return (Next(g) * 0x9E3779B97F4A7C15ull) % N;
+        }
+
+    private:
+        static double Zeta(uint64_t n) {
+            double sum = 0;
+            for (uint64_t i = 1; i <= n; ++i) {
+                sum += 1 / std::pow(i, THETA);
+            }
+            return sum;
+        }
+
+    private:
+        uint64_t N;
+        double Alpha;
+        double ZetaN;
+        double Eta;
+    };
+
+    template <std::size_t Size>
+    struct TValue {
+        std::array<char, Size> Data{};
+
+        bool operator<(const TValue& other) const {
+            return false;
+        }
+    };
+
+    struct TReport {
+        uint64_t Ops = 0;
+        uint64_t Found = 0;
+        double Seconds = 0;
+        THistogram Latencies;
+        uint64_t UserWrittenBytes = 0;
+        uint64_t UserReadBytes = 0;
+        TIOCounters IO;
+    };
+
+    // Runs the benchmarks one after another over the same tree. The reads of the
+    // tree take TreeMutex shared and go concurrently, the writes take it exclusive,
+    // so the latencies include the wait for the writers (see README.md, Threads).
+    template <std::size_t ValueSize>
+    class TBenchmark {
+    public:
+        using TTree = TLSMTree<uint64_t, TValue<ValueSize>>;
+        using TEntry = typename TTree::TEntry;
+
+    public:
+        TBenchmark(TFlags flags)
+            : Flags(std::move(flags))
+        {
+            if (!Flags.UseExistingDb) {
+                std::filesystem::remove_all(Flags.Db);
+            }
+            std::filesystem::create_directories(Flags.Db);
+            Tree = std::make_unique<TTree>(Flags.Db, Flags.BackgroundIO);
+            if (Flags.Subcompactions > 0) {
+                Tree->SetMaxSubcompactions(Flags.Subcompactions);
+            }
+            if (Flags.Statistics != "none") {
+                Tree->EnableLatencyHistograms();
+            }
+            KeyCount = Flags.Num;
+        }
+
+        void Run(const std::string& name) {
+            TReport report;
+            auto ioBefore = ReadIOCounters();
+            auto start = std::chrono::steady_clock::now();
+
+            if (name == "fillseq") {
+                RunThreads(Flags.Num, report, [this](uint64_t op, std::mt19937_64&, TThreadReport& thread) { Write(op, thread); });
+            } else if (name == "fillrandom" || name == "overwrite") {
+                RunThreads(Flags.Num, report, [this](uint64_t, std::mt19937_64& g, TThreadReport& thread) { Write(g() % Flags.Num, thread); });
+            } else if (name == "readrandom") {
+                RunThreads(Flags.Reads, report, [this](uint64_t, std::mt19937_64& g, TThreadReport& thread) { Read(g() % KeyCount, thread); });
+            } else if (name == "readseq") {
+                RunThreads(Flags.Reads, report, [this](uint64_t op, std::mt19937_64&, TThreadReport& thread) { Read(op % KeyCount, thread); });
+            } else if (name == "seekrandom") {
+                RunThreads(Flags.Reads, report, [this](uint64_t, std::mt19937_64& g, TThreadReport& thread) { Scan(g() % KeyCount, Flags.SeekNexts, thread); });
+            } else if (name == "readwhilewriting") {
+                RunReadWhileWriting(report);
+            } else if (name.starts_with("ycsb") && name.size() == 5 && name[4] >= 'a' && name[4] <= 'f') {
+                RunYCSB(name[4], report);
+            } else {
+                throw std::runtime_error("unknown benchmark: " + name + ".");
+            }
+
+            report.Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            auto ioAfter = ReadIOCounters();
+            report.IO = TIOCounters{.ReadBytes = ioAfter.ReadBytes - ioBefore.ReadBytes, .WrittenBytes = ioAfter.WrittenBytes - ioBefore.WrittenBytes};
+            Print(name, report);
+        }
+
+    private:
+        struct TThreadReport {
+            THistogram Latencies;
+            uint64_t Ops = 0;
+            uint64_t Found = 0;
+            uint64_t WrittenBytes = 0;
+            uint64_t ReadBytes = 0;
+        };
+
+        using TOperation = std::function<void(uint64_t op, std::mt19937_64& g, TThreadReport& thread)>;
+
+        // the threads share the operation counter, every operation is timed
+        void RunThreads(uint64_t ops, TReport& report, const TOperation& operation, std::size_t threads = 0) {
+            threads = threads == 0 ? Flags.Threads : threads;
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(Flags.Duration));
+            std::atomic<uint64_t> nextOp = 0;
+            std::vector<TThreadReport> reports(threads);
+            std::vector<std::thread> workers;
+            for (std::size_t i = 0; i < threads; ++i) {
+                workers.emplace_back([&, i]() {
+                    std::mt19937_64 g(Flags.Seed + i);
+                    auto& thread = reports[i];
+                    while (true) {
+                        uint64_t op = nextOp.fetch_add(1, std::memory_order_relaxed);
+                        if (Flags.Duration > 0 ? std::chrono::steady_clock::now() >= deadline : op >= ops) {
+                            break;
+                        }
+                        auto start = std::chrono::steady_clock::now();
+                        operation(op, g, thread);
+                        thread.Latencies.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+                        ++thread.Ops;
+                    }
+                });
+            }
+            for (auto& worker: workers) {
+                worker.join();
+            }
+
+            for (const auto& thread: reports) {
+                report.Latencies.Merge(thread.Latencies);
+                report.Ops += thread.Ops;
+                report.Found += thread.Found;
+                report.UserWrittenBytes += thread.WrittenBytes;
+                report.UserReadBytes += thread.ReadBytes;
+            }
+        }
+
+        // the readers are measured, one more thread writes until they finish
+        void RunReadWhileWriting(TReport& report) {
+            std::atomic<bool> done = false;
+            TThreadReport writer;
+            std::thread writerThread([&]() {
+                std::mt19937_64 g(Flags.Seed - 1);
+                while (!done.load(std::memory_order_relaxed)) {
+                    Write(g() % Flags.Num, writer);
+                }
+            });
+            RunThreads(Flags.Reads, report, [this](uint64_t, std::mt19937_64& g, TThreadReport& thread) { Read(g() % KeyCount, thread); });
+            done = true;
+            writerThread.join();
+            report.UserWrittenBytes += writer.WrittenBytes;
+        }
+
+        // A: 50% reads, 50% updates; B: 95% reads, 5% updates; C: reads only;
+        // D: 95% reads of the latest keys, 5% inserts; E: 95% scans, 5% inserts;
+        // F: 50% reads, 50% read-modify-writes. The keys are zipfian.
+        void RunYCSB(char workload, TReport& report) {
+            TZipfian zipfian(KeyCount);
+            auto nextKey = [&](std::mt19937_64& g) {
+                return zipfian.NextScrambled(g) % KeyCount;
+            };
+
+            RunThreads(Flags.Reads, report, [&, workload](uint64_t, std::mt19937_64& g, TThreadReport& thread) {
+                uint64_t dice = g() % 100;
+                switch (workload) {
+                    case 'a': dice < 50 ? Read(nextKey(g), thread) : Write(nextKey(g), thread); break;
+                    case 'b': dice < 95 ? Read(nextKey(g), thread) : Write(nextKey(g), thread); break;
+                    case 'c': Read(nextKey(g), thread); break;
+                    case 'd': {
+                        if (dice < 95) {
+                            uint64_t latest = KeyCount;
+                            Read(latest - 1 - zipfian.Next(g) % latest, thread);
+                        } else {
+                            Write(KeyCount.fetch_add(1), thread);
+                        }
+                        break;
+                    }
+                    case 'e': dice < 95 ? Scan(nextKey(g), 1 + g() % Flags.SeekNexts, thread) : Write(KeyCount.fetch_add(1), thread); break;
+                    case 'f': {
+                        uint64_t key = nextKey(g);
+                        Read(key, thread);
+                        if (dice >= 50) {
+                            Write(key, thread);
+                        }
+                        break;
+                    }
+                }
+            });
+        }
+
+        void Write(uint64_t key, TThreadReport& thread) {
+            TValue<ValueSize> value;
+            std::memcpy(value.Data.data(), &key, std::min(sizeof(key), ValueSize));
+            {
+                std::unique_lock lock(TreeMutex);
+                Tree->Insert(key, value);
+                MarkLive(key);
+            }
+            thread.WrittenBytes += sizeof(TEntry);
+        }
+
+        void Read(uint64_t key, TThreadReport& thread) {
+            std::optional<TEntry> entry;
+            {
+                std::shared_lock lock(TreeMutex);
+                entry = Tree->ReadPoint(key);
+            }
+            if (entry) {
+                ++thread.Found;
+                thread.ReadBytes += sizeof(TEntry);
+            }
+        }
+
+        void Scan(uint64_t key, uint64_t count, TThreadReport& thread) {
+            std::vector<TEntry> entries;
+            {
+                std::shared_lock lock(TreeMutex);
+                entries = Tree->ReadRanges(key, key + count - 1);
+            }
+            thread.Found += !entries.empty();
+            thread.ReadBytes += entries.size() * sizeof(TEntry);
+        }
+
+        // under the exclusive TreeMutex
+        void MarkLive(uint64_t key) {
+            if (key >= Live.size()) {
+                Live.resize(std::max<std::size_t>(key + 1, Live.size() * 2));
+            }
+            LiveCount += !Live[key];
+            Live[key] = true;
+        }
+
+        void Print(const std::string& name, const TReport& report) const {
+            double microsPerOp = report.Ops == 0 ? 0 : report.Seconds * 1e6 / report.Ops * Flags.Threads;
+            double userBytes = report.UserWrittenBytes + report.UserReadBytes;
+
+            std::cout << std::left << std::setw(18) << name << ": "
+                      << std::fixed << std::setprecision(3) << microsPerOp << " micros/op "
+                      << static_cast<uint64_t>(report.Ops / report.Seconds) << " ops/sec; "
+                      << std::setprecision(1) << userBytes / 1'048'576 / report.Seconds << " MB/s";
+            if (report.UserReadBytes != 0 || name.starts_with("read") || name == "seekrandom") {
+                std::cout << " (" << report.Found << " of " << report.Ops << " found)";
+            }
+            std::cout << "\n";
+
+            std::cout << "  latency ns: " << report.Latencies.ToString() << "\n";
+
+            std::cout << std::setprecision(2) << "  amplification:";
+            if (report.UserWrittenBytes != 0) {
+                std::cout << " write " << static_cast<double>(report.IO.WrittenBytes) / report.UserWrittenBytes;
+            }
+            if (report.UserReadBytes != 0) {
+                std::cout << " read " << static_cast<double>(report.IO.ReadBytes) / report.UserReadBytes;
+            }
+            if (LiveCount != 0) {
+                std::cout << " space " << static_cast<double>(GetDirectorySize(Flags.Db)) / (LiveCount * sizeof(TEntry));
+            }
+            std::cout << std::endl;
+
+            if (Flags.Statistics == "text") {
+                std::cout << Tree->GetStatistics().ToString();
+            } else if (Flags.Statistics == "json") {
+                std::cout << Tree->GetStatistics().ToJson() << std::endl;
+            }
+        }
+
+    private:
+        TFlags Flags;
+        std::unique_ptr<TTree> Tree;
+        std::shared_mutex TreeMutex;
+        // the key space, grows with the inserts of ycsbd and ycsbe
+        std::atomic<uint64_t> KeyCount = 0;
+        // the keys written by this run, for the space amplification
+        std::vector<bool> Live;
+        uint64_t LiveCount = 0;
+    };
+
+    template <std::size_t ValueSize>
+    void RunBenchmarks(const TFlags& flags) {
+        TBenchmark<ValueSize> benchmark(flags);
+        std::cout << "keys: 8 bytes, values: " << ValueSize << " bytes, entries: " << flags.Num
+                  << ", threads: " << flags.Threads << ", db: " << flags.Db.string() << std::endl;
+
+        std::stringstream benchmarks(flags.Benchmarks);
+        std::string name;
+        while (std::getline(benchmarks, name, ',')) {
+            if (!name.empty()) {
+                benchmark.Run(name);
+            }
+        }
+
+        if (!flags.Trace.empty()) {
+#ifndef SEARCH_TRACING
+            std::cerr << "the spans are not recorded, build with SEARCH_TRACING." << std::endl;
+#endif
+            std::ofstream out(flags.Trace);
+            NTrace::TRegistry::Get().DumpChromeJson(out);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc == 2 && std::string(argv[1]) == "--help") {
+        std::cout << USAGE;
+        return 0;
+    }
+
+    try {
+        auto flags = ParseFlags(argc, argv);
+        // the entries are raw structs on the disk, so the value sizes are fixed at the compile time
+        switch (flags.ValueSize) {
+            case 16: RunBenchmarks<16>(flags); break;
+            case 100: RunBenchmarks<100>(flags); break;
+            case 1000: RunBenchmarks<1000>(flags); break;
+            case 4000: RunBenchmarks<4000>(flags); break;
+            default: throw std::runtime_error("unsupported value size: " + std::to_string(flags.ValueSize) + ".");
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n" << USAGE;
+        return 1;
+    }
+    return 0;
+}
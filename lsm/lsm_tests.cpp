@@ -1,6 +1,12 @@
 #include <gtest/gtest.h>
+#include <map>
+#include <set>
 #include <random>
+#include "histogram.h"
+#include "loser_tree.h"
 #include "lsm.h"
+#include "thread_pool.h"
+#include "trace.h"
 #include "types.h"
 
 #include "spdlog/spdlog.h"
@@ -107,3 +113,704 @@ TEST(LSMTree, IntCorrectnessRangeRequest) {
         auto range = lsm.ReadRanges(lhs.first, rhs.second);
     }
 }
+
+TEST(LSMTree, RangeRequestReturnsLatestVersions) {
+    const int DATA_SIZE = TMemTable<int, int>::MAX_SIZE * 3 + 17;
+
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directory("./test");
+    TLSMTree<int, int> lsm("./test");
+
+    for (int i = 0; i < DATA_SIZE; ++i) {
+        lsm.Insert(i, i);
+    }
+    for (int i = 0; i < DATA_SIZE; ++i) {
+        lsm.Insert(i, i + 1);
+    }
+
+    auto range = lsm.ReadRanges(0, DATA_SIZE);
+    ASSERT_EQ(range.size(), DATA_SIZE);
+    for (int i = 0; i < DATA_SIZE; ++i) {
+        ASSERT_EQ(range[i].first, i);
+        ASSERT_EQ(range[i].second, i + 1) << "stale value for " << i;
+    }
+
+    range = lsm.ReadRanges(DATA_SIZE - 10, DATA_SIZE - 1);
+    ASSERT_EQ(range.size(), 10);
+    ASSERT_EQ(range.front().first, DATA_SIZE - 10);
+}
+
+TEST(LSMTree, PointRequestAfterUpdates) {
+    const int DATA_SIZE = TMemTable<int, int>::MAX_SIZE * 5;
+
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directory("./test");
+    TLSMTree<int, int> lsm("./test");
+
+    for (int version = 0; version < 3; ++version) {
+        for (int i = 0; i < DATA_SIZE; ++i) {
+            lsm.Insert(i, i + version);
+        }
+    }
+
+    for (int i = 0; i < DATA_SIZE; ++i) {
+        auto entry = lsm.ReadPoint(i);
+        ASSERT_TRUE(entry.has_value()) << "not found: " << i;
+        ASSERT_EQ(entry.value().second, i + 2) << "stale value for " << i;
+    }
+}
+
+TEST(LSMTree, AsyncReadPoints) {
+    const int DATA_SIZE = TMemTable<int, int>::MAX_SIZE * 5;
+
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directory("./test");
+    TLSMTree<int, int> lsm("./test");
+
+    std::mt19937 g(5);
+    for (int version = 0; version < 2; ++version) {
+        for (int i = 0; i < DATA_SIZE; ++i) {
+            lsm.Insert(2 * i, 2 * i + version);
+        }
+    }
+
+    std::vector<int> keys;
+    for (int i = 0; i < 3'000; ++i) {
+        keys.push_back(g() % (2 * DATA_SIZE + 10) - 5);
+    }
+
+    std::vector<std::optional<std::pair<int, int>>> expected;
+    for (auto key: keys) {
+        expected.push_back(lsm.ReadPoint(key));
+    }
+    ASSERT_EQ(lsm.MultiGet(keys), expected);
+
+    // a small queue keeps the lookups waiting for the free slots
+    for (auto backend: {NAsyncIO::EBackend::EAuto, NAsyncIO::EBackend::EPRead}) {
+        auto ioReader = NAsyncIO::MakeReader(4, backend);
+        TLSMTree<int, int>::TAsyncReader reader(lsm, *ioReader);
+        std::vector<std::optional<std::pair<int, int>>> result(keys.size());
+        std::size_t done = 0;
+        for (std::size_t i = 0; i < keys.size(); ++i) {
+            reader.ReadPointAsync(keys[i], [&, i](std::optional<std::pair<int, int>> entry) {
+                result[i] = std::move(entry);
+                ++done;
+            });
+            if (i % 100 == 0) {
+                reader.Poll(false);
+            }
+        }
+        reader.Drain();
+        ASSERT_EQ(done, keys.size()) << ioReader->GetName();
+        ASSERT_EQ(result, expected) << ioReader->GetName();
+    }
+
+    auto found = lsm.ReadPoints(keys);
+    ASSERT_EQ(found.size(), std::count_if(expected.begin(), expected.end(), [](const auto& entry) { return entry.has_value(); }));
+}
+
+TEST(LSMTree, AsyncReadPointsOfTruncatedSSTable) {
+    const int DATA_SIZE = TMemTable<int, int>::MAX_SIZE * 2;
+
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directory("./test");
+    TLSMTree<int, int> lsm("./test");
+    for (int i = 0; i < DATA_SIZE; ++i) {
+        lsm.Insert(i, i);
+    }
+    for (const auto& file: std::filesystem::directory_iterator("./test")) {
+        if (file.path().filename().string().starts_with("C")) {
+            std::filesystem::resize_file(file.path(), sizeof(std::pair<int, int>) * 3);
+        }
+    }
+
+    // the lookups past the end of the files fail without an entry instead of throwing from Poll
+    for (auto backend: {NAsyncIO::EBackend::EAuto, NAsyncIO::EBackend::EPRead}) {
+        auto ioReader = NAsyncIO::MakeReader(4, backend);
+        TLSMTree<int, int>::TAsyncReader reader(lsm, *ioReader);
+        std::size_t done = 0;
+        std::size_t found = 0;
+        for (int key = 0; key < DATA_SIZE; key += 7) {
+            reader.ReadPointAsync(key, [&](std::optional<std::pair<int, int>> entry) {
+                ++done;
+                found += entry.has_value();
+            });
+        }
+        ASSERT_NO_THROW(reader.Drain());
+        ASSERT_EQ(done, (DATA_SIZE + 6) / 7) << ioReader->GetName();
+        ASSERT_GT(reader.GetFailedCount(), 0) << ioReader->GetName();
+        ASSERT_LT(found, done) << ioReader->GetName();
+        ASSERT_EQ(reader.GetActiveCount(), 0) << ioReader->GetName();
+    }
+    ASSERT_EQ(lsm.MultiGet({0, 1, 2}).size(), 3);
+}
+
+TEST(LSMTree, BackgroundIO) {
+    const int DATA_SIZE = TMemTable<int, int>::MAX_SIZE * 7 + 13;
+
+    for (auto mode: {NDirectIO::EMode::EBuffered, NDirectIO::EMode::EFadvise, NDirectIO::EMode::EDirect}) {
+        std::filesystem::remove_all("./test");
+        std::filesystem::create_directory("./test");
+        {
+            TLSMTree<int, int> lsm("./test", mode);
+            for (int version = 0; version < 3; ++version) {
+                for (int i = 0; i < DATA_SIZE; ++i) {
+                    lsm.Insert((i * 7'919) % DATA_SIZE, i + version);
+                }
+            }
+            std::vector<std::pair<int, int>> bulk;
+            for (int i = 0; i < 1'000; ++i) {
+                bulk.emplace_back(DATA_SIZE + i, i);
+            }
+            lsm.BulkInsert(std::move(bulk));
+            ASSERT_GT(lsm.GetStatistics().Compactions, 0);
+        }
+
+        TLSMTree<int, int> lsm("./test", mode);
+        for (int i = 0; i < DATA_SIZE; ++i) {
+            auto entry = lsm.ReadPoint((i * 7'919) % DATA_SIZE);
+            ASSERT_TRUE(entry.has_value()) << i;
+            ASSERT_EQ(entry->second, i + 2) << i;
+        }
+        ASSERT_EQ(lsm.ReadRanges(0, DATA_SIZE + 1'000).size(), DATA_SIZE + 1'000);
+        // the direct writes are cut back to the table size
+        for (const auto& file: std::filesystem::directory_iterator("./test")) {
+            if (file.path().filename().string().starts_with("C")) {
+                ASSERT_EQ(file.file_size() % sizeof(std::pair<int, int>), 0) << file.path();
+            }
+        }
+    }
+}
+
+TEST(LSMTree, MemoryBudget) {
+    const std::size_t LIMIT = 64ull << 10;
+    const int DATA_SIZE = 20'000;
+
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directories("./test/a");
+    std::filesystem::create_directories("./test/b");
+    {
+        auto manager = std::make_shared<NMemory::TWriteBufferManager>(LIMIT);
+        TLSMTree<int, int> lhs("./test/a", NDirectIO::EMode::EBuffered, manager);
+        TLSMTree<int, int> rhs("./test/b", NDirectIO::EMode::EBuffered, manager);
+        for (int i = 0; i < DATA_SIZE; ++i) {
+            lhs.Insert(i, i);
+            rhs.Insert(i, -i);
+            // the writer over the limit flushes itself or the other one on its next write
+            ASSERT_LE(manager->GetUsage(), LIMIT) << i;
+        }
+        ASSERT_GT(manager->GetBufferFlushes(), 0);
+        ASSERT_GT(lhs.GetStatistics().BufferFlushes + rhs.GetStatistics().BufferFlushes, 0);
+        ASSERT_EQ(manager->GetUsage(), lhs.GetStatistics().MemTableBytes + rhs.GetStatistics().MemTableBytes);
+        ASSERT_GE(NMemory::TMemoryTracker::Get().GetAllocated(NMemory::ECategory::EMemTable), lhs.GetStatistics().MemTableBytes - (5ull << 10));
+        ASSERT_GT(NMemory::TMemoryTracker::Get().GetAllocated(NMemory::ECategory::EBloomFilter), 0);
+
+        auto lhsRange = lhs.ReadRanges(0, DATA_SIZE);
+        auto rhsRange = rhs.ReadRanges(0, DATA_SIZE);
+        ASSERT_EQ(lhsRange.size(), DATA_SIZE);
+        ASSERT_EQ(rhsRange.size(), DATA_SIZE);
+        for (int i = 0; i < DATA_SIZE; ++i) {
+            ASSERT_EQ(lhsRange[i], std::make_pair(i, i));
+            ASSERT_EQ(rhsRange[i], std::make_pair(i, -i));
+        }
+    }
+
+    // an idle tree is flushed by its owner on the request of the other writer
+    std::filesystem::create_directories("./test/c");
+    std::filesystem::create_directories("./test/d");
+    {
+        const std::size_t IDLE_LIMIT = 48ull << 10;
+        auto manager = std::make_shared<NMemory::TWriteBufferManager>(IDLE_LIMIT);
+        TLSMTree<int, int> idle("./test/c", NDirectIO::EMode::EBuffered, manager);
+        TLSMTree<int, int> busy("./test/d", NDirectIO::EMode::EBuffered, manager);
+        std::size_t emptyBytes = idle.GetStatistics().MemTableBytes;
+        std::size_t requests = 0;
+        idle.SetFlushRequestHandler([&requests]() { ++requests; });
+        for (int i = 0; i < 4'096; ++i) {
+            idle.Insert(i, i);
+        }
+        ASSERT_EQ(idle.GetStatistics().Flushes, 0);
+
+        for (int i = 0; i < DATA_SIZE; ++i) {
+            busy.Insert(i, -i);
+            if (requests > 0) {
+                idle.FlushIfRequested();
+            }
+            ASSERT_LE(manager->GetUsage(), IDLE_LIMIT) << i;
+        }
+        ASSERT_EQ(requests, 1);
+        ASSERT_EQ(idle.GetStatistics().Flushes, 1);
+        ASSERT_EQ(idle.GetStatistics().BufferFlushes, 1);
+        // the requested flush frees the buffer of the entries
+        ASSERT_EQ(idle.GetStatistics().MemTableBytes, emptyBytes);
+        ASSERT_EQ(idle.ReadPoint(4'095), std::make_pair(4'095, 4'095));
+    }
+
+    auto& tracker = NMemory::TMemoryTracker::Get();
+    uint64_t queryBytes = tracker.GetAllocated(NMemory::ECategory::EQuery);
+    {
+        NMemory::TArena arena;
+        std::vector<int, NMemory::TArenaAllocator<int>> scratch{NMemory::TArenaAllocator<int>(arena)};
+        for (int i = 0; i < 10'000; ++i) {
+            scratch.push_back(i);
+        }
+        ASSERT_EQ(scratch[9'999], 9'999);
+        ASSERT_GE(arena.GetAllocatedBytes(), 10'000 * sizeof(int));
+        ASSERT_EQ(tracker.GetAllocated(NMemory::ECategory::EQuery), queryBytes + arena.GetAllocatedBytes());
+        arena.Reset();
+        ASSERT_EQ(arena.GetAllocatedBytes(), NMemory::TArena::MIN_BLOCK_SIZE);
+    }
+    ASSERT_EQ(tracker.GetAllocated(NMemory::ECategory::EQuery), queryBytes);
+}
+
+TEST(LSMTree, MemTableBuffer) {
+    const std::size_t ENTRIES_BYTES = TMemTable<int, int>::MAX_SIZE * sizeof(std::pair<int, int>);
+
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directory("./test");
+    TLSMTree<int, int> lsm("./test");
+    std::size_t emptyBytes = lsm.GetStatistics().MemTableBytes;
+    for (int i = 0; i < static_cast<int>(TMemTable<int, int>::MAX_SIZE) * 2 + 5; ++i) {
+        lsm.Insert(i, i);
+        // the growth stops at the flush threshold
+        ASSERT_LE(lsm.GetStatistics().MemTableBytes, emptyBytes + ENTRIES_BYTES) << i;
+    }
+    // the buffer of a full memtable is reused after its flush
+    ASSERT_EQ(lsm.GetStatistics().Flushes, 2);
+    ASSERT_EQ(lsm.GetStatistics().MemTableBytes, emptyBytes + ENTRIES_BYTES);
+    lsm.Flush();
+    ASSERT_EQ(lsm.GetStatistics().MemTableBytes, emptyBytes);
+    ASSERT_EQ(lsm.ReadPoint(5), std::make_pair(5, 5));
+}
+
+TEST(LoserTree, Merge) {
+    std::mt19937 random(7);
+    for (std::size_t count: {1, 2, 3, 5, 8, 13}) {
+        std::vector<std::vector<int>> sources(count);
+        std::vector<int> expected;
+        for (auto& source: sources) {
+            source.resize(random() % 100);
+            for (auto& value: source) {
+                value = random() % 1'000;
+            }
+            std::sort(source.begin(), source.end());
+            expected.insert(expected.end(), source.begin(), source.end());
+        }
+        std::sort(expected.begin(), expected.end());
+
+        std::vector<std::size_t> positions(count, 0);
+        auto head = [&](std::size_t i) { return positions[i] < sources[i].size() ? &sources[i][positions[i]] : nullptr; };
+        NMerge::TLoserTree tree(count, [&](std::size_t lhs, std::size_t rhs) {
+            return head(lhs) && (!head(rhs) || *head(lhs) < *head(rhs));
+        });
+        std::vector<int> merged;
+        for (auto top = tree.Top(); head(top); top = tree.Top()) {
+            merged.push_back(*head(top));
+            ++positions[top];
+            tree.Replay();
+        }
+        ASSERT_EQ(merged, expected) << count;
+    }
+}
+
+TEST(LSMTree, Subcompactions) {
+    const int DATA_SIZE = TLSMTree<int, int>::MIN_SUBCOMPACTION_BYTES / sizeof(std::pair<int, int>) * 2;
+
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directory("./test");
+    {
+        TLSMTree<int, int> lsm("./test");
+        lsm.SetMaxSubcompactions(4);
+        for (int version = 0; version < 2; ++version) {
+            std::vector<std::pair<int, int>> bulk;
+            for (int i = version; i < DATA_SIZE; i += 1 + version) {
+                bulk.emplace_back(i, i + version);
+            }
+            lsm.BulkInsert(std::move(bulk));
+        }
+        // the memtable flushes on top are merged with the cascade
+        for (int i = 0; i < TMemTable<int, int>::MAX_SIZE * 5; ++i) {
+            lsm.Insert(i * 3, -i);
+        }
+        auto statistics = lsm.GetStatistics();
+        ASSERT_GE(statistics.Subcompactions, 2);
+    }
+
+    // the small compactions are not split
+    std::filesystem::create_directory("./test/small");
+    {
+        TLSMTree<int, int> lsm("./test/small");
+        lsm.SetMaxSubcompactions(4);
+        for (int i = 0; i < TMemTable<int, int>::MAX_SIZE * 5; ++i) {
+            lsm.Insert(i, i);
+        }
+        auto statistics = lsm.GetStatistics();
+        ASSERT_GT(statistics.Compactions, 0);
+        ASSERT_EQ(statistics.Subcompactions, 0);
+    }
+
+    auto expected = [&](int key) {
+        if (key % 3 == 0 && key / 3 < static_cast<int>(TMemTable<int, int>::MAX_SIZE) * 5) {
+            return -key / 3;
+        }
+        return key % 2 == 1 ? key + 1 : key;
+    };
+    TLSMTree<int, int> lsm("./test");
+    std::vector<int> keys;
+    for (int key = 0; key < DATA_SIZE; key += 101) {
+        keys.push_back(key);
+    }
+    auto found = lsm.MultiGet(keys);
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+        ASSERT_TRUE(found[i].has_value()) << keys[i];
+        ASSERT_EQ(found[i]->second, expected(keys[i])) << keys[i];
+        ASSERT_EQ(lsm.ReadPoint(keys[i])->second, expected(keys[i])) << keys[i];
+    }
+    for (int lhs = 0; lhs < DATA_SIZE; lhs += DATA_SIZE / 7) {
+        auto range = lsm.ReadRanges(lhs, lhs + 5'000);
+        ASSERT_EQ(range.size(), std::min(5'001, DATA_SIZE - lhs));
+        for (const auto& [key, value]: range) {
+            ASSERT_EQ(value, expected(key)) << key;
+        }
+    }
+}
+
+TEST(LSMTree, BulkInsert) {
+    const int DATA_SIZE = TMemTable<int, int>::MAX_SIZE * 3;
+
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directory("./test");
+    TLSMTree<int, int> lsm("./test");
+
+    for (int i = 0; i < DATA_SIZE; i += 2) {
+        lsm.Insert(i, 0);
+    }
+
+    std::vector<std::pair<int, int>> batch;
+    for (int i = DATA_SIZE - 1; i >= 0; --i) {
+        batch.emplace_back(i, -1);
+        batch.emplace_back(i, i);
+    }
+    lsm.BulkInsert(std::move(batch));
+
+    for (int i = 0; i < 100; ++i) {
+        lsm.Insert(DATA_SIZE + i, DATA_SIZE + i);
+    }
+
+    for (int i = 0; i < DATA_SIZE + 100; ++i) {
+        auto entry = lsm.ReadPoint(i);
+        ASSERT_TRUE(entry.has_value()) << "not found: " << i;
+        ASSERT_EQ(entry.value().second, i) << "wrong value for " << i;
+    }
+
+    auto range = lsm.ReadRanges(0, DATA_SIZE + 100);
+    ASSERT_EQ(range.size(), DATA_SIZE + 100);
+}
+
+// The merges of the compactions shrink the tables by the dropped versions, every merge
+// still has to take a contiguous run of the newest tables or the newer ones are lost.
+TEST(LSMTree, BulkInsertAfterDedup) {
+    const int KEY_COUNT = 4'000;
+
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directory("./test");
+
+    std::mt19937 g(17);
+    std::map<int, int> expected;
+    {
+        TLSMTree<int, int> lsm("./test");
+        for (int round = 0; round < 60; ++round) {
+            std::vector<std::pair<int, int>> batch;
+            // the small batches repeat a few keys many times, the large ones cover the key range
+            int size = std::uniform_int_distribution<int>(1, round % 3 == 0 ? 6'000 : 300)(g);
+            int keys = round % 3 == 0 ? KEY_COUNT : 50;
+            for (int i = 0; i < size; ++i) {
+                int key = std::uniform_int_distribution<int>(0, keys - 1)(g);
+                batch.emplace_back(key, round * 10'000 + i);
+                expected[key] = round * 10'000 + i;
+            }
+
+            if (round % 4 == 1) {
+                for (const auto& [key, value]: batch) {
+                    lsm.Insert(key, value);
+                }
+            } else {
+                lsm.BulkInsert(std::move(batch));
+            }
+
+            for (int key = 0; key < KEY_COUNT; key += 97) {
+                auto entry = lsm.ReadPoint(key);
+                auto it = expected.find(key);
+                ASSERT_EQ(entry.has_value(), it != expected.end()) << "round " << round << ", key " << key;
+                if (entry) {
+                    ASSERT_EQ(entry.value().second, it->second) << "round " << round << ", key " << key;
+                }
+            }
+        }
+    }
+
+    TLSMTree<int, int> lsm("./test");
+    auto range = lsm.ReadRanges(0, KEY_COUNT);
+    ASSERT_EQ(range.size(), expected.size());
+    for (const auto& [key, value]: range) {
+        ASSERT_EQ(value, expected.at(key)) << key;
+    }
+}
+
+TEST(ThreadPool, NestedTasks) {
+    TThreadPool pool(4);
+    ASSERT_FALSE(pool.WorkerIndex().has_value());
+
+    std::atomic<int> sum = 0;
+    std::vector<std::future<int>> outer;
+    for (int i = 0; i < 64; ++i) {
+        outer.push_back(pool.Submit([&pool, &sum, i]() {
+            EXPECT_LT(pool.WorkerIndex().value(), pool.Size());
+            // the nested tasks go to the own queue of the worker and are stolen by the idle ones
+            for (int j = 0; j < 16; ++j) {
+                pool.Submit([&sum]() { ++sum; });
+            }
+            return i;
+        }));
+    }
+
+    int total = 0;
+    for (auto& future: outer) {
+        total += future.get();
+    }
+    ASSERT_EQ(total, 63 * 64 / 2);
+
+    while (sum != 64 * 16) {
+        std::this_thread::yield();
+    }
+}
+
+TEST(ThreadPool, BoundedQueue) {
+    TBoundedQueue<int> queue(4);
+    std::thread producer([&queue]() {
+        for (int i = 0; i < 1000; ++i) {
+            ASSERT_TRUE(queue.Push(i));
+        }
+        queue.Close();
+    });
+
+    int expected = 0;
+    while (auto item = queue.Pop()) {
+        ASSERT_EQ(item.value(), expected++);
+    }
+    producer.join();
+
+    ASSERT_EQ(expected, 1000);
+    ASSERT_FALSE(queue.Push(0));
+}
+
+TEST(LSMTree, Reopen) {
+    const int DATA_SIZE = TMemTable<int, int>::MAX_SIZE * 5 / 2;
+
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directory("./test");
+    {
+        TLSMTree<int, int> lsm("./test");
+        for (int i = 0; i < DATA_SIZE; ++i) {
+            lsm.Insert(i, i);
+        }
+        lsm.Insert(0, -1);
+    }
+
+    TLSMTree<int, int> lsm("./test");
+    ASSERT_EQ(lsm.ReadPoint(0).value().second, -1);
+    for (int i = 1; i < DATA_SIZE; ++i) {
+        auto entry = lsm.ReadPoint(i);
+        ASSERT_TRUE(entry.has_value()) << "not found: " << i;
+        ASSERT_EQ(entry.value().second, i);
+    }
+    ASSERT_FALSE(lsm.ReadPoint(DATA_SIZE).has_value());
+    ASSERT_EQ(lsm.ReadRanges(0, DATA_SIZE).size(), DATA_SIZE);
+}
+
+TEST(LSMTree, RemovesOrphans) {
+    const int DATA_SIZE = TMemTable<int, int>::MAX_SIZE * 5 / 2;
+
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directory("./test");
+    {
+        TLSMTree<int, int> lsm("./test");
+        for (int i = 0; i < DATA_SIZE; ++i) {
+            lsm.Insert(i, i);
+        }
+    }
+
+    // the leftovers of a crash in the middle of a flush or a compaction
+    std::set<std::string> files;
+    for (const auto& entry: std::filesystem::directory_iterator("./test")) {
+        files.insert(entry.path().filename().string());
+    }
+    for (const auto* name: {"C999", "C5.1", "tmp.0", "meta.tmp"}) {
+        std::ofstream("./test/" + std::string(name)) << "garbage";
+    }
+
+    TLSMTree<int, int> lsm("./test");
+    std::set<std::string> reopened;
+    for (const auto& entry: std::filesystem::directory_iterator("./test")) {
+        reopened.insert(entry.path().filename().string());
+    }
+    ASSERT_EQ(reopened, files);
+    for (int i = 0; i < DATA_SIZE; ++i) {
+        auto entry = lsm.ReadPoint(i);
+        ASSERT_TRUE(entry.has_value()) << "not found: " << i;
+        ASSERT_EQ(entry.value().second, i);
+    }
+}
+
+TEST(Histogram, Percentiles) {
+    THistogram histogram;
+    ASSERT_EQ(histogram.GetPercentile(50), 0);
+
+    for (uint64_t value = 1; value <= 100'000; ++value) {
+        histogram.Record(value);
+    }
+    ASSERT_EQ(histogram.GetCount(), 100'000);
+    ASSERT_EQ(histogram.GetMin(), 1);
+    ASSERT_EQ(histogram.GetMax(), 100'000);
+    ASSERT_DOUBLE_EQ(histogram.GetMean(), 50'000.5);
+    for (double percentile: {1.0, 50.0, 99.0, 99.9}) {
+        double expected = percentile * 1'000;
+        ASSERT_NEAR(histogram.GetPercentile(percentile), expected, expected / 64) << percentile;
+    }
+    ASSERT_EQ(histogram.GetPercentile(100), 100'000);
+
+    THistogram other;
+    other.Record(std::numeric_limits<uint64_t>::max());
+    other.Record(3);
+    histogram.Merge(other);
+    ASSERT_EQ(histogram.GetCount(), 100'002);
+    ASSERT_EQ(histogram.GetPercentile(100), std::numeric_limits<uint64_t>::max());
+    ASSERT_EQ(histogram.GetPercentile(0), 1);
+}
+
+TEST(LSMTree, Statistics) {
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directory("./test");
+    TLSMTree<uint64_t, uint64_t> lsm("./test");
+    // the levels and the histograms are allocated on demand
+    ASSERT_LT(sizeof(NStatistics::TStatistics), 16ull << 10);
+    ASSERT_FALSE(lsm.GetStatistics().GetLatency.has_value());
+    lsm.EnableLatencyHistograms();
+
+    const uint64_t count = TMemTable<uint64_t, uint64_t>::MAX_SIZE * 3 + 10;
+    for (uint64_t key = 0; key < count; ++key) {
+        lsm.Insert(2 * key, key);
+    }
+
+    NPerf::SetPerfLevel(NPerf::EPerfLevel::ETime);
+    NPerf::GetPerfContext().Reset();
+    for (uint64_t key = 0; key < 1'000; ++key) {
+        ASSERT_TRUE(lsm.ReadPoint(2 * key).has_value());
+        ASSERT_FALSE(lsm.ReadPoint(2 * key + 1).has_value());
+    }
+    ASSERT_EQ(lsm.ReadRanges(0, 99).size(), 50);
+    auto perf = NPerf::GetPerfContext();
+    NPerf::SetPerfLevel(NPerf::EPerfLevel::ECount);
+    ASSERT_GT(perf.DiskNanos, 0);
+    ASSERT_GT(perf.FilterNanos, 0);
+    ASSERT_GT(perf.BloomUseful, 0);
+    ASSERT_GT(perf.ReadBytes, 0);
+
+    auto statistics = lsm.GetStatistics();
+    ASSERT_EQ(statistics.Puts, count);
+    ASSERT_EQ(statistics.Gets, 2'000);
+    ASSERT_EQ(statistics.GetHits, 1'000);
+    ASSERT_EQ(statistics.GetLatency->GetCount(), 2'000);
+    ASSERT_EQ(statistics.FlushLatency->GetCount(), 3);
+    ASSERT_EQ(statistics.Flushes, 3);
+    ASSERT_EQ(statistics.RangeReads, 1);
+    ASSERT_EQ(statistics.UserBytesWritten, count * sizeof(std::pair<uint64_t, uint64_t>));
+    ASSERT_GE(statistics.GetWriteAmplification(), 1.0);
+    ASSERT_FALSE(statistics.Levels.empty());
+
+    uint64_t probes = 0, useful = 0, falsePositive = 0, hits = 0;
+    for (const auto& level: statistics.Levels) {
+        probes += level.Probes;
+        useful += level.BloomUseful;
+        falsePositive += level.BloomFalsePositive;
+        hits += level.Hits;
+    }
+    ASSERT_EQ(hits, 1'000);
+    ASSERT_EQ(probes - useful, hits + falsePositive);
+    ASSERT_GT(useful, 900);
+    ASSERT_EQ(statistics.ToJson().front(), '{');
+    ASSERT_NE(statistics.ToString().find("bloom useful"), std::string::npos);
+}
+
+TEST(Trace, ChromeJson) {
+    auto& registry = NTrace::TRegistry::Get();
+    registry.Clear();
+
+    {
+        NTrace::TSpan span("test", "Outer");
+        NTrace::TSpan inner("test", "Inner");
+    }
+    std::thread([] {
+        for (size_t i = 0; i < NTrace::RING_BUFFER_SIZE + 10; ++i) {
+            NTrace::TSpan span("test", "Wrapped");
+        }
+    }).join();
+
+    std::string json = registry.DumpChromeJson();
+    ASSERT_EQ(json.find("{\"traceEvents\":["), 0);
+    ASSERT_NE(json.find("\"name\":\"Outer\",\"cat\":\"test\",\"ph\":\"X\""), std::string::npos);
+    ASSERT_LT(json.find("\"Inner\""), json.find("\"Outer\""));
+
+    // the spans of the finished thread are kept, the oldest ones are overwritten
+    size_t wrapped = 0;
+    for (size_t pos = json.find("\"Wrapped\""); pos != std::string::npos; pos = json.find("\"Wrapped\"", pos + 1)) {
+        ++wrapped;
+    }
+    ASSERT_EQ(wrapped, NTrace::RING_BUFFER_SIZE);
+
+    registry.Clear();
+    ASSERT_EQ(registry.DumpChromeJson().find("\"name\""), std::string::npos);
+}
+
+TEST(Trace, ThreadExitAndClear) {
+    auto& registry = NTrace::TRegistry::Get();
+    registry.Clear();
+    { NTrace::TSpan span("test", "Main"); }
+    std::size_t buffers = registry.GetBufferCount();
+
+    // the buffers of the finished threads are freed
+    for (size_t i = 0; i < 10; ++i) {
+        std::thread([] {
+            NTrace::TSpan span("test", "Short");
+        }).join();
+    }
+    ASSERT_EQ(registry.GetBufferCount(), buffers);
+    std::string json = registry.DumpChromeJson();
+    ASSERT_NE(json.find("\"Short\""), std::string::npos);
+
+    // a clear concurrent with the writer doesn't bring back the spans it dropped
+    std::atomic<bool> stop = false;
+    std::atomic<uint64_t> recorded = 0;
+    std::thread writer([&stop, &recorded] {
+        while (!stop.load()) {
+            NTrace::TSpan span("test", "Concurrent");
+            recorded.fetch_add(1);
+        }
+    });
+    while (recorded.load() < 1'000) {
+        std::this_thread::yield();
+    }
+    registry.Clear();
+    uint64_t after = recorded.load();
+    ASSERT_EQ(registry.GetBufferCount(), buffers + 1);
+    json = registry.DumpChromeJson();
+    stop = true;
+    writer.join();
+
+    size_t concurrent = 0;
+    for (size_t pos = json.find("\"Concurrent\""); pos != std::string::npos; pos = json.find("\"Concurrent\"", pos + 1)) {
+        ++concurrent;
+    }
+    ASSERT_LE(concurrent, recorded.load() - after + 1);
+    ASSERT_EQ(json.find("\"Short\""), std::string::npos);
+}
@@ -0,0 +1,325 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Memory accounting of the trees and the indexes:
+//   TMemoryTracker       process wide bytes by category, fed by TTrackingAllocator and TArena
+//   TArena               bump allocation of the scratch of a request, freed at once
+//   TWriteBufferManager  a limit on the memtables of all the trees sharing it
+namespace NMemory {
+    enum class ECategory {
+        EMemTable,
+        EBloomFilter,
+        EQuery,
+        ECache,
+        EOther,
+    };
+
+    const static std::size_t CATEGORY_COUNT = 5ull;
+
+    inline const char* GetCategoryName(ECategory category) {
+        switch (category) {
+            case ECategory::EMemTable: return "memtable";
+            case ECategory::EBloomFilter: return "bloom_filter";
+            case ECategory::EQuery: return "query";
+            case ECategory::ECache: return "cache";
+            case ECategory::EOther: return "other";
+        }
+        return "unknown";
+    }
+
+    class TMemoryTracker {
+    public:
+        static TMemoryTracker& Get() {
+            static TMemoryTracker tracker;
+            return tracker;
+        }
+
+        void Allocate(ECategory category, std::size_t bytes) {
+            auto& counter = Counters[static_cast<std::size_t>(category)];
+            uint64_t current = counter.Current.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+            uint64_t peak = counter.Peak.load(std::memory_order_relaxed);
+            while (peak < current && !counter.Peak.compare_exchange_weak(peak, current, std::memory_order_relaxed)) {
+            }
+        }
+
+        void Deallocate(ECategory category, std::size_t bytes) {
+            Counters[static_cast<std::size_t>(category)].Current.fetch_sub(bytes, std::memory_order_relaxed);
+        }
+
+        uint64_t GetAllocated(ECategory category) const {
+            return Counters[static_cast<std::size_t>(category)].Current.load(std::memory_order_relaxed);
+        }
+
+        uint64_t GetPeak(ECategory category) const {
+            return Counters[static_cast<std::size_t>(category)].Peak.load(std::memory_order_relaxed);
+        }
+
+        uint64_t GetTotal() const {
+            uint64_t total = 0;
+            for (const auto& counter: Counters) {
+                total += counter.Current.load(std::memory_order_relaxed);
+            }
+            return total;
+        }
+
+        std::string ToString() const {
+            std::stringstream ss;
+            ss << "total: " << GetTotal();
+            for (std::size_t i = 0; i < CATEGORY_COUNT; ++i) {
+                auto category = static_cast<ECategory>(i);
+                ss << " " << GetCategoryName(category) << ": " << GetAllocated(category) << " (peak " << GetPeak(category) << ")";
+            }
+            return ss.str();
+        }
+
+    private:
+        struct alignas(64) TCounter {
+            std::atomic<uint64_t> Current = 0;
+            std::atomic<uint64_t> Peak = 0;
+        };
+
+        std::array<TCounter, CATEGORY_COUNT> Counters{};
+    };
+
+    // std::allocator accounted to Category, e.g. std::vector<bool, TTrackingAllocator<bool, ECategory::EBloomFilter>>
+    template <typename T, ECategory Category>
+    class TTrackingAllocator {
+    public:
+        using value_type = T;
+
+        template <typename U>
+        struct rebind {
+            using other = TTrackingAllocator<U, Category>;
+        };
+
+        TTrackingAllocator() = default;
+
+        template <typename U>
+        TTrackingAllocator(const TTrackingAllocator<U, Category>&) {}
+
+        T* allocate(std::size_t n) {
+            T* data = std::allocator<T>().allocate(n);
+            TMemoryTracker::Get().Allocate(Category, n * sizeof(T));
+            return data;
+        }
+
+        void deallocate(T* data, std::size_t n) {
+            TMemoryTracker::Get().Deallocate(Category, n * sizeof(T));
+            std::allocator<T>().deallocate(data, n);
+        }
+
+        template <typename U>
+        bool operator==(const TTrackingAllocator<U, Category>&) const {
+            return true;
+        }
+    };
+
+    // Bump allocator: the blocks double from MIN_BLOCK_SIZE up to MAX_BLOCK_SIZE, nothing
+    // is freed until Reset or the destruction. For the short-lived node containers of a
+    // request, a map of a range read costs a few blocks instead of a malloc per entry.
+    class TArena {
+    public:
+        static constexpr std::size_t MIN_BLOCK_SIZE = 4'096;
+        static constexpr std::size_t MAX_BLOCK_SIZE = 1ull << 20;
+
+    public:
+        explicit TArena(ECategory category = ECategory::EQuery)
+            : Category(category)
+        {}
+
+        ~TArena() {
+            Release(0);
+        }
+
+        TArena(const TArena&) = delete;
+        TArena& operator=(const TArena&) = delete;
+
+        void* Allocate(std::size_t size, std::size_t alignment = alignof(std::max_align_t)) {
+            std::size_t offset = (Position + alignment - 1) & ~(alignment - 1);
+            if (Blocks.empty() || offset + size > Blocks.back().Size) {
+                AddBlock(size + alignment);
+                offset = (Position + alignment - 1) & ~(alignment - 1);
+            }
+            Position = offset + size;
+            return Blocks.back().Data.get() + offset;
+        }
+
+        // the first block is kept for the next request
+        void Reset() {
+            Release(1);
+            Position = 0;
+        }
+
+        std::size_t GetAllocatedBytes() const {
+            return AllocatedBytes;
+        }
+
+    private:
+        struct TBlock {
+            std::unique_ptr<char[]> Data;
+            std::size_t Size = 0;
+        };
+
+        void AddBlock(std::size_t minSize) {
+            std::size_t size = Blocks.empty() ? MIN_BLOCK_SIZE : std::min(Blocks.back().Size * 2, MAX_BLOCK_SIZE);
+            size = std::max(size, minSize);
+            Blocks.push_back(TBlock{.Data = std::make_unique_for_overwrite<char[]>(size), .Size = size});
+            TMemoryTracker::Get().Allocate(Category, size);
+            AllocatedBytes += size;
+            Position = 0;
+        }
+
+        void Release(std::size_t keep) {
+            while (Blocks.size() > keep) {
+                TMemoryTracker::Get().Deallocate(Category, Blocks.back().Size);
+                AllocatedBytes -= Blocks.back().Size;
+                Blocks.pop_back();
+            }
+        }
+
+    private:
+        ECategory Category;
+        std::vector<TBlock> Blocks;
+        // in the last block
+        std::size_t Position = 0;
+        std::size_t AllocatedBytes = 0;
+    };
+
+    // std allocator over an arena, deallocate is a no-op
+    template <typename T>
+    class TArenaAllocator {
+    public:
+        using value_type = T;
+
+        explicit TArenaAllocator(TArena& arena)
+            : Arena(&arena)
+        {}
+
+        template <typename U>
+        TArenaAllocator(const TArenaAllocator<U>& other)
+            : Arena(other.Arena)
+        {}
+
+        T* allocate(std::size_t n) {
+            return static_cast<T*>(Arena->Allocate(n * sizeof(T), alignof(T)));
+        }
+
+        void deallocate(T*, std::size_t) {}
+
+        template <typename U>
+        bool operator==(const TArenaAllocator<U>& other) const {
+            return Arena == other.Arena;
+        }
+
+    private:
+        template <typename U>
+        friend class TArenaAllocator;
+
+        TArena* Arena;
+    };
+
+    // The memory of a memtable as seen by a TWriteBufferManager, owned by the tree.
+    struct TWriteBuffer {
+        std::atomic<std::size_t> Usage = 0;
+        // set by the manager when another writer ran out of the budget
+        std::atomic<bool> FlushRequested = false;
+        // see TWriteBufferManager::SetFlushRequestHandler, guarded by the manager
+        std::shared_ptr<const std::function<void()>> FlushRequestHandler;
+    };
+
+    // A budget of the memtables of several trees. A writer which pushes the total over
+    // the limit flushes its own memtable if it holds at least a fair share of the budget,
+    // otherwise the largest memtable is asked to flush on its next write or, if its
+    // owner set a flush request handler, right away by the owner.
+    class TWriteBufferManager {
+    public:
+        explicit TWriteBufferManager(std::size_t limit)
+            : Limit(limit)
+        {}
+
+        void Register(TWriteBuffer& buffer) {
+            std::lock_guard lock(Mutex);
+            Buffers.push_back(&buffer);
+        }
+
+        void Unregister(TWriteBuffer& buffer) {
+            std::lock_guard lock(Mutex);
+            Buffers.erase(std::remove(Buffers.begin(), Buffers.end(), &buffer), Buffers.end());
+            buffer.FlushRequestHandler.reset();
+            Usage.fetch_sub(buffer.Usage.exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+
+        // Called without the lock from the thread of the writer which asks the buffer to
+        // flush, so an idle tree doesn't hold its memtable over the limit until its next
+        // write. The handler only schedules the flush, the owner does it under its own lock.
+        void SetFlushRequestHandler(TWriteBuffer& buffer, std::function<void()> handler) {
+            std::lock_guard lock(Mutex);
+            buffer.FlushRequestHandler = handler ? std::make_shared<const std::function<void()>>(std::move(handler)) : nullptr;
+        }
+
+        // true if the memtable of buffer has to be flushed now
+        bool Update(TWriteBuffer& buffer, std::size_t usage) {
+            std::size_t previous = buffer.Usage.exchange(usage, std::memory_order_relaxed);
+            std::size_t total = Usage.fetch_add(usage - previous, std::memory_order_relaxed) + usage - previous;
+            if (total <= Limit) {
+                return false;
+            }
+
+            std::shared_ptr<const std::function<void()>> handler;
+            {
+                std::lock_guard lock(Mutex);
+                if (usage * Buffers.size() >= Limit) {
+                    BufferFlushes.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+                auto largest = std::max_element(Buffers.begin(), Buffers.end(), [](const TWriteBuffer* lhs, const TWriteBuffer* rhs) {
+                    return lhs->Usage.load(std::memory_order_relaxed) < rhs->Usage.load(std::memory_order_relaxed);
+                });
+                if (*largest == &buffer) {
+                    BufferFlushes.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+                // the owner is notified once per request
+                if (!(*largest)->FlushRequested.exchange(true, std::memory_order_relaxed)) {
+                    handler = (*largest)->FlushRequestHandler;
+                }
+            }
+            if (handler) {
+                (*handler)();
+            }
+            return false;
+        }
+
+        std::size_t GetUsage() const {
+            return Usage.load(std::memory_order_relaxed);
+        }
+
+        std::size_t GetLimit() const {
+            return Limit;
+        }
+
+        // the flushes forced by the limit
+        uint64_t GetBufferFlushes() const {
+            return BufferFlushes.load(std::memory_order_relaxed);
+        }
+
+    private:
+        std::size_t Limit;
+        std::atomic<std::size_t> Usage = 0;
+        std::atomic<uint64_t> BufferFlushes = 0;
+        std::mutex Mutex;
+        std::vector<TWriteBuffer*> Buffers;
+    };
+}
@@ -0,0 +1,391 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "histogram.h"
+
+namespace NStatistics {
+    // Counter striped over the cache lines, the threads add to their own stripe
+    // and the reads sum all of them, so the hot counters are not contended.
+    class TStripedCounter {
+    public:
+        static constexpr std::size_t STRIPE_COUNT = 8;
+
+    public:
+        void Add(uint64_t value = 1) {
+            Stripes[GetStripe()].Value.fetch_add(value, std::memory_order_relaxed);
+        }
+
+        uint64_t Get() const {
+            uint64_t sum = 0;
+            for (const auto& stripe: Stripes) {
+                sum += stripe.Value.load(std::memory_order_relaxed);
+            }
+            return sum;
+        }
+
+    private:
+        struct alignas(64) TStripe {
+            std::atomic<uint64_t> Value = 0;
+        };
+
+        static std::size_t GetStripe() {
+            static std::atomic<std::size_t> nextStripe = 0;
+            thread_local std::size_t stripe = nextStripe.fetch_add(1, std::memory_order_relaxed) % STRIPE_COUNT;
+            return stripe;
+        }
+
+    private:
+        std::array<TStripe, STRIPE_COUNT> Stripes{};
+    };
+
+    struct TLevelSnapshot {
+        // the point reads which reached the level
+        uint64_t Probes = 0;
+        // the probes rejected by the bloom filter
+        uint64_t BloomUseful = 0;
+        // the probes passed by the bloom filter without the key in the level
+        uint64_t BloomFalsePositive = 0;
+        uint64_t Hits = 0;
+        uint64_t ReadBytes = 0;
+    };
+
+    struct TSnapshot {
+        uint64_t Gets = 0;
+        uint64_t GetHits = 0;
+        uint64_t MemTableHits = 0;
+        uint64_t Puts = 0;
+        uint64_t RangeReads = 0;
+        uint64_t RangeEntries = 0;
+        uint64_t Flushes = 0;
+        uint64_t Compactions = 0;
+        // the key ranges of the compactions merged in parallel, an unsplit compaction adds none
+        uint64_t Subcompactions = 0;
+        // the entries of the inserts
+        uint64_t UserBytesWritten = 0;
+        // the SSTables written by the flushes and the bulk inserts
+        uint64_t FlushBytesWritten = 0;
+        uint64_t CompactionBytesRead = 0;
+        uint64_t CompactionBytesWritten = 0;
+        // the SSTable reads of the point and range requests
+        uint64_t BytesRead = 0;
+        // the flushes forced by the write buffer manager
+        uint64_t BufferFlushes = 0;
+        // the entries and the filter of the memtable
+        uint64_t MemTableBytes = 0;
+        // the filters of the SSTables
+        uint64_t BloomFilterBytes = 0;
+
+        // only if the latencies are enabled
+        std::optional<THistogram> GetLatency;
+        std::optional<THistogram> PutLatency;
+        std::optional<THistogram> FlushLatency;
+        std::optional<THistogram> CompactionLatency;
+
+        // the newest level goes last, as the SSTables
+        std::vector<TLevelSnapshot> Levels;
+
+        // the SSTables read by a point request on average
+        double GetReadAmplification() const {
+            uint64_t reads = 0;
+            for (const auto& level: Levels) {
+                reads += level.Probes - level.BloomUseful;
+            }
+            return Gets == 0 ? 0 : static_cast<double>(reads) / Gets;
+        }
+
+        // the bytes written to the disk per the inserted byte
+        double GetWriteAmplification() const {
+            return UserBytesWritten == 0 ? 0 : static_cast<double>(FlushBytesWritten + CompactionBytesWritten) / UserBytesWritten;
+        }
+
+        std::string ToString() const {
+            std::stringstream ss;
+            ss << "LSMTree Statistics:\n"
+               << "\tgets: " << Gets << " hits: " << GetHits << " memtable hits: " << MemTableHits << "\n"
+               << "\tputs: " << Puts << " user bytes written: " << UserBytesWritten << "\n"
+               << "\trange reads: " << RangeReads << " entries: " << RangeEntries << "\n"
+               << "\tflushes: " << Flushes << " bytes written: " << FlushBytesWritten << "\n"
+               << "\tcompactions: " << Compactions << " subcompactions: " << Subcompactions << " bytes read: " << CompactionBytesRead << " bytes written: " << CompactionBytesWritten << "\n"
+               << "\tbytes read: " << BytesRead << "\n"
+               << "\tmemtable bytes: " << MemTableBytes << " bloom filter bytes: " << BloomFilterBytes << " buffer flushes: " << BufferFlushes << "\n"
+               << "\tread amplification: " << GetReadAmplification() << " write amplification: " << GetWriteAmplification() << "\n";
+            if (GetLatency) {
+                ss << "\tget ns: " << GetLatency->ToString() << "\n"
+                   << "\tput ns: " << PutLatency->ToString() << "\n"
+                   << "\tflush ns: " << FlushLatency->ToString() << "\n"
+                   << "\tcompaction ns: " << CompactionLatency->ToString() << "\n";
+            }
+            for (std::size_t i = 0; i < Levels.size(); ++i) {
+                const auto& level = Levels[i];
+                ss << "\tlevel " << i << ": probes: " << level.Probes
+                   << " bloom useful: " << level.BloomUseful
+                   << " bloom false positive: " << level.BloomFalsePositive
+                   << " hits: " << level.Hits
+                   << " bytes read: " << level.ReadBytes << "\n";
+            }
+            return ss.str();
+        }
+
+        std::string ToJson() const {
+            std::stringstream ss;
+            ss << "{"
+               << "\"gets\":" << Gets << ",\"get_hits\":" << GetHits << ",\"memtable_hits\":" << MemTableHits
+               << ",\"puts\":" << Puts << ",\"range_reads\":" << RangeReads << ",\"range_entries\":" << RangeEntries
+               << ",\"flushes\":" << Flushes << ",\"compactions\":" << Compactions << ",\"subcompactions\":" << Subcompactions
+               << ",\"user_bytes_written\":" << UserBytesWritten << ",\"flush_bytes_written\":" << FlushBytesWritten
+               << ",\"compaction_bytes_read\":" << CompactionBytesRead << ",\"compaction_bytes_written\":" << CompactionBytesWritten
+               << ",\"bytes_read\":" << BytesRead
+               << ",\"memtable_bytes\":" << MemTableBytes << ",\"bloom_filter_bytes\":" << BloomFilterBytes << ",\"buffer_flushes\":" << BufferFlushes
+               << ",\"read_amplification\":" << GetReadAmplification() << ",\"write_amplification\":" << GetWriteAmplification();
+            if (GetLatency) {
+                ss << ",\"get_ns\":" << HistogramToJson(*GetLatency) << ",\"put_ns\":" << HistogramToJson(*PutLatency)
+                   << ",\"flush_ns\":" << HistogramToJson(*FlushLatency) << ",\"compaction_ns\":" << HistogramToJson(*CompactionLatency);
+            }
+            ss << ",\"levels\":[";
+            for (std::size_t i = 0; i < Levels.size(); ++i) {
+                const auto& level = Levels[i];
+                ss << (i > 0 ? "," : "")
+                   << "{\"probes\":" << level.Probes << ",\"bloom_useful\":" << level.BloomUseful
+                   << ",\"bloom_false_positive\":" << level.BloomFalsePositive << ",\"hits\":" << level.Hits
+                   << ",\"bytes_read\":" << level.ReadBytes << "}";
+            }
+            ss << "]}";
+            return ss.str();
+        }
+
+    private:
+        static std::string HistogramToJson(const THistogram& histogram) {
+            std::stringstream ss;
+            ss << "{\"count\":" << histogram.GetCount() << ",\"mean\":" << histogram.GetMean()
+               << ",\"p50\":" << histogram.GetPercentile(50) << ",\"p99\":" << histogram.GetPercentile(99)
+               << ",\"p999\":" << histogram.GetPercentile(99.9) << ",\"max\":" << histogram.GetMax() << "}";
+            return ss.str();
+        }
+    };
+
+    // nanoseconds since start
+    inline uint64_t ElapsedNanos(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    enum class ELatency {
+        EGet,
+        EPut,
+        EFlush,
+        ECompaction,
+    };
+
+    const static std::size_t LATENCY_COUNT = 4ull;
+
+    // Live statistics of a tree, updated from any thread. The levels are the SSTables
+    // positions, the deeper ones than MAX_LEVEL_COUNT are accounted to the last one.
+    // The counters of a level are allocated when it is first reached and the latency
+    // histograms (60 KiB each) only by EnableLatencies, a tree costs about 8 KiB otherwise.
+    struct TStatistics {
+        static constexpr std::size_t MAX_LEVEL_COUNT = 64;
+
+        struct TLevel {
+            TStripedCounter Probes;
+            TStripedCounter BloomUseful;
+            TStripedCounter BloomFalsePositive;
+            TStripedCounter Hits;
+            TStripedCounter ReadBytes;
+        };
+
+        TStripedCounter Gets;
+        TStripedCounter GetHits;
+        TStripedCounter MemTableHits;
+        TStripedCounter Puts;
+        TStripedCounter RangeReads;
+        TStripedCounter RangeEntries;
+        TStripedCounter Flushes;
+        TStripedCounter Compactions;
+        TStripedCounter Subcompactions;
+        TStripedCounter UserBytesWritten;
+        TStripedCounter FlushBytesWritten;
+        TStripedCounter CompactionBytesRead;
+        TStripedCounter CompactionBytesWritten;
+        TStripedCounter BytesRead;
+        TStripedCounter BufferFlushes;
+
+        TStatistics() = default;
+
+        TStatistics(const TStatistics&) = delete;
+        TStatistics& operator=(const TStatistics&) = delete;
+
+        ~TStatistics() {
+            for (auto& level: Levels) {
+                delete level.load(std::memory_order_relaxed);
+            }
+        }
+
+        // not concurrently with the updates
+        void EnableLatencies() {
+            if (!Latencies) {
+                Latencies = std::make_unique<std::array<TAtomicHistogram, LATENCY_COUNT>>();
+            }
+        }
+
+        void Record(ELatency latency, std::chrono::steady_clock::time_point start) {
+            if (Latencies) {
+                (*Latencies)[static_cast<std::size_t>(latency)].Record(ElapsedNanos(start));
+            }
+        }
+
+        // the threads racing for a new level keep the counters of the first one
+        TLevel& GetLevel(std::size_t level) {
+            auto& slot = Levels[std::min(level, MAX_LEVEL_COUNT - 1)];
+            if (auto* counters = slot.load(std::memory_order_acquire)) {
+                return *counters;
+            }
+            auto* counters = new TLevel();
+            TLevel* expected = nullptr;
+            if (!slot.compare_exchange_strong(expected, counters, std::memory_order_acq_rel)) {
+                delete counters;
+                return *expected;
+            }
+            return *counters;
+        }
+
+        // levelCount is the current number of the SSTables
+        TSnapshot Snapshot(std::size_t levelCount) const {
+            TSnapshot snapshot{
+                .Gets = Gets.Get(),
+                .GetHits = GetHits.Get(),
+                .MemTableHits = MemTableHits.Get(),
+                .Puts = Puts.Get(),
+                .RangeReads = RangeReads.Get(),
+                .RangeEntries = RangeEntries.Get(),
+                .Flushes = Flushes.Get(),
+                .Compactions = Compactions.Get(),
+                .Subcompactions = Subcompactions.Get(),
+                .UserBytesWritten = UserBytesWritten.Get(),
+                .FlushBytesWritten = FlushBytesWritten.Get(),
+                .CompactionBytesRead = CompactionBytesRead.Get(),
+                .CompactionBytesWritten = CompactionBytesWritten.Get(),
+                .BytesRead = BytesRead.Get(),
+                .BufferFlushes = BufferFlushes.Get(),
+            };
+            if (Latencies) {
+                snapshot.GetLatency = (*Latencies)[static_cast<std::size_t>(ELatency::EGet)].Snapshot();
+                snapshot.PutLatency = (*Latencies)[static_cast<std::size_t>(ELatency::EPut)].Snapshot();
+                snapshot.FlushLatency = (*Latencies)[static_cast<std::size_t>(ELatency::EFlush)].Snapshot();
+                snapshot.CompactionLatency = (*Latencies)[static_cast<std::size_t>(ELatency::ECompaction)].Snapshot();
+            }
+            for (std::size_t i = 0; i < std::min(levelCount, MAX_LEVEL_COUNT); ++i) {
+                auto& level = snapshot.Levels.emplace_back();
+                const auto* counters = Levels[i].load(std::memory_order_acquire);
+                if (!counters) {
+                    continue;
+                }
+                level = TLevelSnapshot{
+                    .Probes = counters->Probes.Get(),
+                    .BloomUseful = counters->BloomUseful.Get(),
+                    .BloomFalsePositive = counters->BloomFalsePositive.Get(),
+                    .Hits = counters->Hits.Get(),
+                    .ReadBytes = counters->ReadBytes.Get(),
+                };
+            }
+            return snapshot;
+        }
+
+    private:
+        std::array<std::atomic<TLevel*>, MAX_LEVEL_COUNT> Levels{};
+        std::unique_ptr<std::array<TAtomicHistogram, LATENCY_COUNT>> Latencies;
+    };
+}
+
+// Breakdown of the requests of the current thread, e.g.
+//   NPerf::SetPerfLevel(NPerf::EPerfLevel::ETime);
+//   NPerf::GetPerfContext().Reset();
+//   tree.ReadPoint(key);
+//   std::cout << NPerf::GetPerfContext().ToString();
+namespace NPerf {
+    enum class EPerfLevel {
+        // the counters only
+        ECount,
+        // the counters and the timers
+        ETime,
+    };
+
+    struct TPerfContext {
+        uint64_t MemTableNanos = 0;
+        uint64_t FilterNanos = 0;
+        uint64_t DiskNanos = 0;
+        uint64_t MergeNanos = 0;
+
+        uint64_t BloomProbes = 0;
+        uint64_t BloomUseful = 0;
+        uint64_t SSTableReads = 0;
+        uint64_t ReadBytes = 0;
+
+        void Reset() {
+            *this = TPerfContext();
+        }
+
+        std::string ToString() const {
+            std::stringstream ss;
+            ss << "memtable_nanos=" << MemTableNanos
+               << " filter_nanos=" << FilterNanos
+               << " disk_nanos=" << DiskNanos
+               << " merge_nanos=" << MergeNanos
+               << " bloom_probes=" << BloomProbes
+               << " bloom_useful=" << BloomUseful
+               << " sstable_reads=" << SSTableReads
+               << " read_bytes=" << ReadBytes;
+            return ss.str();
+        }
+    };
+
+    inline EPerfLevel& GetPerfLevelRef() {
+        thread_local EPerfLevel level = EPerfLevel::ECount;
+        return level;
+    }
+
+    inline EPerfLevel GetPerfLevel() {
+        return GetPerfLevelRef();
+    }
+
+    inline void SetPerfLevel(EPerfLevel level) {
+        GetPerfLevelRef() = level;
+    }
+
+    inline TPerfContext& GetPerfContext() {
+        thread_local TPerfContext context;
+        return context;
+    }
+
+    // adds the lifetime to the counter if the timers are enabled
+    class TPerfTimer {
+    public:
+        explicit TPerfTimer(uint64_t& nanos)
+            : Nanos(GetPerfLevel() == EPerfLevel::ETime ? &nanos : nullptr)
+        {
+            if (Nanos) {
+                Start = std::chrono::steady_clock::now();
+            }
+        }
+
+        ~TPerfTimer() {
+            if (Nanos) {
+                *Nanos += NStatistics::ElapsedNanos(Start);
+            }
+        }
+
+        TPerfTimer(const TPerfTimer&) = delete;
+        TPerfTimer& operator=(const TPerfTimer&) = delete;
+
+    private:
+        uint64_t* Nanos;
+        std::chrono::steady_clock::time_point Start;
+    };
+}
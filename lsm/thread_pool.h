@@ -0,0 +1,198 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Work stealing pool: every worker has its own queue, tasks submitted from a
+// worker go to its queue, the idle workers steal from the others.
+class TThreadPool {
+public:
+    explicit TThreadPool(std::size_t threadCount = std::thread::hardware_concurrency()) {
+        threadCount = std::max<std::size_t>(threadCount, 1);
+        for (std::size_t i = 0; i < threadCount; ++i) {
+            Queues.push_back(std::make_unique<TQueue>());
+        }
+        for (std::size_t i = 0; i < threadCount; ++i) {
+            Workers.emplace_back([this, i]() { Run(i); });
+        }
+    }
+
+    ~TThreadPool() {
+        {
+            std::lock_guard lock(SleepMutex);
+            Stopping = true;
+        }
+        WakeUp.notify_all();
+        for (auto& worker: Workers) {
+            worker.join();
+        }
+    }
+
+    template <typename TTask>
+    std::future<std::invoke_result_t<TTask>> Submit(TTask&& task) {
+        auto packagedTask = std::make_shared<std::packaged_task<std::invoke_result_t<TTask>()>>(std::forward<TTask>(task));
+        auto future = packagedTask->get_future();
+
+        std::size_t queueIdx = CurrentPool == this ? CurrentWorker : NextQueue.fetch_add(1, std::memory_order_relaxed) % Queues.size();
+        {
+            std::lock_guard lock(Queues[queueIdx]->Mutex);
+            Queues[queueIdx]->Tasks.emplace_back([packagedTask]() { (*packagedTask)(); });
+        }
+        {
+            std::lock_guard lock(SleepMutex);
+            ++Pending;
+        }
+        WakeUp.notify_one();
+
+        return future;
+    }
+
+    std::size_t Size() const {
+        return Workers.size();
+    }
+
+    // index of the current thread among the workers of this pool
+    std::optional<std::size_t> WorkerIndex() const {
+        if (CurrentPool != this) {
+            return std::nullopt;
+        }
+        return CurrentWorker;
+    }
+
+private:
+    struct TQueue {
+        std::mutex Mutex;
+        std::deque<std::function<void()>> Tasks;
+    };
+
+    void Run(std::size_t index) {
+        CurrentPool = this;
+        CurrentWorker = index;
+
+        while (true) {
+            {
+                std::unique_lock lock(SleepMutex);
+                WakeUp.wait(lock, [this]() { return Stopping || Pending > 0; });
+                if (Pending == 0) {
+                    return;
+                }
+                // the task is claimed here, so some queue is guaranteed to have it
+                --Pending;
+            }
+
+            std::optional<std::function<void()>> task;
+            while (!(task = TryPop(index))) {
+                std::this_thread::yield();
+            }
+            (*task)();
+        }
+    }
+
+    // the newest own task first, then the oldest task of the other workers
+    std::optional<std::function<void()>> TryPop(std::size_t index) {
+        {
+            auto& own = *Queues[index];
+            std::lock_guard lock(own.Mutex);
+            if (!own.Tasks.empty()) {
+                auto task = std::move(own.Tasks.back());
+                own.Tasks.pop_back();
+                return task;
+            }
+        }
+
+        for (std::size_t i = 1; i < Queues.size(); ++i) {
+            auto& other = *Queues[(index + i) % Queues.size()];
+            std::lock_guard lock(other.Mutex);
+            if (!other.Tasks.empty()) {
+                auto task = std::move(other.Tasks.front());
+                other.Tasks.pop_front();
+                return task;
+            }
+        }
+
+        return std::nullopt;
+    }
+
+private:
+    std::vector<std::unique_ptr<TQueue>> Queues;
+    std::vector<std::thread> Workers;
+    std::atomic<std::size_t> NextQueue = 0;
+
+    std::mutex SleepMutex;
+    std::condition_variable WakeUp;
+    std::size_t Pending = 0;
+    bool Stopping = false;
+
+    static inline thread_local const TThreadPool* CurrentPool = nullptr;
+    static inline thread_local std::size_t CurrentWorker = 0;
+};
+
+// Push blocks while the queue is full, which throttles the producer.
+template <typename T>
+class TBoundedQueue {
+public:
+    explicit TBoundedQueue(std::size_t capacity)
+        : Capacity(std::max<std::size_t>(capacity, 1))
+    {}
+
+    // false if the queue is closed
+    bool Push(T item) {
+        std::unique_lock lock(Mutex);
+        NotFull.wait(lock, [this]() { return Closed || Items.size() < Capacity; });
+        if (Closed) {
+            return false;
+        }
+        Items.push_back(std::move(item));
+        NotEmpty.notify_one();
+        return true;
+    }
+
+    // waits for an item, std::nullopt if the queue is closed and drained
+    std::optional<T> Pop() {
+        std::unique_lock lock(Mutex);
+        NotEmpty.wait(lock, [this]() { return Closed || !Items.empty(); });
+        return PopLocked();
+    }
+
+    std::optional<T> TryPop() {
+        std::lock_guard lock(Mutex);
+        return PopLocked();
+    }
+
+    void Close() {
+        {
+            std::lock_guard lock(Mutex);
+            Closed = true;
+        }
+        NotFull.notify_all();
+        NotEmpty.notify_all();
+    }
+
+private:
+    std::optional<T> PopLocked() {
+        if (Items.empty()) {
+            return std::nullopt;
+        }
+        T item = std::move(Items.front());
+        Items.pop_front();
+        NotFull.notify_one();
+        return item;
+    }
+
+private:
+    const std::size_t Capacity;
+    std::mutex Mutex;
+    std::condition_variable NotFull;
+    std::condition_variable NotEmpty;
+    std::deque<T> Items;
+    bool Closed = false;
+};
@@ -0,0 +1,265 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Tracing spans of the hot paths. Every thread writes its finished spans into its
+// own ring buffer without locks, the oldest spans are overwritten. The buffers are
+// dumped in the Chrome trace event format, which chrome://tracing and Perfetto open.
+//
+// The spans of the library are compiled in with SEARCH_TRACING defined only:
+//   NTRACE_SPAN("lsm", "ReadPoint");
+namespace NTrace {
+    // per thread
+    const static std::size_t RING_BUFFER_SIZE = 16'384ull;
+    // the spans kept of all the finished threads
+    const static std::size_t RETIRED_EVENT_LIMIT = RING_BUFFER_SIZE;
+
+    inline uint64_t NowNanos() {
+        static const auto epoch = std::chrono::steady_clock::now();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    // Single writer ring: the owner thread fills the slot and then publishes it by
+    // advancing Head, a reader drops the slots the writer could have overwritten
+    // while they were copied. Only the owner writes Head, Clear moves the start
+    // of the snapshots instead.
+    class TRingBuffer {
+    public:
+        struct TEvent {
+            const char* Category = nullptr;
+            const char* Name = nullptr;
+            uint64_t BeginNanos = 0;
+            uint64_t DurationNanos = 0;
+        };
+
+    public:
+        explicit TRingBuffer(uint32_t threadID)
+            : ThreadID(threadID)
+        {}
+
+        void Record(const char* category, const char* name, uint64_t beginNanos, uint64_t durationNanos) {
+            uint64_t head = Head.load(std::memory_order_relaxed);
+            auto& slot = Slots[head % RING_BUFFER_SIZE];
+            slot.Category.store(category, std::memory_order_relaxed);
+            slot.Name.store(name, std::memory_order_relaxed);
+            slot.BeginNanos.store(beginNanos, std::memory_order_relaxed);
+            slot.DurationNanos.store(durationNanos, std::memory_order_relaxed);
+            Head.store(head + 1, std::memory_order_release);
+        }
+
+        // the events in the recording order
+        std::vector<TEvent> Snapshot() const {
+            uint64_t head = Head.load(std::memory_order_acquire);
+            uint64_t from = std::max(head > RING_BUFFER_SIZE ? head - RING_BUFFER_SIZE : 0, Cleared.load(std::memory_order_acquire));
+
+            std::vector<TEvent> events;
+            events.reserve(head - from);
+            for (uint64_t i = from; i < head; ++i) {
+                const auto& slot = Slots[i % RING_BUFFER_SIZE];
+                events.push_back(TEvent{
+                    .Category = slot.Category.load(std::memory_order_relaxed),
+                    .Name = slot.Name.load(std::memory_order_relaxed),
+                    .BeginNanos = slot.BeginNanos.load(std::memory_order_relaxed),
+                    .DurationNanos = slot.DurationNanos.load(std::memory_order_relaxed),
+                });
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t overwritten = Head.load(std::memory_order_relaxed);
+            if (overwritten > RING_BUFFER_SIZE && overwritten - RING_BUFFER_SIZE > from) {
+                events.erase(events.begin(), events.begin() + std::min<uint64_t>(overwritten - RING_BUFFER_SIZE - from, events.size()));
+            }
+            return events;
+        }
+
+        // drops the spans recorded before the call
+        void Clear() {
+            Cleared.store(Head.load(std::memory_order_acquire), std::memory_order_release);
+        }
+
+        uint32_t GetThreadID() const {
+            return ThreadID;
+        }
+
+    private:
+        struct TSlot {
+            std::atomic<const char*> Category = nullptr;
+            std::atomic<const char*> Name = nullptr;
+            std::atomic<uint64_t> BeginNanos = 0;
+            std::atomic<uint64_t> DurationNanos = 0;
+        };
+
+    private:
+        uint32_t ThreadID;
+        std::atomic<uint64_t> Head = 0;
+        std::atomic<uint64_t> Cleared = 0;
+        std::array<TSlot, RING_BUFFER_SIZE> Slots;
+    };
+
+    // The buffer of a thread is freed when the thread exits, its spans are kept up to
+    // RETIRED_EVENT_LIMIT of all the finished threads, the newest ones, and dumped too.
+    class TRegistry {
+    public:
+        static TRegistry& Get() {
+            static TRegistry registry;
+            return registry;
+        }
+
+        TRingBuffer& GetThreadBuffer() {
+            thread_local TThreadBuffer buffer(*this);
+            return *buffer.Buffer;
+        }
+
+        // of the running threads which have recorded a span
+        std::size_t GetBufferCount() const {
+            std::lock_guard lock(Mutex);
+            return Buffers.size();
+        }
+
+        // only the spans recorded before the call are guaranteed to be seen
+        void DumpChromeJson(std::ostream& out) const {
+            std::vector<std::shared_ptr<TRingBuffer>> buffers;
+            std::deque<TRetired> retired;
+            {
+                std::lock_guard lock(Mutex);
+                buffers = Buffers;
+                retired = Retired;
+            }
+            for (const auto& buffer: buffers) {
+                retired.push_back(TRetired{.ThreadID = buffer->GetThreadID(), .Events = buffer->Snapshot()});
+            }
+
+            out << "{\"traceEvents\":[";
+            bool first = true;
+            for (const auto& thread: retired) {
+                for (const auto& event: thread.Events) {
+                    out << (first ? "" : ",") << "\n"
+                        << "{\"name\":\"" << event.Name << "\",\"cat\":\"" << event.Category
+                        << "\",\"ph\":\"X\",\"ts\":" << event.BeginNanos / 1'000 << "." << Padded(event.BeginNanos % 1'000)
+                        << ",\"dur\":" << event.DurationNanos / 1'000 << "." << Padded(event.DurationNanos % 1'000)
+                        << ",\"pid\":1,\"tid\":" << thread.ThreadID << "}";
+                    first = false;
+                }
+            }
+            out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+        }
+
+        std::string DumpChromeJson() const {
+            std::stringstream ss;
+            DumpChromeJson(ss);
+            return ss.str();
+        }
+
+        // the spans recorded concurrently may be kept
+        void Clear() {
+            std::lock_guard lock(Mutex);
+            for (auto& buffer: Buffers) {
+                buffer->Clear();
+            }
+            Retired.clear();
+            RetiredEvents = 0;
+        }
+
+    private:
+        struct TRetired {
+            uint32_t ThreadID = 0;
+            std::vector<TRingBuffer::TEvent> Events;
+        };
+
+        // registers the buffer of the thread and retires it at the thread exit
+        struct TThreadBuffer {
+            explicit TThreadBuffer(TRegistry& registry)
+                : Registry(registry)
+                , Buffer(registry.Register())
+            {}
+
+            ~TThreadBuffer() {
+                Registry.Retire(Buffer);
+            }
+
+            TRegistry& Registry;
+            std::shared_ptr<TRingBuffer> Buffer;
+        };
+
+        std::shared_ptr<TRingBuffer> Register() {
+            std::lock_guard lock(Mutex);
+            Buffers.push_back(std::make_shared<TRingBuffer>(++ThreadCount));
+            return Buffers.back();
+        }
+
+        // a dump in progress may still hold the buffer
+        void Retire(const std::shared_ptr<TRingBuffer>& buffer) {
+            auto events = buffer->Snapshot();
+            std::lock_guard lock(Mutex);
+            Buffers.erase(std::remove(Buffers.begin(), Buffers.end(), buffer), Buffers.end());
+            if (events.empty()) {
+                return;
+            }
+            RetiredEvents += events.size();
+            Retired.push_back(TRetired{.ThreadID = buffer->GetThreadID(), .Events = std::move(events)});
+            while (RetiredEvents > RETIRED_EVENT_LIMIT) {
+                auto& oldest = Retired.front().Events;
+                std::size_t dropped = std::min(oldest.size(), RetiredEvents - RETIRED_EVENT_LIMIT);
+                oldest.erase(oldest.begin(), oldest.begin() + dropped);
+                RetiredEvents -= dropped;
+                if (oldest.empty()) {
+                    Retired.pop_front();
+                }
+            }
+        }
+
+        static std::string Padded(uint64_t nanos) {
+            std::string digits = std::to_string(nanos);
+            return std::string(3 - digits.size(), '0') + digits;
+        }
+
+    private:
+        mutable std::mutex Mutex;
+        std::vector<std::shared_ptr<TRingBuffer>> Buffers;
+        std::deque<TRetired> Retired;
+        std::size_t RetiredEvents = 0;
+        uint32_t ThreadCount = 0;
+    };
+
+    // records the lifetime of the scope, the names have to be string literals
+    class TSpan {
+    public:
+        TSpan(const char* category, const char* name)
+            : Category(category)
+            , Name(name)
+            , BeginNanos(NowNanos())
+        {}
+
+        ~TSpan() {
+            TRegistry::Get().GetThreadBuffer().Record(Category, Name, BeginNanos, NowNanos() - BeginNanos);
+        }
+
+        TSpan(const TSpan&) = delete;
+        TSpan& operator=(const TSpan&) = delete;
+
+    private:
+        const char* Category;
+        const char* Name;
+        uint64_t BeginNanos;
+    };
+}
+
+#define NTRACE_CONCAT_IMPL(lhs, rhs) lhs##rhs
+#define NTRACE_CONCAT(lhs, rhs) NTRACE_CONCAT_IMPL(lhs, rhs)
+
+#ifdef SEARCH_TRACING
+#define NTRACE_SPAN(category, name) ::NTrace::TSpan NTRACE_CONCAT(traceSpan, __LINE__)(category, name)
+#else
+#define NTRACE_SPAN(category, name) static_cast<void>(0)
+#endif
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "protocol.h"
+
+namespace NServer {
+    // Blocking client of TServer. Send and Receive can be used apart to keep several
+    // requests in flight, the responses are matched to the requests by their IDs.
+    class TClient {
+    public:
+        explicit TClient(const std::filesystem::path& socketPath) {
+            sockaddr_un address{};
+            address.sun_family = AF_UNIX;
+            if (socketPath.native().size() >= sizeof(address.sun_path)) {
+                throw std::runtime_error("socket path is too long.");
+            }
+            std::strcpy(address.sun_path, socketPath.c_str());
+            Connect(AF_UNIX, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+        }
+
+        explicit TClient(uint16_t port) {
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            address.sin_port = htons(port);
+            Connect(AF_INET, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+            int one = 1;
+            setsockopt(Socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+
+        ~TClient() {
+            close(Socket);
+        }
+
+        TClient(const TClient&) = delete;
+        TClient& operator=(const TClient&) = delete;
+
+        // the request ID is assigned by the client
+        uint64_t Send(NProtocol::TRequest request) {
+            request.ID = NextID++;
+            auto frame = NProtocol::EncodeRequest(request);
+            for (std::size_t offset = 0; offset < frame.size();) {
+                auto count = send(Socket, frame.data() + offset, frame.size() - offset, MSG_NOSIGNAL);
+                if (count < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throw std::runtime_error(std::string("send: ") + std::strerror(errno));
+                }
+                offset += count;
+            }
+            return request.ID;
+        }
+
+        // no more requests, the responses to the sent ones still arrive
+        void CloseWrite() {
+            if (shutdown(Socket, SHUT_WR) < 0) {
+                throw std::runtime_error(std::string("shutdown: ") + std::strerror(errno));
+            }
+        }
+
+        // the next response in the server order
+        NProtocol::TResponse Receive() {
+            while (true) {
+                if (auto frame = NProtocol::NextFrame(std::string_view(Buffer).substr(Offset))) {
+                    auto response = NProtocol::DecodeResponse(frame->first);
+                    Offset += frame->second;
+                    if (Offset == Buffer.size()) {
+                        Buffer.clear();
+                        Offset = 0;
+                    }
+                    return response;
+                }
+
+                char chunk[READ_CHUNK_SIZE];
+                auto count = recv(Socket, chunk, sizeof(chunk), 0);
+                if (count < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (count <= 0) {
+                    throw std::runtime_error(count == 0 ? std::string("connection is closed.") : std::string("recv: ") + std::strerror(errno));
+                }
+                Buffer.erase(0, Offset);
+                Offset = 0;
+                Buffer.append(chunk, count);
+            }
+        }
+
+        // throws the server error
+        NProtocol::TResponse Call(NProtocol::TRequest request) {
+            auto id = Send(std::move(request));
+            auto response = Receive();
+            if (response.ID != id) {
+                throw std::runtime_error("unexpected response id.");
+            }
+            if (response.Status == NProtocol::EStatus::EError) {
+                throw std::runtime_error(response.Error);
+            }
+            return response;
+        }
+
+        void AddDocument(uint64_t docID, std::string text) {
+            Call(NProtocol::TRequest{.OpCode = NProtocol::EOpCode::EAddDocument, .DocID = docID, .Text = std::move(text)});
+        }
+
+        std::vector<uint64_t> Search(std::string query) {
+            return Call(NProtocol::TRequest{.OpCode = NProtocol::EOpCode::ESearch, .Text = std::move(query)}).DocIDs;
+        }
+
+        void Put(uint64_t key, uint64_t value) {
+            Call(NProtocol::TRequest{.OpCode = NProtocol::EOpCode::EPut, .Key = key, .Value = value});
+        }
+
+        std::optional<uint64_t> ReadPoint(uint64_t key) {
+            auto entries = Call(NProtocol::TRequest{.OpCode = NProtocol::EOpCode::EReadPoint, .Key = key}).Entries;
+            if (entries.empty()) {
+                return std::nullopt;
+            }
+            return entries[0].second;
+        }
+
+        // [lhs, rhs]
+        std::vector<std::pair<uint64_t, uint64_t>> ReadRange(uint64_t lhs, uint64_t rhs) {
+            return Call(NProtocol::TRequest{.OpCode = NProtocol::EOpCode::EReadRange, .Key = lhs, .Value = rhs}).Entries;
+        }
+
+    private:
+        const static std::size_t READ_CHUNK_SIZE = 64ull << 10;
+
+        void Connect(int family, const sockaddr* address, socklen_t length) {
+            Socket = socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (Socket < 0) {
+                throw std::runtime_error(std::string("socket: ") + std::strerror(errno));
+            }
+            if (connect(Socket, address, length) < 0) {
+                int error = errno;
+                close(Socket);
+                throw std::runtime_error(std::string("connect: ") + std::strerror(error));
+            }
+        }
+
+    private:
+        int Socket = -1;
+        uint64_t NextID = 1;
+        std::string Buffer;
+        std::size_t Offset = 0;
+    };
+}
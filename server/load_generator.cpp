@@ -0,0 +1,221 @@
+// Load generator of search_server: every connection keeps --depth requests in flight.
+//   load_generator --socket=/tmp/search.sock --fill=1 --workload=readpoint --connections=8 --depth=32
+// Reports the throughput and the latency percentiles from the send to the response.
+
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../lsm/histogram.h"
+#include "client.h"
+
+namespace {
+    struct TFlags {
+        std::filesystem::path SocketPath;
+        uint16_t Port = 0;
+        std::size_t Connections = 4;
+        std::size_t Depth = 16;
+        uint64_t Requests = 100'000;
+        // readpoint, readrange, search or mixed
+        std::string Workload = "readpoint";
+        uint64_t Keys = 100'000;
+        // loads the keys and the documents before the workload
+        bool Fill = false;
+        uint64_t Seed = 301;
+    };
+
+    const std::string USAGE =
+        "usage: load_generator (--socket=path | --port=N) [--connections=N] [--depth=N] [--requests=N]\n"
+        "                      [--workload=readpoint|readrange|search|mixed] [--keys=N] [--fill=0|1] [--seed=N]\n";
+
+    const static std::size_t DOC_COUNT = 128ull;
+    const static std::size_t VOCABULARY_SIZE = 200ull;
+
+    TFlags ParseFlags(int argc, char** argv) {
+        TFlags flags;
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            auto eq = arg.find('=');
+            if (!arg.starts_with("--") || eq == std::string::npos) {
+                throw std::runtime_error("bad flag: " + arg + ".");
+            }
+            auto name = arg.substr(2, eq - 2);
+            auto value = arg.substr(eq + 1);
+
+            if (name == "socket") {
+                flags.SocketPath = value;
+            } else if (name == "port") {
+                flags.Port = std::stoul(value);
+            } else if (name == "connections") {
+                flags.Connections = std::max<std::size_t>(1, std::stoull(value));
+            } else if (name == "depth") {
+                flags.Depth = std::max<std::size_t>(1, std::stoull(value));
+            } else if (name == "requests") {
+                flags.Requests = std::stoull(value);
+            } else if (name == "workload") {
+                if (value != "readpoint" && value != "readrange" && value != "search" && value != "mixed") {
+                    throw std::runtime_error("unknown workload: " + value + ".");
+                }
+                flags.Workload = value;
+            } else if (name == "keys") {
+                flags.Keys = std::max<uint64_t>(1, std::stoull(value));
+            } else if (name == "fill") {
+                flags.Fill = value == "1" || value == "true";
+            } else if (name == "seed") {
+                flags.Seed = std::stoull(value);
+            } else {
+                throw std::runtime_error("unknown flag: " + name + ".");
+            }
+        }
+        if (flags.SocketPath.empty() && flags.Port == 0) {
+            throw std::runtime_error("socket or port is required.");
+        }
+        return flags;
+    }
+
+    std::unique_ptr<NServer::TClient> Connect(const TFlags& flags) {
+        if (!flags.SocketPath.empty()) {
+            return std::make_unique<NServer::TClient>(flags.SocketPath);
+        }
+        return std::make_unique<NServer::TClient>(flags.Port);
+    }
+
+    std::string MakeWord(std::mt19937_64& random) {
+        return "w" + std::to_string(std::min(random() % VOCABULARY_SIZE, random() % VOCABULARY_SIZE));
+    }
+
+    // the put and the document requests are pipelined as the workload
+    void Fill(const TFlags& flags) {
+        auto client = Connect(flags);
+        std::mt19937_64 random(flags.Seed);
+        std::vector<NProtocol::TRequest> requests;
+        for (uint64_t key = 0; key < flags.Keys; ++key) {
+            requests.push_back(NProtocol::TRequest{.OpCode = NProtocol::EOpCode::EPut, .Key = key, .Value = key * 2});
+        }
+        for (std::size_t docID = 0; docID < DOC_COUNT; ++docID) {
+            std::string text;
+            for (std::size_t i = 0; i < 50; ++i) {
+                text += MakeWord(random) + " ";
+            }
+            requests.push_back(NProtocol::TRequest{.OpCode = NProtocol::EOpCode::EAddDocument, .DocID = docID, .Text = std::move(text)});
+        }
+
+        std::size_t sent = 0, received = 0;
+        while (received < requests.size()) {
+            while (sent < requests.size() && sent - received < flags.Depth) {
+                client->Send(requests[sent++]);
+            }
+            auto response = client->Receive();
+            if (response.Status == NProtocol::EStatus::EError) {
+                throw std::runtime_error("fill: " + response.Error);
+            }
+            ++received;
+        }
+    }
+
+    NProtocol::TRequest MakeRequest(const TFlags& flags, std::mt19937_64& random) {
+        auto workload = flags.Workload;
+        if (workload == "mixed") {
+            // mostly the point lookups, as a cache in front of a service
+            auto dice = random() % 100;
+            workload = dice < 80 ? "readpoint" : dice < 90 ? "readrange" : "search";
+        }
+
+        if (workload == "readpoint") {
+            return NProtocol::TRequest{.OpCode = NProtocol::EOpCode::EReadPoint, .Key = random() % flags.Keys};
+        }
+        if (workload == "readrange") {
+            uint64_t lhs = random() % flags.Keys;
+            return NProtocol::TRequest{.OpCode = NProtocol::EOpCode::EReadRange, .Key = lhs, .Value = lhs + 100};
+        }
+        return NProtocol::TRequest{.OpCode = NProtocol::EOpCode::ESearch, .Text = MakeWord(random) + " AND " + MakeWord(random)};
+    }
+
+    THistogram RunConnection(const TFlags& flags, uint64_t requests, uint64_t seed) {
+        auto client = Connect(flags);
+        std::mt19937_64 random(seed);
+        THistogram latencies;
+        std::unordered_map<uint64_t, std::chrono::steady_clock::time_point> sentAt;
+
+        uint64_t sent = 0, received = 0;
+        while (received < requests) {
+            while (sent < requests && sent - received < flags.Depth) {
+                auto now = std::chrono::steady_clock::now();
+                sentAt.emplace(client->Send(MakeRequest(flags, random)), now);
+                ++sent;
+            }
+
+            auto response = client->Receive();
+            auto it = sentAt.find(response.ID);
+            if (it == sentAt.end()) {
+                throw std::runtime_error("unexpected response id.");
+            }
+            latencies.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - it->second).count());
+            sentAt.erase(it);
+            if (response.Status == NProtocol::EStatus::EError) {
+                throw std::runtime_error(response.Error);
+            }
+            ++received;
+        }
+        return latencies;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc == 2 && std::string(argv[1]) == "--help") {
+        std::cout << USAGE;
+        return 0;
+    }
+
+    try {
+        auto flags = ParseFlags(argc, argv);
+        if (flags.Fill) {
+            auto start = std::chrono::steady_clock::now();
+            Fill(flags);
+            std::cout << "fill: " << flags.Keys << " keys, " << DOC_COUNT << " documents in "
+                      << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
+        }
+
+        THistogram latencies;
+        std::mutex latenciesMutex;
+        std::exception_ptr error;
+        std::vector<std::thread> threads;
+
+        auto start = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < flags.Connections; ++i) {
+            uint64_t requests = flags.Requests / flags.Connections + (i < flags.Requests % flags.Connections);
+            threads.emplace_back([&, requests, i]() {
+                try {
+                    auto connectionLatencies = RunConnection(flags, requests, flags.Seed + i + 1);
+                    std::lock_guard lock(latenciesMutex);
+                    latencies.Merge(connectionLatencies);
+                } catch (...) {
+                    std::lock_guard lock(latenciesMutex);
+                    error = std::current_exception();
+                }
+            });
+        }
+        for (auto& thread: threads) {
+            thread.join();
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << flags.Workload << ": " << latencies.GetCount() << " requests, " << flags.Connections << " connections, depth "
+                  << flags.Depth << ": " << static_cast<uint64_t>(latencies.GetCount() / seconds) << " requests/sec\n"
+                  << "  latency ns: " << latencies.ToString() << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n" << USAGE;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,85 @@
+// The query server:
+//   search_server --data=./data --socket=/tmp/search.sock
+//   search_server --data=./data --port=7070 --threads=8 --max_batch=256 --batch_delay_us=50
+//   search_server --data=./data --socket=/tmp/search.sock --memtable_budget=4194304
+// see protocol.h for the wire format and load_generator.cpp for a client.
+
+#include <csignal>
+#include <iostream>
+#include <string>
+
+#include "server.h"
+
+namespace {
+    const std::string USAGE =
+        "usage: search_server [--data=path] [--socket=path | --port=N] [--threads=N] [--max_batch=N] [--batch_delay_us=N]\n"
+        "                     [--memtable_budget=bytes] [--max_range=N]\n";
+
+    NServer::TServer* RunningServer = nullptr;
+
+    void HandleSignal(int) {
+        if (RunningServer) {
+            RunningServer->Stop();
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    std::filesystem::path data = "./search_data";
+    NServer::TOptions options;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--help") {
+                std::cout << USAGE;
+                return 0;
+            }
+            auto eq = arg.find('=');
+            if (!arg.starts_with("--") || eq == std::string::npos) {
+                throw std::runtime_error("bad flag: " + arg + ".");
+            }
+            auto name = arg.substr(2, eq - 2);
+            auto value = arg.substr(eq + 1);
+
+            if (name == "data") {
+                data = value;
+            } else if (name == "socket") {
+                options.SocketPath = value;
+            } else if (name == "port") {
+                options.Port = std::stoul(value);
+            } else if (name == "threads") {
+                options.Threads = std::max<std::size_t>(1, std::stoull(value));
+            } else if (name == "max_batch") {
+                options.MaxBatchSize = std::stoull(value);
+            } else if (name == "batch_delay_us") {
+                options.MaxBatchDelay = std::chrono::microseconds(std::stoull(value));
+            } else if (name == "memtable_budget") {
+                options.MemTableBudget = std::stoull(value);
+            } else if (name == "max_range") {
+                options.MaxRangeEntries = std::stoull(value);
+            } else {
+                throw std::runtime_error("unknown flag: " + name + ".");
+            }
+        }
+
+        NServer::TServer server(data, options);
+        RunningServer = &server;
+        std::signal(SIGINT, HandleSignal);
+        std::signal(SIGTERM, HandleSignal);
+
+        if (options.SocketPath.empty()) {
+            spdlog::info("listening on 127.0.0.1:{}", server.GetPort());
+        } else {
+            spdlog::info("listening on {}", options.SocketPath.string());
+        }
+        server.Run();
+
+        RunningServer = nullptr;
+        spdlog::info("stopped, {}", server.GetStatistics().ToString());
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n" << USAGE;
+        return 1;
+    }
+    return 0;
+}
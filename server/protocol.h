@@ -0,0 +1,259 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Wire format of the query server. Every message is a frame: the little endian uint32
+// length of the body, then the body. The responses carry the ID of their request and
+// may come out of the request order, so a client can keep many requests in flight.
+//
+// request:  id u64, opcode u8, the opcode fields
+//   EAddDocument  docID u64, text string
+//   ESearch       query string (query.h syntax)
+//   EPut          key u64, value u64
+//   EReadPoint    key u64
+//   EReadRange    lhs u64, rhs u64 (inclusive)
+// response: id u64, status u8, then the error string or the result:
+//   count u32, docID u64 * count         the ESearch documents
+//   count u32, (key u64, value u64) * count   the EReadPoint, EReadRange entries,
+//                                             at most MAX_RANGE_ENTRIES
+// string: length u32, bytes
+namespace NProtocol {
+    const static std::size_t MAX_FRAME_SIZE = 16ull << 20;
+    // the entries of a response fit into a frame together with its header
+    const static std::size_t MAX_RANGE_ENTRIES = (MAX_FRAME_SIZE - 64) / (2 * sizeof(uint64_t));
+
+    enum class EOpCode : uint8_t {
+        EAddDocument = 1,
+        ESearch = 2,
+        EPut = 3,
+        EReadPoint = 4,
+        EReadRange = 5,
+    };
+
+    enum class EStatus : uint8_t {
+        EOk = 0,
+        EError = 1,
+    };
+
+    struct TRequest {
+        uint64_t ID = 0;
+        EOpCode OpCode = EOpCode::ESearch;
+        // EAddDocument
+        uint64_t DocID = 0;
+        // EAddDocument text, ESearch query
+        std::string Text;
+        // EPut, EReadPoint key, EReadRange lower bound
+        uint64_t Key = 0;
+        // EPut value, EReadRange upper bound
+        uint64_t Value = 0;
+    };
+
+    struct TResponse {
+        uint64_t ID = 0;
+        EStatus Status = EStatus::EOk;
+        std::string Error;
+        std::vector<uint64_t> DocIDs;
+        std::vector<std::pair<uint64_t, uint64_t>> Entries;
+    };
+
+    class TWriter {
+    public:
+        // reserves the frame length, Finish fills it
+        TWriter() {
+            Put<uint32_t>(0);
+        }
+
+        template <typename T>
+        void Put(T value) {
+            static_assert(std::is_integral_v<T>);
+            for (std::size_t i = 0; i < sizeof(T); ++i) {
+                Data.push_back(static_cast<char>(static_cast<uint64_t>(value) >> (8 * i)));
+            }
+        }
+
+        void PutString(std::string_view value) {
+            Put<uint32_t>(value.size());
+            Data.append(value);
+        }
+
+        std::string Finish() && {
+            uint32_t length = Data.size() - sizeof(uint32_t);
+            for (std::size_t i = 0; i < sizeof(uint32_t); ++i) {
+                Data[i] = static_cast<char>(length >> (8 * i));
+            }
+            return std::move(Data);
+        }
+
+    private:
+        std::string Data;
+    };
+
+    class TReader {
+    public:
+        explicit TReader(std::string_view body)
+            : Body(body)
+        {}
+
+        template <typename T>
+        T Get() {
+            static_assert(std::is_integral_v<T>);
+            Require(sizeof(T));
+            uint64_t value = 0;
+            for (std::size_t i = 0; i < sizeof(T); ++i) {
+                value |= static_cast<uint64_t>(static_cast<uint8_t>(Body[i])) << (8 * i);
+            }
+            Body.remove_prefix(sizeof(T));
+            return static_cast<T>(value);
+        }
+
+        std::string GetString() {
+            auto length = Get<uint32_t>();
+            Require(length);
+            std::string value(Body.substr(0, length));
+            Body.remove_prefix(length);
+            return value;
+        }
+
+        // the element count of an array, checked against the rest of the frame
+        std::size_t GetCount(std::size_t elementSize) {
+            auto count = Get<uint32_t>();
+            Require(static_cast<uint64_t>(count) * elementSize);
+            return count;
+        }
+
+        void ExpectEnd() const {
+            if (!Body.empty()) {
+                throw std::runtime_error("trailing bytes in the frame.");
+            }
+        }
+
+    private:
+        void Require(std::size_t size) const {
+            if (Body.size() < size) {
+                throw std::runtime_error("truncated frame.");
+            }
+        }
+
+    private:
+        std::string_view Body;
+    };
+
+    // the body of the first complete frame in the buffer and the size of the whole frame
+    inline std::optional<std::pair<std::string_view, std::size_t>> NextFrame(std::string_view buffer) {
+        if (buffer.size() < sizeof(uint32_t)) {
+            return std::nullopt;
+        }
+        auto length = TReader(buffer).Get<uint32_t>();
+        if (length > MAX_FRAME_SIZE) {
+            throw std::runtime_error("frame is too large.");
+        }
+        if (buffer.size() < sizeof(uint32_t) + length) {
+            return std::nullopt;
+        }
+        return std::make_pair(buffer.substr(sizeof(uint32_t), length), sizeof(uint32_t) + length);
+    }
+
+    inline std::string EncodeRequest(const TRequest& request) {
+        TWriter writer;
+        writer.Put(request.ID);
+        writer.Put(static_cast<uint8_t>(request.OpCode));
+        switch (request.OpCode) {
+            case EOpCode::EAddDocument:
+                writer.Put(request.DocID);
+                writer.PutString(request.Text);
+                break;
+            case EOpCode::ESearch:
+                writer.PutString(request.Text);
+                break;
+            case EOpCode::EPut:
+            case EOpCode::EReadRange:
+                writer.Put(request.Key);
+                writer.Put(request.Value);
+                break;
+            case EOpCode::EReadPoint:
+                writer.Put(request.Key);
+                break;
+        }
+        return std::move(writer).Finish();
+    }
+
+    inline TRequest DecodeRequest(std::string_view body) {
+        TReader reader(body);
+        TRequest request;
+        request.ID = reader.Get<uint64_t>();
+        request.OpCode = static_cast<EOpCode>(reader.Get<uint8_t>());
+        switch (request.OpCode) {
+            case EOpCode::EAddDocument:
+                request.DocID = reader.Get<uint64_t>();
+                request.Text = reader.GetString();
+                break;
+            case EOpCode::ESearch:
+                request.Text = reader.GetString();
+                break;
+            case EOpCode::EPut:
+            case EOpCode::EReadRange:
+                request.Key = reader.Get<uint64_t>();
+                request.Value = reader.Get<uint64_t>();
+                break;
+            case EOpCode::EReadPoint:
+                request.Key = reader.Get<uint64_t>();
+                break;
+            default:
+                throw std::runtime_error("unknown opcode.");
+        }
+        reader.ExpectEnd();
+        return request;
+    }
+
+    inline std::string EncodeResponse(const TResponse& response) {
+        TWriter writer;
+        writer.Put(response.ID);
+        writer.Put(static_cast<uint8_t>(response.Status));
+        if (response.Status == EStatus::EError) {
+            writer.PutString(response.Error);
+            return std::move(writer).Finish();
+        }
+
+        writer.Put<uint32_t>(response.DocIDs.size());
+        for (auto docID: response.DocIDs) {
+            writer.Put(docID);
+        }
+        writer.Put<uint32_t>(response.Entries.size());
+        for (const auto& [key, value]: response.Entries) {
+            writer.Put(key);
+            writer.Put(value);
+        }
+        return std::move(writer).Finish();
+    }
+
+    inline TResponse DecodeResponse(std::string_view body) {
+        TReader reader(body);
+        TResponse response;
+        response.ID = reader.Get<uint64_t>();
+        response.Status = static_cast<EStatus>(reader.Get<uint8_t>());
+        if (response.Status == EStatus::EError) {
+            response.Error = reader.GetString();
+            reader.ExpectEnd();
+            return response;
+        }
+
+        response.DocIDs.resize(reader.GetCount(sizeof(uint64_t)));
+        for (auto& docID: response.DocIDs) {
+            docID = reader.Get<uint64_t>();
+        }
+        response.Entries.resize(reader.GetCount(2 * sizeof(uint64_t)));
+        for (auto& [key, value]: response.Entries) {
+            key = reader.Get<uint64_t>();
+            value = reader.Get<uint64_t>();
+        }
+        reader.ExpectEnd();
+        return response;
+    }
+}
@@ -0,0 +1,614 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../inverted_index/inverted_index.h"
+#include "../lsm/lsm.h"
+#include "../lsm/thread_pool.h"
+#include "protocol.h"
+
+namespace NServer {
+    struct TOptions {
+        // the Unix socket, the loopback TCP port is listened if empty
+        std::filesystem::path SocketPath;
+        // 0 picks a free port, see TServer::GetPort
+        uint16_t Port = 0;
+        std::size_t Threads = std::thread::hardware_concurrency();
+        // the point lookups of one event loop round are executed as one batch of at most this size
+        std::size_t MaxBatchSize = 256;
+        // a batch below MaxBatchSize waits for more lookups up to the delay, 0 doesn't wait
+        std::chrono::microseconds MaxBatchDelay{0};
+        // the limit of the memtables of the index and the tree together, 0 is unlimited
+        std::size_t MemTableBudget = 0;
+        // a larger EReadRange fails instead of exceeding the frame size of the protocol
+        std::size_t MaxRangeEntries = NProtocol::MAX_RANGE_ENTRIES;
+    };
+
+    struct TStatistics {
+        uint64_t Connections = 0;
+        uint64_t Requests = 0;
+        uint64_t Errors = 0;
+        uint64_t ReadBatches = 0;
+        uint64_t BatchedReads = 0;
+        // the tracked allocations of the process, see lsm/memory.h
+        uint64_t MemoryBytes = 0;
+
+        std::string ToString() const {
+            std::stringstream ss;
+            ss << "connections: " << Connections
+               << " requests: " << Requests
+               << " errors: " << Errors
+               << " read batches: " << ReadBatches
+               << " batched reads: " << BatchedReads
+               << " memory bytes: " << MemoryBytes;
+            return ss.str();
+        }
+    };
+
+    // Serves the inverted index and a uint64 -> uint64 LSM tree over protocol.h.
+    // One thread runs the epoll loop: it accepts the connections, reads and parses the
+    // frames and writes the responses; the requests are executed in the worker pool.
+    // The point lookups are not submitted one by one: the loop gathers the lookups of
+    // all the connections into a batch, which is executed by one task under one lock
+    // as a multi-get with all its SSTable reads in flight.
+    class TServer {
+    public:
+        // the logic algebra evaluates TDocs<128>
+        using TIndex = TInvertedIndex<128>;
+        using TTree = TLSMTree<uint64_t, uint64_t>;
+
+    public:
+        TServer(const std::filesystem::path& dataPath, TOptions options)
+            : Options(std::move(options))
+            , WriteBufferManager(Options.MemTableBudget > 0 ? std::make_shared<NMemory::TWriteBufferManager>(Options.MemTableBudget) : nullptr)
+            , Index(NUtils::EnsureDirectory(dataPath / "index"), TStopWords::Default(), WriteBufferManager)
+            , Tree(NUtils::EnsureDirectory(dataPath / "kv"), NDirectIO::EMode::EBuffered, WriteBufferManager)
+            , Pool(std::make_unique<TThreadPool>(Options.Threads))
+        {
+            Options.MaxBatchSize = std::max<std::size_t>(Options.MaxBatchSize, 1);
+            Options.MaxRangeEntries = std::min(Options.MaxRangeEntries, NProtocol::MAX_RANGE_ENTRIES);
+            try {
+                Listen();
+                Epoll = Check(epoll_create1(EPOLL_CLOEXEC), "epoll_create1");
+                WakeUp = Check(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), "eventfd");
+                BatchTimer = Check(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC), "timerfd_create");
+                Watch(ListenSocket, LISTEN_ID, EPOLLIN);
+                Watch(WakeUp, WAKE_UP_ID, EPOLLIN);
+                Watch(BatchTimer, BATCH_TIMER_ID, EPOLLIN);
+            } catch (...) {
+                CloseFds();
+                throw;
+            }
+
+            // an idle index or tree is flushed on the pool when the other one runs out of the budget
+            Index.SetFlushRequestHandler([this]() {
+                ScheduleFlush(IndexMutex, [this]() { Index.FlushIfRequested(); });
+            });
+            Tree.SetFlushRequestHandler([this]() {
+                ScheduleFlush(TreeMutex, [this]() { Tree.FlushIfRequested(); });
+            });
+        }
+
+        ~TServer() {
+            // the handlers submit to the pool
+            Index.SetFlushRequestHandler(nullptr);
+            Tree.SetFlushRequestHandler(nullptr);
+            // the workers wake the loop up through the fds
+            Pool.reset();
+            for (auto& [_, connection]: Connections) {
+                close(connection.Fd);
+            }
+            CloseFds();
+            if (!Options.SocketPath.empty()) {
+                std::filesystem::remove(Options.SocketPath);
+            }
+        }
+
+        TServer(const TServer&) = delete;
+        TServer& operator=(const TServer&) = delete;
+
+        // the event loop, returns after Stop
+        void Run() {
+            std::vector<epoll_event> events(EVENT_BATCH_SIZE);
+            while (!Stopping.load()) {
+                int count = epoll_wait(Epoll, events.data(), events.size(), -1);
+                if (count < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throw std::runtime_error(std::string("epoll_wait: ") + std::strerror(errno));
+                }
+
+                for (int i = 0; i < count; ++i) {
+                    HandleEvent(events[i]);
+                }
+                DeliverCompletions();
+
+                if (!PendingReads.empty()) {
+                    if (Options.MaxBatchDelay.count() == 0) {
+                        FlushReads();
+                    } else if (!BatchTimerArmed) {
+                        ArmBatchTimer();
+                    }
+                }
+            }
+        }
+
+        // from any thread or a signal handler
+        void Stop() {
+            Stopping.store(true);
+            uint64_t one = 1;
+            [[maybe_unused]] auto written = write(WakeUp, &one, sizeof(one));
+        }
+
+        uint16_t GetPort() const {
+            return Options.Port;
+        }
+
+        TStatistics GetStatistics() const {
+            return TStatistics{
+                .Connections = ConnectionCount.load(std::memory_order_relaxed),
+                .Requests = RequestCount.load(std::memory_order_relaxed),
+                .Errors = ErrorCount.load(std::memory_order_relaxed),
+                .ReadBatches = ReadBatchCount.load(std::memory_order_relaxed),
+                .BatchedReads = BatchedReadCount.load(std::memory_order_relaxed),
+                .MemoryBytes = NMemory::TMemoryTracker::Get().GetTotal(),
+            };
+        }
+
+    private:
+        const static std::size_t EVENT_BATCH_SIZE = 64ull;
+        const static std::size_t READ_CHUNK_SIZE = 64ull << 10;
+        const static int LISTEN_BACKLOG = 1'024;
+
+        // the epoll data of the service fds, the connections are numbered after them
+        const static uint64_t LISTEN_ID = 0;
+        const static uint64_t WAKE_UP_ID = 1;
+        const static uint64_t BATCH_TIMER_ID = 2;
+
+        struct TConnection {
+            uint64_t ID = 0;
+            int Fd = -1;
+            std::string In;
+            std::string Out;
+            bool WaitsWritable = false;
+            // the peer has shut down its side, the connection is closed once the responses are sent
+            bool ReadClosed = false;
+            // the requests without a response yet
+            std::size_t InFlight = 0;
+        };
+
+        struct TRead {
+            uint64_t ConnectionID;
+            uint64_t RequestID;
+            uint64_t Key;
+        };
+
+        struct TCompletion {
+            uint64_t ConnectionID;
+            std::string Frame;
+        };
+
+    private:
+        static int Check(int result, const char* call) {
+            if (result < 0) {
+                throw std::runtime_error(std::string(call) + ": " + std::strerror(errno));
+            }
+            return result;
+        }
+
+        void Listen() {
+            if (!Options.SocketPath.empty()) {
+                sockaddr_un address{};
+                address.sun_family = AF_UNIX;
+                if (Options.SocketPath.native().size() >= sizeof(address.sun_path)) {
+                    throw std::runtime_error("socket path is too long.");
+                }
+                std::strcpy(address.sun_path, Options.SocketPath.c_str());
+                std::filesystem::remove(Options.SocketPath);
+
+                ListenSocket = Check(socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0), "socket");
+                Check(bind(ListenSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)), "bind");
+            } else {
+                sockaddr_in address{};
+                address.sin_family = AF_INET;
+                address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                address.sin_port = htons(Options.Port);
+
+                ListenSocket = Check(socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0), "socket");
+                int one = 1;
+                setsockopt(ListenSocket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+                Check(bind(ListenSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)), "bind");
+
+                socklen_t length = sizeof(address);
+                Check(getsockname(ListenSocket, reinterpret_cast<sockaddr*>(&address), &length), "getsockname");
+                Options.Port = ntohs(address.sin_port);
+            }
+            Check(listen(ListenSocket, LISTEN_BACKLOG), "listen");
+        }
+
+        void CloseFds() {
+            for (int fd: {ListenSocket, Epoll, WakeUp, BatchTimer}) {
+                if (fd >= 0) {
+                    close(fd);
+                }
+            }
+        }
+
+        void Watch(int fd, uint64_t id, uint32_t events) {
+            epoll_event event{.events = events, .data = {.u64 = id}};
+            Check(epoll_ctl(Epoll, EPOLL_CTL_ADD, fd, &event), "epoll_ctl");
+        }
+
+        void HandleEvent(const epoll_event& event) {
+            switch (event.data.u64) {
+                case LISTEN_ID:
+                    Accept();
+                    return;
+                case WAKE_UP_ID: {
+                    uint64_t value;
+                    [[maybe_unused]] auto read = ::read(WakeUp, &value, sizeof(value));
+                    return;
+                }
+                case BATCH_TIMER_ID: {
+                    uint64_t expirations;
+                    [[maybe_unused]] auto read = ::read(BatchTimer, &expirations, sizeof(expirations));
+                    BatchTimerArmed = false;
+                    FlushReads();
+                    return;
+                }
+            }
+
+            auto it = Connections.find(event.data.u64);
+            if (it == Connections.end()) {
+                return;
+            }
+            auto& connection = it->second;
+            if (connection.ReadClosed && (event.events & (EPOLLHUP | EPOLLERR))) {
+                CloseConnection(it);
+                return;
+            }
+            if (!connection.ReadClosed && (event.events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && !ReadFrom(connection)) {
+                CloseConnection(it);
+                return;
+            }
+            if ((event.events & EPOLLOUT) && !WriteTo(connection)) {
+                CloseConnection(it);
+                return;
+            }
+            if (IsDone(connection)) {
+                CloseConnection(it);
+            }
+        }
+
+        void Accept() {
+            while (true) {
+                int fd = accept4(ListenSocket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd < 0) {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                        spdlog::warn("accept4: {}", std::strerror(errno));
+                    }
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return;
+                }
+                if (Options.SocketPath.empty()) {
+                    int one = 1;
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                }
+
+                uint64_t id = NextConnectionID++;
+                Connections.emplace(id, TConnection{.ID = id, .Fd = fd});
+                Watch(fd, id, EPOLLIN | EPOLLRDHUP);
+                ConnectionCount.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        // false if the connection is to be closed, on the end of the stream the requests
+        // read so far are still answered
+        bool ReadFrom(TConnection& connection) {
+            char chunk[READ_CHUNK_SIZE];
+            bool eof = false;
+            while (true) {
+                auto count = read(connection.Fd, chunk, sizeof(chunk));
+                if (count > 0) {
+                    connection.In.append(chunk, count);
+                    continue;
+                }
+                if (count < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                    return false;
+                }
+                eof = count == 0;
+                break;
+            }
+
+            std::size_t offset = 0;
+            try {
+                while (auto frame = NProtocol::NextFrame(std::string_view(connection.In).substr(offset))) {
+                    offset += frame->second;
+                    Dispatch(connection, frame->first);
+                }
+            } catch (const std::exception& e) {
+                // the stream can't be resynchronized after a bad frame
+                spdlog::warn("connection {}: {}", connection.ID, e.what());
+                ErrorCount.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            connection.In.erase(0, offset);
+            if (eof) {
+                // a partial frame is never completed
+                connection.ReadClosed = true;
+                UpdateEvents(connection);
+            }
+            return true;
+        }
+
+        void Dispatch(TConnection& connection, std::string_view body) {
+            auto request = NProtocol::DecodeRequest(body);
+            RequestCount.fetch_add(1, std::memory_order_relaxed);
+            ++connection.InFlight;
+            uint64_t connectionID = connection.ID;
+
+            if (request.OpCode == NProtocol::EOpCode::EReadPoint) {
+                PendingReads.push_back(TRead{.ConnectionID = connectionID, .RequestID = request.ID, .Key = request.Key});
+                if (PendingReads.size() >= Options.MaxBatchSize) {
+                    FlushReads();
+                }
+                return;
+            }
+
+            Pool->Submit([this, connectionID, request = std::move(request)]() {
+                Complete({TCompletion{.ConnectionID = connectionID, .Frame = NProtocol::EncodeResponse(Execute(request))}});
+            });
+        }
+
+        NProtocol::TResponse Execute(const NProtocol::TRequest& request) {
+            NProtocol::TResponse response{.ID = request.ID};
+            try {
+                switch (request.OpCode) {
+                    case NProtocol::EOpCode::EAddDocument: {
+                        if (request.DocID >= 128) {
+                            throw std::runtime_error("document id is out of range.");
+                        }
+                        std::unique_lock lock(IndexMutex);
+                        Index.AddDocument(TDocument{.ID = request.DocID, .Text = request.Text});
+                        break;
+                    }
+                    case NProtocol::EOpCode::ESearch: {
+                        std::shared_lock lock(IndexMutex);
+                        for (auto docID: Index.FindDocsByQuery(request.Text).GetIDs()) {
+                            response.DocIDs.push_back(docID);
+                        }
+                        break;
+                    }
+                    case NProtocol::EOpCode::EPut: {
+                        std::unique_lock lock(TreeMutex);
+                        Tree.Insert(request.Key, request.Value);
+                        break;
+                    }
+                    case NProtocol::EOpCode::EReadRange: {
+                        std::shared_lock lock(TreeMutex);
+                        response.Entries = Tree.ReadRanges(request.Key, request.Value);
+                        if (response.Entries.size() > Options.MaxRangeEntries) {
+                            throw std::runtime_error("range is too large, narrow it.");
+                        }
+                        break;
+                    }
+                    case NProtocol::EOpCode::EReadPoint: {
+                        std::shared_lock lock(TreeMutex);
+                        if (auto entry = Tree.ReadPoint(request.Key)) {
+                            response.Entries.push_back(entry.value());
+                        }
+                        break;
+                    }
+                }
+            } catch (const std::exception& e) {
+                ErrorCount.fetch_add(1, std::memory_order_relaxed);
+                response = NProtocol::TResponse{.ID = request.ID, .Status = NProtocol::EStatus::EError, .Error = e.what()};
+            }
+            return response;
+        }
+
+        // the flush requested by the write buffer manager, nobody waits for the task
+        template <typename TFlush>
+        void ScheduleFlush(std::shared_mutex& mutex, TFlush flush) {
+            Pool->Submit([&mutex, flush = std::move(flush)]() {
+                try {
+                    std::unique_lock lock(mutex);
+                    flush();
+                } catch (const std::exception& e) {
+                    spdlog::error(std::string("Failed to flush: ") + e.what());
+                }
+            });
+        }
+
+        void FlushReads() {
+            if (PendingReads.empty()) {
+                return;
+            }
+            ReadBatchCount.fetch_add(1, std::memory_order_relaxed);
+            BatchedReadCount.fetch_add(PendingReads.size(), std::memory_order_relaxed);
+
+            Pool->Submit([this, reads = std::exchange(PendingReads, {})]() {
+                std::vector<uint64_t> keys;
+                keys.reserve(reads.size());
+                for (const auto& read: reads) {
+                    keys.push_back(read.Key);
+                }
+
+                std::vector<std::optional<TTree::TEntry>> entries;
+                {
+                    std::shared_lock lock(TreeMutex);
+                    entries = Tree.MultiGet(keys);
+                }
+
+                std::vector<TCompletion> completions;
+                completions.reserve(reads.size());
+                for (std::size_t i = 0; i < reads.size(); ++i) {
+                    NProtocol::TResponse response{.ID = reads[i].RequestID};
+                    if (entries[i]) {
+                        response.Entries.push_back(entries[i].value());
+                    }
+                    completions.push_back(TCompletion{.ConnectionID = reads[i].ConnectionID, .Frame = NProtocol::EncodeResponse(response)});
+                }
+                Complete(std::move(completions));
+            });
+        }
+
+        void ArmBatchTimer() {
+            itimerspec spec{};
+            spec.it_value.tv_sec = Options.MaxBatchDelay.count() / 1'000'000;
+            spec.it_value.tv_nsec = Options.MaxBatchDelay.count() % 1'000'000 * 1'000;
+            Check(timerfd_settime(BatchTimer, 0, &spec, nullptr), "timerfd_settime");
+            BatchTimerArmed = true;
+        }
+
+        // from the workers, the loop writes the frames
+        void Complete(std::vector<TCompletion> completions) {
+            {
+                std::lock_guard lock(CompletionsMutex);
+                for (auto& completion: completions) {
+                    Completions.push_back(std::move(completion));
+                }
+            }
+            uint64_t one = 1;
+            [[maybe_unused]] auto written = write(WakeUp, &one, sizeof(one));
+        }
+
+        void DeliverCompletions() {
+            std::vector<TCompletion> completions;
+            {
+                std::lock_guard lock(CompletionsMutex);
+                completions.swap(Completions);
+            }
+
+            std::vector<uint64_t> touched;
+            for (auto& completion: completions) {
+                // the connection may be closed while its request was executed
+                auto it = Connections.find(completion.ConnectionID);
+                if (it == Connections.end()) {
+                    continue;
+                }
+                --it->second.InFlight;
+                if (it->second.Out.empty()) {
+                    touched.push_back(completion.ConnectionID);
+                }
+                it->second.Out += completion.Frame;
+            }
+
+            for (auto id: touched) {
+                auto it = Connections.find(id);
+                if ((!it->second.WaitsWritable && !WriteTo(it->second)) || IsDone(it->second)) {
+                    CloseConnection(it);
+                }
+            }
+        }
+
+        // false if the connection is to be closed
+        bool WriteTo(TConnection& connection) {
+            std::size_t offset = 0;
+            while (offset < connection.Out.size()) {
+                auto count = send(connection.Fd, connection.Out.data() + offset, connection.Out.size() - offset, MSG_NOSIGNAL);
+                if (count >= 0) {
+                    offset += count;
+                    continue;
+                }
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    return false;
+                }
+                break;
+            }
+            connection.Out.erase(0, offset);
+
+            // EPOLLOUT is watched only while the socket buffer is full
+            bool waitsWritable = !connection.Out.empty();
+            if (waitsWritable != connection.WaitsWritable) {
+                connection.WaitsWritable = waitsWritable;
+                UpdateEvents(connection);
+            }
+            return true;
+        }
+
+        // EPOLLIN until the end of the stream, EPOLLOUT only while the socket buffer is full
+        void UpdateEvents(const TConnection& connection) {
+            uint32_t events = (connection.ReadClosed ? 0u : EPOLLIN | EPOLLRDHUP) | (connection.WaitsWritable ? EPOLLOUT : 0u);
+            epoll_event event{.events = events, .data = {.u64 = connection.ID}};
+            Check(epoll_ctl(Epoll, EPOLL_CTL_MOD, connection.Fd, &event), "epoll_ctl");
+        }
+
+        // a half-closed connection with every response sent
+        static bool IsDone(const TConnection& connection) {
+            return connection.ReadClosed && connection.InFlight == 0 && connection.Out.empty();
+        }
+
+        void CloseConnection(std::unordered_map<uint64_t, TConnection>::iterator it) {
+            epoll_ctl(Epoll, EPOLL_CTL_DEL, it->second.Fd, nullptr);
+            close(it->second.Fd);
+            Connections.erase(it);
+        }
+
+    private:
+        TOptions Options;
+
+        std::shared_ptr<NMemory::TWriteBufferManager> WriteBufferManager;
+        // the searches share it, see TInvertedIndex
+        std::shared_mutex IndexMutex;
+        TIndex Index;
+        std::shared_mutex TreeMutex;
+        TTree Tree;
+
+        int ListenSocket = -1;
+        int Epoll = -1;
+        int WakeUp = -1;
+        int BatchTimer = -1;
+        std::atomic<bool> Stopping = false;
+
+        // the loop thread only
+        std::unordered_map<uint64_t, TConnection> Connections;
+        uint64_t NextConnectionID = BATCH_TIMER_ID + 1;
+        std::vector<TRead> PendingReads;
+        bool BatchTimerArmed = false;
+
+        std::mutex CompletionsMutex;
+        std::vector<TCompletion> Completions;
+
+        std::atomic<uint64_t> ConnectionCount = 0;
+        std::atomic<uint64_t> RequestCount = 0;
+        std::atomic<uint64_t> ErrorCount = 0;
+        std::atomic<uint64_t> ReadBatchCount = 0;
+        std::atomic<uint64_t> BatchedReadCount = 0;
+
+        std::unique_ptr<TThreadPool> Pool;
+    };
+}
@@ -0,0 +1,171 @@
+#include <gtest/gtest.h>
+#include <map>
+#include <set>
+#include <thread>
+
+#include "client.h"
+#include "server.h"
+
+TEST(Protocol, RoundTrip) {
+    NProtocol::TRequest request{.ID = 7, .OpCode = NProtocol::EOpCode::EAddDocument, .DocID = 3, .Text = "russia europe"};
+    auto frame = NProtocol::EncodeRequest(request);
+    auto body = NProtocol::NextFrame(frame);
+    ASSERT_TRUE(body);
+    ASSERT_EQ(body->second, frame.size());
+    auto decoded = NProtocol::DecodeRequest(body->first);
+    ASSERT_EQ(decoded.ID, 7);
+    ASSERT_EQ(decoded.OpCode, NProtocol::EOpCode::EAddDocument);
+    ASSERT_EQ(decoded.DocID, 3);
+    ASSERT_EQ(decoded.Text, "russia europe");
+
+    // a partial frame waits for the rest
+    ASSERT_FALSE(NProtocol::NextFrame(std::string_view(frame).substr(0, frame.size() - 1)));
+
+    NProtocol::TResponse response{.ID = 9, .DocIDs = {1, 5}, .Entries = {{2, 4}}};
+    auto responseFrame = NProtocol::EncodeResponse(response);
+    auto decodedResponse = NProtocol::DecodeResponse(NProtocol::NextFrame(responseFrame)->first);
+    ASSERT_EQ(decodedResponse.ID, 9);
+    ASSERT_EQ(decodedResponse.DocIDs, response.DocIDs);
+    ASSERT_EQ(decodedResponse.Entries, response.Entries);
+
+    auto error = NProtocol::DecodeResponse(NProtocol::NextFrame(NProtocol::EncodeResponse({.ID = 1, .Status = NProtocol::EStatus::EError, .Error = "bad"}))->first);
+    ASSERT_EQ(error.Error, "bad");
+
+    ASSERT_THROW(NProtocol::DecodeRequest(std::string_view(body->first).substr(0, body->first.size() - 1)), std::runtime_error);
+}
+
+TEST(Server, Requests) {
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directories("./test");
+
+    for (bool unixSocket: {true, false}) {
+        NServer::TOptions options{.Threads = 4, .MaxBatchSize = 16};
+        if (unixSocket) {
+            options.SocketPath = std::filesystem::absolute("./test/server.sock");
+        }
+        NServer::TServer server(unixSocket ? "./test/unix" : "./test/tcp", options);
+        std::thread loop([&server]() { server.Run(); });
+
+        {
+            auto client = unixSocket ? std::make_unique<NServer::TClient>(options.SocketPath) : std::make_unique<NServer::TClient>(server.GetPort());
+            client->AddDocument(0, "Russia and Europe");
+            client->AddDocument(1, "Putin visited Europe");
+            ASSERT_EQ(client->Search("europe AND NOT russia"), std::vector<uint64_t>{1});
+            ASSERT_THROW(client->AddDocument(500, "out of range"), std::runtime_error);
+            ASSERT_THROW(client->Search("russia AND"), std::runtime_error);
+
+            for (uint64_t key = 0; key < 2'000; ++key) {
+                client->Put(key, key * 3);
+            }
+            ASSERT_EQ(client->ReadPoint(10), 30);
+            ASSERT_FALSE(client->ReadPoint(5'000));
+            auto range = client->ReadRange(100, 104);
+            ASSERT_EQ(range.size(), 5);
+            ASSERT_EQ(range.front(), std::make_pair(uint64_t(100), uint64_t(300)));
+
+            // the pipelined lookups of several connections are batched
+            std::vector<std::thread> readers;
+            for (size_t i = 0; i < 4; ++i) {
+                readers.emplace_back([&, i]() {
+                    auto reader = unixSocket ? std::make_unique<NServer::TClient>(options.SocketPath) : std::make_unique<NServer::TClient>(server.GetPort());
+                    std::map<uint64_t, uint64_t> keys;
+                    for (uint64_t key = i; key < 2'000; key += 4) {
+                        keys[reader->Send(NProtocol::TRequest{.OpCode = NProtocol::EOpCode::EReadPoint, .Key = key})] = key;
+                    }
+                    for (size_t j = 0; j < keys.size(); ++j) {
+                        auto response = reader->Receive();
+                        ASSERT_EQ(response.Entries.size(), 1);
+                        ASSERT_EQ(response.Entries[0].first, keys.at(response.ID));
+                        ASSERT_EQ(response.Entries[0].second, keys.at(response.ID) * 3);
+                    }
+                });
+            }
+            for (auto& reader: readers) {
+                reader.join();
+            }
+        }
+
+        server.Stop();
+        loop.join();
+
+        auto statistics = server.GetStatistics();
+        ASSERT_EQ(statistics.Connections, 5);
+        ASSERT_EQ(statistics.Errors, 2);
+        ASSERT_EQ(statistics.BatchedReads, 2'002);
+        ASSERT_LT(statistics.ReadBatches, statistics.BatchedReads / 2);
+    }
+}
+
+TEST(Server, LargeRange) {
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directories("./test");
+
+    // the largest range fits into a frame
+    NProtocol::TResponse largest{.ID = 1, .Entries = std::vector<std::pair<uint64_t, uint64_t>>(NProtocol::MAX_RANGE_ENTRIES)};
+    auto frame = NProtocol::EncodeResponse(largest);
+    ASSERT_EQ(NProtocol::DecodeResponse(NProtocol::NextFrame(frame)->first).Entries.size(), NProtocol::MAX_RANGE_ENTRIES);
+
+    NServer::TOptions options{.Threads = 4, .MaxRangeEntries = 1'000};
+    options.SocketPath = std::filesystem::absolute("./test/server.sock");
+    NServer::TServer server("./test/large_range", options);
+    std::thread loop([&server]() { server.Run(); });
+
+    {
+        NServer::TClient client(options.SocketPath);
+        for (uint64_t key = 0; key < 1'500; ++key) {
+            client.Send(NProtocol::TRequest{.OpCode = NProtocol::EOpCode::EPut, .Key = key, .Value = key * 3});
+        }
+        for (size_t i = 0; i < 1'500; ++i) {
+            ASSERT_EQ(client.Receive().Status, NProtocol::EStatus::EOk);
+        }
+
+        ASSERT_THROW(client.ReadRange(0, 1'499), std::runtime_error);
+        // the connection survives the failed range
+        auto range = client.ReadRange(500, 1'499);
+        ASSERT_EQ(range.size(), 1'000);
+        ASSERT_EQ(range.back(), std::make_pair(uint64_t(1'499), uint64_t(4'497)));
+    }
+
+    server.Stop();
+    loop.join();
+    ASSERT_EQ(server.GetStatistics().Errors, 1);
+}
+
+TEST(Server, HalfClose) {
+    std::filesystem::remove_all("./test");
+    std::filesystem::create_directories("./test");
+
+    NServer::TOptions options{.Threads = 4, .MaxBatchSize = 16};
+    options.SocketPath = std::filesystem::absolute("./test/server.sock");
+    NServer::TServer server("./test/half_close", options);
+    std::thread loop([&server]() { server.Run(); });
+
+    {
+        NServer::TClient writer(options.SocketPath);
+        writer.AddDocument(0, "Russia and Europe");
+        writer.AddDocument(1, "Putin visited Europe");
+    }
+
+    // the responses to the requests sent before the shutdown are delivered
+    NServer::TClient client(options.SocketPath);
+    std::vector<uint64_t> searches;
+    for (size_t i = 0; i < 64; ++i) {
+        searches.push_back(client.Send(NProtocol::TRequest{.OpCode = NProtocol::EOpCode::ESearch, .Text = "europe AND NOT russia"}));
+    }
+    auto read = client.Send(NProtocol::TRequest{.OpCode = NProtocol::EOpCode::EReadPoint, .Key = 1});
+    client.CloseWrite();
+
+    std::set<uint64_t> received;
+    for (size_t i = 0; i < searches.size() + 1; ++i) {
+        auto response = client.Receive();
+        received.insert(response.ID);
+        if (response.ID != read) {
+            ASSERT_EQ(response.DocIDs, std::vector<uint64_t>{1});
+        }
+    }
+    ASSERT_EQ(received.size(), searches.size() + 1);
+    ASSERT_THROW(client.Receive(), std::runtime_error);
+
+    server.Stop();
+    loop.join();
+}